@@ -11,7 +11,14 @@
 
 #include "bravais.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -22,8 +29,7 @@ namespace bravais
 {
 
 BravaisLattice::BravaisLattice(unsigned int dim)
-   : T_(dim),
-     dim_(dim),
+   : dim_(dim),
      vol_(0.0),
      bz_vol_(0.0)
 {
@@ -73,6 +79,18 @@ BravaisLattice::SetIntermediatePoints()
    }
 }
 
+void
+BravaisLattice::SetTransformations()
+{
+   trans_.resize(this->GetNumberTransformations());
+   for (unsigned int i=0; i<trans_.size(); i++)
+   {
+      trans_[i].SetSize(dim_);
+      trans_[i] = 0.0;
+      this->ComputeTransformation(i, trans_[i]);
+   }
+}
+
 void
 BravaisLattice::SetCellVolumes()
 {
@@ -147,6 +165,67 @@ BravaisLattice::GetFaceRadii(vector<double> & r) const
    }
 }
 
+bool
+BravaisLattice::MapToPrimitiveCell(const Vector & pt, Vector & ipt) const
+{
+   double A[9], B[9];
+   this->GetFlatVectors(A, B);
+
+   ipt.SetSize(dim_);
+   return MapPointToPrimitiveCell(dim_, A, B, pt.GetData(), ipt.GetData());
+}
+
+void
+BravaisLattice::MapPointsToPrimitiveCell(int n, const double * const * x,
+                                         double * const * y,
+                                         bool * mapped) const
+{
+   double A[9], B[9];
+   this->GetFlatVectors(A, B);
+
+   double p[3], q[3];
+   for (int j=0; j<n; j++)
+   {
+      for (unsigned int i=0; i<dim_; i++) { p[i] = x[i][j]; }
+      bool m = MapPointToPrimitiveCell(dim_, A, B, p, q);
+      for (unsigned int i=0; i<dim_; i++) { y[i][j] = q[i]; }
+      if ( mapped ) { mapped[j] = m; }
+   }
+}
+
+void
+BravaisLattice::MapPointsToFundamentalDomain(int n, const double * const * x,
+                                             double * const * y,
+                                             bool * mapped) const
+{
+   // Vectors wrapping stack storage so that the per-lattice mappings
+   // can be reused without allocating
+   double p[3], q[3];
+   Vector pt(p, dim_);
+   Vector ipt(q, dim_);
+
+   for (int j=0; j<n; j++)
+   {
+      for (unsigned int i=0; i<dim_; i++) { p[i] = q[i] = x[i][j]; }
+      bool m = this->MapToFundamentalDomain(pt, ipt);
+      for (unsigned int i=0; i<dim_; i++) { y[i][j] = q[i]; }
+      if ( mapped ) { mapped[j] = m; }
+   }
+}
+
+void
+BravaisLattice::GetFlatVectors(double * A, double * B) const
+{
+   for (unsigned int i=0; i<dim_; i++)
+   {
+      for (unsigned int k=0; k<dim_; k++)
+      {
+         A[3*i+k] = lat_vecs_[i][k];
+         B[3*i+k] = rec_vecs_[i][k];
+      }
+   }
+}
+
 /** The Primitive Cell is the unique unit cell which is centered on
     the lattice point which is at the origin.  We can compute this
     mapping by minimizing ||pt - A.n|| over n.  Where n is a vector of
@@ -155,42 +234,54 @@ BravaisLattice::GetFaceRadii(vector<double> & r) const
     reciprocal vectors B.  So, we can estimate n using B^T.pt as a
     starting point.  Then try all integer vectors in the immediate
     neighborhood of the real vector B^T.pt.
+
+    The lattice and reciprocal lattice vectors are passed as rows of
+    the flat 3x3 arrays @a A and @a B so that only fixed-size stack
+    storage is needed.
  */
 bool
-BravaisLattice::MapToPrimitiveCell(const Vector & pt, Vector & ipt) const
+BravaisLattice::MapPointToPrimitiveCell(int dim,
+                                        const double * A, const double * B,
+                                        const double * pt, double * ipt)
 {
    bool map = false;
-   ipt = pt;
 
-   Vector v(dim_);
-   Array<int> npt(2*dim_);
+   // Work on a copy so that pt and ipt may share storage
+   double p[3], v[3];
+   int npt[6];
+   for (int i=0; i<dim; i++) { p[i] = pt[i]; }
 
-   for (unsigned int i=0; i<dim_; i++)
+   double pmin = 0.0;
+   for (int i=0; i<dim; i++)
    {
+      ipt[i] = p[i];
+      pmin  += p[i] * p[i];
+
       // Compute B^T.pt
-      v[i] = rec_vecs_[i] * pt;
+      v[i] = 0.0;
+      for (int k=0; k<dim; k++) { v[i] += B[3*i+k] * p[k]; }
 
       // Grab the integer values in the neighborhood of B^T.pt
       npt[2*i+0] = (int)floor(v[i]);
       npt[2*i+1] =  (int)ceil(v[i]);
    }
 
-   double pmin = pt.Norml2();
-
    // Search for the minimum ||pt - A.n||
-   for (int j=0; j<(1<<dim_); j++)
+   for (int j=0; j<(1<<dim); j++)
    {
-      bool m = true;
-      v = pt;
-      for (unsigned int i=0; i<dim_; i++)
+      bool m = false;
+      for (int k=0; k<dim; k++) { v[k] = p[k]; }
+      for (int i=0; i<dim; i++)
       {
-         v.Add((double)npt[2*i+((j>>i)%2)], lat_vecs_[i]);
-         m = m && (npt[2*i+((j>>i)%2)] == 0);
+         int ni = npt[2*i+((j>>i)%2)];
+         for (int k=0; k<dim; k++) { v[k] += ni * A[3*i+k]; }
+         m = m || (ni != 0);
       }
-      double nrm = v.Norml2();
+      double nrm = 0.0;
+      for (int k=0; k<dim; k++) { nrm += v[k] * v[k]; }
       if ( nrm < pmin )
       {
-         ipt  = v;
+         for (int k=0; k<dim; k++) { ipt[k] = v[k]; }
          pmin = nrm;
          map  = m;
       }
@@ -457,6 +548,9 @@ LinearLattice::LinearLattice(double a)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "Delta";  // Gamma -> X
 
@@ -496,10 +590,10 @@ LinearLattice::MapToFundamentalDomain(const Vector & pt, Vector & ipt) const
    return map;
 }
 
-const DenseMatrix & LinearLattice::GetTransformation(int ti) const
+void
+LinearLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
-   T_(0,0) = (ti == 0) ? 1.0 : -1.0;
-   return T_;
+   T(0,0) = (ti == 0) ? 1.0 : -1.0;
 }
 
 Mesh *
@@ -637,6 +731,9 @@ SquareLattice::SquareLattice(double a)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "Delta";  // Gamma -> X
    il_[0][1] = "Z";      // X     -> M
@@ -700,34 +797,33 @@ SquareLattice::MapToFundamentalDomain(const Vector & pt, Vector & ipt) const
    return map;
 }
 
-const DenseMatrix & SquareLattice::GetTransformation(int ti) const
+void
+SquareLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
    int ir = ti % 2;
    int iq = ti / 2;
 
-   T_ = 0.0;
+   T = 0.0;
 
    if ( ir % 2 == 0 )
    {
-      T_(0, 0) = 1.0;
-      T_(1, 1) = 1.0;
+      T(0, 0) = 1.0;
+      T(1, 1) = 1.0;
    }
    else
    {
-      T_(0, 1) = 1.0;
-      T_(1, 0) = 1.0;
+      T(0, 1) = 1.0;
+      T(1, 0) = 1.0;
    }
 
    for (int i=0; i<2; i++)
    {
       if ( iq & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -861,6 +957,9 @@ HexagonalLattice::HexagonalLattice(double a)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "Sigma";  // Gamma -> M
    il_[0][1] = "MK";     // M     -> K
@@ -950,30 +1049,31 @@ HexagonalLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix & HexagonalLattice::GetTransformation(int ti) const
+void
+HexagonalLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
    int ir = ti % 3;
    int iq = ti / 3;
 
-   T_ = 0.0;
+   T = 0.0;
 
    switch (ir)
    {
       case 0:
-         T_(0, 0) =  1.0;
-         T_(1, 1) =  1.0;
+         T(0, 0) =  1.0;
+         T(1, 1) =  1.0;
          break;
       case 1:
-         T_(0, 0) =  0.5;
-         T_(0, 1) =  sqrt(0.75);
-         T_(1, 0) =  sqrt(0.75);
-         T_(1, 1) = -0.5;
+         T(0, 0) =  0.5;
+         T(0, 1) =  sqrt(0.75);
+         T(1, 0) =  sqrt(0.75);
+         T(1, 1) = -0.5;
          break;
       case 2:
-         T_(0, 0) =  0.5;
-         T_(0, 1) = -sqrt(0.75);
-         T_(1, 0) =  sqrt(0.75);
-         T_(1, 1) =  0.5;
+         T(0, 0) =  0.5;
+         T(0, 1) = -sqrt(0.75);
+         T(1, 0) =  sqrt(0.75);
+         T(1, 1) =  0.5;
          break;
    }
 
@@ -981,12 +1081,10 @@ const DenseMatrix & HexagonalLattice::GetTransformation(int ti) const
    {
       if ( iq & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -1138,6 +1236,9 @@ RectangularLattice::RectangularLattice(double a, double b)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "GammaX"; // Gamma -> X
    il_[0][1] = "XS";     // X     -> S
@@ -1198,28 +1299,28 @@ RectangularLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix & RectangularLattice::GetTransformation(int ti) const
+void
+RectangularLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
    switch (ti)
    {
       case 0:
-         T_(0,0) =  1.0; T_(0,1) =  0.0;
-         T_(1,0) =  0.0; T_(1,1) =  1.0;
+         T(0,0) =  1.0; T(0,1) =  0.0;
+         T(1,0) =  0.0; T(1,1) =  1.0;
          break;
       case 1:
-         T_(0,0) = -1.0; T_(0,1) =  0.0;
-         T_(1,0) =  0.0; T_(1,1) =  1.0;
+         T(0,0) = -1.0; T(0,1) =  0.0;
+         T(1,0) =  0.0; T(1,1) =  1.0;
          break;
       case 2:
-         T_(0,0) = -1.0; T_(0,1) =  0.0;
-         T_(1,0) =  0.0; T_(1,1) = -1.0;
+         T(0,0) = -1.0; T(0,1) =  0.0;
+         T(1,0) =  0.0; T(1,1) = -1.0;
          break;
       case 3:
-         T_(0,0) =  1.0; T_(0,1) =  0.0;
-         T_(1,0) =  0.0; T_(1,1) = -1.0;
+         T(0,0) =  1.0; T(0,1) =  0.0;
+         T(1,0) =  0.0; T(1,1) = -1.0;
          break;
    }
-   return T_;
 }
 
 Mesh *
@@ -1376,6 +1477,9 @@ CenteredRectangularLattice::CenteredRectangularLattice(double a, double b)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "GammaX"; // Gamma -> X
    il_[0][1] = "XS";     // X     -> S
@@ -1447,13 +1551,13 @@ CenteredRectangularLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix & CenteredRectangularLattice::GetTransformation(int ti) const
+void
+CenteredRectangularLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
-   T_(0,0) = (ti > 0 && ti < 3) ? 1.0 : -1.0;
-   T_(0,1) = 0.0;
-   T_(1,0) = 0.0;
-   T_(1,1) = (ti < 2) ? 1.0 : -1.0;
-   return T_;
+   T(0,0) = (ti > 0 && ti < 3) ? 1.0 : -1.0;
+   T(0,1) = 0.0;
+   T(1,0) = 0.0;
+   T(1,1) = (ti < 2) ? 1.0 : -1.0;
 }
 
 Mesh *
@@ -1662,6 +1766,9 @@ ObliqueLattice::ObliqueLattice(double a, double b, double gamma)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "GammaY";  // Gamma -> Y
    il_[0][1] = "YH";      // Y     -> H
@@ -1768,13 +1875,13 @@ ObliqueLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix & ObliqueLattice::GetTransformation(int ti) const
+void
+ObliqueLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
-   T_(0,0) = (ti == 0) ? 1.0 : -1.0;
-   T_(0,1) = 0.0;
-   T_(1,0) = 0.0;
-   T_(1,1) = (ti == 0) ? 1.0 : -1.0;
-   return T_;
+   T(0,0) = (ti == 0) ? 1.0 : -1.0;
+   T(0,1) = 0.0;
+   T(1,0) = 0.0;
+   T(1,1) = (ti == 0) ? 1.0 : -1.0;
 }
 
 Mesh *
@@ -1955,6 +2062,9 @@ CubicLattice::CubicLattice(double a)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "Delta";  // Gamma -> X
    il_[0][1] = "Z";      // X     -> M
@@ -2223,25 +2333,26 @@ CubicLattice::MapToFundamentalDomain(const Vector & pt, Vector & ipt) const
    return map;
 }
 
-const DenseMatrix & CubicLattice::GetTransformation(int ti) const
+void
+CubicLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
    int ir = ti % 6;
    int iq = ti / 6;
 
-   T_ = 0.0;
+   T = 0.0;
 
    if ( ir % 2 == 0 )
    {
       for (int i=0; i<3; i++)
       {
-         T_(i, (i + (ir / 2)) % 3) = 1.0;
+         T(i, (i + (ir / 2)) % 3) = 1.0;
       }
    }
    else
    {
       for (int i=0; i<3; i++)
       {
-         T_(i, (3 - i + (ir / 2)) % 3) = 1.0;
+         T(i, (3 - i + (ir / 2)) % 3) = 1.0;
       }
    }
 
@@ -2249,13 +2360,11 @@ const DenseMatrix & CubicLattice::GetTransformation(int ti) const
    {
       if ( iq & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -2462,6 +2571,9 @@ FaceCenteredCubicLattice::FaceCenteredCubicLattice(double a)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "Delta";  // Gamma -> X
    il_[0][1] = "Z";      // X     -> W
@@ -2553,25 +2665,26 @@ FaceCenteredCubicLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix & FaceCenteredCubicLattice::GetTransformation(int ti) const
+void
+FaceCenteredCubicLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
    int ir = ti % 6;
    int iq = ti / 6;
 
-   T_ = 0.0;
+   T = 0.0;
 
    if ( ir % 2 == 0 )
    {
       for (int i=0; i<3; i++)
       {
-         T_(i, (i + (ir / 2)) % 3) = 1.0;
+         T(i, (i + (ir / 2)) % 3) = 1.0;
       }
    }
    else
    {
       for (int i=0; i<3; i++)
       {
-         T_(i, (3 - i + (ir / 2)) % 3) = 1.0;
+         T(i, (3 - i + (ir / 2)) % 3) = 1.0;
       }
    }
 
@@ -2579,13 +2692,11 @@ const DenseMatrix & FaceCenteredCubicLattice::GetTransformation(int ti) const
    {
       if ( iq & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -2738,6 +2849,9 @@ BodyCenteredCubicLattice::BodyCenteredCubicLattice(double a)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "Delta";  // Gamma -> H
    il_[0][1] = "G";      // H     -> N
@@ -2941,25 +3055,26 @@ BodyCenteredCubicLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix & BodyCenteredCubicLattice::GetTransformation(int ti) const
+void
+BodyCenteredCubicLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
    int ir = ti % 6;
    int iq = ti / 6;
 
-   T_ = 0.0;
+   T = 0.0;
 
    if ( ir % 2 == 0 )
    {
       for (int i=0; i<3; i++)
       {
-         T_(i, (i + (ir / 2)) % 3) = 1.0;
+         T(i, (i + (ir / 2)) % 3) = 1.0;
       }
    }
    else
    {
       for (int i=0; i<3; i++)
       {
-         T_(i, (3 - i + (ir / 2)) % 3) = 1.0;
+         T(i, (3 - i + (ir / 2)) % 3) = 1.0;
       }
    }
 
@@ -2967,13 +3082,11 @@ const DenseMatrix & BodyCenteredCubicLattice::GetTransformation(int ti) const
    {
       if ( iq & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -3140,6 +3253,9 @@ TetragonalLattice::TetragonalLattice(double a, double c)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "Delta";  // Gamma -> X
    il_[0][1] = "XM";     // X     -> M
@@ -3244,36 +3360,35 @@ TetragonalLattice::MapToFundamentalDomain(const Vector & pt, Vector & ipt) const
    return map;
 }
 
-const DenseMatrix & TetragonalLattice::GetTransformation(int ti) const
+void
+TetragonalLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
    int ir = ti % 2;
    int iq = ti / 2;
 
-   T_ = 0.0;
+   T = 0.0;
 
    if ( ir == 0 )
    {
-      T_(0, 0) = 1.0;
-      T_(1, 1) = 1.0;
+      T(0, 0) = 1.0;
+      T(1, 1) = 1.0;
    }
    else
    {
-      T_(0, 1) = 1.0;
-      T_(1, 0) = 1.0;
+      T(0, 1) = 1.0;
+      T(1, 0) = 1.0;
    }
-   T_(2, 2) = 1.0;
+   T(2, 2) = 1.0;
 
    for (int i=0; i<3; i++)
    {
       if ( iq & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -3558,6 +3673,9 @@ BodyCenteredTetragonalLattice::BodyCenteredTetragonalLattice(double a, double c)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    if ( c_ < a_ )
    {
@@ -3976,37 +4094,36 @@ BodyCenteredTetragonalLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix &
-BodyCenteredTetragonalLattice::GetTransformation(int ti) const
+void
+BodyCenteredTetragonalLattice::ComputeTransformation(int ti,
+                                                     DenseMatrix & T) const
 {
    int ir = ti % 2;
    int iq = ti / 2;
 
-   T_ = 0.0;
+   T = 0.0;
 
    if ( ir == 0 )
    {
-      T_(0, 0) = 1.0;
-      T_(1, 1) = 1.0;
+      T(0, 0) = 1.0;
+      T(1, 1) = 1.0;
    }
    else
    {
-      T_(0, 1) = 1.0;
-      T_(1, 0) = 1.0;
+      T(0, 1) = 1.0;
+      T(1, 0) = 1.0;
    }
-   T_(2, 2) = 1.0;
+   T(2, 2) = 1.0;
 
    for (int i=0; i<3; i++)
    {
       if ( iq & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -4168,6 +4285,9 @@ OrthorhombicLattice::OrthorhombicLattice(double a, double b, double c)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "GammaX"; // Gamma -> X
    il_[0][1] = "XS";     // X     -> S
@@ -4280,26 +4400,24 @@ OrthorhombicLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix &
-OrthorhombicLattice::GetTransformation(int ti) const
+void
+OrthorhombicLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
-   T_ = 0.0;
+   T = 0.0;
 
-   T_(0, 0) = 1.0;
-   T_(1, 1) = 1.0;
-   T_(2, 2) = 1.0;
+   T(0, 0) = 1.0;
+   T(1, 1) = 1.0;
+   T(2, 2) = 1.0;
 
    for (int i=0; i<3; i++)
    {
       if ( ti & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -4645,6 +4763,9 @@ FaceCenteredOrthorhombicLattice::FaceCenteredOrthorhombicLattice(double a,
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    if ( variety_ == 1)
    {
@@ -4950,26 +5071,25 @@ FaceCenteredOrthorhombicLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix &
-FaceCenteredOrthorhombicLattice::GetTransformation(int ti) const
+void
+FaceCenteredOrthorhombicLattice::ComputeTransformation(int ti,
+                                                       DenseMatrix & T) const
 {
-   T_ = 0.0;
+   T = 0.0;
 
-   T_(0, 0) = 1.0;
-   T_(1, 1) = 1.0;
-   T_(2, 2) = 1.0;
+   T(0, 0) = 1.0;
+   T(1, 1) = 1.0;
+   T(2, 2) = 1.0;
 
    for (int i=0; i<3; i++)
    {
       if ( ti & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -5226,6 +5346,9 @@ BodyCenteredOrthorhombicLattice::BodyCenteredOrthorhombicLattice(double a,
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][ 0] = "GammaX"; // Gamma -> X
    il_[0][ 1] = "XL";     // X     -> L
@@ -5569,26 +5692,25 @@ BodyCenteredOrthorhombicLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix &
-BodyCenteredOrthorhombicLattice::GetTransformation(int ti) const
+void
+BodyCenteredOrthorhombicLattice::ComputeTransformation(int ti,
+                                                       DenseMatrix & T) const
 {
-   T_ = 0.0;
+   T = 0.0;
 
-   T_(0, 0) = 1.0;
-   T_(1, 1) = 1.0;
-   T_(2, 2) = 1.0;
+   T(0, 0) = 1.0;
+   T(1, 1) = 1.0;
+   T(2, 2) = 1.0;
 
    for (int i=0; i<3; i++)
    {
       if ( ti & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -5771,6 +5893,9 @@ BaseCenteredOrthorhombicLattice::BaseCenteredOrthorhombicLattice(double a,
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][ 0] = "GammaX"; // Gamma -> X
    il_[0][ 1] = "XS";     // X     -> S
@@ -5944,26 +6069,25 @@ BaseCenteredOrthorhombicLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix &
-BaseCenteredOrthorhombicLattice::GetTransformation(int ti) const
+void
+BaseCenteredOrthorhombicLattice::ComputeTransformation(int ti,
+                                                       DenseMatrix & T) const
 {
-   T_ = 0.0;
+   T = 0.0;
 
-   T_(0, 0) = 1.0;
-   T_(1, 1) = 1.0;
-   T_(2, 2) = 1.0;
+   T(0, 0) = 1.0;
+   T(1, 1) = 1.0;
+   T(2, 2) = 1.0;
 
    for (int i=0; i<3; i++)
    {
       if ( ti & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -6126,6 +6250,9 @@ HexagonalPrismLattice::HexagonalPrismLattice(double a, double c)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "Sigma";  // Gamma -> M
    il_[0][1] = "MK";     // M     -> K
@@ -6259,33 +6386,33 @@ HexagonalPrismLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix &
-HexagonalPrismLattice::GetTransformation(int ti) const
+void
+HexagonalPrismLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
    int ir = ti % 3;
    int iq = ti / 3;
 
-   T_ = 0.0;
+   T = 0.0;
 
-   T_(2, 2) =  1.0;
+   T(2, 2) =  1.0;
 
    switch (ir)
    {
       case 0:
-         T_(0, 0) =  1.0;
-         T_(1, 1) =  1.0;
+         T(0, 0) =  1.0;
+         T(1, 1) =  1.0;
          break;
       case 1:
-         T_(0, 0) =  0.5;
-         T_(0, 1) =  sqrt(0.75);
-         T_(1, 0) =  sqrt(0.75);
-         T_(1, 1) = -0.5;
+         T(0, 0) =  0.5;
+         T(0, 1) =  sqrt(0.75);
+         T(1, 0) =  sqrt(0.75);
+         T(1, 1) = -0.5;
          break;
       case 2:
-         T_(0, 0) =  0.5;
-         T_(0, 1) = -sqrt(0.75);
-         T_(1, 0) =  sqrt(0.75);
-         T_(1, 1) =  0.5;
+         T(0, 0) =  0.5;
+         T(0, 1) = -sqrt(0.75);
+         T(1, 0) =  sqrt(0.75);
+         T(1, 1) =  0.5;
          break;
    }
 
@@ -6293,13 +6420,11 @@ HexagonalPrismLattice::GetTransformation(int ti) const
    {
       if ( iq & (int)pow(2, i) )
       {
-         T_(i,0) *= -1.0;
-         T_(i,1) *= -1.0;
-         T_(i,2) *= -1.0;
+         T(i,0) *= -1.0;
+         T(i,1) *= -1.0;
+         T(i,2) *= -1.0;
       }
    }
-
-   return T_;
 }
 
 Mesh *
@@ -6652,6 +6777,9 @@ RhombohedralLattice::RhombohedralLattice(double a, double alpha)
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    if ( alpha_ < 0.5 * M_PI )
    {
@@ -7251,6 +7379,9 @@ MonoclinicLattice::MonoclinicLattice(double a, double b, double c,
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "GammaY"; // Gamma -> Y
    il_[0][1] = "YH";     // Y     -> H
@@ -7458,26 +7589,25 @@ MonoclinicLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix & MonoclinicLattice::GetTransformation(int ti) const
+void
+MonoclinicLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
-   T_ = 0.0;
+   T = 0.0;
 
    for (int i=0; i<3; i++)
    {
-      T_(i,i) = 1.0;
+      T(i,i) = 1.0;
    }
 
    if (ti == 1 || ti == 2)
    {
-      T_(1,1) *= -1.0;
-      T_(2,2) *= -1.0;
+      T(1,1) *= -1.0;
+      T(2,2) *= -1.0;
    }
    if ( ti >= 2 )
    {
-      T_(0,0) *= -1.0;
+      T(0,0) *= -1.0;
    }
-
-   return T_;
 }
 
 Mesh *
@@ -7662,6 +7792,9 @@ BaseCenteredMonoclinicLattice::BaseCenteredMonoclinicLattice(double a,
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "Sigma";  // Gamma -> M
    il_[0][1] = "MK";     // M     -> K
@@ -8544,6 +8677,9 @@ TriclinicLattice::TriclinicLattice(double a, double b, double c,
    // Set Intermediate Symmetry Points
    this->SetIntermediatePoints();
 
+   // Tabulate the point group operations
+   this->SetTransformations();
+
    // Set Intermediate Symmetry Point Labels
    il_[0][0] = "XGamma"; // X     -> Gamma
    il_[0][1] = "GammaY"; // Gamma -> Y
@@ -8565,16 +8701,14 @@ TriclinicLattice::MapToFundamentalDomain(const Vector & pt,
    return map;
 }
 
-const DenseMatrix &
-TriclinicLattice::GetTransformation(int ti) const
+void
+TriclinicLattice::ComputeTransformation(int ti, DenseMatrix & T) const
 {
-   T_ = 0.0;
+   T = 0.0;
 
-   T_(0, 0) = 1.0 - 2.0 * ti;
-   T_(1, 1) = 1.0 - 2.0 * ti;
-   T_(2, 2) = 1.0 - 2.0 * ti;
-
-   return T_;
+   T(0, 0) = 1.0 - 2.0 * ti;
+   T(1, 1) = 1.0 - 2.0 * ti;
+   T(2, 2) = 1.0 - 2.0 * ti;
 }
 
 Mesh *
@@ -9162,136 +9296,574 @@ L2FourierSeries::L2FourierSeries(const BravaisLattice & bravais,
    bi_->AddDomainIntegrator(new DomainLFIntegrator(coefi_));
 }
 
-int toint(int d, double v)
+VectorFourierProjector::VectorFourierProjector(const BravaisLattice & bravais,
+                                               ParFiniteElementSpace & fes,
+                                               int nmax)
+   : fes_(&fes),
+     n_(nmax),
+     nm_(1)
 {
-   return (int)copysign(round(fabs(v)*pow(10.0,d)),v);
+   vol_ = bravais.GetUnitCellVolume();
+
+   bravais.GetReciprocalLatticeVectors(rec_vecs_);
+
+   // Directions without a reciprocal vector only carry the zero mode
+   for (int d=0; d<3; d++)
+   {
+      nmax_[d] = (d < (int)rec_vecs_.size()) ? nmax : 0;
+      w_[d]    = 2 * nmax_[d] + 1;
+      nm_     *= w_[d];
+   }
 }
 
-double todouble(int d, int v)
+void
+VectorFourierProjector::GetModeIndices(int m, int & n0, int & n1,
+                                       int & n2) const
 {
-   return pow(10.0,-d)*v;
+   n2 = m % w_[2] - nmax_[2]; m /= w_[2];
+   n1 = m % w_[1] - nmax_[1]; m /= w_[1];
+   n0 = m - nmax_[0];
 }
 
-Mesh *
-OldMakePeriodicMesh(Mesh * mesh, const vector<Vector> & trans_vecs, int logging)
+void
+VectorFourierProjector::accumulate(const DenseMatrix & Y, DenseMatrix & C) const
 {
-   int dim  = mesh->Dimension();
-   int sdim = mesh->SpaceDimension();
+   int nv = Y.Width();
+   int nr = rec_vecs_.size();
 
-   if ( logging > 0 )
-      cout << "Euler Number of Initial Mesh:  "
-           << ((dim==3)?mesh->EulerNumber():mesh->EulerNumber2D()) << endl;
+   C.SetSize(6 * nm_, nv);
+   C = 0.0;
 
-   map<int,map<int,map<int,int> > > c2v;
-   set<int> v;
+   // Powers exp(i n theta_d) for -nmax_d <= n <= nmax_d
+   vector<double> c[3], s[3];
+   for (int d=0; d<3; d++)
+   {
+      c[d].resize(w_[d]);
+      s[d].resize(w_[d]);
+      c[d][nmax_[d]] = 1.0;
+      s[d][nmax_[d]] = 0.0;
+   }
 
-   int d = 5;
-   Vector xMax(sdim), xMin(sdim);
-   xMax = xMin = 0.0;
+   Array<int> vdofs;
+   DenseMatrix vshape, Ye, U;
+   double x[3] = {0.0, 0.0, 0.0};
+   Vector transip(x, 3);
 
-   for (int be=0; be<mesh->GetNBE(); be++)
+   for (int e=0; e<fes_->GetNE(); e++)
    {
-      Array<int> dofs;
-      mesh->GetBdrElementVertices(be,dofs);
+      const FiniteElement * fe = fes_->GetFE(e);
+      ElementTransformation * T = fes_->GetElementTransformation(e);
+      fes_->GetElementVDofs(e, vdofs);
 
-      for (int i=0; i<dofs.Size(); i++)
+      int ndof = fe->GetDof();
+      int sdim = T->GetSpaceDim();
+      vshape.SetSize(ndof, sdim);
+      U.SetSize(sdim, nv);
+
+      // Element values of the fields with the dof orientations applied
+      Ye.SetSize(ndof, nv);
+      for (int j=0; j<ndof; j++)
       {
-         double * coords = mesh->GetVertex(dofs[i]);
-         for (int j=0; j<sdim; j++)
+         int dof = vdofs[j];
+         double sgn = 1.0;
+         if ( dof < 0 ) { dof = -1 - dof; sgn = -1.0; }
+         for (int v=0; v<nv; v++) { Ye(j, v) = sgn * Y(dof, v); }
+      }
+
+      // Same quadrature as VectorFEDomainLFIntegrator
+      const IntegrationRule & ir = IntRules.Get(fe->GetGeomType(),
+                                                2 * fe->GetOrder());
+
+      for (int q=0; q<ir.GetNPoints(); q++)
+      {
+         const IntegrationPoint & ip = ir.IntPoint(q);
+         T->SetIntPoint(&ip);
+         T->Transform(ip, transip);
+         fe->CalcVShape(*T, vshape);
+
+         // Weighted field values, sdim x nv
+         MultAtB(vshape, Ye, U);
+         U *= ip.weight * T->Weight();
+
+         for (int d=0; d<nr; d++)
          {
-            xMax[j] = max(xMax[j],coords[j]);
-            xMin[j] = min(xMin[j],coords[j]);
+            double theta = 0.0;
+            for (int k=0; k<rec_vecs_[d].Size() && k<3; k++)
+            {
+               theta += rec_vecs_[d][k] * x[k];
+            }
+            theta *= 2.0 * M_PI;
+
+            double c1 = cos(theta);
+            double s1 = sin(theta);
+            int o = nmax_[d];
+            for (int n=1; n<=nmax_[d]; n++)
+            {
+               c[d][o+n] = c[d][o+n-1] * c1 - s[d][o+n-1] * s1;
+               s[d][o+n] = s[d][o+n-1] * c1 + c[d][o+n-1] * s1;
+               c[d][o-n] =  c[d][o+n];
+               s[d][o-n] = -s[d][o+n];
+            }
+         }
+
+         int m = 0;
+         for (int i0=0; i0<w_[0]; i0++)
+         {
+            for (int i1=0; i1<w_[1]; i1++)
+            {
+               double c01 = c[0][i0] * c[1][i1] - s[0][i0] * s[1][i1];
+               double s01 = s[0][i0] * c[1][i1] + c[0][i0] * s[1][i1];
+
+               for (int i2=0; i2<w_[2]; i2++, m++)
+               {
+                  double cm = c01 * c[2][i2] - s01 * s[2][i2];
+                  double sm = s01 * c[2][i2] + c01 * s[2][i2];
+
+                  for (int k=0; k<sdim && k<3; k++)
+                  {
+                     for (int v=0; v<nv; v++)
+                     {
+                        C(3 * m + k, v)         += U(k, v) * cm;
+                        C(3 * (nm_ + m) + k, v) -= U(k, v) * sm;
+                     }
+                  }
+               }
+            }
          }
-         c2v[toint(d,coords[0])][toint(d,coords[1])][toint(d,coords[2])] =
-            dofs[i];
-         v.insert(dofs[i]);
       }
    }
-   if ( logging > 0 )
-   {
-      cout << "Number of Boundary Vertices:  " << v.size() << endl;
+}
 
-      cout << "xMin: ";
-      xMin.Print(cout,sdim);
-      cout << "xMax: ";
-      xMax.Print(cout,sdim);
+void
+VectorFourierProjector::Project(const DenseMatrix & X,
+                                DenseMatrix & a_r, DenseMatrix & a_i)
+{
+   int vsize = fes_->GetVSize();
+   int tsize = fes_->TrueVSize();
+
+   MFEM_VERIFY(X.Height() == tsize,
+               "VectorFourierProjector: input vectors must be true vectors");
+
+   int nv = X.Width();
+
+   // With the local test vectors b and P the dof to true dof map the
+   // projections are (P^T b)^T X = b^T (P X)
+   HypreParMatrix * P = fes_->Dof_TrueDof_Matrix();
+
+   DenseMatrix Y(vsize, nv);
+   for (int j=0; j<nv; j++)
+   {
+      Vector xj(const_cast<double*>(X.GetColumn(j)), tsize);
+      Vector yj(Y.GetColumn(j), vsize);
+      P->Mult(xj, yj);
    }
 
-   set<int> xc;
-   set<int> yc;
-   set<int> zc;
+   DenseMatrix C;
+   this->accumulate(Y, C);
 
-   map<int,map<int,map<int,int> > >::iterator mxyz;
-   map<int,map<int,int> >::iterator myz;
-   map<int,int>::iterator mz;
+   MPI_Allreduce(MPI_IN_PLACE, C.Data(), 6 * nm_ * nv, MPI_DOUBLE, MPI_SUM,
+                 fes_->GetComm());
 
-   if ( logging > 0 )
+   a_r.SetSize(3 * nm_, nv);
+   a_i.SetSize(3 * nm_, nv);
+   for (int j=0; j<nv; j++)
    {
-      int c = 0;
-      for (mxyz=c2v.begin(); mxyz!=c2v.end(); mxyz++)
+      for (int i=0; i<3*nm_; i++)
       {
-         for (myz=mxyz->second.begin(); myz!=mxyz->second.end(); myz++)
-         {
-            for (mz=myz->second.begin(); mz!=myz->second.end(); mz++)
-            {
-               cout << mz->second << ":  "
-                    << mxyz->first << " " << myz->first << " " << mz->first
-                    << endl;
-               c++;
-            }
-         }
+         a_r(i, j) = C(i, j) / vol_;
+         a_i(i, j) = C(3 * nm_ + i, j) / vol_;
       }
    }
+}
 
-   map<int,int>        slaves;
-   map<int,set<int> > masters;
+BrillouinZoneMesh::BrillouinZoneMesh(const BravaisLattice & bravais, int n)
+   : dim_(bravais.GetDim()),
+     n_(n)
+{
+   MFEM_VERIFY(n_ > 0, "BrillouinZoneMesh: n must be positive");
 
-   set<int>::iterator sit;
-   for (sit=v.begin(); sit!=v.end(); sit++) { masters[*sit]; }
+   vector<Vector> lat_vecs;
+   bravais.GetLatticeVectors(lat_vecs);
+   bravais.GetReciprocalLatticeVectors(rec_vecs_);
 
-   Vector at(sdim);
+   int npts = 1;
+   for (int i=0; i<dim_; i++) { npts *= n_; }
 
-   for (unsigned int i=0; i<trans_vecs.size(); i++)
+   // The identity is implied when a lattice provides no transformations
+   int nops = std::max(1, (int)bravais.GetNumberTransformations());
+
+   full2irr_.SetSize(npts);
+   full2irr_ = -1;
+   irr2full_.SetSize(0);
+   mult_.SetSize(0);
+
+   int    m[3], mi[3];
+   double k[3], rk[3];
+
+   for (int j=0; j<npts; j++)
    {
-      int c = 0;
-      if ( logging > 0 )
+      if ( full2irr_[j] >= 0 ) { continue; }
+
+      int r = mult_.Size();
+      irr2full_.Append(j);
+      mult_.Append(0);
+
+      for (int i=0, jj=j; i<dim_; i++, jj/=n_) { m[i] = jj % n_; }
+
+      for (int d=0; d<dim_; d++)
       {
-         cout << "trans_vecs = ";
-         trans_vecs[i].Print(cout,sdim);
-         cout << "toint(trans_vecs) = " << toint(d,trans_vecs[i][0]) << " "
-              << toint(d,trans_vecs[i][1]) << " "
-              << toint(d,trans_vecs[i][2]) << endl;
+         k[d] = 0.0;
+         for (int i=0; i<dim_; i++) { k[d] += m[i] * rec_vecs_[i][d]; }
       }
-      for (mxyz=c2v.begin(); mxyz!=c2v.end(); mxyz++)
+
+      for (int t=0; t<nops; t++)
       {
-         for (myz=mxyz->second.begin(); myz!=mxyz->second.end(); myz++)
+         if ( bravais.GetNumberTransformations() > 0 )
          {
-            for (mz=myz->second.begin(); mz!=myz->second.end(); mz++)
+            const DenseMatrix & T = bravais.GetTransformation(t);
+            for (int d=0; d<dim_; d++)
             {
-               double * coords = mesh->GetVertex(mz->second);
-
-               at = trans_vecs[i];
-               for (int j=0; j<sdim; j++) { at[j] += coords[j]; }
+               rk[d] = 0.0;
+               for (int l=0; l<dim_; l++) { rk[d] += T(d,l) * k[l]; }
+            }
+         }
+         else
+         {
+            for (int d=0; d<dim_; d++) { rk[d] = k[d]; }
+         }
 
-               int xi = 0, yi = 0, zi = 0;
+         // Fractional coordinates of the image are a_i.(R k), these must
+         // be integers if the operation maps the grid onto itself
+         bool onGrid = true;
+         for (int i=0; i<dim_; i++)
+         {
+            double f = 0.0;
+            for (int d=0; d<dim_; d++) { f += lat_vecs[i][d] * rk[d]; }
+            mi[i] = (int)floor(f + 0.5);
+            onGrid = onGrid && fabs(f - mi[i]) < 1.0e-8 * n_;
+         }
+         if ( !onGrid ) { continue; }
 
-               xi = toint(d,at[0]);
-               if ( sdim > 1 ) { yi = toint(d,at[1]); }
-               if ( sdim > 2 ) { zi = toint(d,at[2]); }
+         // The image and its time reversed partner
+         for (int s=0; s<2; s++)
+         {
+            int jr = this->fullIndex(mi);
+            if ( full2irr_[jr] < 0 )
+            {
+               full2irr_[jr] = r;
+               mult_[r]++;
+            }
+            for (int i=0; i<dim_; i++) { mi[i] = -mi[i]; }
+         }
+      }
+   }
 
-               if (c2v.find(xi) == c2v.end()) { continue; }
-               if (c2v[xi].find(yi) == c2v[xi].end()) { continue; }
-               if (c2v[xi][yi].find(zi) == c2v[xi][yi].end()) { continue; }
+   // Split each grid cell into dim! simplices sharing the diagonal from
+   // corner 0 to corner 2^dim-1.  Each simplex follows the cell edges in
+   // the order given by one permutation of the axes.
+   static const int perms[6][3] = {{0,1,2}, {0,2,1}, {1,0,2},
+      {1,2,0}, {2,0,1}, {2,1,0}
+   };
+   int nperm = (dim_ == 3) ? 6 : ((dim_ == 2) ? 2 : 1);
+   int pstep = (dim_ == 2) ? 2 : 1;
 
-               int master = mz->second;
-               int slave  = c2v[xi][yi][zi];
+   simplices_.SetSize(npts * nperm * (dim_ + 1));
+   int c = 0;
+   for (int j=0; j<npts; j++)
+   {
+      for (int i=0, jj=j; i<dim_; i++, jj/=n_) { m[i] = jj % n_; }
 
-               bool mInM = masters.find(master) != masters.end();
-               bool sInM = masters.find(slave)  != masters.end();
+      for (int q=0; q<nperm; q++)
+      {
+         // In 2D only the permutations of the first two axes are needed,
+         // these are entries 0 and 2 of the table
+         const int * perm = perms[q * pstep];
+         for (int i=0; i<dim_; i++) { mi[i] = m[i]; }
+         simplices_[c++] = this->fullIndex(mi);
+         for (int v=0; v<dim_; v++)
+         {
+            mi[perm[v]]++;
+            simplices_[c++] = this->fullIndex(mi);
+         }
+      }
+   }
+}
 
-               if ( mInM && sInM )
-               {
-                  // Both vertices are currently masters
+int
+BrillouinZoneMesh::fullIndex(const int * m) const
+{
+   int j = 0;
+   for (int i=dim_-1; i>=0; i--)
+   {
+      j = j * n_ + ((m[i] % n_) + n_) % n_;
+   }
+   return j;
+}
+
+void
+BrillouinZoneMesh::GetIrreduciblePoint(int i, Vector & kappa) const
+{
+   kappa.SetSize(dim_);
+   kappa = 0.0;
+
+   int j = irr2full_[i];
+   for (int l=0; l<dim_; l++, j/=n_)
+   {
+      int m = j % n_;
+      if ( 2 * m > n_ ) { m -= n_; }
+      kappa.Add(2.0 * M_PI * m / n_, rec_vecs_[l]);
+   }
+}
+
+void
+BrillouinZoneMesh::GetBandEdges(const DenseMatrix & bands, int b,
+                                double & lo, double & hi) const
+{
+   MFEM_ASSERT(bands.Height() == mult_.Size(),
+               "BrillouinZoneMesh: one row per irreducible point expected");
+
+   lo = bands(0, b);
+   hi = bands(0, b);
+   for (int i=1; i<bands.Height(); i++)
+   {
+      lo = std::min(lo, bands(i, b));
+      hi = std::max(hi, bands(i, b));
+   }
+}
+
+/** The fraction of a simplex, with sorted vertex values e, on which the
+    linearly interpolated value lies below w.  These are the integrated
+    densities of states of P. E. Blochl, O. Jepsen, and O. K. Andersen,
+    Phys. Rev. B 49, 16223 (1994) and their 1D and 2D analogues.
+ */
+double
+BrillouinZoneMesh::simplexFraction(int dim, const double * e, double w)
+{
+   if ( w <= e[0] ) { return 0.0; }
+   if ( w >= e[dim] ) { return 1.0; }
+
+   switch (dim)
+   {
+      case 1:
+         return (w - e[0]) / (e[1] - e[0]);
+      case 2:
+         if ( w < e[1] )
+         {
+            return (w - e[0]) * (w - e[0]) / ((e[1] - e[0]) * (e[2] - e[0]));
+         }
+         return 1.0 - (e[2] - w) * (e[2] - w) /
+                ((e[2] - e[0]) * (e[2] - e[1]));
+      case 3:
+      default:
+         if ( w < e[1] )
+         {
+            return pow(w - e[0], 3) /
+                   ((e[1] - e[0]) * (e[2] - e[0]) * (e[3] - e[0]));
+         }
+         else if ( w < e[2] )
+         {
+            double e21 = e[1] - e[0];
+            double e31 = e[2] - e[0];
+            double e41 = e[3] - e[0];
+            double e32 = e[2] - e[1];
+            double e42 = e[3] - e[1];
+            double dw  = w - e[1];
+            return (e21 * e21 + 3.0 * e21 * dw + 3.0 * dw * dw
+                    - (e31 + e42) * dw * dw * dw / (e32 * e42)) / (e31 * e41);
+         }
+         return 1.0 - pow(e[3] - w, 3) /
+                ((e[3] - e[0]) * (e[3] - e[1]) * (e[3] - e[2]));
+   }
+}
+
+void
+BrillouinZoneMesh::GetDensityOfStates(const DenseMatrix & bands,
+                                      double wmin, double wmax,
+                                      Vector & dos) const
+{
+   MFEM_ASSERT(bands.Height() == mult_.Size(),
+               "BrillouinZoneMesh: one row per irreducible point expected");
+
+   int nbins = dos.Size();
+   double dw = (wmax - wmin) / nbins;
+
+   int nv = dim_ + 1;
+   int ns = simplices_.Size() / nv;
+   double ws = 1.0 / ns;
+
+   // The integrated density of states at the nbins+1 bin edges.  Beyond
+   // its largest vertex value a simplex contributes its full weight which
+   // is accumulated as a step and summed afterwards.
+   Vector N(nbins + 1);  N = 0.0;
+   Vector step(nbins + 2); step = 0.0;
+
+   double e[4];
+   for (int b=0; b<bands.Width(); b++)
+   {
+      for (int s=0; s<ns; s++)
+      {
+         for (int v=0; v<nv; v++)
+         {
+            e[v] = bands(full2irr_[simplices_[nv * s + v]], b);
+         }
+         std::sort(e, e + nv);
+
+         int i0 = (int)ceil((e[0] - wmin) / dw);
+         int i1 = (int)ceil((e[dim_] - wmin) / dw);
+         i0 = std::min(std::max(i0, 0), nbins + 1);
+         i1 = std::min(std::max(i1, i0), nbins + 1);
+
+         for (int i=i0; i<i1; i++)
+         {
+            N[i] += ws * simplexFraction(dim_, e, wmin + i * dw);
+         }
+         step[i1] += ws;
+      }
+   }
+
+   double acc = 0.0;
+   for (int i=0; i<=nbins; i++)
+   {
+      acc  += step[i];
+      N[i] += acc;
+   }
+
+   for (int i=0; i<nbins; i++)
+   {
+      dos[i] = (N[i+1] - N[i]) / dw;
+   }
+}
+
+int toint(int d, double v)
+{
+   return (int)copysign(round(fabs(v)*pow(10.0,d)),v);
+}
+
+double todouble(int d, int v)
+{
+   return pow(10.0,-d)*v;
+}
+
+Mesh *
+OldMakePeriodicMesh(Mesh * mesh, const vector<Vector> & trans_vecs, int logging)
+{
+   int dim  = mesh->Dimension();
+   int sdim = mesh->SpaceDimension();
+
+   if ( logging > 0 )
+      cout << "Euler Number of Initial Mesh:  "
+           << ((dim==3)?mesh->EulerNumber():mesh->EulerNumber2D()) << endl;
+
+   map<int,map<int,map<int,int> > > c2v;
+   set<int> v;
+
+   int d = 5;
+   Vector xMax(sdim), xMin(sdim);
+   xMax = xMin = 0.0;
+
+   for (int be=0; be<mesh->GetNBE(); be++)
+   {
+      Array<int> dofs;
+      mesh->GetBdrElementVertices(be,dofs);
+
+      for (int i=0; i<dofs.Size(); i++)
+      {
+         double * coords = mesh->GetVertex(dofs[i]);
+         for (int j=0; j<sdim; j++)
+         {
+            xMax[j] = max(xMax[j],coords[j]);
+            xMin[j] = min(xMin[j],coords[j]);
+         }
+         c2v[toint(d,coords[0])][toint(d,coords[1])][toint(d,coords[2])] =
+            dofs[i];
+         v.insert(dofs[i]);
+      }
+   }
+   if ( logging > 0 )
+   {
+      cout << "Number of Boundary Vertices:  " << v.size() << endl;
+
+      cout << "xMin: ";
+      xMin.Print(cout,sdim);
+      cout << "xMax: ";
+      xMax.Print(cout,sdim);
+   }
+
+   set<int> xc;
+   set<int> yc;
+   set<int> zc;
+
+   map<int,map<int,map<int,int> > >::iterator mxyz;
+   map<int,map<int,int> >::iterator myz;
+   map<int,int>::iterator mz;
+
+   if ( logging > 0 )
+   {
+      int c = 0;
+      for (mxyz=c2v.begin(); mxyz!=c2v.end(); mxyz++)
+      {
+         for (myz=mxyz->second.begin(); myz!=mxyz->second.end(); myz++)
+         {
+            for (mz=myz->second.begin(); mz!=myz->second.end(); mz++)
+            {
+               cout << mz->second << ":  "
+                    << mxyz->first << " " << myz->first << " " << mz->first
+                    << endl;
+               c++;
+            }
+         }
+      }
+   }
+
+   map<int,int>        slaves;
+   map<int,set<int> > masters;
+
+   set<int>::iterator sit;
+   for (sit=v.begin(); sit!=v.end(); sit++) { masters[*sit]; }
+
+   Vector at(sdim);
+
+   for (unsigned int i=0; i<trans_vecs.size(); i++)
+   {
+      int c = 0;
+      if ( logging > 0 )
+      {
+         cout << "trans_vecs = ";
+         trans_vecs[i].Print(cout,sdim);
+         cout << "toint(trans_vecs) = " << toint(d,trans_vecs[i][0]) << " "
+              << toint(d,trans_vecs[i][1]) << " "
+              << toint(d,trans_vecs[i][2]) << endl;
+      }
+      for (mxyz=c2v.begin(); mxyz!=c2v.end(); mxyz++)
+      {
+         for (myz=mxyz->second.begin(); myz!=mxyz->second.end(); myz++)
+         {
+            for (mz=myz->second.begin(); mz!=myz->second.end(); mz++)
+            {
+               double * coords = mesh->GetVertex(mz->second);
+
+               at = trans_vecs[i];
+               for (int j=0; j<sdim; j++) { at[j] += coords[j]; }
+
+               int xi = 0, yi = 0, zi = 0;
+
+               xi = toint(d,at[0]);
+               if ( sdim > 1 ) { yi = toint(d,at[1]); }
+               if ( sdim > 2 ) { zi = toint(d,at[2]); }
+
+               if (c2v.find(xi) == c2v.end()) { continue; }
+               if (c2v[xi].find(yi) == c2v[xi].end()) { continue; }
+               if (c2v[xi][yi].find(zi) == c2v[xi][yi].end()) { continue; }
+
+               int master = mz->second;
+               int slave  = c2v[xi][yi][zi];
+
+               bool mInM = masters.find(master) != masters.end();
+               bool sInM = masters.find(slave)  != masters.end();
+
+               if ( mInM && sInM )
+               {
+                  // Both vertices are currently masters
                   //   Demote "slave" to be a slave of master
                   if ( logging > 0 )
                   {
@@ -9831,6 +10403,602 @@ MakePeriodicMesh(Mesh * mesh, const vector<Vector> & trans_vecs, int logging)
    return per_mesh;
 }
 
+ParMesh *
+DistributeMesh(MPI_Comm comm, Mesh * mesh, int sr, int pr, bool nc,
+               int min_elems, int logging)
+{
+   int num_procs = 1, myid = 0;
+   MPI_Comm_size(comm, &num_procs);
+   MPI_Comm_rank(comm, &myid);
+
+   // Each level of uniform refinement multiplies the element count by
+   // 2^dim so the serial mesh is refined only until it can be partitioned
+   int sl = 0;
+   while ( sl < sr && mesh->GetNE() < min_elems * num_procs )
+   {
+      mesh->UniformRefinement();
+      sl++;
+   }
+   if ( nc ) { mesh->EnsureNCMesh(); }
+
+   if ( logging > 0 && myid == 0 )
+   {
+      cout << "Distributing mesh with " << mesh->GetNE() << " elements after "
+           << sl << " serial refinement(s), " << sr + pr - sl
+           << " parallel refinement(s) remain" << endl;
+   }
+
+   ParMesh * pmesh = new ParMesh(comm, *mesh);
+   delete mesh;
+
+   for (int l = sl; l < sr + pr; l++)
+   {
+      pmesh->UniformRefinement();
+   }
+   return pmesh;
+}
+
+ParMesh *
+DistributeMesh(MPI_Comm comm, LatticeMeshCache & cache,
+               const BravaisLattice & bl, int sr, int pr, bool periodic,
+               bool nc, int min_elems, int logging)
+{
+   int num_procs = 1;
+   MPI_Comm_size(comm, &num_procs);
+
+   // The size of the coarse mesh determines how many refinements must
+   // precede the partitioning
+   Mesh * mesh = cache.GetWignerSeitzMesh(bl, 0, periodic);
+
+   int ne = mesh->GetNE();
+   int sl = 0;
+   while ( sl < sr && ne < min_elems * num_procs )
+   {
+      ne *= 1 << mesh->Dimension();
+      sl++;
+   }
+   if ( sl > 0 )
+   {
+      delete mesh;
+      mesh = cache.GetWignerSeitzMesh(bl, sl, periodic);
+   }
+
+   return DistributeMesh(comm, mesh, 0, sr + pr - sl, nc, min_elems, logging);
+}
+
+bool
+MorphLatticeMesh(const BravaisLattice & bl0, const BravaisLattice & bl1,
+                 Mesh & mesh)
+{
+   if ( bl0.GetLatticeType() != bl1.GetLatticeType() ||
+        bl0.GetLatticeTypeLabel() != bl1.GetLatticeTypeLabel() )
+   {
+      return false;
+   }
+
+   vector<Vector> t0, t1;
+   bl0.GetTranslationVectors(t0);
+   bl1.GetTranslationVectors(t1);
+   if ( t0.size() != t1.size() ) { return false; }
+
+   int dim = bl0.GetDim();
+   MFEM_VERIFY(mesh.SpaceDimension() == dim,
+               "MorphLatticeMesh: mesh and lattice dimensions differ");
+
+   vector<Vector> a0, a1;
+   bl0.GetLatticeVectors(a0);
+   bl1.GetLatticeVectors(a1);
+
+   // L = A1 A0^{-1} where the columns of A0 and A1 are the lattice vectors
+   DenseMatrix A0(dim), A1(dim), A0Inv(dim), L(dim);
+   for (int i=0; i<dim; i++)
+   {
+      for (int j=0; j<dim; j++)
+      {
+         A0(j,i) = a0[i][j];
+         A1(j,i) = a1[i][j];
+      }
+   }
+   CalcInverse(A0, A0Inv);
+   Mult(A1, A0Inv, L);
+
+   // An orientation reversing map would invert every element
+   if ( L.Det() <= 0.0 ) { return false; }
+
+   Vector x(dim), y(dim);
+   for (int i=0; i<mesh.GetNV(); i++)
+   {
+      double * v = mesh.GetVertex(i);
+      x = v;
+      L.Mult(x, y);
+      for (int j=0; j<dim; j++) { v[j] = y[j]; }
+   }
+
+   GridFunction * nodes = mesh.GetNodes();
+   if ( nodes )
+   {
+      const FiniteElementSpace * fes = nodes->FESpace();
+      for (int d=0; d<fes->GetNDofs(); d++)
+      {
+         for (int j=0; j<dim; j++) { x[j] = (*nodes)(fes->DofToVDof(d, j)); }
+         L.Mult(x, y);
+         for (int j=0; j<dim; j++) { (*nodes)(fes->DofToVDof(d, j)) = y[j]; }
+      }
+   }
+
+   ParMesh * pmesh = dynamic_cast<ParMesh*>(&mesh);
+   if ( pmesh ) { pmesh->ExchangeFaceNbrNodes(); }
+
+   return true;
+}
+
+static const char LatticeMeshCacheMagic[8] =
+{ 'B', 'R', 'A', 'V', 'M', 'E', 'S', 'H' };
+
+// Increment whenever the layout of the cache files changes so that entries
+// written by older versions are rejected and regenerated
+static const int LatticeMeshCacheVersion = 1;
+
+static bool
+SameLatticeMesh(const LatticeMeshCache::Header & a,
+                const LatticeMeshCache::Header & b)
+{
+   if ( memcmp(a.magic, b.magic, 8) != 0 ) { return false; }
+   if ( a.version != b.version ) { return false; }
+   if ( a.lattice_type != b.lattice_type ) { return false; }
+   if ( a.dim != b.dim ) { return false; }
+   for (int i=0; i<9; i++)
+   {
+      if ( fabs(a.lattice_vecs[i] - b.lattice_vecs[i]) > 1e-10 )
+      {
+         return false;
+      }
+   }
+   return ( a.ref_levels == b.ref_levels && a.periodic == b.periodic );
+}
+
+static void
+WriteMeshElement(ofstream & ofs, const Element & el)
+{
+   int buf[2];
+   buf[0] = el.GetGeometryType();
+   buf[1] = el.GetAttribute();
+   ofs.write((const char*)buf, 2 * sizeof(int));
+   ofs.write((const char*)el.GetVertices(), el.GetNVertices() * sizeof(int));
+}
+
+static Element *
+ReadMeshElement(ifstream & ifs, Mesh & mesh)
+{
+   int buf[2];
+   ifs.read((char*)buf, 2 * sizeof(int));
+   if ( !ifs || buf[0] < 0 || buf[0] >= Geometry::NumGeom ) { return NULL; }
+
+   Element * el = mesh.NewElement(buf[0]);
+   el->SetAttribute(buf[1]);
+   ifs.read((char*)el->GetVertices(), el->GetNVertices() * sizeof(int));
+   return el;
+}
+
+LatticeMeshCache::LatticeMeshCache(MPI_Comm comm, const string & dir,
+                                   int logging)
+   : comm_(comm),
+     myid_(0),
+     logging_(logging),
+     dir_(dir)
+{
+   MPI_Comm_rank(comm_, &myid_);
+
+   if ( dir_.empty() ) { return; }
+
+   // The directory may be shared by several runs so failure is only
+   // reported if it still does not exist
+   if ( myid_ == 0 )
+   {
+      struct stat st;
+      if ( mkdir(dir_.c_str(), 0775) != 0 &&
+           ( stat(dir_.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) ) )
+      {
+         cout << "Unable to create mesh cache directory "
+              << dir_ << ", the cache is disabled" << endl;
+         dir_ = "";
+      }
+   }
+   int enabled = !dir_.empty();
+   MPI_Bcast(&enabled, 1, MPI_INT, 0, comm_);
+   if ( !enabled ) { dir_ = ""; }
+}
+
+void
+LatticeMeshCache::initHeader(const BravaisLattice & bl, int ref_levels,
+                             bool periodic, Header & hdr) const
+{
+   // Zero the padding so that the header is written deterministically
+   memset(&hdr, 0, sizeof(Header));
+   memcpy(hdr.magic, LatticeMeshCacheMagic, 8);
+   hdr.version      = LatticeMeshCacheVersion;
+   hdr.lattice_type = (int)bl.GetLatticeType();
+   hdr.dim          = (int)bl.GetDim();
+   hdr.ref_levels   = ref_levels;
+   hdr.periodic     = periodic ? 1 : 0;
+
+   vector<Vector> a;
+   bl.GetLatticeVectors(a);
+   for (int i=0; i<hdr.dim; i++)
+   {
+      for (int j=0; j<hdr.dim; j++)
+      {
+         hdr.lattice_vecs[3*i+j] = a[i][j];
+      }
+   }
+}
+
+string
+LatticeMeshCache::GetFileName(const BravaisLattice & bl, int ref_levels,
+                              bool periodic) const
+{
+   Header hdr;
+   this->initHeader(bl, ref_levels, periodic, hdr);
+
+   // 64-bit FNV-1a hash of the key fields.  The lattice vectors are
+   // rounded so that parameters which differ only by round-off share an
+   // entry.
+   long long key[13];
+   key[0] = hdr.lattice_type;
+   key[1] = hdr.dim;
+   key[2] = hdr.ref_levels;
+   key[3] = hdr.periodic;
+   for (int i=0; i<9; i++)
+   {
+      key[4+i] = (long long)floor(1e8 * hdr.lattice_vecs[i] + 0.5);
+   }
+
+   unsigned long long h = 14695981039346656037ULL;
+   const unsigned char * c = (const unsigned char*)key;
+   for (size_t i=0; i<sizeof(key); i++)
+   {
+      h ^= c[i];
+      h *= 1099511628211ULL;
+   }
+
+   ostringstream oss;
+   oss << dir_ << "/mesh-" << hex << setfill('0') << setw(16) << h << ".bin";
+   return oss.str();
+}
+
+void
+LatticeMeshCache::WriteMesh(const string & fname, const Header & hdr,
+                            const Mesh & mesh)
+{
+   MFEM_VERIFY(mesh.ncmesh == NULL,
+               "LatticeMeshCache: nonconforming meshes cannot be stored");
+
+   Header h = hdr;
+   h.sdim = mesh.SpaceDimension();
+   h.nv   = mesh.GetNV();
+   h.ne   = mesh.GetNE();
+   h.nbe  = mesh.GetNBE();
+
+   const GridFunction * nodes = mesh.GetNodes();
+   if ( nodes )
+   {
+      const FiniteElementSpace * fes = nodes->FESpace();
+      h.nodes_order    = fes->GetOrder(0);
+      h.nodes_discont  =
+         dynamic_cast<const L2_FECollection*>(fes->FEColl()) != NULL;
+      h.nodes_ordering = fes->GetOrdering();
+      h.nodes_size     = nodes->Size();
+   }
+
+   ostringstream oss;
+   oss << fname << ".tmp." << getpid();
+   string tmp = oss.str();
+
+   ofstream ofs(tmp.c_str(), ios::out | ios::binary | ios::trunc);
+   ofs.write((const char*)&h, sizeof(Header));
+   for (int i=0; i<h.nv; i++)
+   {
+      ofs.write((const char*)mesh.GetVertex(i), h.sdim * sizeof(double));
+   }
+   for (int i=0; i<h.ne; i++)
+   {
+      WriteMeshElement(ofs, *mesh.GetElement(i));
+   }
+   for (int i=0; i<h.nbe; i++)
+   {
+      WriteMeshElement(ofs, *mesh.GetBdrElement(i));
+   }
+   if ( nodes )
+   {
+      ofs.write((const char*)nodes->GetData(), h.nodes_size * sizeof(double));
+   }
+   ofs.close();
+
+   if ( !ofs || rename(tmp.c_str(), fname.c_str()) != 0 )
+   {
+      remove(tmp.c_str());
+      cout << "Unable to write mesh cache entry " << fname << endl;
+   }
+}
+
+Mesh *
+LatticeMeshCache::ReadMesh(const string & fname, const Header & hdr)
+{
+   ifstream ifs(fname.c_str(), ios::in | ios::binary);
+   if ( !ifs ) { return NULL; }
+
+   Header h;
+   ifs.read((char*)&h, sizeof(Header));
+   if ( !ifs || !SameLatticeMesh(h, hdr) ) { return NULL; }
+
+   Mesh * mesh = new Mesh(h.dim, h.nv, h.ne, h.nbe, h.sdim);
+
+   double x[3];
+   for (int i=0; i<h.nv; i++)
+   {
+      ifs.read((char*)x, h.sdim * sizeof(double));
+      mesh->AddVertex(x);
+   }
+   bool ok = (bool)ifs;
+   for (int i=0; ok && i<h.ne; i++)
+   {
+      Element * el = ReadMeshElement(ifs, *mesh);
+      if ( el ) { mesh->AddElement(el); }
+      ok = ( el != NULL && ifs );
+   }
+   for (int i=0; ok && i<h.nbe; i++)
+   {
+      Element * el = ReadMeshElement(ifs, *mesh);
+      if ( el ) { mesh->AddBdrElement(el); }
+      ok = ( el != NULL && ifs );
+   }
+   if ( !ok )
+   {
+      delete mesh;
+      return NULL;
+   }
+
+   // The stored elements are already oriented and, for periodic meshes,
+   // must keep their vertex order to match the stored nodes
+   mesh->FinalizeTopology();
+   mesh->Finalize(false, false);
+
+   if ( h.nodes_size > 0 )
+   {
+      mesh->SetCurvature(h.nodes_order, h.nodes_discont != 0, h.sdim,
+                         h.nodes_ordering);
+      GridFunction * nodes = mesh->GetNodes();
+      if ( nodes->Size() != h.nodes_size )
+      {
+         delete mesh;
+         return NULL;
+      }
+      ifs.read((char*)nodes->GetData(), h.nodes_size * sizeof(double));
+      if ( !ifs )
+      {
+         delete mesh;
+         return NULL;
+      }
+   }
+   return mesh;
+}
+
+Mesh *
+LatticeMeshCache::readEntry(const BravaisLattice & bl, int ref_levels,
+                            bool periodic)
+{
+   if ( dir_.empty() ) { return NULL; }
+
+   Header hdr;
+   this->initHeader(bl, ref_levels, periodic, hdr);
+
+   Mesh * mesh = ReadMesh(this->GetFileName(bl, ref_levels, periodic), hdr);
+
+   // Every processor must agree on the outcome
+   int found = ( mesh != NULL );
+   int glb_found = 0;
+   MPI_Allreduce(&found, &glb_found, 1, MPI_INT, MPI_MIN, comm_);
+   if ( !glb_found )
+   {
+      delete mesh;
+      return NULL;
+   }
+   return mesh;
+}
+
+void
+LatticeMeshCache::writeEntry(const BravaisLattice & bl, int ref_levels,
+                             bool periodic, const Mesh & mesh)
+{
+   if ( dir_.empty() ) { return; }
+
+   Header hdr;
+   this->initHeader(bl, ref_levels, periodic, hdr);
+
+   WriteMesh(this->GetFileName(bl, ref_levels, periodic), hdr, mesh);
+}
+
+Mesh *
+LatticeMeshCache::GetWignerSeitzMesh(const BravaisLattice & bl,
+                                     int ref_levels, bool periodic)
+{
+   // Start from the most refined entry available
+   Mesh * mesh = NULL;
+   int l = ref_levels;
+   for (; l >= 0 && mesh == NULL; l--)
+   {
+      mesh = this->readEntry(bl, l, periodic);
+   }
+   l++;
+
+   bool found = ( mesh != NULL );
+   if ( !found )
+   {
+      mesh = periodic ? bl.GetPeriodicWignerSeitzMesh() :
+             bl.GetWignerSeitzMesh();
+      if ( myid_ == 0 ) { this->writeEntry(bl, 0, periodic, *mesh); }
+   }
+
+   if ( logging_ > 0 && myid_ == 0 && !dir_.empty() )
+   {
+      cout << "Mesh cache: " << (found ? "read" : "generated")
+           << " refinement level " << l << " of " << ref_levels << endl;
+   }
+
+   for (; l < ref_levels; l++)
+   {
+      mesh->UniformRefinement();
+      if ( myid_ == 0 ) { this->writeEntry(bl, l + 1, periodic, *mesh); }
+   }
+   return mesh;
+}
+
+ParFESpaceWorkspace::ParFESpaceWorkspace(ParFiniteElementSpace & fes)
+   : fes_(&fes)
+{}
+
+ParFESpaceWorkspace::~ParFESpaceWorkspace()
+{
+   this->Update();
+}
+
+void
+ParFESpaceWorkspace::Update()
+{
+   map<int, vector<HypreParVector*> >::iterator vit;
+   for (vit=vecs_.begin(); vit!=vecs_.end(); vit++)
+   {
+      for (unsigned int i=0; i<vit->second.size(); i++)
+      {
+         delete vit->second[i];
+      }
+   }
+   vecs_.clear();
+
+   for (unsigned int i=0; i<views_.size(); i++) { delete views_[i]; }
+   views_.clear();
+
+   for (unsigned int i=0; i<gfs_.size(); i++) { delete gfs_[i]; }
+   gfs_.clear();
+
+   // The single block partitioning belongs to the FE space
+   map<int, HYPRE_Int*>::iterator pit;
+   for (pit=part_.begin(); pit!=part_.end(); pit++)
+   {
+      if ( pit->first != 1 ) { delete [] pit->second; }
+   }
+   part_.clear();
+   glb_.clear();
+}
+
+HYPRE_Int *
+ParFESpaceWorkspace::GetPartitioning(int nblk)
+{
+   map<int, HYPRE_Int*>::iterator pit = part_.find(nblk);
+   if ( pit != part_.end() ) { return pit->second; }
+
+   if ( nblk == 1 )
+   {
+      part_[1] = fes_->GetTrueDofOffsets();
+      glb_[1]  = fes_->GlobalTrueVSize();
+      return part_[1];
+   }
+
+   MPI_Comm comm = fes_->GetComm();
+   int numProcs  = fes_->GetNRanks();
+
+   HYPRE_Int locSize = nblk * fes_->TrueVSize();
+   HYPRE_Int glbSize = 0;
+
+   HYPRE_Int * part = NULL;
+
+   if (HYPRE_AssumedPartitionCheck())
+   {
+      part = new HYPRE_Int[2];
+
+      MPI_Scan(&locSize, &part[1], 1, HYPRE_MPI_INT, MPI_SUM, comm);
+
+      part[0] = part[1] - locSize;
+
+      MPI_Allreduce(&locSize, &glbSize, 1, HYPRE_MPI_INT, MPI_SUM, comm);
+   }
+   else
+   {
+      part = new HYPRE_Int[numProcs+1];
+
+      MPI_Allgather(&locSize, 1, HYPRE_MPI_INT,
+                    &part[1], 1, HYPRE_MPI_INT, comm);
+
+      part[0] = 0;
+      for (int i=0; i<numProcs; i++)
+      {
+         part[i+1] += part[i];
+      }
+
+      glbSize = part[numProcs];
+   }
+
+   part_[nblk] = part;
+   glb_[nblk]  = glbSize;
+
+   return part;
+}
+
+HYPRE_Int
+ParFESpaceWorkspace::GetGlobalSize(int nblk)
+{
+   this->GetPartitioning(nblk);
+   return glb_[nblk];
+}
+
+HypreParVector &
+ParFESpaceWorkspace::GetTrueVector(int i, int nblk)
+{
+   vector<HypreParVector*> & vecs = vecs_[nblk];
+   if ( i >= (int)vecs.size() )
+   {
+      vecs.resize(i+1, NULL);
+   }
+   if ( vecs[i] == NULL )
+   {
+      vecs[i] = new HypreParVector(fes_->GetComm(),
+                                   this->GetGlobalSize(nblk),
+                                   this->GetPartitioning(nblk));
+   }
+   return *vecs[i];
+}
+
+HypreParVector &
+ParFESpaceWorkspace::GetTrueVectorView(int i)
+{
+   if ( i >= (int)views_.size() )
+   {
+      views_.resize(i+1, NULL);
+   }
+   if ( views_[i] == NULL )
+   {
+      views_[i] = new HypreParVector(fes_->GetComm(),
+                                     this->GetGlobalSize(1),
+                                     NULL,
+                                     this->GetPartitioning(1));
+   }
+   return *views_[i];
+}
+
+ParGridFunction &
+ParFESpaceWorkspace::GetGridFunction(int i)
+{
+   if ( i >= (int)gfs_.size() )
+   {
+      gfs_.resize(i+1, NULL);
+   }
+   if ( gfs_[i] == NULL )
+   {
+      gfs_[i] = new ParGridFunction(fes_);
+   }
+   return *gfs_[i];
+}
+
 LatticeCoefficient::LatticeCoefficient(const BravaisLattice & bl,
                                        double frac, double val0, double val1)
    : frac_(frac),
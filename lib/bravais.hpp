@@ -14,6 +14,8 @@
 
 #include "mfem.hpp"
 #include "mfem-extras.hpp"
+#include <map>
+#include <vector>
 
 namespace mfem
 {
@@ -97,6 +99,16 @@ public:
    // i.e. returns (ipt != pt).
    bool MapToPrimitiveCell(const Vector & pt, Vector & ipt) const;
 
+   // Batch version of MapToPrimitiveCell acting on @a n points stored
+   // as separate coordinate arrays, i.e. point j is (x[0][j], x[1][j],
+   // x[2][j]).  The mapped points are written to @a y using the same
+   // layout and, when @a mapped is not NULL, mapped[j] receives the
+   // return value for point j.  No heap allocation is performed so this
+   // may safely be called concurrently from several threads.
+   void MapPointsToPrimitiveCell(int n, const double * const * x,
+                                 double * const * y,
+                                 bool * mapped = NULL) const;
+
    // The Fundamental Domain is a connected subset of the Primitive
    // Cell which can generate the entire Primitive Cell under the
    // action of a set of rotation and reflection symmetries.  Returns
@@ -104,13 +116,26 @@ public:
    virtual bool MapToFundamentalDomain(const Vector & pt,
                                        Vector & ipt) const = 0;
 
+   // Batch version of MapToFundamentalDomain using the same
+   // structure-of-arrays layout as MapPointsToPrimitiveCell.
+   void MapPointsToFundamentalDomain(int n, const double * const * x,
+                                     double * const * y,
+                                     bool * mapped = NULL) const;
+
    // The number of proper and improper rotations needed to fill the
    // primitive cell with transformed copies of the fundamental domain.
    virtual unsigned int GetNumberTransformations() const = 0;
 
    // Return the linear operator which transforms points in the fundamental
    // domain into corresponding points elsewhere in the primitive cell.
-   virtual const DenseMatrix & GetTransformation(int ti) const = 0;
+   // These are tabulated when the lattice is constructed so the returned
+   // reference remains valid, and unchanged, for the life of the lattice.
+   inline const DenseMatrix & GetTransformation(int ti) const
+   { return trans_[ti]; }
+
+   // Evaluate transformation @a ti into caller supplied storage.  The
+   // matrix @a T must already be sized dim x dim.
+   virtual void ComputeTransformation(int ti, DenseMatrix & T) const = 0;
 
    // In this context "Symmetry Points" are points in the
    // reciprocal space.  They are sometimes called "High-Symmetry
@@ -154,6 +179,12 @@ protected:
 
    void SetVectorSizes();
    void SetIntermediatePoints();
+   void SetTransformations();
+   void GetFlatVectors(double * A, double * B) const;
+
+   static bool MapPointToPrimitiveCell(int dim,
+                                       const double * A, const double * B,
+                                       const double * pt, double * ipt);
    void SetCellVolumes();
    double ComputeCellVolume(const std::vector<Vector> & vecs);
 
@@ -173,7 +204,7 @@ protected:
    std::string bounds_str_;
    BRAVAIS_LATTICE_TYPE type_;
 
-   mutable DenseMatrix T_;
+   std::vector< DenseMatrix > trans_; // Point group operations
 
    unsigned int dim_;
    double vol_;
@@ -237,7 +268,8 @@ public:
 
    unsigned int GetNumberTransformations() const { return 0; }
 
-   const DenseMatrix & GetTransformation(int ti) const { return T_; }
+   void ComputeTransformation(int ti, DenseMatrix & T) const
+   { T = 0.0; for (int i=0; i<T.Width(); i++) { T(i,i) = 1.0; } }
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const { return NULL; }
 
@@ -293,7 +325,8 @@ public:
 
    unsigned int GetNumberTransformations() const { return 0; }
 
-   const DenseMatrix & GetTransformation(int ti) const { return T_; }
+   void ComputeTransformation(int ti, DenseMatrix & T) const
+   { T = 0.0; for (int i=0; i<T.Width(); i++) { T(i,i) = 1.0; } }
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const { return NULL; }
 
@@ -320,7 +353,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return 1; }
 
    unsigned int GetNumberTransformations() const { return 2; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
 
@@ -359,7 +392,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return 3; }
 
    virtual unsigned int GetNumberTransformations() const { return 8; }
-   virtual const DenseMatrix & GetTransformation(int ti) const;
+   virtual void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
    virtual mfem::Mesh * GetWignerSeitzCellMesh() const;
@@ -399,7 +432,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return 3; }
 
    unsigned int GetNumberTransformations() const { return 12; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
    virtual mfem::Mesh * GetWignerSeitzCellMesh() const;
@@ -442,7 +475,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return 4; }
 
    virtual unsigned int GetNumberTransformations() const { return 4; }
-   virtual const DenseMatrix & GetTransformation(int ti) const;
+   virtual void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
    virtual mfem::Mesh * GetWignerSeitzCellMesh() const;
@@ -481,7 +514,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return 4; }
 
    unsigned int GetNumberTransformations() const { return 4; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
    virtual mfem::Mesh * GetWignerSeitzCellMesh() const;
@@ -520,7 +553,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return 8; }
 
    unsigned int GetNumberTransformations() const { return 2; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
    virtual mfem::Mesh * GetWignerSeitzCellMesh() const;
@@ -562,7 +595,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return (i==0)?5:1; }
 
    unsigned int GetNumberTransformations() const { return 48; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
    virtual mfem::Mesh * GetWignerSeitzCellMesh() const;
@@ -608,7 +641,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return (i==0)?9:1; }
 
    unsigned int GetNumberTransformations() const { return 48; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
    virtual mfem::Mesh * GetWignerSeitzCellMesh() const;
@@ -647,7 +680,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return (i==0)?5:1; }
 
    unsigned int GetNumberTransformations() const { return 48; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
    virtual mfem::Mesh * GetWignerSeitzCellMesh() const;
@@ -693,7 +726,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return (i==0)?7:1; }
 
    unsigned int GetNumberTransformations() const { return 16; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
 
@@ -736,7 +769,7 @@ public:
    { return (c_<a_)?((i==0)?8:1):((i==0)?10:1); }
 
    unsigned int GetNumberTransformations() const { return 16; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
 
@@ -801,7 +834,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return (i==0)?9:1; }
 
    unsigned int GetNumberTransformations() const { return 8; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
 
@@ -860,7 +893,7 @@ public:
    }
 
    unsigned int GetNumberTransformations() const { return 8; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    mfem::Mesh * GetWignerSeitzMesh(bool fdMesh = true) const;
    mfem::Mesh * GetPeriodicWignerSeitzMesh(bool fdMesh = true) const;
@@ -892,7 +925,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return (i==0)?11:1; }
 
    unsigned int GetNumberTransformations() const { return 8; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    mfem::Mesh * GetWignerSeitzMesh(bool fdMesh = true) const;
    mfem::Mesh * GetPeriodicWignerSeitzMesh(bool fdMesh = true) const;
@@ -934,7 +967,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return (i==0)?11:1; }
 
    unsigned int GetNumberTransformations() const { return 8; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
 
@@ -974,7 +1007,7 @@ public:
    virtual unsigned int GetNumberPathSegments(int i)  { return (i==0)?7:1; }
 
    unsigned int GetNumberTransformations() const { return 24; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
 
@@ -1053,7 +1086,7 @@ public:
    { return (i==0)?8:((i==1)?2:1); }
 
    unsigned int GetNumberTransformations() const { return 4; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
 
@@ -1136,7 +1169,7 @@ public:
    { return (i < 4) ? 2 : 1; }
 
    unsigned int GetNumberTransformations() const { return 2; }
-   const DenseMatrix & GetTransformation(int ti) const;
+   void ComputeTransformation(int ti, DenseMatrix & T) const;
 
    virtual mfem::Mesh * GetFundamentalDomainMesh() const;
 
@@ -1428,6 +1461,117 @@ public:
                      mfem::miniapps::RT_ParFESpace & fes);
 };
 
+/// VectorFourierProjector computes the Fourier coefficients of vector
+/// fields in an H(Curl) or H(Div) space for every mode with |n_i| <= nmax
+/// at once.  The projections of all the fields onto all the modes are
+/// accumulated in a single pass over the elements, with the phase factors
+/// of each mode built by recurrence from those of the reciprocal vectors,
+/// followed by a single MPI_Allreduce.  The test vectors of the modes are
+/// never formed so the memory does not grow with the product of the number
+/// of dofs and the number of modes.
+///
+/// The coefficients are returned in dense arrays whose rows are
+/// 3 * GetModeIndex(n0,n1,n2) + component and whose columns correspond
+/// to the columns of the input.  As in VectorFourierSeries the real part
+/// is the projection onto cos(k.x) and the imaginary part the projection
+/// onto -sin(k.x), both divided by the unit cell volume.
+///
+class VectorFourierProjector
+{
+public:
+   VectorFourierProjector(const BravaisLattice & bravais,
+                          ParFiniteElementSpace & fes, int nmax);
+
+   int GetNMax() const { return n_; }
+   int GetNumModes() const { return nm_; }
+
+   int GetModeIndex(int n0, int n1 = 0, int n2 = 0) const
+   {
+      return ((n0 + nmax_[0]) * w_[1] + n1 + nmax_[1]) * w_[2] + n2 + nmax_[2];
+   }
+   void GetModeIndices(int m, int & n0, int & n1, int & n2) const;
+
+   /// Projects the true vectors stored in the columns of X
+   void Project(const DenseMatrix & X, DenseMatrix & a_r, DenseMatrix & a_i);
+
+private:
+   // Local, unreduced projections C of the local vectors in the columns of
+   // Y, the first 3 nm_ rows hold the cosine modes and the remaining 3 nm_
+   // rows the negated sine modes
+   void accumulate(const DenseMatrix & Y, DenseMatrix & C) const;
+
+   ParFiniteElementSpace * fes_;
+   std::vector<Vector>     rec_vecs_;
+
+   int    n_;
+   int    nmax_[3];
+   int    w_[3];
+   int    nm_;
+   double vol_;
+};
+
+/// BrillouinZoneMesh samples the full first Brillouin zone on a uniform,
+/// Gamma-centered grid of n points along each reciprocal lattice vector.
+/// Grid points related by one of the point group operations of the
+/// lattice, or by time reversal (k -> -k), share their Bloch eigenvalues
+/// so only one representative of each orbit, the irreducible points,
+/// needs to be solved.  Each irreducible point carries the size of its
+/// orbit as a multiplicity so that zone averages can be formed from the
+/// irreducible points alone.
+///
+/// Band data on the irreducible points is passed as a DenseMatrix with
+/// one row per irreducible point and one column per band.  The density
+/// of states is computed with the linear tetrahedron method on the full
+/// grid, each grid cell being split into dim! simplices, and is
+/// normalized so that each band integrates to one.
+///
+class BrillouinZoneMesh
+{
+public:
+   BrillouinZoneMesh(const BravaisLattice & bravais, int n);
+
+   int GetNumberDivisions() const { return n_; }
+   int GetNumberPoints() const { return full2irr_.Size(); }
+   int GetNumberIrreduciblePoints() const { return mult_.Size(); }
+
+   /// Returns the phase shift vector (including the factor of 2 pi) of
+   /// irreducible point i, translated to lie near the zone center.
+   void GetIrreduciblePoint(int i, Vector & kappa) const;
+
+   int    GetMultiplicity(int i) const { return mult_[i]; }
+   double GetWeight(int i) const
+   { return (double)mult_[i] / full2irr_.Size(); }
+
+   /// Index of the irreducible point equivalent to full grid point j
+   int GetIrreducibleIndex(int j) const { return full2irr_[j]; }
+
+   /// The extreme values of a band over the sampled points.  Since the
+   /// true extrema may fall between grid points the interval
+   /// [hi(b), lo(b+1)] contains any true gap between bands b and b+1.
+   void GetBandEdges(const DenseMatrix & bands, int b,
+                     double & lo, double & hi) const;
+
+   /// Density of states in dos.Size() equal bins spanning [wmin, wmax]
+   void GetDensityOfStates(const DenseMatrix & bands,
+                           double wmin, double wmax, Vector & dos) const;
+
+private:
+   int fullIndex(const int * m) const;
+
+   static double simplexFraction(int dim, const double * e, double w);
+
+   int dim_;
+   int n_;
+
+   std::vector<Vector> rec_vecs_;
+
+   Array<int> full2irr_; // Irreducible index of each full grid point
+   Array<int> irr2full_; // Representative full grid point of each orbit
+   Array<int> mult_;     // Orbit sizes
+
+   // Full grid vertices of the simplices, dim_ + 1 per simplex
+   Array<int> simplices_;
+};
 
 void
 MergeMeshNodes(Mesh * mesh, int logging = 0);
@@ -1436,6 +1580,155 @@ Mesh *
 MakePeriodicMesh(Mesh * mesh, const std::vector<Vector> & trans_vecs,
                  int logging = 0);
 
+/// Partitions a coarse serial mesh and refines it to sr + pr levels.  Only
+/// the serial refinements needed to give each processor at least min_elems
+/// elements are performed before partitioning, the remaining levels are
+/// performed in parallel.  Converts to a nonconforming mesh when nc is true.
+/// The serial mesh is deleted.
+ParMesh *
+DistributeMesh(MPI_Comm comm, Mesh * mesh, int sr, int pr, bool nc = false,
+               int min_elems = 8, int logging = 0);
+
+/** A content addressed on-disk cache of Wigner-Seitz meshes.
+
+    Each mesh is stored in its own file, "<dir>/mesh-<key>.bin", where the
+    key is a hash of the lattice type, the lattice vectors, the number of
+    uniform refinements and whether or not the mesh is periodic.  The file
+    begins with a Header repeating these fields, to guard against hash
+    collisions, followed by:
+
+      double   : nv * sdim vertex coordinates
+      int      : ne elements, each stored as geometry, attribute and vertices
+      int      : nbe boundary elements stored in the same way
+      double   : the nodal coordinates, when the mesh has nodes
+
+    Processor 0 generates and writes missing entries, all processors then
+    read the same file.  Files are written under a temporary name and
+    renamed so that concurrent runs never see a partial entry.  An empty
+    directory name disables the cache.
+*/
+class LatticeMeshCache
+{
+public:
+   struct Header
+   {
+      char   magic[8];
+      int    version;
+      int    lattice_type;
+      int    dim;
+      int    sdim;
+      double lattice_vecs[9];
+      int    ref_levels;
+      int    periodic;
+      int    nv;
+      int    ne;
+      int    nbe;
+      int    nodes_order;
+      int    nodes_discont;
+      int    nodes_ordering;
+      int    nodes_size;
+      int    pad;
+   };
+
+   LatticeMeshCache(MPI_Comm comm, const std::string & dir, int logging = 0);
+
+   /** Collectively return a new Wigner-Seitz mesh of bl refined uniformly
+       ref_levels times.  The mesh is read from the cache when possible,
+       otherwise the most refined cached ancestor, or a newly generated
+       coarse mesh, is refined and the result is stored. */
+   Mesh * GetWignerSeitzMesh(const BravaisLattice & bl, int ref_levels,
+                             bool periodic = true);
+
+   std::string GetFileName(const BravaisLattice & bl, int ref_levels,
+                           bool periodic) const;
+
+   static void WriteMesh(const std::string & fname, const Header & hdr,
+                         const Mesh & mesh);
+
+   /// Returns NULL if the file is missing or does not match hdr
+   static Mesh * ReadMesh(const std::string & fname, const Header & hdr);
+
+private:
+   void initHeader(const BravaisLattice & bl, int ref_levels, bool periodic,
+                   Header & hdr) const;
+
+   /// Collectively read an entry, NULL if it has not been cached
+   Mesh * readEntry(const BravaisLattice & bl, int ref_levels, bool periodic);
+
+   /// Called on processor 0 only
+   void writeEntry(const BravaisLattice & bl, int ref_levels, bool periodic,
+                   const Mesh & mesh);
+
+   MPI_Comm comm_;
+   int myid_;
+   int logging_;
+
+   std::string dir_;
+};
+
+/// Partitions the lattice mesh as above, reading the coarse mesh, refined
+/// as far as needed before partitioning, from the cache
+ParMesh *
+DistributeMesh(MPI_Comm comm, LatticeMeshCache & cache,
+               const BravaisLattice & bl, int sr, int pr, bool periodic = true,
+               bool nc = false, int min_elems = 8, int logging = 0);
+
+/** Moves the vertices and nodes of a mesh of the lattice bl0 so that it
+    becomes a mesh of the lattice bl1, avoiding a remesh during parameter
+    sweeps.  The linear map taking the lattice vectors of bl0 onto those of
+    bl1 also maps lattice translations onto lattice translations so a
+    periodic mesh stays periodic and its topology, partitioning and dof
+    numbering are unchanged.  The result is a primitive cell of bl1 which
+    approximates, rather than equals, its Wigner-Seitz cell.
+
+    The mesh is only moved, and true returned, when both lattices share a
+    type, label and number of translation vectors, i.e. the same cell
+    shape class.  Otherwise the caller should build a new mesh. */
+bool
+MorphLatticeMesh(const BravaisLattice & bl0, const BravaisLattice & bl1,
+                 Mesh & mesh);
+
+/** A pool of temporary vectors and grid functions tied to a single
+    ParFiniteElementSpace.  The partitionings of vectors holding one or more
+    true dof vectors per processor are computed once and the pooled objects
+    are reused between calls.  Call Update() after the space has been
+    updated.
+*/
+class ParFESpaceWorkspace
+{
+public:
+   ParFESpaceWorkspace(ParFiniteElementSpace & fes);
+   ~ParFESpaceWorkspace();
+
+   ParFiniteElementSpace * GetFESpace() { return fes_; }
+
+   /// Partitioning of vectors holding nblk true dof vectors per processor
+   HYPRE_Int * GetPartitioning(int nblk = 1);
+   HYPRE_Int   GetGlobalSize(int nblk = 1);
+
+   /// The i-th pooled vector holding nblk true dof vectors
+   HypreParVector & GetTrueVector(int i, int nblk = 1);
+
+   /// The i-th pooled true dof vector which owns no data (see SetData)
+   HypreParVector & GetTrueVectorView(int i);
+
+   /// The i-th pooled grid function
+   ParGridFunction & GetGridFunction(int i);
+
+   /// Release the pooled objects and partitionings
+   void Update();
+
+private:
+   ParFiniteElementSpace * fes_;
+
+   std::map<int, HYPRE_Int*> part_;
+   std::map<int, HYPRE_Int>  glb_;
+
+   std::map<int, std::vector<HypreParVector*> > vecs_;
+   std::vector<HypreParVector*>  views_;
+   std::vector<ParGridFunction*> gfs_;
+};
+
 class LatticeCoefficient : public Coefficient
 {
 public:
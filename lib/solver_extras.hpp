@@ -0,0 +1,41 @@
+// Copyright (c) 2010, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-443211. All Rights
+// reserved. See file COPYRIGHT for details.
+//
+// This file is part of the MFEM library. For more information and source code
+// availability see http://mfem.org.
+//
+// MFEM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU Lesser General Public License (as published by the Free
+// Software Foundation) version 2.1 dated February 1999.
+
+#ifndef MFEM_SOLVER_EXTRAS
+#define MFEM_SOLVER_EXTRAS
+
+namespace mfem
+{
+
+namespace miniapps
+{
+
+/** Solvers which keep a preconditioner hierarchy, e.g. a BoomerAMG built
+    for an earlier matrix, while the matrix changes compare the iterations
+    of each solve to those of the first solve after the hierarchy was
+    built.  The hierarchy is considered stale, and should be rebuilt, once
+    a solve needs more than StaleIterationFactor times as many iterations
+    plus StaleIterationSlack.  The slack keeps the small iteration counts of
+    easy solves from triggering rebuilds. */
+const int StaleIterationFactor = 2;
+const int StaleIterationSlack  = 5;
+
+inline bool
+PreconditionerIsStale(int its, int fresh_its)
+{
+   return its > StaleIterationFactor * fresh_its + StaleIterationSlack;
+}
+
+} // namespace miniapps
+
+} // namespace mfem
+
+#endif // MFEM_SOLVER_EXTRAS
@@ -14,7 +14,15 @@
 #ifdef MFEM_USE_MPI
 
 #include "maxwell_bloch.hpp"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 /*
 extern "C" {
 #include "evsl.h"
@@ -31,21 +39,100 @@ using namespace miniapps;
 namespace bloch
 {
 
+// Degree of the single precision Chebyshev polynomial used in place of AMS
+// for the S1 blocks
+static const int SinglePrecisionS1Order = 4;
+
+// Approximate storage, in bytes, of the local part of a ParCSR matrix
+static size_t
+ParCSRMatrixBytes(hypre_ParCSRMatrix * A)
+{
+   if ( A == NULL ) { return 0; }
+
+   hypre_CSRMatrix * diag = hypre_ParCSRMatrixDiag(A);
+   hypre_CSRMatrix * offd = hypre_ParCSRMatrixOffd(A);
+
+   size_t nnz   = hypre_CSRMatrixNumNonzeros(diag) +
+                  hypre_CSRMatrixNumNonzeros(offd);
+   size_t nrows = hypre_CSRMatrixNumRows(diag);
+   size_t ncols = hypre_CSRMatrixNumCols(offd);
+
+   return nnz * (sizeof(double) + sizeof(HYPRE_Int)) +
+          2 * (nrows + 1) * sizeof(HYPRE_Int) + ncols * sizeof(HYPRE_Int);
+}
+
+static size_t
+HypreParMatrixBytes(const HypreParMatrix * A)
+{
+   if ( A == NULL ) { return 0; }
+   return ParCSRMatrixBytes((hypre_ParCSRMatrix*)
+                            *const_cast<HypreParMatrix*>(A));
+}
+
+// Coarse level operators and interpolation matrices of a BoomerAMG
+// hierarchy.  Returns zero if the hierarchy has not yet been set up.
+static size_t
+BoomerAMGBytes(HYPRE_Solver solver)
+{
+   if ( solver == NULL ) { return 0; }
+
+   hypre_ParAMGData * amg = (hypre_ParAMGData*)solver;
+
+   int nlev = hypre_ParAMGDataNumLevels(amg);
+   hypre_ParCSRMatrix ** A = hypre_ParAMGDataAArray(amg);
+   hypre_ParCSRMatrix ** P = hypre_ParAMGDataPArray(amg);
+
+   if ( A == NULL || P == NULL ) { return 0; }
+
+   size_t bytes = 0;
+   for (int l=1; l<nlev; l++) { bytes += ParCSRMatrixBytes(A[l]); }
+   for (int l=0; l<nlev-1; l++) { bytes += ParCSRMatrixBytes(P[l]); }
+   return bytes;
+}
+
+// Auxiliary operators and sub-space hierarchies of an AMS solver
+static size_t
+AMSBytes(HYPRE_Solver solver)
+{
+   if ( solver == NULL ) { return 0; }
+
+   hypre_AMSData * ams = (hypre_AMSData*)solver;
+
+   return ParCSRMatrixBytes(ams->Pi) +
+          ParCSRMatrixBytes(ams->A_G) + ParCSRMatrixBytes(ams->A_Pi) +
+          BoomerAMGBytes(ams->B_G) + BoomerAMGBytes(ams->B_Pi);
+}
+
 MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
-                                                   int order)
+                                                   int order,
+                                                   bool lowMemory)
    : myid_(0),
+     order_(order),
+     hdiv_loc_size_(0),
      nev_(-1),
+     lowMemory_(lowMemory),
+     newAvgs_(true),
+     newAvgVals_(true),
      // newAlpha_(true),
      newBeta_(true),
      newZeta_(true),
      newOmega_(true),
      newMCoef_(true),
      newKCoef_(true),
+     singlePrec_(false),
+     adaptiveProj_(false),
+     partialAssembly_(false),
+     lowOrderPrec_(false),
+     mgMesh_(NULL),
+     mgRef_(0),
      pmesh_(&pmesh),
      H1FESpace_(NULL),
      HCurlFESpace_(NULL),
      HDivFESpace_(NULL),
      L2FESpace_(NULL),
+     hcurlWS_(NULL),
+     hdivWS_(NULL),
+     writer_(NULL),
      bravais_(NULL),
      fourierHCurl_(NULL),
      // alpha_a_(0.0),
@@ -60,6 +147,7 @@ MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
      A_(NULL),
      M_(NULL),
      C_(NULL),
+     APA_(NULL),
      blkHCurl_(NULL),
      blkHDiv_(NULL),
      M1_(NULL),
@@ -71,6 +159,9 @@ MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
      DKZ_(NULL),
      DKZT_(NULL),
      T1Inv_(NULL),
+     T1InvSP_(NULL),
+     T1InvMG_(NULL),
+     T1InvLO_(NULL),
      Curl_(NULL),
      Zeta_(NULL),
      BDP_(NULL),
@@ -82,7 +173,8 @@ MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
      vec0_(NULL),
      lobpcg_(NULL),
      ame_(NULL),
-     energy_(NULL)/*,
+     energy_(NULL),
+     avgAsm_(NULL)/*,
      B_(NULL),
      minres_(NULL),
      gmres_(NULL),
@@ -102,13 +194,21 @@ MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
 
    zeta_.SetSize(dim);
 
-   H1FESpace_    = new H1_ParFESpace(&pmesh,order,dim);
+   for (int i=0; i<3; i++)
+   {
+      AvgHCurl_coskx_[i] = NULL; AvgHCurl_sinkx_[i] = NULL;
+      AvgHDiv_coskx_[i]  = NULL; AvgHDiv_sinkx_[i]  = NULL;
+
+      AvgHCurl_eps_coskx_[i]   = NULL; AvgHCurl_eps_sinkx_[i]   = NULL;
+      AvgHDiv_muInv_coskx_[i]  = NULL; AvgHDiv_muInv_sinkx_[i]  = NULL;
+   }
+
    HCurlFESpace_ = new ND_ParFESpace(&pmesh,order,dim);
-   HDivFESpace_  = new RT_ParFESpace(&pmesh,order,dim);
-   L2FESpace_    = new L2_ParFESpace(&pmesh,0,dim);
+   hcurlWS_      = new ParFESpaceWorkspace(*HCurlFESpace_);
 
    hcurl_loc_size_ = HCurlFESpace_->TrueVSize();
-   hdiv_loc_size_  = HDivFESpace_->TrueVSize();
+
+   // The H1 and H(Div) spaces are built when first needed
 
    block_offsets_.SetSize(3);
    block_offsets_[0] = 0;
@@ -122,12 +222,6 @@ MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
    block_trueOffsets_[2] = HCurlFESpace_->TrueVSize();
    block_trueOffsets_.PartialSum();
 
-   block_trueOffsets2_.SetSize(3);
-   block_trueOffsets2_[0] = 0;
-   block_trueOffsets2_[1] = HDivFESpace_->TrueVSize();
-   block_trueOffsets2_[2] = HDivFESpace_->TrueVSize();
-   block_trueOffsets2_.PartialSum();
-
    tdof_offsets_.SetSize(HCurlFESpace_->GetNRanks()+1);
    HYPRE_Int * hcurl_tdof_offsets = HCurlFESpace_->GetTrueDofOffsets();
    for (int i=0; i<tdof_offsets_.Size(); i++)
@@ -135,8 +229,10 @@ MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
       tdof_offsets_[i] = 2 * hcurl_tdof_offsets[i];
    }
 
-   blkHCurl_ = new BlockVector(block_trueOffsets_);
-   blkHDiv_  = new BlockVector(block_trueOffsets2_);
+   if ( !lowMemory_ )
+   {
+      blkHCurl_ = new BlockVector(block_trueOffsets_);
+   }
 }
 
 MaxwellBlochWaveEquation::~MaxwellBlochWaveEquation()
@@ -163,8 +259,13 @@ MaxwellBlochWaveEquation::~MaxwellBlochWaveEquation()
    delete A_;
    delete M_;
    delete C_;
+   delete APA_;
    delete BDP_;
    delete T1Inv_;
+   delete T1InvSP_;
+   delete T1InvMG_;
+   delete T1InvLO_;
+   delete avgAsm_;
 
    delete M1_;
    delete M2_;
@@ -179,6 +280,9 @@ MaxwellBlochWaveEquation::~MaxwellBlochWaveEquation()
 
    delete fourierHCurl_;
 
+   delete hcurlWS_;
+   delete hdivWS_;
+
    delete H1FESpace_;
    delete HCurlFESpace_;
    delete HDivFESpace_;
@@ -194,9 +298,37 @@ MaxwellBlochWaveEquation::~MaxwellBlochWaveEquation()
 
       delete AvgHCurl_eps_coskx_[i];
       delete AvgHCurl_eps_sinkx_[i];
+
+      delete AvgHDiv_muInv_coskx_[i];
+      delete AvgHDiv_muInv_sinkx_[i];
    }
 }
 
+void
+MaxwellBlochWaveEquation::buildH1FESpace()
+{
+   if ( H1FESpace_ != NULL ) { return; }
+
+   H1FESpace_ = new H1_ParFESpace(pmesh_,order_,pmesh_->Dimension());
+}
+
+void
+MaxwellBlochWaveEquation::buildHDivFESpace()
+{
+   if ( HDivFESpace_ != NULL ) { return; }
+
+   HDivFESpace_ = new RT_ParFESpace(pmesh_,order_,pmesh_->Dimension());
+   hdivWS_      = new ParFESpaceWorkspace(*HDivFESpace_);
+
+   hdiv_loc_size_ = HDivFESpace_->TrueVSize();
+
+   block_trueOffsets2_.SetSize(3);
+   block_trueOffsets2_[0] = 0;
+   block_trueOffsets2_[1] = HDivFESpace_->TrueVSize();
+   block_trueOffsets2_[2] = HDivFESpace_->TrueVSize();
+   block_trueOffsets2_.PartialSum();
+}
+
 void
 MaxwellBlochWaveEquation::SetKappa(const Vector & kappa)
 {
@@ -208,75 +340,45 @@ MaxwellBlochWaveEquation::SetKappa(const Vector & kappa)
       zeta_ /= beta_;
    }
 
-   RealPhaseCoefficient rpc; rpc.SetKappa(kappa_);
-   ImagPhaseCoefficient ipc; ipc.SetKappa(kappa_);
+   // The field averages are only assembled when they are requested
+   newAvgs_ = true;
+   newAvgVals_ = true;
+}
 
-   ProductCoefficient eps_rpc(*mCoef_, rpc);
-   ProductCoefficient eps_ipc(*mCoef_, ipc);
+void
+MaxwellBlochWaveEquation::assembleAverages()
+{
+   if ( !newAvgs_ ) { return; }
 
-   ProductCoefficient muInv_rpc(*kCoef_, rpc);
-   ProductCoefficient muInv_ipc(*kCoef_, ipc);
+   this->buildHDivFESpace();
 
    for (int i=0; i<3; i++)
    {
-      Vector v(3); v = 0.0; v[i] = 1.0;
-      VectorConstantCoefficient vc(v);
-
-      VectorFunctionCoefficient rpvc(v, rpc);
-      VectorFunctionCoefficient ipvc(v, ipc);
-
-      VectorFunctionCoefficient eps_rpvc(v, eps_rpc);
-      VectorFunctionCoefficient eps_ipvc(v, eps_ipc);
-
-      VectorFunctionCoefficient muInv_rpvc(v, muInv_rpc);
-      VectorFunctionCoefficient muInv_ipvc(v, muInv_ipc);
-
-      ParLinearForm avgHCurl_coskx(HCurlFESpace_);
-      avgHCurl_coskx.AddDomainIntegrator(
-         new VectorFEDomainLFIntegrator(rpvc));
-      avgHCurl_coskx.Assemble();
-      AvgHCurl_coskx_[i] = avgHCurl_coskx.ParallelAssemble();
-
-      ParLinearForm avgHCurl_sinkx(HCurlFESpace_);
-      avgHCurl_sinkx.AddDomainIntegrator(
-         new VectorFEDomainLFIntegrator(ipvc));
-      avgHCurl_sinkx.Assemble();
-      AvgHCurl_sinkx_[i] = avgHCurl_sinkx.ParallelAssemble();
-
-      ParLinearForm avgHCurl_eps_coskx(HCurlFESpace_);
-      avgHCurl_eps_coskx.AddDomainIntegrator(
-         new VectorFEDomainLFIntegrator(eps_rpvc));
-      avgHCurl_eps_coskx.Assemble();
-      AvgHCurl_eps_coskx_[i] = avgHCurl_eps_coskx.ParallelAssemble();
-
-      ParLinearForm avgHCurl_eps_sinkx(HCurlFESpace_);
-      avgHCurl_eps_sinkx.AddDomainIntegrator(
-         new VectorFEDomainLFIntegrator(eps_ipvc));
-      avgHCurl_eps_sinkx.Assemble();
-      AvgHCurl_eps_sinkx_[i] = avgHCurl_eps_sinkx.ParallelAssemble();
-
-      ParLinearForm avgHDiv_coskx(HDivFESpace_);
-      avgHDiv_coskx.AddDomainIntegrator(new VectorFEDomainLFIntegrator(rpvc));
-      avgHDiv_coskx.Assemble();
-      AvgHDiv_coskx_[i] = avgHDiv_coskx.ParallelAssemble();
+      delete AvgHCurl_coskx_[i];
+      delete AvgHCurl_sinkx_[i];
+      delete AvgHDiv_coskx_[i];
+      delete AvgHDiv_sinkx_[i];
+      delete AvgHCurl_eps_coskx_[i];
+      delete AvgHCurl_eps_sinkx_[i];
+      delete AvgHDiv_muInv_coskx_[i];
+      delete AvgHDiv_muInv_sinkx_[i];
+   }
 
-      ParLinearForm avgHDiv_sinkx(HDivFESpace_);
-      avgHDiv_sinkx.AddDomainIntegrator(new VectorFEDomainLFIntegrator(ipvc));
-      avgHDiv_sinkx.Assemble();
-      AvgHDiv_sinkx_[i] = avgHDiv_sinkx.ParallelAssemble();
+   if ( avgAsm_ == NULL )
+   {
+      avgAsm_ = new PhaseAverageAssembler(*HCurlFESpace_, *HDivFESpace_,
+                                          *mCoef_, *kCoef_);
+   }
 
-      ParLinearForm avgHDiv_muInv_coskx(HDivFESpace_);
-      avgHDiv_muInv_coskx.AddDomainIntegrator(
-         new VectorFEDomainLFIntegrator(muInv_rpvc));
-      avgHDiv_muInv_coskx.Assemble();
-      AvgHDiv_muInv_coskx_[i] = avgHDiv_muInv_coskx.ParallelAssemble();
+   HypreParVector ** hcurl[4] = { AvgHCurl_coskx_, AvgHCurl_sinkx_,
+                                  AvgHCurl_eps_coskx_, AvgHCurl_eps_sinkx_
+                                };
+   HypreParVector ** hdiv[4]  = { AvgHDiv_coskx_, AvgHDiv_sinkx_,
+                                  AvgHDiv_muInv_coskx_, AvgHDiv_muInv_sinkx_
+                                };
+   avgAsm_->Assemble(kappa_, hcurl, hdiv);
 
-      ParLinearForm avgHDiv_muInv_sinkx(HDivFESpace_);
-      avgHDiv_muInv_sinkx.AddDomainIntegrator(
-         new VectorFEDomainLFIntegrator(muInv_ipvc));
-      avgHDiv_muInv_sinkx.Assemble();
-      AvgHDiv_muInv_sinkx_[i] = avgHDiv_muInv_sinkx.ParallelAssemble();
-   }
+   newAvgs_ = false;
 }
 
 void
@@ -325,13 +427,61 @@ MaxwellBlochWaveEquation::SetNumEigs(int nev)
 void
 MaxwellBlochWaveEquation::SetMassCoef(Coefficient & m)
 {
-   mCoef_ = &m; newMCoef_ = true;
+   mCoef_ = &m; newMCoef_ = true; newAvgs_ = true; newAvgVals_ = true;
+   delete avgAsm_; avgAsm_ = NULL;
 }
 
 void
 MaxwellBlochWaveEquation::SetStiffnessCoef(Coefficient & k)
 {
-   kCoef_ = &k; newKCoef_ = true;
+   kCoef_ = &k; newKCoef_ = true; newAvgs_ = true; newAvgVals_ = true;
+   delete avgAsm_; avgAsm_ = NULL;
+}
+
+void
+MaxwellBlochWaveEquation::SetSinglePrecisionPreconditioner(bool sp)
+{
+   if ( sp != singlePrec_ )
+   {
+      // Force the preconditioners to be rebuilt
+      singlePrec_ = sp; newKCoef_ = true;
+   }
+}
+
+void
+MaxwellBlochWaveEquation::SetLowOrderPreconditioner(bool lo)
+{
+   if ( lo != lowOrderPrec_ )
+   {
+      // Force the preconditioners to be rebuilt
+      lowOrderPrec_ = lo; newKCoef_ = true;
+   }
+}
+
+void
+MaxwellBlochWaveEquation::SetPartialAssembly(bool pa)
+{
+   if ( pa != partialAssembly_ )
+   {
+      partialAssembly_ = pa;
+      if ( !pa )
+      {
+         delete APA_; APA_ = NULL;
+      }
+      // Force every operator to be rebuilt in the new mode
+      newZeta_ = true; newMCoef_ = true; newKCoef_ = true;
+   }
+}
+
+void
+MaxwellBlochWaveEquation::SetMultigrid(ParMesh & coarse_mesh, int num_ref)
+{
+   mgMesh_ = &coarse_mesh;
+   mgRef_  = num_ref;
+
+   // Force the preconditioners to be rebuilt
+   delete T1InvMG_; T1InvMG_ = NULL;
+   newKCoef_ = true;
 }
 
 void
@@ -361,7 +511,13 @@ MaxwellBlochWaveEquation::Setup()
        zeta_.Print(cout);
     }
    */
-   if ( newKCoef_ )
+   // With partial assembly H(Div) is only built on demand by
+   // buildCOperator
+   if ( !partialAssembly_ ) { this->buildHDivFESpace(); }
+
+   // M2 only depends upon the stiffness coefficient so it is kept for
+   // every kappa, even in low memory mode
+   if ( !partialAssembly_ && ( newKCoef_ || M2_ == NULL ) )
    {
       if ( myid_ == 0 ) { cout << "Building M2(k)" << endl; }
       ParBilinearForm m2(HDivFESpace_);
@@ -372,27 +528,37 @@ MaxwellBlochWaveEquation::Setup()
       M2_ = m2.ParallelAssemble();
    }
 
-   if ( newZeta_ )
+   // In low memory mode Zeta and Z12 are released after S1 has been formed
+   if ( !partialAssembly_ &&
+        ( newZeta_ || ( Z12_ == NULL && ( newBeta_ || newKCoef_ ) ) ) )
    {
-      if ( myid_ == 0 ) { cout << "Building zeta cross operator" << endl; }
-      delete Zeta_;
-      Zeta_ = new ParDiscreteVectorCrossProductOperator(HCurlFESpace_,
-                                                        HDivFESpace_,zeta_);
-      Zeta_->Assemble();
-      Zeta_->Finalize();
+      if ( newZeta_ || Zeta_ == NULL )
+      {
+         if ( myid_ == 0 ) { cout << "Building zeta cross operator" << endl; }
+         delete Zeta_;
+         Zeta_ = new ParDiscreteVectorCrossProductOperator(HCurlFESpace_,
+                                                           HDivFESpace_,
+                                                           zeta_);
+         Zeta_->Assemble();
+         Zeta_->Finalize();
+      }
+      delete Z12_;
       Z12_ = Zeta_->ParallelAssemble();
    }
 
-   if ( Curl_ == NULL )
+   if ( T12_ == NULL && !partialAssembly_ )
    {
-      if ( myid_ == 0 ) { cout << "Building Curl operator" << endl; }
-      Curl_ = new ParDiscreteCurlOperator(HCurlFESpace_,HDivFESpace_);
-      Curl_->Assemble();
-      Curl_->Finalize();
+      if ( Curl_ == NULL )
+      {
+         if ( myid_ == 0 ) { cout << "Building Curl operator" << endl; }
+         Curl_ = new ParDiscreteCurlOperator(HCurlFESpace_,HDivFESpace_);
+         Curl_->Assemble();
+         Curl_->Finalize();
+      }
       T12_ = Curl_->ParallelAssemble();
    }
 
-   if ( newZeta_ || newBeta_ || newKCoef_ )
+   if ( ( newZeta_ || newBeta_ || newKCoef_ ) && !partialAssembly_ )
    {
       if ( myid_ == 0 ) { cout << "Forming CMC" << endl; }
       HypreParMatrix * CMC = RAP(M2_,T12_);
@@ -422,6 +588,21 @@ MaxwellBlochWaveEquation::Setup()
       {
          S1_ = CMC;
       }
+
+      if ( lowMemory_ )
+      {
+         // Only the assembled T12 is needed for the next kappa.  The curl
+         // operator C depends upon Z12 so it must be rebuilt too.
+         delete C_;    C_    = NULL;
+         delete Z12_;  Z12_  = NULL;
+         delete Zeta_; Zeta_ = NULL;
+         delete Curl_; Curl_ = NULL;
+      }
+   }
+
+   if ( partialAssembly_ )
+   {
+      this->buildPAOperators();
    }
 
    if ( newMCoef_ )
@@ -444,7 +625,8 @@ MaxwellBlochWaveEquation::Setup()
       }
       A_->SetDiagonalBlock(0,S1_);
       A_->SetDiagonalBlock(1,S1_);
-      if ( fabs(beta_) > 0.0 )
+      // With partial assembly D is only applied through APA_
+      if ( fabs(beta_) > 0.0 && !partialAssembly_ )
       {
          // A_->SetBlock(0,1,DKZ_, beta_*M_PI/(180.0*a_));
          // A_->SetBlock(1,0,DKZ_,-beta_*M_PI/(180.0*a_));
@@ -468,32 +650,60 @@ MaxwellBlochWaveEquation::Setup()
       M_->owns_blocks = 0;
    }
 
-   if ( newZeta_ || newBeta_ )
+   if ( ( newZeta_ || newBeta_ ) && !lowMemory_ && !partialAssembly_ )
    {
-      if ( C_ == NULL )
-      {
-         if ( myid_ == 0 ) { cout << "Building Block C" << endl; }
-         C_ = new BlockOperator(block_trueOffsets2_, block_trueOffsets_);
-      }
-      C_->SetDiagonalBlock(0, T12_);
-      C_->SetDiagonalBlock(1, T12_);
-      if ( fabs(beta_) > 0.0 )
-      {
-         // C_->SetBlock(0,1,Zeta_->ParallelAssemble(), beta_*M_PI/(180.0*a_));
-         // C_->SetBlock(1,0,Zeta_->ParallelAssemble(),-beta_*M_PI/(180.0*a_));
-         // C_->SetBlock(0,1,Zeta_->ParallelAssemble(), beta_/a_);
-         // C_->SetBlock(1,0,Zeta_->ParallelAssemble(),-beta_/a_);
-         C_->SetBlock(0,1,Z12_, beta_);
-         C_->SetBlock(1,0,Z12_,-beta_);
-      }
-      C_->owns_blocks = 0;
+      this->buildCOperator();
    }
 
    if ( newZeta_ || newBeta_ || newKCoef_ )
    {
       if ( myid_ == 0 ) { cout << "Building T1Inv" << endl; }
-      delete T1Inv_;
-      if ( fabs(beta_*180.0) < M_PI )
+      delete T1Inv_;   T1Inv_   = NULL;
+      delete T1InvSP_; T1InvSP_ = NULL;
+      if ( singlePrec_ && fabs(beta_) > 0.0 )
+      {
+         // The AME solver used when beta == 0 requires a HypreSolver
+         T1InvSP_ = new SinglePrecisionChebyshev(*S1_,
+                                              SinglePrecisionS1Order);
+      }
+      else if ( mgMesh_ != NULL && fabs(beta_) > 0.0 )
+      {
+         // The hierarchy is kept for every kappa, only its operators change
+         if ( T1InvMG_ == NULL )
+         {
+            if ( myid_ == 0 )
+            {
+               cout << "Building multigrid hierarchy" << endl;
+            }
+            T1InvMG_ = new HCurlMultigrid(*mgMesh_, mgRef_, order_,
+                                          *HCurlFESpace_);
+         }
+         T1InvMG_->SetSingularProblem(fabs(beta_*180.0) < M_PI);
+         T1InvMG_->SetOperator(*S1_);
+      }
+      else if ( lowOrderPrec_ && order_ > 1 && fabs(beta_) > 0.0 )
+      {
+         // The lowest order space and prolongation are kept for every kappa
+         if ( T1InvLO_ == NULL )
+         {
+            if ( myid_ == 0 )
+            {
+               cout << "Building low order preconditioner" << endl;
+            }
+            T1InvLO_ = new HCurlLowOrderSolver(*HCurlFESpace_);
+         }
+         T1InvLO_->SetSingularProblem(fabs(beta_*180.0) < M_PI);
+         T1InvLO_->SetCoefficients(*kCoef_, beta_, zeta_);
+         if ( APA_ )
+         {
+            T1InvLO_->SetOperator(*APA_);
+         }
+         else
+         {
+            T1InvLO_->SetOperator(*S1_);
+         }
+      }
+      else if ( fabs(beta_*180.0) < M_PI )
       {
          cout << "HypreAMS::SetSingularProblem()" << endl;
          T1Inv_ = new HypreAMS(*S1_,HCurlFESpace_);
@@ -507,11 +717,16 @@ MaxwellBlochWaveEquation::Setup()
 
       if ( true || fabs(beta_) > 0.0 )
       {
+         Solver * T1Inv = ( T1InvSP_ ) ? (Solver*)T1InvSP_ :
+                          ( T1Inv_ ) ? (Solver*)T1Inv_ :
+                          ( T1InvMG_ ) ? (Solver*)T1InvMG_ :
+                          (Solver*)T1InvLO_;
+
          if ( myid_ == 0 ) { cout << "Building BDP" << endl; }
          delete BDP_;
          BDP_ = new BlockDiagonalPreconditioner(block_trueOffsets_);
-         BDP_->SetDiagonalBlock(0,T1Inv_);
-         BDP_->SetDiagonalBlock(1,T1Inv_);
+         BDP_->SetDiagonalBlock(0,T1Inv);
+         BDP_->SetDiagonalBlock(1,T1Inv);
          BDP_->owns_blocks = 0;
       }
    }
@@ -520,19 +735,41 @@ MaxwellBlochWaveEquation::Setup()
    {
       if ( fabs(beta_) > 0.0 )
       {
-         delete SubSpaceProj_;
-         if ( myid_ == 0 ) { cout << "Building Subspace Projector" << endl; }
-         SubSpaceProj_ = new MaxwellBlochWaveProjector(//*HDivFESpace_,
-            *HCurlFESpace_,
-            *H1FESpace_,
-            *M_,beta_,zeta_);
+         this->buildH1FESpace();
+
+         if ( SubSpaceProj_ == NULL || newMCoef_ )
+         {
+            delete SubSpaceProj_;
+            if ( myid_ == 0 )
+            {
+               cout << "Building Subspace Projector" << endl;
+            }
+            SubSpaceProj_ = new MaxwellBlochWaveProjector(//*HDivFESpace_,
+               *HCurlFESpace_,
+               *H1FESpace_,
+               *M_,beta_,zeta_);
+         }
+         else
+         {
+            // Reuse the gradient operator and the AMG hierarchy
+            SubSpaceProj_->SetBeta(beta_);
+            if ( newZeta_ ) { SubSpaceProj_->SetZeta(zeta_); }
+         }
+         SubSpaceProj_->SetSinglePrecision(singlePrec_);
          SubSpaceProj_->Setup();
 
+         // The finest level of the multigrid hierarchy shares this gradient
+         if ( T1InvMG_ )
+         {
+            T1InvMG_->SetFineGradient(*SubSpaceProj_->GetGradient());
+         }
+
          if ( myid_ == 0 ) { cout << "Building Preconditioner" << endl; }
          delete Precond_;
-         Precond_ = new MaxwellBlochWavePrecond(*HCurlFESpace_,*BDP_,
+         Precond_ = new MaxwellBlochWavePrecond(*hcurlWS_,*BDP_,
                                                 *SubSpaceProj_,0.5);
          Precond_->SetOperator(*A_);
+         Precond_->SetAdaptiveProjection(adaptiveProj_);
 
          if ( myid_ == 0 ) { cout << "Building HypreLOBPCG solver" << endl; }
          delete lobpcg_;
@@ -546,8 +783,16 @@ MaxwellBlochWaveEquation::Setup()
          lobpcg_->SetPrintLevel(1);
 
          // Set the matrices which define the linear system
+         // M1 is needed by the subspace projector so M is always assembled
          lobpcg_->SetMassMatrix(*this->GetMOperator());
-         lobpcg_->SetOperator(*this->GetAOperator());
+         if ( APA_ )
+         {
+            lobpcg_->SetOperator(*APA_);
+         }
+         else
+         {
+            lobpcg_->SetOperator(*this->GetAOperator());
+         }
          lobpcg_->SetSubSpaceProjector(*this->GetSubSpaceProjector());
 
          if ( false && vecs_ != NULL )
@@ -620,176 +865,271 @@ MaxwellBlochWaveEquation::Setup()
 }
 
 void
-MaxwellBlochWaveEquation::SetInitialVectors(int num_vecs,
-                                            HypreParVector ** vecs)
-{
-   if ( lobpcg_ )
-   {
-      lobpcg_->SetInitialVectors(num_vecs, vecs);
-   }
-}
-
-void MaxwellBlochWaveEquation::Update()
+MaxwellBlochWaveEquation::buildCOperator()
 {
-   if ( myid_ == 0 ) { cout << "Building M2(k)" << endl; }
-   ParBilinearForm m2(HDivFESpace_);
-   m2.AddDomainIntegrator(new VectorFEMassIntegrator(*kCoef_));
-   m2.Assemble();
-   m2.Finalize();
-   delete M2_;
-   M2_ = m2.ParallelAssemble();
+   // With partial assembly the discrete operators are only built here
+   this->buildHDivFESpace();
 
-   if ( Zeta_ )
+   if ( T12_ == NULL )
    {
-      Zeta_->Update();
-      delete Z12_;
-      Z12_ = Zeta_->ParallelAssemble();
-   }
-   if ( Curl_ )
-   {
-      Curl_->Update();
-      delete T12_;
+      if ( Curl_ == NULL )
+      {
+         if ( myid_ == 0 ) { cout << "Building Curl operator" << endl; }
+         Curl_ = new ParDiscreteCurlOperator(HCurlFESpace_,HDivFESpace_);
+         Curl_->Assemble();
+         Curl_->Finalize();
+      }
       T12_ = Curl_->ParallelAssemble();
    }
-
-   if ( myid_ == 0 ) { cout << "Forming CMC" << endl; }
-   HypreParMatrix * CMC = RAP(M2_, T12_);
-
-   delete S1_;
-
-   if ( fabs(beta_) > 0.0 )
+   if ( fabs(beta_) > 0.0 && Zeta_ == NULL )
    {
-      if ( myid_ == 0 ) { cout << "Forming 2nd order operators" << endl; }
-      HypreParMatrix * ZMZ = RAP(M2_,Z12_);
-
-      HypreParMatrix * CMZ = RAP(T12_, M2_, Z12_);
-      HypreParMatrix * ZMC = RAP(Z12_, M2_, T12_);
-
-      *ZMC *= -1.0;
-      delete DKZ_;
-      DKZ_ = ParAdd(CMZ,ZMC);
-      delete CMZ;
-      delete ZMC;
-
-      // *ZMZ *= beta_*beta_*M_PI*M_PI/(32400.0*a_*a_);
-      // *ZMZ *= beta_*beta_/(a_*a_);
-      *ZMZ *= beta_*beta_;
-      S1_ = ParAdd(CMC,ZMZ);
-      delete CMC;
-      delete ZMZ;
+      if ( myid_ == 0 ) { cout << "Building zeta cross operator" << endl; }
+      Zeta_ = new ParDiscreteVectorCrossProductOperator(HCurlFESpace_,
+                                                        HDivFESpace_,zeta_);
+      Zeta_->Assemble();
+      Zeta_->Finalize();
    }
-   else
+   if ( fabs(beta_) > 0.0 && Z12_ == NULL )
    {
-      S1_ = CMC;
+      Z12_ = Zeta_->ParallelAssemble();
    }
 
-   if ( myid_ == 0 ) { cout << "Building M1(m)" << endl; }
-   ParBilinearForm m1(HCurlFESpace_);
-   m1.AddDomainIntegrator(new VectorFEMassIntegrator(*mCoef_));
-   m1.Assemble();
-   m1.Finalize();
-   delete M1_;
-   M1_ = m1.ParallelAssemble();
-
-   if ( myid_ == 0 ) { cout << "Building Block A" << endl; }
-   delete A_;
-   A_ = new BlockOperator(block_trueOffsets_);
-   A_->SetDiagonalBlock(0,S1_);
-   A_->SetDiagonalBlock(1,S1_);
-   if ( fabs(beta_) > 0.0 )
+   if ( C_ == NULL )
    {
-      // A_->SetBlock(0,1,DKZ_,beta_*M_PI/(180.0*a_));
-      // A_->SetBlock(1,0,DKZ_,-beta_*M_PI/(180.0*a_));
-      // A_->SetBlock(0,1,DKZ_,beta_/a_);
-      // A_->SetBlock(1,0,DKZ_,-beta_/a_);
-      A_->SetBlock(0,1,DKZ_,beta_);
-      A_->SetBlock(1,0,DKZ_,-beta_);
+      if ( myid_ == 0 ) { cout << "Building Block C" << endl; }
+      C_ = new BlockOperator(block_trueOffsets2_, block_trueOffsets_);
    }
-   A_->owns_blocks = 0;
-
-   if ( myid_ == 0 ) { cout << "Building Block M" << endl; }
-   delete M_;
-   M_ = new BlockOperator(block_trueOffsets_);
-   M_->SetDiagonalBlock(0,M1_);
-   M_->SetDiagonalBlock(1,M1_);
-   M_->owns_blocks = 0;
-
-   if ( myid_ == 0 ) { cout << "Building Block C" << endl; }
-   delete C_;
-   C_ = new BlockOperator(block_trueOffsets2_, block_trueOffsets_);
    C_->SetDiagonalBlock(0, T12_);
    C_->SetDiagonalBlock(1, T12_);
    if ( fabs(beta_) > 0.0 )
    {
-      // C_->SetBlock(0,1,Zeta_->ParallelAssemble(),beta_*M_PI/(180.0*a_));
+      // C_->SetBlock(0,1,Zeta_->ParallelAssemble(), beta_*M_PI/(180.0*a_));
       // C_->SetBlock(1,0,Zeta_->ParallelAssemble(),-beta_*M_PI/(180.0*a_));
-      // C_->SetBlock(0,1,Zeta_->ParallelAssemble(),beta_/a_);
+      // C_->SetBlock(0,1,Zeta_->ParallelAssemble(), beta_/a_);
       // C_->SetBlock(1,0,Zeta_->ParallelAssemble(),-beta_/a_);
-      C_->SetBlock(0,1,Z12_,beta_);
+      C_->SetBlock(0,1,Z12_, beta_);
       C_->SetBlock(1,0,Z12_,-beta_);
    }
    C_->owns_blocks = 0;
+}
 
-   if ( myid_ == 0 ) { cout << "Building T1Inv" << endl; }
-   delete T1Inv_;
-   if ( fabs(beta_) < 1.0 )
+// beta^2 k (|zeta|^2 I - zeta zeta^T) so that the ND mass integrator forms
+// the (zeta x u, k zeta x v) term of S1
+class ShiftedMassCoefficient : public MatrixCoefficient
+{
+public:
+   ShiftedMassCoefficient(Coefficient & k, const Vector & zeta, double beta)
+      : MatrixCoefficient(3), k_(&k), zeta_(zeta), beta_(beta) {}
+
+   virtual void Eval(DenseMatrix &K, ElementTransformation &T,
+                     const IntegrationPoint &ip)
    {
-      T1Inv_ = new HypreAMS(*S1_,HCurlFESpace_);
-      T1Inv_->SetSingularProblem();
+      double s  = beta_ * beta_ * k_->Eval(T, ip);
+      double z2 = zeta_ * zeta_;
+
+      K.SetSize(3);
+      for (int i=0; i<3; i++)
+      {
+         for (int j=0; j<3; j++)
+         {
+            K(i,j) = s * ( ( ( i == j ) ? z2 : 0.0 ) - zeta_[i] * zeta_[j] );
+         }
+      }
    }
-   else
+
+private:
+   Coefficient * k_;
+   Vector zeta_;
+   double beta_;
+};
+
+void
+MaxwellBlochWaveEquation::buildPAOperators()
+{
+   if ( newKCoef_ || APA_ == NULL )
    {
-      T1Inv_ = new HypreAMS(*S1_,HCurlFESpace_);
-      T1Inv_->SetSingularProblem();
+      if ( myid_ == 0 ) { cout << "Building partially assembled A" << endl; }
+      delete APA_;
+      APA_ = new MaxwellBlochPAOperator(*HCurlFESpace_, *kCoef_);
    }
 
-   if ( myid_ == 0 ) { cout << "Building BDP" << endl; }
-   delete BDP_;
-   BDP_ = new BlockDiagonalPreconditioner(block_trueOffsets_);
-   BDP_->SetDiagonalBlock(0,T1Inv_);
-   BDP_->SetDiagonalBlock(1,T1Inv_);
-   BDP_->owns_blocks = 0;
-
-   if ( SubSpaceProj_ ) { SubSpaceProj_->Update(); }
+   APA_->SetBeta(beta_);
+   APA_->SetZeta(zeta_);
 
-   if ( myid_ == 0 ) { cout << "Building Preconditioner" << endl; }
-   delete Precond_;
-   Precond_ = new MaxwellBlochWavePrecond(*HCurlFESpace_,*BDP_,*SubSpaceProj_,0.5);
-   Precond_->SetOperator(*A_);
+   if ( newZeta_ || newBeta_ )
+   {
+      // C is rebuilt on demand from fresh discrete operators
+      delete C_; C_ = NULL;
+      if ( newZeta_ )
+      {
+         delete Zeta_; Zeta_ = NULL;
+         delete Z12_;  Z12_  = NULL;
+      }
+   }
 
-   if ( myid_ == 0 ) { cout << "Building HypreLOBPCG solver" << endl; }
-   delete lobpcg_;
-   lobpcg_ = new HypreLOBPCG(comm_);
+   if ( newZeta_ || newBeta_ || newKCoef_ )
+   {
+      // The preconditioners and AME still need S1 but it can be assembled
+      // directly on H(Curl) without the products through H(Div)
+      if ( myid_ == 0 ) { cout << "Assembling S1 on H(Curl)" << endl; }
+      ShiftedMassCoefficient zkzCoef(*kCoef_, zeta_, beta_);
 
-   lobpcg_->SetNumModes(nev_);
-   lobpcg_->SetPreconditioner(*this->GetPreconditioner());
-   lobpcg_->SetMaxIter(2000);
-   lobpcg_->SetTol(1e-6);
-   lobpcg_->SetPrecondUsageMode(1);
-   lobpcg_->SetPrintLevel(1);
+      ParBilinearForm s1(HCurlFESpace_);
+      s1.AddDomainIntegrator(new CurlCurlIntegrator(*kCoef_));
+      if ( fabs(beta_) > 0.0 )
+      {
+         s1.AddDomainIntegrator(new VectorFEMassIntegrator(zkzCoef));
+      }
+      s1.Assemble();
+      s1.Finalize();
 
-   // Set the matrices which define the linear system
-   lobpcg_->SetMassMatrix(*this->GetMOperator());
-   lobpcg_->SetOperator(*this->GetAOperator());
-   lobpcg_->SetSubSpaceProjector(*this->GetSubSpaceProjector());
+      delete S1_;
+      S1_ = s1.ParallelAssemble();
 
-   newZeta_  = false;
-   newBeta_  = false;
-   newMCoef_ = false;
-   newKCoef_ = false;
+      delete DKZ_; DKZ_ = NULL;
+      delete M2_;  M2_  = NULL;
+   }
 }
-/*
-void MaxwellBlochWaveEquation::TestVector(const HypreParVector & v)
-{
-   SubSpaceProj_->Mult(v,*tmpVecA_);
-   A_->Mult(*tmpVecA_,*tmpVecB_);
-
-   double normV  = v.Norml2();
-   double normPV = tmpVecA_->Norml2();
 
-   if ( myid_ == 0 )
-   {
-      cout << "========================" << endl;
+void
+MaxwellBlochWaveEquation::SetInitialVectors(int num_vecs,
+                                            HypreParVector ** vecs)
+{
+   if ( lobpcg_ )
+   {
+      lobpcg_->SetInitialVectors(num_vecs, vecs);
+   }
+}
+
+void
+MaxwellBlochWaveEquation::MeshMoved()
+{
+   newMCoef_   = true;
+   newKCoef_   = true;
+   newZeta_    = true;
+   newAvgs_    = true;
+   newAvgVals_ = true;
+
+   // The Fourier series and the averages sample the old geometry and
+   // possibly old lattice
+   delete fourierHCurl_;
+   fourierHCurl_ = NULL;
+   delete avgAsm_;
+   avgAsm_ = NULL;
+
+   // The multigrid hierarchy holds refined copies of the old coarse mesh
+   // and the low order solver was set up with the old geometry
+   delete T1InvMG_;
+   T1InvMG_ = NULL;
+   delete T1InvLO_;
+   T1InvLO_ = NULL;
+}
+
+void MaxwellBlochWaveEquation::Update()
+{
+   // The hierarchy is built from the coarse mesh given to SetMultigrid and
+   // can not follow a refinement made outside of it
+   MFEM_VERIFY(mgMesh_ == NULL,
+               "MaxwellBlochWaveEquation::Update: the multigrid "
+               "preconditioner does not support mesh refinement");
+
+   // Updating a space which already matches the mesh has no effect
+   HCurlFESpace_->Update();
+   if ( H1FESpace_   ) { H1FESpace_->Update(); }
+   if ( HDivFESpace_ ) { HDivFESpace_->Update(); }
+   if ( L2FESpace_   ) { L2FESpace_->Update(); }
+
+   // Pooled vectors and partitionings refer to the old spaces
+   hcurlWS_->Update();
+   if ( hdivWS_ ) { hdivWS_->Update(); }
+
+   hcurl_loc_size_ = HCurlFESpace_->TrueVSize();
+
+   block_offsets_[1] = HCurlFESpace_->GetVSize();
+   block_offsets_[2] = 2 * HCurlFESpace_->GetVSize();
+
+   block_trueOffsets_[1] = HCurlFESpace_->TrueVSize();
+   block_trueOffsets_[2] = 2 * HCurlFESpace_->TrueVSize();
+
+   HYPRE_Int * hcurl_tdof_offsets = HCurlFESpace_->GetTrueDofOffsets();
+   for (int i=0; i<tdof_offsets_.Size(); i++)
+   {
+      tdof_offsets_[i] = 2 * hcurl_tdof_offsets[i];
+   }
+
+   if ( HDivFESpace_ )
+   {
+      hdiv_loc_size_ = HDivFESpace_->TrueVSize();
+
+      block_trueOffsets2_[1] = HDivFESpace_->TrueVSize();
+      block_trueOffsets2_[2] = 2 * HDivFESpace_->TrueVSize();
+   }
+
+   if ( blkHCurl_ )
+   {
+      delete blkHCurl_;
+      blkHCurl_ = new BlockVector(block_trueOffsets_);
+   }
+   delete blkHDiv_; blkHDiv_ = NULL;
+
+   // Everything assembled on the old mesh is dropped so that Setup rebuilds
+   // it along the same path, assembled or partially assembled, that it
+   // takes for a new kappa
+   delete A_;   A_   = NULL;
+   delete M_;   M_   = NULL;
+   delete C_;   C_   = NULL;
+   delete APA_; APA_ = NULL;
+   delete M1_;  M1_  = NULL;
+   delete M2_;  M2_  = NULL;
+   delete S1_;  S1_  = NULL;
+   delete T12_; T12_ = NULL;
+   delete Z12_; Z12_ = NULL;
+   delete DKZ_; DKZ_ = NULL;
+   delete Curl_; Curl_ = NULL;
+   delete Zeta_; Zeta_ = NULL;
+
+   delete BDP_;     BDP_     = NULL;
+   delete T1Inv_;   T1Inv_   = NULL;
+   delete T1InvSP_; T1InvSP_ = NULL;
+   delete T1InvLO_; T1InvLO_ = NULL;
+
+   delete Precond_;      Precond_      = NULL;
+   delete SubSpaceProj_; SubSpaceProj_ = NULL;
+   delete lobpcg_;       lobpcg_       = NULL;
+   delete ame_;          ame_          = NULL;
+
+   if ( vecs_ != NULL )
+   {
+      for (int i=0; i<nev_; i++) { delete vecs_[i]; }
+      delete [] vecs_;
+      vecs_ = NULL;
+   }
+   delete vec0_; vec0_ = NULL;
+
+   delete fourierHCurl_; fourierHCurl_ = NULL;
+   delete avgAsm_;       avgAsm_       = NULL;
+
+   newZeta_    = true;
+   newBeta_    = true;
+   newMCoef_   = true;
+   newKCoef_   = true;
+   newAvgs_    = true;
+   newAvgVals_ = true;
+
+   this->Setup();
+}
+/*
+void MaxwellBlochWaveEquation::TestVector(const HypreParVector & v)
+{
+   SubSpaceProj_->Mult(v,*tmpVecA_);
+   A_->Mult(*tmpVecA_,*tmpVecB_);
+
+   double normV  = v.Norml2();
+   double normPV = tmpVecA_->Norml2();
+
+   if ( myid_ == 0 )
+   {
+      cout << "========================" << endl;
       cout << "Norm v:    " << normV  << endl;
       cout << "Norm Pv:   " << normPV << endl;
    }
@@ -809,6 +1149,9 @@ void MaxwellBlochWaveEquation::TestVector(const HypreParVector & v)
 void
 MaxwellBlochWaveEquation::Solve()
 {
+   // The eigenvectors are about to change
+   newAvgVals_ = true;
+
    if ( nev_ > 0 )
    {
       if ( fabs(beta_) > 0.0 )
@@ -1425,8 +1768,17 @@ MaxwellBlochWaveEquation::GetEigenvectorB(unsigned int i,
    vector<double> eigenvalues;
    this->GetEigenvalues(eigenvalues);
 
+   this->buildHDivFESpace();
+
+   if ( blkHDiv_ == NULL )
+   {
+      blkHDiv_ = new BlockVector(block_trueOffsets2_);
+   }
+
    if ( lobpcg_ )
    {
+      if ( C_ == NULL ) { this->buildCOperator(); }
+
       if ( vecs_ != NULL )
       {
          C_->Mult(*vecs_[i], *blkHDiv_);
@@ -1438,14 +1790,17 @@ MaxwellBlochWaveEquation::GetEigenvectorB(unsigned int i,
    }
    else if ( ame_ )
    {
+      if ( T12_ == NULL ) { this->buildCOperator(); }
+
+      // The eigenvectors and blkHDiv_ hold true dofs
       if ( i%2 == 0 )
       {
          blkHDiv_->GetBlock(1) = 0.0;
-         Curl_->Mult(ame_->GetEigenvector(i/2),blkHDiv_->GetBlock(0));
+         T12_->Mult(ame_->GetEigenvector(i/2),blkHDiv_->GetBlock(0));
       }
       else
       {
-         Curl_->Mult(ame_->GetEigenvector((i-1)/2),blkHDiv_->GetBlock(1));
+         T12_->Mult(ame_->GetEigenvector((i-1)/2),blkHDiv_->GetBlock(1));
          blkHDiv_->GetBlock(0) = 0.0;
       }
    }
@@ -1573,62 +1928,28 @@ MaxwellBlochWaveEquation::GetFieldAverages(unsigned int i,
 
    // fourierHCurl_->SetMode(0,0,0);
 
-   HypreParVector  ParEr(HCurlFESpace_->GetComm(),
-                         HCurlFESpace_->GlobalTrueVSize(),
-                         NULL,
-                         HCurlFESpace_->GetTrueDofOffsets());
-
-   HypreParVector  ParEi(HCurlFESpace_->GetComm(),
-                         HCurlFESpace_->GlobalTrueVSize(),
-                         NULL,
-                         HCurlFESpace_->GetTrueDofOffsets());
-
-   HypreParVector  ParBr(HDivFESpace_->GetComm(),
-                         HDivFESpace_->GlobalTrueVSize(),
-                         NULL,
-                         HDivFESpace_->GetTrueDofOffsets());
-
-   HypreParVector  ParBi(HDivFESpace_->GetComm(),
-                         HDivFESpace_->GlobalTrueVSize(),
-                         NULL,
-                         HDivFESpace_->GetTrueDofOffsets());
-
-   this->GetEigenvector(i, ParEr, ParEi, ParBr, ParBi);
-
-   Er.SetSize(3); Er = 0.0;
-   Ei.SetSize(3); Ei = 0.0;
-   Dr.SetSize(3); Dr = 0.0;
-   Di.SetSize(3); Di = 0.0;
-   Hr.SetSize(3); Hr = 0.0;
-   Hi.SetSize(3); Hi = 0.0;
-   Br.SetSize(3); Br = 0.0;
-   Bi.SetSize(3); Bi = 0.0;
-
-   for (int i=0; i<3; i++)
-   {
-      Er[i] += *AvgHCurl_coskx_[i] * ParEr;
-      Er[i] -= *AvgHCurl_sinkx_[i] * ParEi;
-
-      Ei[i] += *AvgHCurl_sinkx_[i] * ParEr;
-      Ei[i] += *AvgHCurl_coskx_[i] * ParEi;
-
-      Br[i] += *AvgHDiv_coskx_[i] * ParBr;
-      Br[i] -= *AvgHDiv_sinkx_[i] * ParBi;
-
-      Bi[i] += *AvgHDiv_sinkx_[i] * ParBr;
-      Bi[i] += *AvgHDiv_coskx_[i] * ParBi;
+   this->computeAverages();
 
-      Dr[i] += *AvgHCurl_eps_coskx_[i] * ParEr;
-      Dr[i] -= *AvgHCurl_eps_sinkx_[i] * ParEi;
-
-      Di[i] += *AvgHCurl_eps_sinkx_[i] * ParEr;
-      Di[i] += *AvgHCurl_eps_coskx_[i] * ParEi;
-
-      Hr[i] += *AvgHDiv_muInv_coskx_[i] * ParBr;
-      Hr[i] -= *AvgHDiv_muInv_sinkx_[i] * ParBi;
+   Er.SetSize(3); Ei.SetSize(3);
+   Dr.SetSize(3); Di.SetSize(3);
+   Hr.SetSize(3); Hi.SetSize(3);
+   Br.SetSize(3); Bi.SetSize(3);
 
-      Hi[i] += *AvgHDiv_muInv_sinkx_[i] * ParBr;
-      Hi[i] += *AvgHDiv_muInv_coskx_[i] * ParBi;
+   // See computeAverages for the layout of each column
+   for (int k=0; k<3; k++)
+   {
+      const double * e = &avgVals_(16 * k, i);
+      const double * b = &avgVals_(16 * k + 8, i);
+
+      Er[k] = e[0] - e[3];
+      Ei[k] = e[2] + e[1];
+      Dr[k] = e[4] - e[7];
+      Di[k] = e[6] + e[5];
+
+      Br[k] = b[0] - b[3];
+      Bi[k] = b[2] + b[1];
+      Hr[k] = b[4] - b[7];
+      Hi[k] = b[6] + b[5];
    }
    /*
    // Compute the averages of the real and imaginary parts of E
@@ -1691,6 +2012,64 @@ MaxwellBlochWaveEquation::GetFieldAverages(unsigned int i,
    */
 }
 
+void
+MaxwellBlochWaveEquation::computeAverages()
+{
+   if ( !newAvgVals_ ) { return; }
+
+   this->assembleAverages();
+
+   HypreParVector & ParEr = hcurlWS_->GetTrueVectorView(0);
+   HypreParVector & ParEi = hcurlWS_->GetTrueVectorView(1);
+   HypreParVector & ParBr = hdivWS_->GetTrueVectorView(0);
+   HypreParVector & ParBi = hdivWS_->GetTrueVectorView(1);
+
+   vector<double> eigs;
+   this->GetEigenvalues(eigs);
+
+   int nev = eigs.size();
+
+   // For each component k the column holds 16 local dot products:
+   //   (cos, Er), (cos, Ei), (sin, Er), (sin, Ei) followed by the
+   //   same four with eps, then the H(Div) counterparts with B and mu^{-1}
+   avgVals_.SetSize(48, nev);
+
+   for (int l=0; l<nev; l++)
+   {
+      this->GetEigenvector(l, ParEr, ParEi, ParBr, ParBi);
+
+      for (int k=0; k<3; k++)
+      {
+         double * e = &avgVals_(16 * k, l);
+         double * b = &avgVals_(16 * k + 8, l);
+
+         e[0] = *AvgHCurl_coskx_[k] * ParEr;
+         e[1] = *AvgHCurl_coskx_[k] * ParEi;
+         e[2] = *AvgHCurl_sinkx_[k] * ParEr;
+         e[3] = *AvgHCurl_sinkx_[k] * ParEi;
+         e[4] = *AvgHCurl_eps_coskx_[k] * ParEr;
+         e[5] = *AvgHCurl_eps_coskx_[k] * ParEi;
+         e[6] = *AvgHCurl_eps_sinkx_[k] * ParEr;
+         e[7] = *AvgHCurl_eps_sinkx_[k] * ParEi;
+
+         b[0] = *AvgHDiv_coskx_[k] * ParBr;
+         b[1] = *AvgHDiv_coskx_[k] * ParBi;
+         b[2] = *AvgHDiv_sinkx_[k] * ParBr;
+         b[3] = *AvgHDiv_sinkx_[k] * ParBi;
+         b[4] = *AvgHDiv_muInv_coskx_[k] * ParBr;
+         b[5] = *AvgHDiv_muInv_coskx_[k] * ParBi;
+         b[6] = *AvgHDiv_muInv_sinkx_[k] * ParBr;
+         b[7] = *AvgHDiv_muInv_sinkx_[k] * ParBi;
+      }
+   }
+
+   // One reduction covers every eigenvector at this wave vector
+   MPI_Allreduce(MPI_IN_PLACE, avgVals_.Data(), 48 * nev, MPI_DOUBLE,
+                 MPI_SUM, comm_);
+
+   newAvgVals_ = false;
+}
+
 void
 MaxwellBlochWaveEquation::ComputeHomogenizedCoefs()
 {
@@ -1731,61 +2110,68 @@ void
 MaxwellBlochWaveEquation::WriteVisitFields(const string & prefix,
                                            const string & label)
 {
-   cout << "Writing VisIt data to: " << prefix  << " " << label << endl;
+   if ( writer_ )
+   {
+      cout << "Queueing VisIt data for: " << prefix  << " " << label << endl;
+   }
+   else
+   {
+      cout << "Writing VisIt data to: " << prefix  << " " << label << endl;
+   }
 
-   ParGridFunction Er(this->GetHCurlFESpace());
-   ParGridFunction Ei(this->GetHCurlFESpace());
+   ParFESpaceWorkspace * hdivWS = this->GetHDivWorkspace();
 
-   ParGridFunction Br(this->GetHDivFESpace());
-   ParGridFunction Bi(this->GetHDivFESpace());
+   ParGridFunction & Er = hcurlWS_->GetGridFunction(0);
+   ParGridFunction & Ei = hcurlWS_->GetGridFunction(1);
 
-   HypreParVector ErVec(this->GetHCurlFESpace()->GetComm(),
-                        this->GetHCurlFESpace()->GlobalTrueVSize(),
-                        NULL,
-                        this->GetHCurlFESpace()->GetTrueDofOffsets());
-   HypreParVector EiVec(this->GetHCurlFESpace()->GetComm(),
-                        this->GetHCurlFESpace()->GlobalTrueVSize(),
-                        NULL,
-                        this->GetHCurlFESpace()->GetTrueDofOffsets());
+   ParGridFunction & Br = hdivWS->GetGridFunction(0);
+   ParGridFunction & Bi = hdivWS->GetGridFunction(1);
 
-   HypreParVector BrVec(this->GetHDivFESpace()->GetComm(),
-                        this->GetHDivFESpace()->GlobalTrueVSize(),
-                        NULL,
-                        this->GetHDivFESpace()->GetTrueDofOffsets());
-   HypreParVector BiVec(this->GetHDivFESpace()->GetComm(),
-                        this->GetHDivFESpace()->GlobalTrueVSize(),
-                        NULL,
-                        this->GetHDivFESpace()->GetTrueDofOffsets());
+   HypreParVector & ErVec = hcurlWS_->GetTrueVectorView(0);
+   HypreParVector & EiVec = hcurlWS_->GetTrueVectorView(1);
+
+   HypreParVector & BrVec = hdivWS->GetTrueVectorView(0);
+   HypreParVector & BiVec = hdivWS->GetTrueVectorView(1);
 
-   VisItDataCollection visit_dc(label.c_str(), pmesh_);
-   visit_dc.SetPrefixPath(prefix.c_str());
+   GridFunction * epsilon = NULL;
+   GridFunction * muInv   = NULL;
 
    if ( dynamic_cast<GridFunctionCoefficient*>(mCoef_) )
    {
       GridFunctionCoefficient * gfc =
          dynamic_cast<GridFunctionCoefficient*>(mCoef_);
-      visit_dc.RegisterField("epsilon", gfc->GetGridFunction() );
+      epsilon = gfc->GetGridFunction();
    }
    if ( dynamic_cast<GridFunctionCoefficient*>(kCoef_) )
    {
       GridFunctionCoefficient * gfc =
          dynamic_cast<GridFunctionCoefficient*>(kCoef_);
-      visit_dc.RegisterField("muInv", gfc->GetGridFunction() );
+      muInv = gfc->GetGridFunction();
    }
-   /*
-   if ( cosKappaX_ )
+
+   // Without a writer the fields are saved directly from the pooled grid
+   // functions, otherwise the writer copies them for each cycle.
+   VisItDataCollection * visit_dc = NULL;
+
+   if ( writer_ )
    {
-     visit_dc.RegisterField("CosKappaX", cosKappaX_);
+      writer_->BeginVisitCollection(prefix, label);
+      if ( epsilon ) { writer_->AddVisitStaticField("epsilon", *epsilon); }
+      if ( muInv   ) { writer_->AddVisitStaticField("muInv", *muInv); }
    }
-   if ( sinKappaX_ )
+   else
    {
-     visit_dc.RegisterField("SinKappaX", sinKappaX_);
+      visit_dc = new VisItDataCollection(label.c_str(), pmesh_);
+      visit_dc->SetPrefixPath(prefix.c_str());
+
+      if ( epsilon ) { visit_dc->RegisterField("epsilon", epsilon); }
+      if ( muInv   ) { visit_dc->RegisterField("muInv", muInv); }
+
+      visit_dc->RegisterField("E_r", &Er);
+      visit_dc->RegisterField("E_i", &Ei);
+      visit_dc->RegisterField("B_r", &Br);
+      visit_dc->RegisterField("B_i", &Bi);
    }
-   */
-   visit_dc.RegisterField("E_r", &Er);
-   visit_dc.RegisterField("E_i", &Ei);
-   visit_dc.RegisterField("B_r", &Br);
-   visit_dc.RegisterField("B_i", &Bi);
 
    vector<double> eigenvalues;
    this->GetEigenvalues(eigenvalues);
@@ -1803,22 +2189,35 @@ MaxwellBlochWaveEquation::WriteVisitFields(const string & prefix,
       Br = BrVec;
       Bi = BiVec;
 
-      visit_dc.SetCycle(i+1);
+      double time = -1.0;
       if ( eigenvalues[i] > 0.0 )
       {
-         visit_dc.SetTime(sqrt(eigenvalues[i]));
+         time = sqrt(eigenvalues[i]);
       }
       else if ( eigenvalues[i] > -1.0e-6 )
       {
-         visit_dc.SetTime(0.0);
+         time = 0.0;
+      }
+
+      if ( writer_ )
+      {
+         writer_->AddVisitCycle(time);
+         writer_->AddVisitField("E_r", Er);
+         writer_->AddVisitField("E_i", Ei);
+         writer_->AddVisitField("B_r", Br);
+         writer_->AddVisitField("B_i", Bi);
       }
       else
       {
-         visit_dc.SetTime(-1.0);
+         visit_dc->SetCycle(i+1);
+         visit_dc->SetTime(time);
+         visit_dc->Save();
       }
-
-      visit_dc.Save();
    }
+
+   if ( writer_ ) { writer_->EndVisitCollection(); }
+
+   delete visit_dc;
 }
 
 void
@@ -1862,52 +2261,187 @@ MaxwellBlochWaveEquation::GetSolverStats(double &meanTime, double &stdDevTime,
    stdDevIter = sqrt(var);
 }
 
-MaxwellBlochWaveEquation::MaxwellBlochWavePrecond::
-MaxwellBlochWavePrecond(ParFiniteElementSpace & HCurlFESpace,
-                        BlockDiagonalPreconditioner & BDP,
-                        Operator & subSpaceProj,
-                        //BlockOperator & LU,
-                        double w)
-   : Solver(2*HCurlFESpace.GlobalTrueVSize()),
-     myid_(0), BDP_(&BDP), subSpaceProj_(&subSpaceProj), u_(NULL)
+void
+MaxwellBlochWaveEquation::GetEigenvalueResiduals(vector<double> & resid)
 {
-   // Initialize MPI variables
-   MPI_Comm comm = HCurlFESpace.GetComm();
-   MPI_Comm_rank(comm, &myid_);
-   int numProcs = HCurlFESpace.GetNRanks();
+   vector<double> eigenvalues;
+   this->GetEigenvalues(eigenvalues);
 
-   if ( myid_ == 0 ) { cout << "MaxwellBlochWavePrecond" << endl; }
+   int n = (int)eigenvalues.size();
+   resid.resize(n);
+   if ( n == 0 ) { return; }
+
+   HypreParVector & Er = hcurlWS_->GetTrueVectorView(0);
+   HypreParVector & Ei = hcurlWS_->GetTrueVectorView(1);
+
+   // The complex modes are stored contiguously while the modes computed by
+   // AME are purely real or purely imaginary
+   int size = ( lobpcg_ ) ? 2 * hcurl_loc_size_ : hcurl_loc_size_;
+   Vector Ax(size), Mx(size);
+
+   // Local contributions to |A x - lambda M x|^2 and |M x|^2
+   vector<double> loc(2*n), glb(2*n);
+
+   for (int i=0; i<n; i++)
+   {
+      this->GetEigenvectorE(i, Er, Ei);
+
+      if ( lobpcg_ )
+      {
+         Vector x(Er.GetData(), size);
+         if ( APA_ )
+         {
+            APA_->Mult(x, Ax);
+         }
+         else
+         {
+            A_->Mult(x, Ax);
+         }
+         M_->Mult(x, Mx);
+      }
+      else
+      {
+         HypreParVector & x = ( i%2 == 0 ) ? Er : Ei;
+         S1_->Mult(x, Ax);
+         M1_->Mult(x, Mx);
+      }
+      add(Ax, -eigenvalues[i], Mx, Ax);
 
-   int locSize = 2*HCurlFESpace.TrueVSize();
-   int glbSize = 0;
+      loc[2*i+0] = Ax * Ax;
+      loc[2*i+1] = Mx * Mx;
+   }
+
+   MPI_Allreduce(&loc[0], &glb[0], 2*n, MPI_DOUBLE, MPI_SUM, comm_);
 
-   HYPRE_Int * part = NULL;
+   for (int i=0; i<n; i++)
+   {
+      resid[i] = ( glb[2*i+1] > 0.0 ) ?
+                 sqrt(glb[2*i+0] / glb[2*i+1]) : sqrt(glb[2*i+0]);
+   }
+}
 
-   if (HYPRE_AssumedPartitionCheck())
+void
+MaxwellBlochWaveEquation::GetMemoryUsage(map<string,size_t> & bytes) const
+{
+   // Every processor reports the same set of keys
+   bytes["operator:M1"]   = HypreParMatrixBytes(M1_);
+   bytes["operator:M2"]   = HypreParMatrixBytes(M2_);
+   bytes["operator:S1"]   = HypreParMatrixBytes(S1_);
+   bytes["operator:T12"]  = HypreParMatrixBytes(T12_);
+   bytes["operator:Z12"]  = HypreParMatrixBytes(Z12_);
+   bytes["operator:DKZ"]  = HypreParMatrixBytes(DKZ_) +
+                            HypreParMatrixBytes(DKZT_);
+   bytes["operator:PA"]   = ( APA_ ) ? APA_->GetMemoryUsage() : 0;
+
+   bytes["preconditioner:T1Inv"] =
+      ( T1Inv_ ) ? AMSBytes((HYPRE_Solver)*T1Inv_) : 0;
+   bytes["preconditioner:T1Inv"] +=
+      ( T1InvSP_ ) ? T1InvSP_->GetMemoryUsage() : 0;
+
+   size_t vec_bytes = 0;
+   if ( blkHCurl_ ) { vec_bytes += sizeof(double) * blkHCurl_->Size(); }
+   if ( blkHDiv_  ) { vec_bytes += sizeof(double) * blkHDiv_->Size(); }
+   if ( vec0_     ) { vec_bytes += sizeof(double) * vec0_->Size(); }
+   if ( Precond_  )
    {
-      part = new HYPRE_Int[2];
+      vec_bytes +=
+         dynamic_cast<MaxwellBlochWavePrecond*>(Precond_)->GetMemoryUsage();
+   }
+   bytes["workspace:vectors"] = vec_bytes;
 
-      MPI_Scan(&locSize, &part[1], 1, HYPRE_MPI_INT, MPI_SUM, comm);
+   size_t avg_bytes = 0;
+   for (int i=0; i<3; i++)
+   {
+      if ( AvgHCurl_coskx_[i] )
+      {
+         avg_bytes += 4 * sizeof(double) * AvgHCurl_coskx_[i]->Size();
+      }
+      if ( AvgHDiv_coskx_[i] )
+      {
+         avg_bytes += 4 * sizeof(double) * AvgHDiv_coskx_[i]->Size();
+      }
+   }
+   bytes["workspace:averages"] = avg_bytes;
 
-      part[0] = part[1] - locSize;
+   size_t eig_bytes = 0;
+   if ( vecs_ != NULL || lobpcg_ != NULL )
+   {
+      eig_bytes = (size_t)std::max(nev_,0) * 2 * hcurl_loc_size_ *
+                  sizeof(double);
+   }
+   else if ( ame_ != NULL )
+   {
+      eig_bytes = (size_t)std::max(nev_/2,0) * hcurl_loc_size_ *
+                  sizeof(double);
+   }
+   bytes["workspace:eigenvectors"] = eig_bytes;
 
-      MPI_Allreduce(&locSize, &glbSize, 1, HYPRE_MPI_INT, MPI_SUM, comm);
+   if ( SubSpaceProj_ )
+   {
+      SubSpaceProj_->GetMemoryUsage(bytes);
    }
    else
    {
-      part = new HYPRE_Int[numProcs+1];
+      bytes["operator:projector"] = 0;
+      bytes["preconditioner:projector"] = 0;
+      bytes["workspace:projector"] = 0;
+   }
+}
+
+void
+MaxwellBlochWaveEquation::PrintMemoryUsage(ostream & os) const
+{
+   map<string,size_t> bytes;
+   this->GetMemoryUsage(bytes);
+
+   int n = (int)bytes.size();
+   vector<double> loc(n+1, 0.0), sum(n+1, 0.0), mx(n+1, 0.0);
+
+   map<string,size_t>::const_iterator mit;
+   int i = 0;
+   for (mit=bytes.begin(); mit!=bytes.end(); mit++, i++)
+   {
+      loc[i] = (double)mit->second;
+      loc[n] += loc[i];
+   }
 
-      MPI_Allgather(&locSize, 1, MPI_INT,
-                    &part[1], 1, HYPRE_MPI_INT, comm);
+   MPI_Reduce(&loc[0], &sum[0], n+1, MPI_DOUBLE, MPI_SUM, 0, comm_);
+   MPI_Reduce(&loc[0], &mx[0],  n+1, MPI_DOUBLE, MPI_MAX, 0, comm_);
 
-      part[0] = 0;
-      for (int i=0; i<numProcs; i++)
+   if ( myid_ == 0 )
+   {
+      const double MB = 1024.0 * 1024.0;
+      os << "Memory usage (MB)" << endl;
+      os << setw(32) << left << "" << setw(14) << right << "total"
+         << setw(14) << "max/proc" << endl;
+      for (mit=bytes.begin(), i=0; mit!=bytes.end(); mit++, i++)
       {
-         part[i+1] += part[i];
+         os << setw(32) << left << mit->first << right
+            << setw(14) << sum[i] / MB << setw(14) << mx[i] / MB << endl;
       }
-
-      glbSize = part[numProcs];
+      os << setw(32) << left << "all" << right
+         << setw(14) << sum[n] / MB << setw(14) << mx[n] / MB << endl;
    }
+}
+
+MaxwellBlochWaveEquation::MaxwellBlochWavePrecond::
+MaxwellBlochWavePrecond(ParFESpaceWorkspace & ws,
+                        BlockDiagonalPreconditioner & BDP,
+                        MaxwellBlochWaveProjector & subSpaceProj,
+                        //BlockOperator & LU,
+                        double w)
+   : Solver(2*ws.GetFESpace()->GlobalTrueVSize()),
+     myid_(0), BDP_(&BDP), subSpaceProj_(&subSpaceProj), u_(NULL),
+     adaptive_(false), rRef_(0.0)
+{
+   // Initialize MPI variables
+   MPI_Comm comm = ws.GetFESpace()->GetComm();
+   MPI_Comm_rank(comm, &myid_);
+
+   if ( myid_ == 0 ) { cout << "MaxwellBlochWavePrecond" << endl; }
+
+   HYPRE_Int   glbSize = ws.GetGlobalSize(2);
+   HYPRE_Int * part    = ws.GetPartitioning(2);
 
    r_ = new HypreParVector(comm,glbSize,part);
    u_ = new HypreParVector(comm,glbSize,part);
@@ -1917,14 +2451,34 @@ MaxwellBlochWavePrecond(ParFiniteElementSpace & HCurlFESpace,
 MaxwellBlochWaveEquation::
 MaxwellBlochWavePrecond::~MaxwellBlochWavePrecond()
 {
+   delete r_;
    delete u_;
+   delete v_;
 }
 
 void
 MaxwellBlochWaveEquation::
 MaxwellBlochWavePrecond::Mult(const Vector & x, Vector & y) const
 {
-   if ( subSpaceProj_ )
+   if ( subSpaceProj_ && adaptive_ )
+   {
+      // The inputs are the eigensolver residuals so their decay measures
+      // how accurately the projection needs to be computed
+      double loc = x * x, nrm = 0.0;
+      MPI_Allreduce(&loc, &nrm, 1, MPI_DOUBLE, MPI_SUM, u_->GetComm());
+      nrm = sqrt(nrm);
+      rRef_ = max(rRef_, nrm);
+
+      double tol = ( rRef_ > 0.0 ) ? 1e-2 * nrm / rRef_ : 0.0;
+      tol = min(1e-4, max(1e-13, tol));
+
+      double tol0 = subSpaceProj_->GetRelTol();
+      subSpaceProj_->SetRelTol(tol);
+      BDP_->Mult(x,*u_);
+      subSpaceProj_->Mult(*u_,y);
+      subSpaceProj_->SetRelTol(tol0);
+   }
+   else if ( subSpaceProj_ )
    {
       BDP_->Mult(x,*u_);
       subSpaceProj_->Mult(*u_,y);
@@ -1952,6 +2506,10 @@ MaxwellBlochWaveProjector(//ParFiniteElementSpace & HDivFESpace,
    : Operator(2*HCurlFESpace.GlobalTrueVSize()),
      newBeta_(true),
      newZeta_(true),
+     singlePrec_(false),
+     relTol_(1e-13),
+     amgRefresh_(2.0),
+     amgBeta_(0.0),
      // HDivFESpace_(&HDivFESpace),
      HCurlFESpace_(&HCurlFESpace),
      H1FESpace_(&H1FESpace),
@@ -1963,7 +2521,10 @@ MaxwellBlochWaveProjector(//ParFiniteElementSpace & HDivFESpace,
      DKZ_(NULL),
      DKZT_(NULL),
      amg_cos_(NULL),
+     amgMat_(NULL),
      minres_(NULL),
+     A0Inv_(NULL),
+     S0Inv_(NULL),
      Grad_(NULL),
      Zeta_(NULL),
      S0_(NULL),
@@ -2027,6 +2588,7 @@ MaxwellBlochWaveProjector::~MaxwellBlochWaveProjector()
    delete u1_; delete v1_;
    delete T01_;
    delete Z01_;
+   if ( amgMat_ != A0_ ) { delete amgMat_; }
    delete A0_;
    delete DKZ_;
    delete DKZT_;
@@ -2036,6 +2598,8 @@ MaxwellBlochWaveProjector::~MaxwellBlochWaveProjector()
    delete G_;
    delete amg_cos_;
    delete minres_;
+   delete S0Inv_;
+   delete A0Inv_;
 }
 
 void
@@ -2050,6 +2614,13 @@ MaxwellBlochWaveProjector::SetZeta(const Vector & zeta)
    zeta_ = zeta; newZeta_ = true;
 }
 
+void
+MaxwellBlochWaveProjector::SetRelTol(double tol)
+{
+   relTol_ = tol;
+   if ( minres_ ) { minres_->SetRelTol(relTol_); }
+}
+
 void
 MaxwellBlochWaveProjector::Setup()
 {
@@ -2072,6 +2643,8 @@ MaxwellBlochWaveProjector::Setup()
       if ( fabs(beta_) > 0.0 )
       {
          if ( myid_ == 0 ) { cout << "Building zeta times operator" << endl; }
+         delete Zeta_;
+         delete Z01_;
          Zeta_ = new ParDiscreteVectorProductOperator(H1FESpace_,
                                                       HCurlFESpace_,zeta_);
          Zeta_->Assemble();
@@ -2098,6 +2671,10 @@ MaxwellBlochWaveProjector::Setup()
 
    if ( newBeta_ || newZeta_ )
    {
+      // A0 may still be referenced by the cached AMG hierarchy
+      if ( A0_ != amgMat_ ) { delete A0_; }
+      delete DKZ_; DKZ_ = NULL;
+
       if ( myid_ == 0 ) { cout << "Forming GMG" << endl; }
       HypreParMatrix *  M1 = dynamic_cast<HypreParMatrix*>(&M_->GetBlock(0,0));
       HypreParMatrix * GMG = RAP(M1,T01_);
@@ -2147,10 +2724,12 @@ MaxwellBlochWaveProjector::Setup()
    delete minres_;
    minres_ = new MINRESSolver(H1FESpace_->GetComm());
    minres_->SetOperator(*S0_);
-   minres_->SetRelTol(1e-13);
+   minres_->SetRelTol(relTol_);
    minres_->SetMaxIter(3000);
    minres_->SetPrintLevel(0);
 
+   this->buildPreconditioner();
+
    newBeta_  = false;
    newZeta_  = false;
 
@@ -2219,11 +2798,17 @@ MaxwellBlochWaveProjector::Update()
    }
    G_->owns_blocks = 0;
 
+   // The cached hierarchy belongs to the old mesh
+   delete amg_cos_; amg_cos_ = NULL;
+   if ( amgMat_ != A0_ ) { delete amgMat_; }
+   amgMat_ = NULL;
+
    if ( myid_ == 0 ) { cout << "Forming GMG" << endl; }
    HypreParMatrix *  M1 = dynamic_cast<HypreParMatrix*>(&M_->GetBlock(0,0));
    HypreParMatrix * GMG = RAP(M1,T01_);
 
    delete A0_;
+   delete DKZ_; DKZ_ = NULL;
    if ( fabs(beta_) > 0.0 )
    {
       if ( myid_ == 0 ) { cout << "Forming 2nd order operators" << endl; }
@@ -2267,16 +2852,78 @@ MaxwellBlochWaveProjector::Update()
    delete minres_;
    minres_ = new MINRESSolver(H1FESpace_->GetComm());
    minres_->SetOperator(*S0_);
-   minres_->SetRelTol(1e-13);
+   minres_->SetRelTol(relTol_);
    minres_->SetMaxIter(3000);
    minres_->SetPrintLevel(0);
 
+   this->buildPreconditioner();
+
    newBeta_  = false;
    newZeta_  = false;
 
    if ( myid_ > 0 ) { cout << "done" << endl; }
 }
 
+void
+MaxwellBlochWaveProjector::buildPreconditioner()
+{
+   delete S0Inv_; S0Inv_ = NULL;
+   delete A0Inv_; A0Inv_ = NULL;
+
+   Solver * A0Inv = NULL;
+   if ( singlePrec_ )
+   {
+      if ( myid_ == 0 ) { cout << "Building single precision S0Inv" << endl; }
+      A0Inv_ = new SinglePrecisionChebyshev(*A0_);
+      A0Inv  = A0Inv_;
+   }
+   else
+   {
+      // A0 only changes through the beta^2 ZMZ term so an AMG hierarchy
+      // built for a nearby beta remains a good preconditioner
+      double b0 = fabs(amgBeta_), b1 = fabs(beta_);
+      if ( amg_cos_ == NULL || b1 > amgRefresh_ * b0 || b0 > amgRefresh_ * b1 )
+      {
+         if ( myid_ == 0 ) { cout << "Building AMG for A0" << endl; }
+         delete amg_cos_;
+         if ( amgMat_ != A0_ ) { delete amgMat_; }
+         amgMat_  = A0_;
+         amgBeta_ = beta_;
+         amg_cos_ = new HypreBoomerAMG(*A0_);
+         amg_cos_->SetPrintLevel(0);
+      }
+      A0Inv = amg_cos_;
+   }
+
+   S0Inv_ = new BlockDiagonalPreconditioner(block_trueOffsets0_);
+   S0Inv_->SetDiagonalBlock(0,A0Inv);
+   S0Inv_->SetDiagonalBlock(1,A0Inv);
+   S0Inv_->owns_blocks = 0;
+
+   minres_->SetPreconditioner(*S0Inv_);
+}
+
+void
+MaxwellBlochWaveProjector::GetMemoryUsage(map<string,size_t> & bytes) const
+{
+   bytes["operator:projector"] = HypreParMatrixBytes(T01_) +
+                                 HypreParMatrixBytes(Z01_) +
+                                 HypreParMatrixBytes(A0_) +
+                                 HypreParMatrixBytes(DKZ_) +
+                                 HypreParMatrixBytes(DKZT_);
+   if ( amgMat_ != A0_ )
+   {
+      bytes["operator:projector"] += HypreParMatrixBytes(amgMat_);
+   }
+
+   bytes["preconditioner:projector"] =
+      ( A0Inv_ ) ? A0Inv_->GetMemoryUsage() : 0;
+
+   bytes["workspace:projector"] = sizeof(double) *
+                                  ( u0_->Size() + v0_->Size() +
+                                    u1_->Size() + v1_->Size() );
+}
+
 void
 MaxwellBlochWaveProjector::Mult(const Vector &x, Vector &y) const
 {
@@ -2289,6 +2936,2057 @@ MaxwellBlochWaveProjector::Mult(const Vector &x, Vector &y) const
    y += x;
 }
 
+// A copy of a ParMesh which communicates on its own communicator so that it
+// can be written by the writer thread
+class AsyncFieldWriter::WriterParMesh : public ParMesh
+{
+public:
+   WriterParMesh(const ParMesh & pmesh, MPI_Comm comm)
+      : ParMesh(pmesh) { MyComm = comm; }
+};
+
+// With a valid communicator the job writes a copy of the mesh and of the
+// spaces of its fields, otherwise the caller's objects are used
+class AsyncFieldWriter::VisItJob : public AsyncFieldWriter::Job
+{
+public:
+   VisItJob(ParMesh & pmesh, const string & prefix, const string & label,
+            MPI_Comm comm);
+   ~VisItJob();
+
+   void AddStaticField(const string & name, const GridFunction & gf)
+   { static_.push_back(new Field(name, this->getSpace(gf), gf)); }
+
+   void AddCycle(double time)
+   { times_.push_back(time); cycles_.resize(times_.size()); }
+
+   void AddField(const string & name, const GridFunction & gf)
+   {
+      MFEM_ASSERT(!cycles_.empty(), "VisItJob: no cycle has been started");
+      cycles_.back().push_back(new Field(name, this->getSpace(gf), gf));
+   }
+
+   void Write();
+
+private:
+   struct Field
+   {
+      Field(const string & n, FiniteElementSpace * f, const GridFunction & gf)
+         : name(n), fes(f), data(gf) {}
+
+      string name;
+      FiniteElementSpace * fes;
+      Vector data;
+   };
+
+   FiniteElementSpace * getSpace(const GridFunction & gf);
+
+   ParMesh * pmesh_;
+   bool ownMesh_;
+   string prefix_;
+   string label_;
+
+   // Copies of the spaces of the fields keyed by the caller's spaces
+   map<const FiniteElementSpace*, FiniteElementSpace*> spaces_;
+   vector<FiniteElementCollection*> fecs_;
+
+   vector<Field*> static_;
+   vector<double> times_;
+   vector<vector<Field*> > cycles_;
+};
+
+AsyncFieldWriter::VisItJob::VisItJob(ParMesh & pmesh, const string & prefix,
+                                     const string & label, MPI_Comm comm)
+   : pmesh_(&pmesh),
+     ownMesh_(false),
+     prefix_(prefix),
+     label_(label)
+{
+   if ( comm != MPI_COMM_NULL )
+   {
+      pmesh_ = new WriterParMesh(pmesh, comm);
+      ownMesh_ = true;
+   }
+}
+
+AsyncFieldWriter::VisItJob::~VisItJob()
+{
+   for (unsigned int i=0; i<static_.size(); i++)
+   {
+      delete static_[i];
+   }
+   for (unsigned int c=0; c<cycles_.size(); c++)
+   {
+      for (unsigned int i=0; i<cycles_[c].size(); i++)
+      {
+         delete cycles_[c][i];
+      }
+   }
+
+   map<const FiniteElementSpace*, FiniteElementSpace*>::iterator mit;
+   for (mit=spaces_.begin(); mit!=spaces_.end(); mit++)
+   {
+      delete mit->second;
+   }
+   for (unsigned int i=0; i<fecs_.size(); i++)
+   {
+      delete fecs_[i];
+   }
+   if ( ownMesh_ ) { delete pmesh_; }
+}
+
+FiniteElementSpace *
+AsyncFieldWriter::VisItJob::getSpace(const GridFunction & gf)
+{
+   const FiniteElementSpace * fes = gf.FESpace();
+   if ( !ownMesh_ ) { return const_cast<FiniteElementSpace*>(fes); }
+
+   map<const FiniteElementSpace*, FiniteElementSpace*>::iterator mit =
+      spaces_.find(fes);
+   if ( mit != spaces_.end() ) { return mit->second; }
+
+   // A serial space on the local mesh reproduces the local dofs of the
+   // parallel space without communicating
+   FiniteElementCollection * fec =
+      FiniteElementCollection::New(fes->FEColl()->Name());
+   fecs_.push_back(fec);
+
+   FiniteElementSpace * copy =
+      new FiniteElementSpace(pmesh_, fec, fes->GetVDim(), fes->GetOrdering());
+   spaces_[fes] = copy;
+   return copy;
+}
+
+void
+AsyncFieldWriter::VisItJob::Write()
+{
+   // The grid functions only wrap the copied data
+   map<string, GridFunction*> gfs;
+   {
+      VisItDataCollection visit_dc(label_.c_str(), pmesh_);
+      visit_dc.SetPrefixPath(prefix_.c_str());
+
+      for (unsigned int i=0; i<static_.size(); i++)
+      {
+         GridFunction * gf = new GridFunction(static_[i]->fes,
+                                              static_[i]->data.GetData());
+         gfs[static_[i]->name] = gf;
+         visit_dc.RegisterField(static_[i]->name.c_str(), gf);
+      }
+
+      for (unsigned int c=0; c<cycles_.size(); c++)
+      {
+         for (unsigned int i=0; i<cycles_[c].size(); i++)
+         {
+            Field * f = cycles_[c][i];
+            if ( gfs.find(f->name) == gfs.end() )
+            {
+               gfs[f->name] = new GridFunction(f->fes, f->data.GetData());
+               visit_dc.RegisterField(f->name.c_str(), gfs[f->name]);
+            }
+            else
+            {
+               gfs[f->name]->SetData(f->data.GetData());
+            }
+         }
+
+         visit_dc.SetCycle(c+1);
+         visit_dc.SetTime(times_[c]);
+         visit_dc.Save();
+      }
+   }
+
+   map<string, GridFunction*>::iterator mit;
+   for (mit=gfs.begin(); mit!=gfs.end(); mit++)
+   {
+      delete mit->second;
+   }
+}
+
+template <typename T>
+static void
+WriteBinary(ostream & os, const vector<T> & v)
+{
+   if ( !v.empty() )
+   {
+      os.write((const char*)&v[0], sizeof(T) * v.size());
+   }
+}
+
+template <typename T>
+static void
+CopyArray(const T * src, int n, vector<T> & dst)
+{
+   dst.resize(n);
+   for (int i=0; i<n; i++) { dst[i] = src[i]; }
+}
+
+class AsyncFieldWriter::MatrixJob : public AsyncFieldWriter::Job
+{
+public:
+   MatrixJob(HypreParMatrix & A, const string & fname, int rank);
+
+   void Write();
+
+private:
+   string fname_;
+
+   HYPRE_Int info_[9];
+
+   vector<HYPRE_Int> diagI_;
+   vector<HYPRE_Int> diagJ_;
+   vector<double>    diagA_;
+   vector<HYPRE_Int> offdI_;
+   vector<HYPRE_Int> offdJ_;
+   vector<double>    offdA_;
+   vector<HYPRE_Int> colMap_;
+};
+
+AsyncFieldWriter::MatrixJob::MatrixJob(HypreParMatrix & A,
+                                       const string & fname, int rank)
+{
+   ostringstream oss;
+   oss << fname << "." << setfill('0') << setw(5) << rank;
+   fname_ = oss.str();
+
+   hypre_ParCSRMatrix * parcsr = (hypre_ParCSRMatrix*)A;
+   hypre_CSRMatrix * diag = hypre_ParCSRMatrixDiag(parcsr);
+   hypre_CSRMatrix * offd = hypre_ParCSRMatrixOffd(parcsr);
+
+   int nrows    = hypre_CSRMatrixNumRows(diag);
+   int diag_nnz = hypre_CSRMatrixNumNonzeros(diag);
+   int offd_nnz = hypre_CSRMatrixNumNonzeros(offd);
+   int offd_nc  = hypre_CSRMatrixNumCols(offd);
+
+   info_[0] = hypre_ParCSRMatrixGlobalNumRows(parcsr);
+   info_[1] = hypre_ParCSRMatrixGlobalNumCols(parcsr);
+   info_[2] = hypre_ParCSRMatrixFirstRowIndex(parcsr);
+   info_[3] = hypre_ParCSRMatrixFirstColDiag(parcsr);
+   info_[4] = nrows;
+   info_[5] = hypre_CSRMatrixNumCols(diag);
+   info_[6] = diag_nnz;
+   info_[7] = offd_nnz;
+   info_[8] = offd_nc;
+
+   CopyArray(hypre_CSRMatrixI(diag), nrows + 1, diagI_);
+   CopyArray(hypre_CSRMatrixJ(diag), diag_nnz, diagJ_);
+   CopyArray(hypre_CSRMatrixData(diag), diag_nnz, diagA_);
+
+   CopyArray(hypre_CSRMatrixI(offd), nrows + 1, offdI_);
+   CopyArray(hypre_CSRMatrixJ(offd), offd_nnz, offdJ_);
+   CopyArray(hypre_CSRMatrixData(offd), offd_nnz, offdA_);
+
+   CopyArray(hypre_ParCSRMatrixColMapOffd(parcsr), offd_nc, colMap_);
+}
+
+void
+AsyncFieldWriter::MatrixJob::Write()
+{
+   ofstream ofs(fname_.c_str(), ios::out | ios::binary);
+
+   int big = ( sizeof(HYPRE_Int) == 8 ) ? 1 : 0;
+   ofs.write((const char*)&big, sizeof(int));
+   ofs.write((const char*)info_, sizeof(info_));
+
+   WriteBinary(ofs, diagI_);
+   WriteBinary(ofs, diagJ_);
+   WriteBinary(ofs, diagA_);
+   WriteBinary(ofs, offdI_);
+   WriteBinary(ofs, offdJ_);
+   WriteBinary(ofs, offdA_);
+   WriteBinary(ofs, colMap_);
+
+   ofs.close();
+}
+
+AsyncFieldWriter::AsyncFieldWriter(ParMesh & pmesh, bool async,
+                                   int max_pending)
+   : async_(false),
+     max_pending_(std::max(max_pending, 1)),
+     pending_(0),
+     done_(false),
+     myid_(0),
+     comm_(MPI_COMM_NULL),
+     pmesh_(&pmesh),
+     visit_(NULL)
+{
+   MPI_Comm_rank(pmesh.GetComm(), &myid_);
+
+   // Writing from a second thread requires full thread support and every
+   // processor has to agree on the mode
+   int provided = MPI_THREAD_SINGLE;
+   MPI_Query_thread(&provided);
+
+   int loc_async = ( async && provided == MPI_THREAD_MULTIPLE ) ? 1 : 0;
+   int glb_async = 0;
+   MPI_Allreduce(&loc_async, &glb_async, 1, MPI_INT, MPI_MIN,
+                 pmesh.GetComm());
+   async_ = glb_async == 1;
+
+   if ( async && !async_ && myid_ == 0 )
+   {
+      cout << "AsyncFieldWriter: MPI_THREAD_MULTIPLE is not available, "
+           << "output will be written synchronously" << endl;
+   }
+
+   if ( !async_ ) { return; }
+
+   MPI_Comm_dup(pmesh.GetComm(), &comm_);
+
+   pthread_mutex_init(&mutex_, NULL);
+   pthread_cond_init(&cond_, NULL);
+   pthread_create(&thread_, NULL, AsyncFieldWriter::run, this);
+}
+
+AsyncFieldWriter::~AsyncFieldWriter()
+{
+   delete visit_;
+
+   if ( !async_ ) { return; }
+
+   pthread_mutex_lock(&mutex_);
+   done_ = true;
+   pthread_cond_broadcast(&cond_);
+   pthread_mutex_unlock(&mutex_);
+
+   // The thread finishes the remaining jobs before exiting
+   pthread_join(thread_, NULL);
+
+   pthread_cond_destroy(&cond_);
+   pthread_mutex_destroy(&mutex_);
+
+   MPI_Comm_free(&comm_);
+}
+
+void
+AsyncFieldWriter::BeginVisitCollection(const string & prefix,
+                                       const string & label)
+{
+   delete visit_;
+   visit_ = new VisItJob(*pmesh_, prefix, label, comm_);
+}
+
+void
+AsyncFieldWriter::AddVisitStaticField(const string & name,
+                                      const GridFunction & gf)
+{
+   MFEM_ASSERT(visit_ != NULL, "AsyncFieldWriter: no VisIt collection");
+   visit_->AddStaticField(name, gf);
+}
+
+void
+AsyncFieldWriter::AddVisitCycle(double time)
+{
+   MFEM_ASSERT(visit_ != NULL, "AsyncFieldWriter: no VisIt collection");
+   visit_->AddCycle(time);
+}
+
+void
+AsyncFieldWriter::AddVisitField(const string & name, const GridFunction & gf)
+{
+   MFEM_ASSERT(visit_ != NULL, "AsyncFieldWriter: no VisIt collection");
+   visit_->AddField(name, gf);
+}
+
+void
+AsyncFieldWriter::EndVisitCollection()
+{
+   MFEM_ASSERT(visit_ != NULL, "AsyncFieldWriter: no VisIt collection");
+   this->submit(visit_);
+   visit_ = NULL;
+}
+
+void
+AsyncFieldWriter::WriteMatrix(HypreParMatrix & A, const string & fname)
+{
+   this->submit(new MatrixJob(A, fname, myid_));
+}
+
+void
+AsyncFieldWriter::Flush()
+{
+   if ( !async_ ) { return; }
+
+   pthread_mutex_lock(&mutex_);
+   while ( pending_ > 0 )
+   {
+      pthread_cond_wait(&cond_, &mutex_);
+   }
+   pthread_mutex_unlock(&mutex_);
+}
+
+void
+AsyncFieldWriter::submit(Job * job)
+{
+   if ( !async_ )
+   {
+      job->Write();
+      delete job;
+      return;
+   }
+
+   // Bound the memory held by snapshots which have not yet been written
+   pthread_mutex_lock(&mutex_);
+   while ( pending_ >= max_pending_ )
+   {
+      pthread_cond_wait(&cond_, &mutex_);
+   }
+   jobs_.push_back(job);
+   pending_++;
+   pthread_cond_broadcast(&cond_);
+   pthread_mutex_unlock(&mutex_);
+}
+
+void *
+AsyncFieldWriter::run(void * writer)
+{
+   AsyncFieldWriter * w = (AsyncFieldWriter*)writer;
+
+   pthread_mutex_lock(&w->mutex_);
+   while ( true )
+   {
+      while ( w->jobs_.empty() && !w->done_ )
+      {
+         pthread_cond_wait(&w->cond_, &w->mutex_);
+      }
+      if ( w->jobs_.empty() ) { break; }
+
+      Job * job = w->jobs_.front();
+      w->jobs_.pop_front();
+      pthread_mutex_unlock(&w->mutex_);
+
+      job->Write();
+      delete job;
+
+      pthread_mutex_lock(&w->mutex_);
+      w->pending_--;
+      pthread_cond_broadcast(&w->cond_);
+   }
+   pthread_mutex_unlock(&w->mutex_);
+
+   return NULL;
+}
+
+SinglePrecisionChebyshev::SinglePrecisionChebyshev(HypreParMatrix & A,
+                                                   int order,
+                                                   double lambda_ratio,
+                                                   int power_its)
+   : Solver(A.Height()),
+     A_((hypre_ParCSRMatrix*)A),
+     order_(order),
+     lmin_(1.0/lambda_ratio),
+     lmax_(1.0)
+{
+   MFEM_ASSERT(order_ > 0, "SinglePrecisionChebyshev: order must be positive");
+
+   hypre_CSRMatrix * diag = hypre_ParCSRMatrixDiag(A_);
+   hypre_CSRMatrix * offd = hypre_ParCSRMatrixOffd(A_);
+
+   int nrows = hypre_CSRMatrixNumRows(diag);
+   int nnz_d = hypre_CSRMatrixNumNonzeros(diag);
+   int nnz_o = hypre_CSRMatrixNumNonzeros(offd);
+   int ncols = hypre_CSRMatrixNumCols(offd);
+
+   // Only the values are copied, the sparsity pattern is shared with A
+   double * a_d = hypre_CSRMatrixData(diag);
+   double * a_o = hypre_CSRMatrixData(offd);
+
+   diagA_.SetSize(nnz_d);
+   for (int j=0; j<nnz_d; j++) { diagA_[j] = (float)a_d[j]; }
+
+   offdA_.SetSize(nnz_o);
+   for (int j=0; j<nnz_o; j++) { offdA_[j] = (float)a_o[j]; }
+
+   // The l1 row sums bound the spectrum of the scaled operator by one
+   HYPRE_Int * I_d = hypre_CSRMatrixI(diag);
+   HYPRE_Int * I_o = hypre_CSRMatrixI(offd);
+
+   l1Inv_.SetSize(nrows);
+   for (int i=0; i<nrows; i++)
+   {
+      double l1 = 0.0;
+      for (int j=I_d[i]; j<I_d[i+1]; j++) { l1 += fabs(a_d[j]); }
+      if ( nnz_o > 0 )
+      {
+         for (int j=I_o[i]; j<I_o[i+1]; j++) { l1 += fabs(a_o[j]); }
+      }
+      l1Inv_[i] = ( l1 > 0.0 ) ? (float)(1.0/l1) : 0.0f;
+   }
+
+   if ( hypre_ParCSRMatrixCommPkg(A_) == NULL )
+   {
+      hypre_MatvecCommPkgCreate(A_);
+   }
+   hypre_ParCSRCommPkg * comm_pkg = hypre_ParCSRMatrixCommPkg(A_);
+   int num_sends = hypre_ParCSRCommPkgNumSends(comm_pkg);
+   int num_recvs = hypre_ParCSRCommPkgNumRecvs(comm_pkg);
+
+   sendBuf_.SetSize(hypre_ParCSRCommPkgSendMapStart(comm_pkg, num_sends));
+   recvBuf_.SetSize(ncols);
+   requests_.SetSize(num_sends + num_recvs);
+
+   r_.SetSize(nrows);
+   z_.SetSize(nrows);
+   d_.SetSize(nrows);
+   t_.SetSize(nrows);
+
+   if ( power_its > 0 )
+   {
+      lmax_ = this->estimateLargestEigenvalue(power_its);
+      lmin_ = lmax_ / lambda_ratio;
+   }
+}
+
+double
+SinglePrecisionChebyshev::estimateLargestEigenvalue(int its) const
+{
+   int n = z_.Size();
+   HYPRE_Int first = hypre_ParCSRMatrixFirstRowIndex(A_);
+   MPI_Comm comm = hypre_ParCSRMatrixComm(A_);
+
+   // A start vector which depends only on the global row keeps the estimate
+   // independent of the partitioning
+   for (int i=0; i<n; i++)
+   {
+      z_[i] = ( l1Inv_[i] > 0.0f ) ?
+              (float)(1.0 + 0.5 * sin((double)(first + i))) : 0.0f;
+   }
+
+   // D^{-1} A is self-adjoint in the inner product weighted by the l1 row
+   // sums D so its Rayleigh quotient approaches lmax from below
+   double lambda = 1.0;
+   for (int k=0; k<its; k++)
+   {
+      this->MultFloat(z_, t_);
+
+      double loc[2] = { 0.0, 0.0 };
+      double glb[2];
+      for (int i=0; i<n; i++)
+      {
+         if ( l1Inv_[i] == 0.0f ) { continue; }
+         loc[0] += (double)z_[i] * t_[i];
+         loc[1] += (double)z_[i] * z_[i] / l1Inv_[i];
+      }
+      MPI_Allreduce(loc, glb, 2, MPI_DOUBLE, MPI_SUM, comm);
+      if ( glb[1] <= 0.0 ) { break; }
+
+      lambda = glb[0] / glb[1];
+
+      float s = (float)(1.0 / sqrt(glb[1]));
+      for (int i=0; i<n; i++) { z_[i] = s * l1Inv_[i] * t_[i]; }
+   }
+
+   // Widen the interval slightly since the estimate is a lower bound
+   return min(1.0, 1.1 * lambda);
+}
+
+size_t
+SinglePrecisionChebyshev::GetMemoryUsage() const
+{
+   return sizeof(float) * ( diagA_.Size() + offdA_.Size() + l1Inv_.Size() +
+                            r_.Size() + z_.Size() + d_.Size() + t_.Size() +
+                            sendBuf_.Size() + recvBuf_.Size() );
+}
+
+void
+SinglePrecisionChebyshev::MultFloat(const Array<float> &x,
+                                    Array<float> &y) const
+{
+   hypre_CSRMatrix * diag = hypre_ParCSRMatrixDiag(A_);
+   hypre_CSRMatrix * offd = hypre_ParCSRMatrixOffd(A_);
+   hypre_ParCSRCommPkg * comm_pkg = hypre_ParCSRMatrixCommPkg(A_);
+
+   int nrows = hypre_CSRMatrixNumRows(diag);
+
+   HYPRE_Int * I_d = hypre_CSRMatrixI(diag);
+   HYPRE_Int * J_d = hypre_CSRMatrixJ(diag);
+   HYPRE_Int * I_o = hypre_CSRMatrixI(offd);
+   HYPRE_Int * J_o = hypre_CSRMatrixJ(offd);
+
+   // Start the exchange of the off-processor entries of x.  hypre only
+   // exchanges doubles so the messages are posted here to send floats.
+   MPI_Comm comm = hypre_ParCSRCommPkgComm(comm_pkg);
+   int num_sends = hypre_ParCSRCommPkgNumSends(comm_pkg);
+   int num_recvs = hypre_ParCSRCommPkgNumRecvs(comm_pkg);
+   HYPRE_Int * send_starts = hypre_ParCSRCommPkgSendMapStarts(comm_pkg);
+   HYPRE_Int * recv_starts = hypre_ParCSRCommPkgRecvVecStarts(comm_pkg);
+
+   for (int p=0; p<num_recvs; p++)
+   {
+      MPI_Irecv(recvBuf_.GetData() + recv_starts[p],
+                recv_starts[p+1] - recv_starts[p], MPI_FLOAT,
+                hypre_ParCSRCommPkgRecvProc(comm_pkg, p), 0, comm,
+                &requests_[p]);
+   }
+   for (int j=0; j<sendBuf_.Size(); j++)
+   {
+      sendBuf_[j] = x[hypre_ParCSRCommPkgSendMapElmt(comm_pkg, j)];
+   }
+   for (int p=0; p<num_sends; p++)
+   {
+      MPI_Isend(sendBuf_.GetData() + send_starts[p],
+                send_starts[p+1] - send_starts[p], MPI_FLOAT,
+                hypre_ParCSRCommPkgSendProc(comm_pkg, p), 0, comm,
+                &requests_[num_recvs+p]);
+   }
+
+   // Overlap the communication with the local part of the product
+   for (int i=0; i<nrows; i++)
+   {
+      float yi = 0.0f;
+      for (int j=I_d[i]; j<I_d[i+1]; j++)
+      {
+         yi += diagA_[j] * x[J_d[j]];
+      }
+      y[i] = yi;
+   }
+
+   MPI_Waitall(requests_.Size(), requests_.GetData(), MPI_STATUSES_IGNORE);
+
+   if ( offdA_.Size() > 0 )
+   {
+      for (int i=0; i<nrows; i++)
+      {
+         float yi = 0.0f;
+         for (int j=I_o[i]; j<I_o[i+1]; j++)
+         {
+            yi += offdA_[j] * recvBuf_[J_o[j]];
+         }
+         y[i] += yi;
+      }
+   }
+}
+
+void
+SinglePrecisionChebyshev::Mult(const Vector &x, Vector &y) const
+{
+   int n = r_.Size();
+
+   const double theta = 0.5 * (lmax_ + lmin_);
+   const double delta = 0.5 * (lmax_ - lmin_);
+   const double sigma = theta / delta;
+
+   double rho = 1.0 / sigma;
+
+   // Convert to single precision at the operator boundary
+   for (int i=0; i<n; i++) { r_[i] = (float)x(i); }
+
+   for (int i=0; i<n; i++)
+   {
+      d_[i] = l1Inv_[i] * r_[i] / (float)theta;
+      z_[i] = d_[i];
+   }
+
+   for (int k=1; k<order_; k++)
+   {
+      this->MultFloat(z_, t_);
+
+      double rho_new = 1.0 / (2.0 * sigma - rho);
+      float  c0 = (float)(rho_new * rho);
+      float  c1 = (float)(2.0 * rho_new / delta);
+
+      for (int i=0; i<n; i++)
+      {
+         d_[i] = c0 * d_[i] + c1 * l1Inv_[i] * (r_[i] - t_[i]);
+         z_[i] += d_[i];
+      }
+      rho = rho_new;
+   }
+
+   for (int i=0; i<n; i++) { y(i) = z_[i]; }
+}
+
+// True on every processor when the two meshes have the same elements, with
+// the same geometries and vertices, at the same vertex positions
+static bool
+SameParMesh(ParMesh & a, ParMesh & b)
+{
+   int same = ( a.GetNE() == b.GetNE() && a.GetNV() == b.GetNV() &&
+                a.SpaceDimension() == b.SpaceDimension() ) ? 1 : 0;
+
+   Array<int> va, vb;
+   for (int i=0; same && i<a.GetNE(); i++)
+   {
+      a.GetElementVertices(i, va);
+      b.GetElementVertices(i, vb);
+      if ( a.GetElementBaseGeometry(i) != b.GetElementBaseGeometry(i) ||
+           va.Size() != vb.Size() )
+      {
+         same = 0;
+         break;
+      }
+      for (int j=0; j<va.Size(); j++)
+      {
+         if ( va[j] != vb[j] ) { same = 0; break; }
+      }
+   }
+
+   int sdim = a.SpaceDimension();
+   for (int i=0; same && i<a.GetNV(); i++)
+   {
+      const double * xa = a.GetVertex(i);
+      const double * xb = b.GetVertex(i);
+      for (int d=0; d<sdim; d++)
+      {
+         if ( fabs(xa[d] - xb[d]) > 1e-10 * (1.0 + fabs(xa[d])) )
+         {
+            same = 0;
+            break;
+         }
+      }
+   }
+
+   MPI_Allreduce(MPI_IN_PLACE, &same, 1, MPI_INT, MPI_MIN, a.GetComm());
+   return same == 1;
+}
+
+HCurlMultigrid::HCurlMultigrid(ParMesh & coarse_mesh, int num_ref,
+                               int order, ParFiniteElementSpace & fine_hcurl)
+   : Solver(fine_hcurl.TrueVSize()),
+     singular_(false),
+     coarseSolver_(NULL)
+{
+   MPI_Comm comm = coarse_mesh.GetComm();
+   ParMesh & fine_mesh = *fine_hcurl.GetParMesh();
+   int dim  = coarse_mesh.Dimension();
+   int nlvl = num_ref + 1;
+
+   // Only the levels below the finest one are owned by the hierarchy
+   meshes_.resize(nlvl - 1, NULL);
+   hcurl_.resize(nlvl, NULL);
+   G_.resize(nlvl, NULL);
+   hcurl_[nlvl-1] = &fine_hcurl;
+
+   if ( nlvl == 1 )
+   {
+      MFEM_VERIFY(SameParMesh(coarse_mesh, fine_mesh),
+                  "HCurlMultigrid: the coarse mesh does not match the mesh "
+                  "of the finest level");
+   }
+   else
+   {
+      meshes_[0] = new ParMesh(coarse_mesh);
+      hcurl_[0]  = new ND_ParFESpace(meshes_[0], order, dim);
+   }
+
+   for (int l=1; l<nlvl; l++)
+   {
+      // Each level starts as a copy of the previous one so that refining it
+      // produces the update operator between the two.  The copy refined to
+      // the finest level is only kept until that operator is extracted.
+      ParMesh * mesh = new ParMesh(*meshes_[l-1]);
+      ND_ParFESpace * hcurl = new ND_ParFESpace(mesh, order, dim);
+
+      mesh->UniformRefinement();
+      hcurl->Update();
+
+      if ( l == nlvl - 1 )
+      {
+         MFEM_VERIFY(SameParMesh(*mesh, fine_mesh) &&
+                     hcurl->GlobalTrueVSize() ==
+                     fine_hcurl.GlobalTrueVSize(),
+                     "HCurlMultigrid: the refined coarse mesh does not "
+                     "match the mesh of the finest level");
+      }
+
+      SparseMatrix * U =
+         dynamic_cast<SparseMatrix*>(hcurl->GetUpdateOperator());
+      MFEM_VERIFY(U != NULL, "HCurlMultigrid: unsupported update operator");
+      hcurl->SetUpdateOperatorOwner(false);
+
+      ParFiniteElementSpace & cfes = *hcurl_[l-1];
+      ParFiniteElementSpace & ffes = *hcurl;
+
+      // The refinement acts on the local dofs so the true dof prolongation
+      // is R_fine U P_coarse
+      HypreParMatrix Uh(comm, ffes.GlobalVSize(), cfes.GlobalVSize(),
+                        ffes.GetDofOffsets(), cfes.GetDofOffsets(), U);
+      HypreParMatrix Rh(comm, ffes.GlobalTrueVSize(), ffes.GlobalVSize(),
+                        ffes.GetTrueDofOffsets(), ffes.GetDofOffsets(),
+                        const_cast<SparseMatrix*>(ffes.GetRestrictionMatrix()));
+
+      HypreParMatrix * UP = ParMult(&Uh, cfes.Dof_TrueDof_Matrix());
+      P_.push_back(ParMult(&Rh, UP));
+      delete UP;
+      delete U;
+
+      if ( l == nlvl - 1 )
+      {
+         // The finest gradient is set by SetFineGradient
+         delete hcurl;
+         delete mesh;
+         break;
+      }
+
+      meshes_[l] = mesh;
+      hcurl_[l]  = hcurl;
+
+      H1_ParFESpace h1(mesh, order, dim);
+      ParDiscreteGradOperator grad(&h1, hcurl);
+      grad.Assemble();
+      grad.Finalize();
+      G_[l] = grad.ParallelAssemble();
+   }
+}
+
+HCurlMultigrid::~HCurlMultigrid()
+{
+   this->clearOperators();
+
+   for (unsigned int l=0; l<P_.size(); l++) { delete P_[l]; }
+   for (unsigned int l=0; l<meshes_.size(); l++)
+   {
+      delete G_[l];
+      delete hcurl_[l];
+      delete meshes_[l];
+   }
+}
+
+void
+HCurlMultigrid::clearOperators()
+{
+   // The finest operator belongs to the caller
+   for (int l=0; l<(int)S_.size()-1; l++) { delete S_[l]; }
+   for (unsigned int l=0; l<SG_.size(); l++)
+   {
+      delete SG_[l];
+      delete edgeSmoother_[l];
+      delete nodeSmoother_[l];
+   }
+   S_.clear();
+   SG_.clear();
+   edgeSmoother_.clear();
+   nodeSmoother_.clear();
+
+   delete coarseSolver_; coarseSolver_ = NULL;
+}
+
+void
+HCurlMultigrid::SetFineGradient(const HypreParMatrix & G)
+{
+   int l = (int)hcurl_.size() - 1;
+   G_[l] = const_cast<HypreParMatrix*>(&G);
+   if ( l > 0 && !S_.empty() ) { this->buildNodeSmoother(l); }
+}
+
+void
+HCurlMultigrid::buildNodeSmoother(int l)
+{
+   delete nodeSmoother_[l];
+   delete SG_[l];
+
+   SG_[l] = RAP(S_[l], G_[l]);
+   nodeSmoother_[l] = new HypreSmoother(*SG_[l], HypreSmoother::l1Jacobi);
+
+   rg_[l].SetSize(SG_[l]->Height());
+   xg_[l].SetSize(SG_[l]->Height());
+}
+
+void
+HCurlMultigrid::SetOperator(const Operator &op)
+{
+   const HypreParMatrix * S = dynamic_cast<const HypreParMatrix*>(&op);
+   MFEM_VERIFY(S != NULL, "HCurlMultigrid requires a HypreParMatrix");
+   MFEM_VERIFY(S->Height() == height,
+               "HCurlMultigrid: operator does not match the finest level");
+
+   this->clearOperators();
+
+   int nlvl = (int)hcurl_.size();
+
+   S_.resize(nlvl, NULL);
+   SG_.resize(nlvl, NULL);
+   edgeSmoother_.resize(nlvl, NULL);
+   nodeSmoother_.resize(nlvl, NULL);
+
+   // Galerkin coarse operators inherit the kappa shift exactly
+   S_[nlvl-1] = const_cast<HypreParMatrix*>(S);
+   for (int l=nlvl-1; l>0; l--)
+   {
+      S_[l-1] = RAP(S_[l], P_[l-1]);
+   }
+
+   r_.resize(nlvl);  x_.resize(nlvl);  b_.resize(nlvl);
+   rg_.resize(nlvl); xg_.resize(nlvl);
+
+   for (int l=1; l<nlvl; l++)
+   {
+      edgeSmoother_[l] = new HypreSmoother(*S_[l], HypreSmoother::l1Jacobi);
+      edgeSmoother_[l]->iterative_mode = true;
+
+      r_[l].SetSize(S_[l]->Height());
+
+      if ( G_[l] ) { this->buildNodeSmoother(l); }
+   }
+   for (int l=0; l<nlvl-1; l++)
+   {
+      x_[l].SetSize(S_[l]->Height());
+      b_[l].SetSize(S_[l]->Height());
+   }
+
+   coarseSolver_ = new HypreAMS(*S_[0], hcurl_[0]);
+   if ( singular_ ) { coarseSolver_->SetSingularProblem(); }
+}
+
+void
+HCurlMultigrid::smooth(int l, const Vector & b, Vector & x, bool pre) const
+{
+   for (int s=0; s<2; s++)
+   {
+      if ( ( s == 0 ) == pre )
+      {
+         edgeSmoother_[l]->Mult(b, x);
+      }
+      else
+      {
+         // Relax the gradient components of the residual
+         S_[l]->Mult(x, r_[l]);
+         subtract(b, r_[l], r_[l]);
+         G_[l]->MultTranspose(r_[l], rg_[l]);
+         nodeSmoother_[l]->Mult(rg_[l], xg_[l]);
+         G_[l]->Mult(1.0, xg_[l], 1.0, x);
+      }
+   }
+}
+
+void
+HCurlMultigrid::cycle(int l, const Vector & b, Vector & x) const
+{
+   if ( l == 0 )
+   {
+      coarseSolver_->Mult(b, x);
+      return;
+   }
+
+   x = 0.0;
+   this->smooth(l, b, x, true);
+
+   S_[l]->Mult(x, r_[l]);
+   subtract(b, r_[l], r_[l]);
+   P_[l-1]->MultTranspose(r_[l], b_[l-1]);
+
+   this->cycle(l-1, b_[l-1], x_[l-1]);
+
+   P_[l-1]->Mult(1.0, x_[l-1], 1.0, x);
+
+   this->smooth(l, b, x, false);
+}
+
+void
+HCurlMultigrid::Mult(const Vector &x, Vector &y) const
+{
+   MFEM_ASSERT(coarseSolver_ != NULL, "HCurlMultigrid: SetOperator not called");
+   MFEM_ASSERT(hcurl_.size() == 1 || nodeSmoother_.back() != NULL,
+               "HCurlMultigrid: SetFineGradient not called");
+   this->cycle((int)hcurl_.size() - 1, x, y);
+}
+
+// Power iterations used to weight the Jacobi smoother of a partially
+// assembled S1
+static const int LowOrderJacobiPowerIts = 10;
+
+HCurlLowOrderSolver::HCurlLowOrderSolver(ParFiniteElementSpace & HCurlFESpace)
+   : Solver(HCurlFESpace.TrueVSize()),
+     singular_(false),
+     kCoef_(NULL),
+     beta_(0.0),
+     HCurlFESpace_(&HCurlFESpace),
+     HCurlFESpace1_(NULL),
+     P_(NULL),
+     S_(NULL),
+     SPA_(NULL),
+     S1_(NULL),
+     smoother_(NULL),
+     omega_(1.0),
+     ams_(NULL)
+{
+   ParMesh * pmesh = HCurlFESpace.GetParMesh();
+   HCurlFESpace1_ = new ND_ParFESpace(pmesh, 1, pmesh->Dimension());
+
+   // The lowest order space is nested so interpolation is exact
+   ParDiscreteLinearOperator id(HCurlFESpace1_, &HCurlFESpace);
+   id.AddDomainInterpolator(new IdentityInterpolator);
+   id.Assemble();
+   id.Finalize();
+   P_ = id.ParallelAssemble();
+
+   r_.SetSize(P_->Height());
+   r1_.SetSize(P_->Width());
+   x1_.SetSize(P_->Width());
+}
+
+HCurlLowOrderSolver::~HCurlLowOrderSolver()
+{
+   this->clearOperators();
+   delete P_;
+   delete HCurlFESpace1_;
+}
+
+void
+HCurlLowOrderSolver::SetCoefficients(Coefficient & kCoef, double beta,
+                                     const Vector & zeta)
+{
+   kCoef_ = &kCoef;
+   beta_  = beta;
+   zeta_  = zeta;
+}
+
+void
+HCurlLowOrderSolver::clearOperators()
+{
+   delete ams_;      ams_      = NULL;
+   delete smoother_; smoother_ = NULL;
+   delete S1_;       S1_       = NULL;
+   S_   = NULL;
+   SPA_ = NULL;
+}
+
+void
+HCurlLowOrderSolver::assembleLowOrder()
+{
+   MFEM_VERIFY(kCoef_ != NULL,
+               "HCurlLowOrderSolver: SetCoefficients not called");
+
+   ShiftedMassCoefficient zkzCoef(*kCoef_, zeta_, beta_);
+
+   ParBilinearForm s1(HCurlFESpace1_);
+   s1.AddDomainIntegrator(new CurlCurlIntegrator(*kCoef_));
+   if ( fabs(beta_) > 0.0 )
+   {
+      s1.AddDomainIntegrator(new VectorFEMassIntegrator(zkzCoef));
+   }
+   s1.Assemble();
+   s1.Finalize();
+   S1_ = s1.ParallelAssemble();
+
+   ams_ = new HypreAMS(*S1_, HCurlFESpace1_);
+   if ( singular_ ) { ams_->SetSingularProblem(); }
+}
+
+void
+HCurlLowOrderSolver::SetOperator(const Operator &op)
+{
+   const HypreParMatrix * S = dynamic_cast<const HypreParMatrix*>(&op);
+   MFEM_VERIFY(S != NULL, "HCurlLowOrderSolver requires a HypreParMatrix");
+   MFEM_VERIFY(S->Height() == height,
+               "HCurlLowOrderSolver: operator does not match the space");
+
+   this->clearOperators();
+
+   S_ = const_cast<HypreParMatrix*>(S);
+
+   smoother_ = new HypreSmoother(*S_, HypreSmoother::l1Jacobi);
+   smoother_->iterative_mode = true;
+
+   this->assembleLowOrder();
+}
+
+void
+HCurlLowOrderSolver::SetOperator(const MaxwellBlochPAOperator & A)
+{
+   MFEM_VERIFY(A.Height() == 2 * height,
+               "HCurlLowOrderSolver: operator does not match the space");
+
+   this->clearOperators();
+
+   SPA_ = &A;
+   SPA_->GetDiagonal(diag_);
+
+   // Jacobi sweeps weighted by 1 / lambda_max(D^{-1} S1) cannot diverge
+   MPI_Comm comm = HCurlFESpace_->GetComm();
+   Vector v(height), w(height);
+   v.Randomize(123);
+   double lmax = 1.0;
+   for (int it=0; it<LowOrderJacobiPowerIts; it++)
+   {
+      double loc[2] = { 0.0, 0.0 }, glb[2];
+      this->applyS(v, w);
+      for (int i=0; i<height; i++)
+      {
+         loc[0] += v(i) * w(i);
+         w(i) /= diag_(i);
+         loc[1] += v(i) * diag_(i) * v(i);
+      }
+      MPI_Allreduce(loc, glb, 2, MPI_DOUBLE, MPI_SUM, comm);
+      if ( glb[1] > 0.0 ) { lmax = glb[0] / glb[1]; }
+
+      double nrm = 0.0;
+      loc[0] = w * w;
+      MPI_Allreduce(loc, &nrm, 1, MPI_DOUBLE, MPI_SUM, comm);
+      if ( nrm == 0.0 ) { break; }
+      v.Set(1.0 / sqrt(nrm), w);
+   }
+   // The Rayleigh quotient underestimates lambda_max
+   omega_ = 1.0 / (1.1 * lmax);
+
+   this->assembleLowOrder();
+}
+
+void
+HCurlLowOrderSolver::applyS(const Vector &x, Vector &y) const
+{
+   if ( S_ ) { S_->Mult(x, y); }
+   else      { SPA_->MultDiagonalBlock(x, y); }
+}
+
+void
+HCurlLowOrderSolver::smooth(const Vector &b, Vector &y) const
+{
+   if ( smoother_ )
+   {
+      smoother_->Mult(b, y);
+      return;
+   }
+
+   this->applyS(y, r_);
+   for (int i=0; i<height; i++)
+   {
+      y(i) += omega_ * (b(i) - r_(i)) / diag_(i);
+   }
+}
+
+void
+HCurlLowOrderSolver::Mult(const Vector &x, Vector &y) const
+{
+   MFEM_ASSERT(ams_ != NULL, "HCurlLowOrderSolver: SetOperator not called");
+
+   y = 0.0;
+   this->smooth(x, y);
+
+   this->applyS(y, r_);
+   subtract(x, r_, r_);
+   P_->MultTranspose(r_, r1_);
+   ams_->Mult(r1_, x1_);
+   P_->Mult(1.0, x1_, 1.0, y);
+
+   this->smooth(x, y);
+}
+
+// Greedy coloring of the local elements so that no two elements of a color
+// share a vertex, and therefore an edge, a face or any dof
+static void
+ColorElements(Mesh & mesh, Array<int> & offsets, Array<int> & elems)
+{
+   int ne = mesh.GetNE();
+   Table * vel = mesh.GetVertexToElementTable();
+
+   Array<int> color(ne); color = -1;
+   Array<int> used;
+   Array<int> v;
+   int nc = 0;
+   for (int e=0; e<ne; e++)
+   {
+      // used[c] == e marks the colors of the neighbors of e
+      mesh.GetElementVertices(e, v);
+      for (int i=0; i<v.Size(); i++)
+      {
+         const int * nbr = vel->GetRow(v[i]);
+         for (int j=0; j<vel->RowSize(v[i]); j++)
+         {
+            if ( color[nbr[j]] >= 0 ) { used[color[nbr[j]]] = e; }
+         }
+      }
+
+      int c = 0;
+      while ( c < nc && used[c] == e ) { c++; }
+      if ( c == nc ) { used.Append(-1); nc++; }
+      color[e] = c;
+   }
+   delete vel;
+
+   offsets.SetSize(nc+1);
+   offsets = 0;
+   for (int e=0; e<ne; e++) { offsets[color[e]+1]++; }
+   offsets.PartialSum();
+
+   Array<int> next(nc);
+   for (int c=0; c<nc; c++) { next[c] = offsets[c]; }
+   elems.SetSize(ne);
+   for (int e=0; e<ne; e++) { elems[next[color[e]]++] = e; }
+}
+
+// Signed local dofs of element e are stored in [offsets[e],offsets[e+1])
+static void
+CacheElementVDofs(FiniteElementSpace & fes, Array<int> & offsets,
+                  Array<int> & dofs)
+{
+   int ne = fes.GetNE();
+
+   Array<int> vdofs;
+   offsets.SetSize(ne+1);
+   offsets[0] = 0;
+   for (int e=0; e<ne; e++)
+   {
+      fes.GetElementVDofs(e, vdofs);
+      offsets[e+1] = offsets[e] + vdofs.Size();
+   }
+   dofs.SetSize(offsets[ne]);
+   for (int e=0; e<ne; e++)
+   {
+      fes.GetElementVDofs(e, vdofs);
+      for (int i=0; i<vdofs.Size(); i++)
+      {
+         dofs[offsets[e]+i] = vdofs[i];
+      }
+   }
+}
+
+MaxwellBlochPAOperator::MaxwellBlochPAOperator(ParFiniteElementSpace & fes,
+                                               Coefficient & coef)
+   : Operator(2*fes.TrueVSize()),
+     fes_(&fes),
+     beta_(0.0),
+     zeta_(3)
+{
+   MFEM_VERIFY(fes.GetParMesh()->Dimension() == 3 &&
+               fes.GetParMesh()->SpaceDimension() == 3,
+               "MaxwellBlochPAOperator requires a three dimensional mesh");
+
+   zeta_ = 0.0;
+
+   int ne = fes.GetNE();
+
+   // Quadrature rules are chosen per geometry, following the rule of the
+   // ShiftedCurlIntegrator, so that the reference data can be shared
+   map<int, const IntegrationRule*> rules;
+
+   qOffset_.SetSize(ne+1);
+   qOffset_[0] = 0;
+   for (int e=0; e<ne; e++)
+   {
+      const FiniteElement & fe = *fes.GetFE(e);
+      int geom = fe.GetGeomType();
+
+      if ( rules.find(geom) == rules.end() )
+      {
+         ElementTransformation * T = fes.GetElementTransformation(e);
+         int order = 2 * fe.GetOrder() + T->OrderW();
+         const IntegrationRule * ir = &IntRules.Get(geom, order);
+         rules[geom] = ir;
+
+         int nd = fe.GetDof();
+         shape_[geom].resize(ir->GetNPoints());
+         curlShape_[geom].resize(ir->GetNPoints());
+         for (int q=0; q<ir->GetNPoints(); q++)
+         {
+            const IntegrationPoint & ip = ir->IntPoint(q);
+            shape_[geom][q].SetSize(nd, 3);
+            curlShape_[geom][q].SetSize(nd, 3);
+            fe.CalcVShape(ip, shape_[geom][q]);
+            fe.CalcCurlShape(ip, curlShape_[geom][q]);
+         }
+      }
+      qOffset_[e+1] = qOffset_[e] + rules[geom]->GetNPoints();
+   }
+
+   jac_.SetSize(9 * qOffset_[ne]);
+   wdet_.SetSize(qOffset_[ne]);
+   coef_.SetSize(qOffset_[ne]);
+
+   for (int e=0; e<ne; e++)
+   {
+      const IntegrationRule & ir = *rules[fes.GetFE(e)->GetGeomType()];
+      ElementTransformation * T = fes.GetElementTransformation(e);
+
+      for (int q=0; q<ir.GetNPoints(); q++)
+      {
+         const IntegrationPoint & ip = ir.IntPoint(q);
+         T->SetIntPoint(&ip);
+
+         int k = qOffset_[e] + q;
+         const DenseMatrix & J = T->Jacobian();
+         for (int j=0; j<3; j++)
+            for (int i=0; i<3; i++)
+            {
+               jac_[9*k+i+3*j] = J(i,j);
+            }
+         wdet_[k] = ip.weight * T->Weight();
+         coef_[k] = coef.Eval(*T, ip);
+      }
+   }
+
+   CacheElementVDofs(fes, dofOffset_, dofs_);
+   ColorElements(*fes.GetParMesh(), colorOffset_, colorElems_);
+
+   xlr_.SetSize(fes.GetVSize()); xli_.SetSize(fes.GetVSize());
+   ylr_.SetSize(fes.GetVSize()); yli_.SetSize(fes.GetVSize());
+}
+
+size_t
+MaxwellBlochPAOperator::GetMemoryUsage() const
+{
+   size_t n = jac_.Size() + wdet_.Size() + coef_.Size() +
+              xlr_.Size() + xli_.Size() + ylr_.Size() + yli_.Size();
+   size_t m = qOffset_.Size() + dofOffset_.Size() + dofs_.Size() +
+              colorOffset_.Size() + colorElems_.Size();
+
+   map<int, vector<DenseMatrix> >::const_iterator mit;
+   for (mit=shape_.begin(); mit!=shape_.end(); mit++)
+   {
+      for (unsigned int q=0; q<mit->second.size(); q++)
+      {
+         n += 2 * mit->second[q].Height() * mit->second[q].Width();
+      }
+   }
+   return sizeof(double) * n + sizeof(int) * m;
+}
+
+void
+MaxwellBlochPAOperator::Mult(const Vector &x, Vector &y) const
+{
+   int tsize = fes_->TrueVSize();
+
+   Vector xr(x.GetData(), tsize), xi(x.GetData() + tsize, tsize);
+   Vector yr(y.GetData(), tsize), yi(y.GetData() + tsize, tsize);
+
+   HypreParMatrix * P = fes_->Dof_TrueDof_Matrix();
+   P->Mult(xr, xlr_);
+   P->Mult(xi, xli_);
+
+   this->multElements();
+
+   P->MultTranspose(ylr_, yr);
+   P->MultTranspose(yli_, yi);
+}
+
+void
+MaxwellBlochPAOperator::MultDiagonalBlock(const Vector &x, Vector &y) const
+{
+   // With a zero imaginary part the real part of A x is S1 x, the
+   // imaginary part -beta D x is formed and discarded
+   HypreParMatrix * P = fes_->Dof_TrueDof_Matrix();
+   P->Mult(x, xlr_);
+   xli_ = 0.0;
+
+   this->multElements();
+
+   P->MultTranspose(ylr_, y);
+}
+
+void
+MaxwellBlochPAOperator::multElements() const
+{
+   ylr_ = 0.0;
+   yli_ = 0.0;
+   for (int c=0; c<colorOffset_.Size()-1; c++)
+   {
+      // Elements of one color share no dofs so their sums cannot collide
+#ifdef MFEM_USE_OPENMP
+      #pragma omp parallel
+#endif
+      {
+         Vector xer, xei, yer, yei;
+#ifdef MFEM_USE_OPENMP
+         #pragma omp for
+#endif
+         for (int i=colorOffset_[c]; i<colorOffset_[c+1]; i++)
+         {
+            this->elementMult(colorElems_[i], xer, xei, yer, yei);
+         }
+      }
+   }
+}
+
+// c = a x b
+static inline void
+cross3(const double * a, const double * b, double * c)
+{
+   c[0] = a[1] * b[2] - a[2] * b[1];
+   c[1] = a[2] * b[0] - a[0] * b[2];
+   c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Inverse of the column major 3 x 3 matrix J from its adjugate, returns
+// the determinant
+static inline double
+invert3(const double * J, double * Jinv)
+{
+   double det = J[0] * (J[4] * J[8] - J[7] * J[5]) -
+                J[3] * (J[1] * J[8] - J[7] * J[2]) +
+                J[6] * (J[1] * J[5] - J[4] * J[2]);
+   Jinv[0] = (J[4] * J[8] - J[7] * J[5]) / det;
+   Jinv[1] = (J[7] * J[2] - J[1] * J[8]) / det;
+   Jinv[2] = (J[1] * J[5] - J[4] * J[2]) / det;
+   Jinv[3] = (J[6] * J[5] - J[3] * J[8]) / det;
+   Jinv[4] = (J[0] * J[8] - J[6] * J[2]) / det;
+   Jinv[5] = (J[3] * J[2] - J[0] * J[5]) / det;
+   Jinv[6] = (J[3] * J[7] - J[6] * J[4]) / det;
+   Jinv[7] = (J[6] * J[1] - J[0] * J[7]) / det;
+   Jinv[8] = (J[0] * J[4] - J[3] * J[1]) / det;
+   return det;
+}
+
+void
+MaxwellBlochPAOperator::elementMult(int e, Vector & xer, Vector & xei,
+                                    Vector & yer, Vector & yei) const
+{
+   int geom = fes_->GetFE(e)->GetGeomType();
+   const vector<DenseMatrix> & B  = shape_.find(geom)->second;
+   const vector<DenseMatrix> & Bc = curlShape_.find(geom)->second;
+
+   // Apart from the final sums into ylr_ and yli_ shared data is only read
+   // so threads may process elements without common dofs concurrently
+   Array<int> vdofs(const_cast<int*>(dofs_.GetData()) + dofOffset_[e],
+                    dofOffset_[e+1] - dofOffset_[e]);
+   xlr_.GetSubVector(vdofs, xer);
+   xli_.GetSubVector(vdofs, xei);
+   yer.SetSize(vdofs.Size()); yer = 0.0;
+   yei.SetSize(vdofs.Size()); yei = 0.0;
+
+   const double * z = zeta_.GetData();
+
+   double ur[3], ui[3], cr[3], ci[3], wr[3], wi[3], t[3];
+   double Jinv[9];
+   double vrd[3], vid[3], grd[3], gid[3];
+   Vector vr(vrd, 3), vi(vid, 3), gr(grd, 3), gi(gid, 3);
+
+   for (int q=qOffset_[e]; q<qOffset_[e+1]; q++)
+   {
+      int k = q - qOffset_[e];
+      const double * J = &jac_[9*q];
+
+      double det = invert3(J, Jinv);
+
+      double s = wdet_[q] * coef_[q];
+
+      // Physical values u = J^{-T} u_ref
+      B[k].MultTranspose(xer, vr);
+      B[k].MultTranspose(xei, vi);
+      for (int i=0; i<3; i++)
+      {
+         ur[i] = Jinv[3*i] * vr[0] + Jinv[3*i+1] * vr[1] + Jinv[3*i+2] * vr[2];
+         ui[i] = Jinv[3*i] * vi[0] + Jinv[3*i+1] * vi[1] + Jinv[3*i+2] * vi[2];
+      }
+
+      // Physical curls, J curl_ref / det(J)
+      Bc[k].MultTranspose(xer, vr);
+      Bc[k].MultTranspose(xei, vi);
+      for (int i=0; i<3; i++)
+      {
+         cr[i] = (J[i] * vr[0] + J[i+3] * vr[1] + J[i+6] * vr[2]) / det;
+         ci[i] = (J[i] * vi[0] + J[i+3] * vi[1] + J[i+6] * vi[2]) / det;
+      }
+
+      // w = curl u - i beta zeta x u in the convention of the assembled
+      // operators, A = [S1, beta D; -beta D, S1]
+      cross3(z, ui, t);
+      for (int i=0; i<3; i++) { wr[i] = s * (cr[i] + beta_ * t[i]); }
+      cross3(z, ur, t);
+      for (int i=0; i<3; i++) { wi[i] = s * (ci[i] - beta_ * t[i]); }
+
+      // Curl test functions, J^T w / det(J)
+      for (int i=0; i<3; i++)
+      {
+         gr[i] = (J[3*i] * wr[0] + J[3*i+1] * wr[1] + J[3*i+2] * wr[2]) / det;
+         gi[i] = (J[3*i] * wi[0] + J[3*i+1] * wi[1] + J[3*i+2] * wi[2]) / det;
+      }
+      Bc[k].AddMult(gr, yer);
+      Bc[k].AddMult(gi, yei);
+
+      // Shift test functions, (zeta x v).w = v.(w x zeta)
+      cross3(wi, z, t);
+      for (int i=0; i<3; i++)
+      {
+         gr[i] = -beta_ * (Jinv[i] * t[0] + Jinv[i+3] * t[1] +
+                           Jinv[i+6] * t[2]);
+      }
+      cross3(wr, z, t);
+      for (int i=0; i<3; i++)
+      {
+         gi[i] = beta_ * (Jinv[i] * t[0] + Jinv[i+3] * t[1] +
+                          Jinv[i+6] * t[2]);
+      }
+      B[k].AddMult(gr, yer);
+      B[k].AddMult(gi, yei);
+   }
+
+   ylr_.AddElementVector(vdofs, yer);
+   yli_.AddElementVector(vdofs, yei);
+}
+
+void
+MaxwellBlochPAOperator::GetDiagonal(Vector & diag) const
+{
+   Vector ldiag(fes_->GetVSize());
+   ldiag = 0.0;
+
+   const double * z = zeta_.GetData();
+   double z2 = zeta_ * zeta_;
+   double Jinv[9];
+
+   for (int e=0; e<fes_->GetNE(); e++)
+   {
+      int geom = fes_->GetFE(e)->GetGeomType();
+      const vector<DenseMatrix> & B  = shape_.find(geom)->second;
+      const vector<DenseMatrix> & Bc = curlShape_.find(geom)->second;
+
+      for (int q=qOffset_[e]; q<qOffset_[e+1]; q++)
+      {
+         int k = q - qOffset_[e];
+         const double * J = &jac_[9*q];
+         double det = invert3(J, Jinv);
+         double s = wdet_[q] * coef_[q];
+
+         for (int j=dofOffset_[e]; j<dofOffset_[e+1]; j++)
+         {
+            int l = j - dofOffset_[e];
+
+            // k |curl phi|^2 + beta^2 k |zeta x phi|^2, the sign of the
+            // dof cancels
+            double cc = 0.0, uu = 0.0, zu = 0.0;
+            for (int i=0; i<3; i++)
+            {
+               double c = (J[i] * Bc[k](l,0) + J[i+3] * Bc[k](l,1) +
+                           J[i+6] * Bc[k](l,2)) / det;
+               double u = Jinv[3*i] * B[k](l,0) + Jinv[3*i+1] * B[k](l,1) +
+                          Jinv[3*i+2] * B[k](l,2);
+               cc += c * c;
+               uu += u * u;
+               zu += z[i] * u;
+            }
+
+            int d = ( dofs_[j] >= 0 ) ? dofs_[j] : -1 - dofs_[j];
+            ldiag[d] += s * (cc + beta_ * beta_ * (z2 * uu - zu * zu));
+         }
+      }
+   }
+
+   // Conforming dofs have a single unit entry in their row of P
+   diag.SetSize(fes_->TrueVSize());
+   fes_->Dof_TrueDof_Matrix()->MultTranspose(ldiag, diag);
+}
+
+PhaseAverageAssembler::PhaseAverageAssembler(
+   ParFiniteElementSpace & HCurlFESpace,
+   ParFiniteElementSpace & HDivFESpace,
+   Coefficient & mCoef, Coefficient & kCoef)
+   : HCurlFESpace_(&HCurlFESpace),
+     HDivFESpace_(&HDivFESpace)
+{
+   MFEM_VERIFY(HCurlFESpace.GetParMesh()->Dimension() == 3 &&
+               HCurlFESpace.GetParMesh()->SpaceDimension() == 3,
+               "PhaseAverageAssembler requires a three dimensional mesh");
+
+   int ne = HCurlFESpace.GetNE();
+
+   // One rule per geometry integrates the products of either basis with
+   // the coefficients
+   map<int, const IntegrationRule*> rules;
+
+   qOffset_.SetSize(ne+1);
+   qOffset_[0] = 0;
+   for (int e=0; e<ne; e++)
+   {
+      const FiniteElement & nd = *HCurlFESpace.GetFE(e);
+      const FiniteElement & rt = *HDivFESpace.GetFE(e);
+      int geom = nd.GetGeomType();
+
+      if ( rules.find(geom) == rules.end() )
+      {
+         ElementTransformation * T = HCurlFESpace.GetElementTransformation(e);
+         int order = 2 * max(nd.GetOrder(), rt.GetOrder()) + T->OrderW();
+         const IntegrationRule * ir = &IntRules.Get(geom, order);
+         rules[geom] = ir;
+
+         ndShape_[geom].resize(ir->GetNPoints());
+         rtShape_[geom].resize(ir->GetNPoints());
+         for (int q=0; q<ir->GetNPoints(); q++)
+         {
+            const IntegrationPoint & ip = ir->IntPoint(q);
+            ndShape_[geom][q].SetSize(nd.GetDof(), 3);
+            rtShape_[geom][q].SetSize(rt.GetDof(), 3);
+            nd.CalcVShape(ip, ndShape_[geom][q]);
+            rt.CalcVShape(ip, rtShape_[geom][q]);
+         }
+      }
+      qOffset_[e+1] = qOffset_[e] + rules[geom]->GetNPoints();
+   }
+
+   int nq = qOffset_[ne];
+   x_.SetSize(3 * nq);
+   ndJac_.SetSize(9 * nq);
+   rtJac_.SetSize(9 * nq);
+   wdet_.SetSize(nq);
+   m_.SetSize(nq);
+   k_.SetSize(nq);
+
+   DenseMatrix Jinv(3);
+   for (int e=0; e<ne; e++)
+   {
+      const IntegrationRule & ir = *rules[HCurlFESpace.GetFE(e)->GetGeomType()];
+      ElementTransformation * T = HCurlFESpace.GetElementTransformation(e);
+
+      for (int q=0; q<ir.GetNPoints(); q++)
+      {
+         const IntegrationPoint & ip = ir.IntPoint(q);
+         T->SetIntPoint(&ip);
+
+         int k = qOffset_[e] + q;
+         Vector x(&x_[3*k], 3);
+         T->Transform(ip, x);
+
+         const DenseMatrix & J = T->Jacobian();
+         double det = T->Weight();
+         CalcInverse(J, Jinv);
+         for (int i=0; i<3; i++)
+            for (int j=0; j<3; j++)
+            {
+               ndJac_[9*k+3*i+j] = Jinv(j,i);
+               rtJac_[9*k+3*i+j] = J(i,j) / det;
+            }
+         wdet_[k] = ip.weight * det;
+         m_[k] = mCoef.Eval(*T, ip);
+         k_[k] = kCoef.Eval(*T, ip);
+      }
+   }
+
+   CacheElementVDofs(HCurlFESpace, ndDofOffset_, ndDofs_);
+   CacheElementVDofs(HDivFESpace, rtDofOffset_, rtDofs_);
+   ColorElements(*HCurlFESpace.GetParMesh(), colorOffset_, colorElems_);
+}
+
+void
+PhaseAverageAssembler::Assemble(const Vector & kappa,
+                                HypreParVector ** hcurl[],
+                                HypreParVector ** hdiv[]) const
+{
+   int ndSize = HCurlFESpace_->GetVSize();
+   int rtSize = HDivFESpace_->GetVSize();
+
+   // Twelve local vectors in each space, three components of four functions
+   Vector ndLoc(12 * ndSize); ndLoc = 0.0;
+   Vector rtLoc(12 * rtSize); rtLoc = 0.0;
+
+   for (int c=0; c<colorOffset_.Size()-1; c++)
+   {
+#ifdef MFEM_USE_OPENMP
+      #pragma omp parallel
+#endif
+      {
+         Vector ndElem, rtElem;
+#ifdef MFEM_USE_OPENMP
+         #pragma omp for
+#endif
+         for (int i=colorOffset_[c]; i<colorOffset_[c+1]; i++)
+         {
+            this->elementAssemble(colorElems_[i], kappa, ndElem, rtElem,
+                                  ndLoc, rtLoc);
+         }
+      }
+   }
+
+   for (int j=0; j<4; j++)
+   {
+      for (int i=0; i<3; i++)
+      {
+         Vector ndv(&ndLoc[(3*j+i)*ndSize], ndSize);
+         hcurl[j][i] = new HypreParVector(HCurlFESpace_);
+         HCurlFESpace_->Dof_TrueDof_Matrix()->MultTranspose(ndv,
+                                                            *hcurl[j][i]);
+
+         Vector rtv(&rtLoc[(3*j+i)*rtSize], rtSize);
+         hdiv[j][i] = new HypreParVector(HDivFESpace_);
+         HDivFESpace_->Dof_TrueDof_Matrix()->MultTranspose(rtv, *hdiv[j][i]);
+      }
+   }
+}
+
+void
+PhaseAverageAssembler::elementAssemble(int e, const Vector & kappa,
+                                       Vector & ndElem, Vector & rtElem,
+                                       Vector & ndLoc, Vector & rtLoc) const
+{
+   int geom = HCurlFESpace_->GetFE(e)->GetGeomType();
+   const vector<DenseMatrix> & B  = ndShape_.find(geom)->second;
+   const vector<DenseMatrix> & Bd = rtShape_.find(geom)->second;
+
+   int ndn = ndDofOffset_[e+1] - ndDofOffset_[e];
+   int rtn = rtDofOffset_[e+1] - rtDofOffset_[e];
+
+   // Element vectors of the twelve forms with the dofs running fastest
+   ndElem.SetSize(12 * ndn); ndElem = 0.0;
+   rtElem.SetSize(12 * rtn); rtElem = 0.0;
+
+   double f[4], g[4], p[3];
+
+   for (int q=qOffset_[e]; q<qOffset_[e+1]; q++)
+   {
+      int k = q - qOffset_[e];
+
+      double phase = kappa[0] * x_[3*q] + kappa[1] * x_[3*q+1] +
+                     kappa[2] * x_[3*q+2];
+      double cw = wdet_[q] * cos(phase);
+      double sw = wdet_[q] * sin(phase);
+
+      f[0] = cw; f[1] = sw; f[2] = m_[q] * cw; f[3] = m_[q] * sw;
+      g[0] = cw; g[1] = sw; g[2] = k_[q] * cw; g[3] = k_[q] * sw;
+
+      // Physical H(Curl) shapes, J^{-T} phi_ref
+      const double * Tn = &ndJac_[9*q];
+      for (int d=0; d<ndn; d++)
+      {
+         for (int i=0; i<3; i++)
+         {
+            p[i] = Tn[3*i] * B[k](d,0) + Tn[3*i+1] * B[k](d,1) +
+                   Tn[3*i+2] * B[k](d,2);
+         }
+         for (int j=0; j<4; j++)
+            for (int i=0; i<3; i++)
+            {
+               ndElem[(3*j+i)*ndn+d] += f[j] * p[i];
+            }
+      }
+
+      // Physical H(Div) shapes, J phi_ref / det(J)
+      const double * Tr = &rtJac_[9*q];
+      for (int d=0; d<rtn; d++)
+      {
+         for (int i=0; i<3; i++)
+         {
+            p[i] = Tr[3*i] * Bd[k](d,0) + Tr[3*i+1] * Bd[k](d,1) +
+                   Tr[3*i+2] * Bd[k](d,2);
+         }
+         for (int j=0; j<4; j++)
+            for (int i=0; i<3; i++)
+            {
+               rtElem[(3*j+i)*rtn+d] += g[j] * p[i];
+            }
+      }
+   }
+
+   // Elements of one color share no dofs so these sums cannot collide
+   int ndSize = HCurlFESpace_->GetVSize();
+   for (int d=0; d<ndn; d++)
+   {
+      int dof = ndDofs_[ndDofOffset_[e]+d];
+      double sgn = (dof >= 0) ? 1.0 : -1.0;
+      if ( dof < 0 ) { dof = -1 - dof; }
+      for (int b=0; b<12; b++)
+      {
+         ndLoc[b*ndSize+dof] += sgn * ndElem[b*ndn+d];
+      }
+   }
+
+   int rtSize = HDivFESpace_->GetVSize();
+   for (int d=0; d<rtn; d++)
+   {
+      int dof = rtDofs_[rtDofOffset_[e]+d];
+      double sgn = (dof >= 0) ? 1.0 : -1.0;
+      if ( dof < 0 ) { dof = -1 - dof; }
+      for (int b=0; b<12; b++)
+      {
+         rtLoc[b*rtSize+dof] += sgn * rtElem[b*rtn+d];
+      }
+   }
+}
+
+static const char DispersionStoreMagic[8] =
+{ 'B', 'L', 'O', 'C', 'H', 'D', 'S', 'P' };
+
+DispersionStore::DispersionStore(const string & fname)
+   : myid_(0),
+     fname_(fname),
+     map_(NULL),
+     map_size_(0),
+     warm_(-1)
+{
+   memset(&hdr_, 0, sizeof(Header));
+
+   if ( !this->mapFile() )
+   {
+      mfem_error("DispersionStore: unable to read file");
+   }
+   hdr_ = *(const Header*)map_;
+
+   for (int r=0; r<(int)offsets_.size(); r++)
+   {
+      index_[this->GetRecord(r).index] = r;
+   }
+}
+
+DispersionStore::DispersionStore(MPI_Comm comm, const string & prefix,
+                                 const Header & hdr, bool restart)
+   : myid_(0),
+     map_(NULL),
+     map_size_(0),
+     warm_(-1)
+{
+   MPI_Comm_rank(comm, &myid_);
+
+   int num_procs = 1;
+   MPI_Comm_size(comm, &num_procs);
+
+   // Zero the padding so that the header is written deterministically
+   memset(&hdr_, 0, sizeof(Header));
+   memcpy(hdr_.magic, DispersionStoreMagic, 8);
+   hdr_.version      = 1;
+   hdr_.lattice_type = hdr.lattice_type;
+   for (int i=0; i<3; i++)
+   {
+      hdr_.lengths[i] = hdr.lengths[i];
+      hdr_.angles[i]  = hdr.angles[i];
+   }
+   hdr_.serial_ref = hdr.serial_ref;
+   hdr_.par_ref    = hdr.par_ref;
+   hdr_.order      = hdr.order;
+   hdr_.num_procs  = num_procs;
+   hdr_.rank       = myid_;
+   hdr_.store_vecs = hdr.store_vecs;
+   hdr_.glb_size   = hdr.glb_size;
+   hdr_.loc_size   = hdr.loc_size;
+
+   ostringstream oss;
+   oss << prefix << "/disp.bin." << setfill('0') << setw(5) << myid_;
+   fname_ = oss.str();
+
+   int nrec = 0;
+   if ( restart && this->mapFile() )
+   {
+      if ( SameSweep(*(const Header*)map_, hdr_) )
+      {
+         nrec = (int)offsets_.size();
+      }
+      else
+      {
+         this->unmapFile();
+      }
+   }
+
+   // Only keep the records which every processor has completed
+   int glb_nrec = 0;
+   MPI_Allreduce(&nrec, &glb_nrec, 1, MPI_INT, MPI_MIN, comm);
+
+   if ( restart && myid_ == 0 )
+   {
+      cout << "Restarting the dispersion sweep with " << glb_nrec
+           << " stored k-points" << endl;
+   }
+
+   if ( glb_nrec == 0 )
+   {
+      this->unmapFile();
+
+      ofs_.open(fname_.c_str(), ios::out | ios::binary | ios::trunc);
+      ofs_.write((const char*)&hdr_, sizeof(Header));
+      ofs_.flush();
+      return;
+   }
+
+   offsets_.resize(glb_nrec);
+   for (int r=0; r<glb_nrec; r++)
+   {
+      index_[this->GetRecord(r).index] = r;
+   }
+
+   // Drop any partially written or surplus records before appending.  The
+   // retained records lie below the new end of the file so that the map
+   // remains valid.
+   const Record & last = this->GetRecord(glb_nrec-1);
+   size_t end = offsets_[glb_nrec-1] + RecordSize(last, hdr_.loc_size);
+   if ( truncate(fname_.c_str(), end) != 0 )
+   {
+      mfem_error("DispersionStore: unable to truncate file");
+   }
+
+   ofs_.open(fname_.c_str(), ios::out | ios::binary | ios::app);
+}
+
+DispersionStore::~DispersionStore()
+{
+   if ( ofs_.is_open() ) { ofs_.close(); }
+   this->unmapFile();
+}
+
+bool
+DispersionStore::SameSweep(const Header & a, const Header & b)
+{
+   if ( memcmp(a.magic, b.magic, 8) != 0 ) { return false; }
+   if ( a.version != b.version ) { return false; }
+   if ( a.lattice_type != b.lattice_type ) { return false; }
+   for (int i=0; i<3; i++)
+   {
+      if ( fabs(a.lengths[i] - b.lengths[i]) > 1e-12 ) { return false; }
+      if ( fabs(a.angles[i]  - b.angles[i])  > 1e-12 ) { return false; }
+   }
+   return ( a.serial_ref == b.serial_ref && a.par_ref    == b.par_ref &&
+            a.order      == b.order      && a.num_procs  == b.num_procs &&
+            a.rank       == b.rank       && a.store_vecs == b.store_vecs &&
+            a.glb_size   == b.glb_size   && a.loc_size   == b.loc_size );
+}
+
+size_t
+DispersionStore::RecordSize(const Record & rec, HYPRE_Int loc_size)
+{
+   size_t nvals = 2;
+   if ( rec.has_vecs ) { nvals += loc_size; }
+   return sizeof(Record) + sizeof(double) * rec.nev * nvals;
+}
+
+bool
+DispersionStore::mapFile()
+{
+   int fd = open(fname_.c_str(), O_RDONLY);
+   if ( fd < 0 ) { return false; }
+
+   struct stat st;
+   if ( fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header) )
+   {
+      close(fd);
+      return false;
+   }
+
+   void * map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+
+   if ( map == MAP_FAILED ) { return false; }
+
+   map_      = (char*)map;
+   map_size_ = st.st_size;
+
+   // Locate the complete records, a partial one may follow the last
+   HYPRE_Int loc_size = ((const Header*)map_)->loc_size;
+
+   offsets_.clear();
+   size_t off = sizeof(Header);
+   while ( off + sizeof(Record) <= map_size_ )
+   {
+      size_t size = RecordSize(*(const Record*)&map_[off], loc_size);
+      if ( off + size > map_size_ ) { break; }
+      offsets_.push_back(off);
+      off += size;
+   }
+
+   return true;
+}
+
+void
+DispersionStore::unmapFile()
+{
+   if ( map_ != NULL )
+   {
+      munmap(map_, map_size_);
+   }
+   map_      = NULL;
+   map_size_ = 0;
+   offsets_.clear();
+   index_.clear();
+}
+
+const DispersionStore::Record &
+DispersionStore::GetRecord(int r) const
+{
+   MFEM_ASSERT(r >= 0 && r < (int)offsets_.size(),
+               "DispersionStore: record index out of range");
+   return *(const Record*)&map_[offsets_[r]];
+}
+
+const double *
+DispersionStore::GetEigenvalues(int r) const
+{
+   return (const double*)&map_[offsets_[r] + sizeof(Record)];
+}
+
+const double *
+DispersionStore::GetResiduals(int r) const
+{
+   return this->GetEigenvalues(r) + this->GetRecord(r).nev;
+}
+
+const double *
+DispersionStore::GetEigenvector(int r, int i) const
+{
+   const Record & rec = this->GetRecord(r);
+   if ( !rec.has_vecs || i < 0 || i >= rec.nev ) { return NULL; }
+   return this->GetEigenvalues(r) + 2 * rec.nev + (size_t)i * hdr_.loc_size;
+}
+
+int
+DispersionStore::FindRecord(int index) const
+{
+   map<int,int>::const_iterator mit = index_.find(index);
+   return ( mit != index_.end() ) ? mit->second : -1;
+}
+
+bool
+DispersionStore::RestoreEigenvalues(int index, vector<double> & eigenvalues)
+{
+   int r = this->FindRecord(index);
+   if ( r < 0 ) { return false; }
+
+   const double * eigs = this->GetEigenvalues(r);
+   eigenvalues.assign(eigs, eigs + this->GetRecord(r).nev);
+
+   warm_ = r;
+
+   return true;
+}
+
+bool
+DispersionStore::SetWarmStart(vector<HypreParVector*> & init_vecs)
+{
+   if ( warm_ < 0 ) { return false; }
+
+   int r = warm_;
+   warm_ = -1;
+
+   if ( !this->GetRecord(r).has_vecs ) { return false; }
+
+   int n = std::min((int)init_vecs.size(), this->GetRecord(r).nev);
+   for (int i=0; i<n; i++)
+   {
+      MFEM_ASSERT(init_vecs[i]->Size() == hdr_.loc_size,
+                  "DispersionStore: initial vector has the wrong size");
+      memcpy(init_vecs[i]->GetData(), this->GetEigenvector(r, i),
+             sizeof(double) * hdr_.loc_size);
+   }
+   return true;
+}
+
+void
+DispersionStore::AddRecord(int index, const string & label,
+                           const Vector & kappa,
+                           MaxwellBlochWaveEquation & eq)
+{
+   vector<double> eigenvalues, resid;
+   eq.GetEigenvalues(eigenvalues);
+   eq.GetEigenvalueResiduals(resid);
+
+   Record rec;
+   memset(&rec, 0, sizeof(Record));
+   rec.index    = index;
+   rec.nev      = (int)eigenvalues.size();
+   rec.has_vecs = hdr_.store_vecs;
+   strncpy(rec.label, label.c_str(), sizeof(rec.label) - 1);
+   for (int i=0; i<3 && i<kappa.Size(); i++)
+   {
+      rec.kappa[i] = kappa[i];
+   }
+
+   ofs_.write((const char*)&rec, sizeof(Record));
+   if ( rec.nev > 0 )
+   {
+      ofs_.write((const char*)&eigenvalues[0], sizeof(double) * rec.nev);
+      ofs_.write((const char*)&resid[0], sizeof(double) * rec.nev);
+   }
+
+   if ( rec.has_vecs )
+   {
+      ParFESpaceWorkspace * ws = eq.GetHCurlWorkspace();
+      HypreParVector & Er = ws->GetTrueVectorView(0);
+      HypreParVector & Ei = ws->GetTrueVectorView(1);
+
+      size_t bytes = sizeof(double) * hdr_.loc_size / 2;
+      for (int i=0; i<rec.nev; i++)
+      {
+         eq.GetEigenvectorE(i, Er, Ei);
+         ofs_.write((const char*)Er.GetData(), bytes);
+         ofs_.write((const char*)Ei.GetData(), bytes);
+      }
+   }
+
+   ofs_.flush();
+}
+
 void
 ElementwiseEnergyNorm(BilinearFormIntegrator & bli,
                       ParGridFunction & x,
@@ -19,6 +19,12 @@
 #include "mfem.hpp"
 #include "../common/pfem_extras.hpp"
 #include "../common/bravais.hpp"
+#include <pthread.h>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
 
 namespace mfem
 {
@@ -32,6 +38,7 @@ using miniapps::ParDiscreteCurlOperator;
 using miniapps::ParDiscreteVectorProductOperator;
 using miniapps::ParDiscreteVectorCrossProductOperator;
 using bravais::BravaisLattice;
+using bravais::ParFESpaceWorkspace;
 using bravais::HCurlFourierSeries;
 using bravais::RealPhaseCoefficient;
 using bravais::ImagPhaseCoefficient;
@@ -50,6 +57,418 @@ namespace bloch
 //static double mu0_ = 1.0;
 #define MAXWELL_MU0 4.0e-7*M_PI
 
+/** Writes VisIt collections and binary matrix files from a separate thread.
+
+    The data is copied into a buffer on the calling thread so that the
+    caller may immediately move on, e.g. to the next k-point, while the
+    files are written in the background.  Jobs are written in the order in
+    which they were submitted.
+
+    Asynchronous output is off by default.  When enabled, each collection
+    holds copies of the ParMesh, taken by BeginVisitCollection, and of the
+    finite element spaces of its fields so that the caller may refine or
+    move the mesh while earlier collections are written.  The copied meshes
+    communicate on a duplicate of the mesh's communicator which requires
+    MPI_THREAD_MULTIPLE support.  When the MPI library was not initialized
+    with that level of thread support, or when asynchronous output is
+    disabled, each job is written before the submitting call returns.
+
+    The mesh must not change between BeginVisitCollection and
+    EndVisitCollection.
+*/
+class AsyncFieldWriter
+{
+public:
+   AsyncFieldWriter(ParMesh & pmesh, bool async = false,
+                    int max_pending = 2);
+   ~AsyncFieldWriter();
+
+   bool IsAsync() const { return async_; }
+
+   /// Start collecting the fields of a new VisIt collection
+   void BeginVisitCollection(const std::string & prefix,
+                             const std::string & label);
+
+   /// Add a field which is written with every cycle of the collection
+   void AddVisitStaticField(const std::string & name,
+                            const GridFunction & gf);
+
+   /// Start a new cycle of the current collection
+   void AddVisitCycle(double time);
+
+   /// Add a field to the current cycle
+   void AddVisitField(const std::string & name, const GridFunction & gf);
+
+   /// Submit the current collection for writing
+   void EndVisitCollection();
+
+   /** Write the local rows of A to the file "fname.<rank>" in binary.  The
+       file contains the following, all native endian and in this order:
+
+         int       : 1 if sizeof(HYPRE_Int) == 8 and 0 otherwise
+         HYPRE_Int : global number of rows, columns, first local row,
+                     first local column of the diagonal block,
+                     number of local rows, local columns,
+                     number of nonzeros in the diag and offd blocks and the
+                     number of offd columns
+         HYPRE_Int : diag row offsets, column indices
+         double    : diag values
+         HYPRE_Int : offd row offsets, column indices
+         double    : offd values
+         HYPRE_Int : global indices of the offd columns
+   */
+   void WriteMatrix(HypreParMatrix & A, const std::string & fname);
+
+   /// Block until all submitted jobs have been written
+   void Flush();
+
+private:
+   class Job
+   {
+   public:
+      virtual ~Job() {}
+      virtual void Write() = 0;
+   };
+
+   class VisItJob;
+   class MatrixJob;
+
+   class WriterParMesh;
+
+   void submit(Job * job);
+
+   static void * run(void * writer);
+
+   bool async_;
+   int  max_pending_;
+   int  pending_;
+   bool done_;
+   int  myid_;
+
+   MPI_Comm comm_;
+   ParMesh * pmesh_;
+
+   VisItJob * visit_;
+
+   std::deque<Job*> jobs_;
+
+   pthread_t       thread_;
+   pthread_mutex_t mutex_;
+   pthread_cond_t  cond_;
+};
+
+/// A Chebyshev polynomial preconditioner for a HypreParMatrix which stores
+/// the matrix entries, its work vectors and its halo exchange buffers in
+/// single precision.  The input and output vectors remain in double
+/// precision so that this can replace a double precision preconditioner
+/// when only a rough approximation of the inverse is needed.  The polynomial
+/// is built on the l1-Jacobi scaled operator whose spectrum lies in (0,1].
+/// The largest eigenvalue lmax is estimated with power_its power iterations
+/// and the polynomial damps the interval [lmax/lambda_ratio, lmax], as the
+/// eigenvalue ratio of hypre's Chebyshev smoother does.  It is a single
+/// level smoother without any coarse correction, so it is much weaker than
+/// the AMS or BoomerAMG hierarchy it replaces.
+class SinglePrecisionChebyshev : public Solver
+{
+public:
+   SinglePrecisionChebyshev(HypreParMatrix & A, int order = 3,
+                            double lambda_ratio = 30.0, int power_its = 10);
+
+   virtual void Mult(const Vector &x, Vector &y) const;
+
+   virtual void SetOperator(const Operator &op) {}
+
+   /// Approximate number of bytes held by this preconditioner
+   size_t GetMemoryUsage() const;
+
+private:
+   // Single precision product y = A x including the off-processor columns
+   void MultFloat(const Array<float> &x, Array<float> &y) const;
+
+   // Rayleigh quotient of the scaled operator after its power iterations
+   double estimateLargestEigenvalue(int its) const;
+
+   hypre_ParCSRMatrix * A_;
+
+   int    order_;
+   double lmin_;
+   double lmax_;
+
+   Array<float> diagA_;
+   Array<float> offdA_;
+   Array<float> l1Inv_;
+
+   mutable Array<float> sendBuf_;
+   mutable Array<float> recvBuf_;
+   mutable Array<MPI_Request> requests_;
+
+   mutable Array<float> r_;
+   mutable Array<float> z_;
+   mutable Array<float> d_;
+   mutable Array<float> t_;
+};
+
+/** A geometric multigrid V-cycle for the kappa shifted curl-curl operator
+    S1 on a nested hierarchy of uniformly refined meshes.
+
+    The finest level is the caller's H(Curl) space, which must match the
+    coarse mesh refined num_ref times, and its discrete gradient is given
+    by SetFineGradient.  Copies of the coarser meshes, their H(Curl) spaces,
+    the prolongations and the coarser discrete gradients are built once by
+    the constructor.  SetOperator only forms the Galerkin coarse operators,
+    the Hiptmair smoothers and an AMS solver on the coarsest level, so it
+    is cheap to repeat for each kappa.  Each smoothing step applies
+    l1-Jacobi to S1 followed by l1-Jacobi on G^T S1 G in the gradient
+    space, and the reverse after the coarse grid correction, so the cycle
+    is symmetric. */
+class HCurlMultigrid : public Solver
+{
+public:
+   HCurlMultigrid(ParMesh & coarse_mesh, int num_ref, int order,
+                  ParFiniteElementSpace & fine_hcurl);
+   ~HCurlMultigrid();
+
+   /// Mirror HypreAMS::SetSingularProblem on the coarsest level
+   void SetSingularProblem(bool singular) { singular_ = singular; }
+
+   /** The discrete gradient of the finest level, which is not copied and
+       must be set again whenever it is rebuilt. */
+   void SetFineGradient(const HypreParMatrix & G);
+
+   virtual void SetOperator(const Operator &op);
+
+   virtual void Mult(const Vector &x, Vector &y) const;
+
+private:
+   void clearOperators();
+
+   void buildNodeSmoother(int l);
+
+   void cycle(int l, const Vector & b, Vector & x) const;
+
+   void smooth(int l, const Vector & b, Vector & x, bool pre) const;
+
+   bool singular_;
+
+   // The finest space and gradient belong to the caller
+   std::vector<ParMesh*>               meshes_;
+   std::vector<ParFiniteElementSpace*> hcurl_;
+
+   // P_[l] maps the true dofs of level l to those of level l+1
+   std::vector<HypreParMatrix*> P_;
+   std::vector<HypreParMatrix*> G_;
+
+   // S_[l] is owned by this object for l below the finest level
+   std::vector<HypreParMatrix*> S_;
+   std::vector<HypreParMatrix*> SG_;
+   std::vector<HypreSmoother*>  edgeSmoother_;
+   std::vector<HypreSmoother*>  nodeSmoother_;
+
+   HypreAMS * coarseSolver_;
+
+   mutable std::vector<Vector> r_;
+   mutable std::vector<Vector> x_;
+   mutable std::vector<Vector> b_;
+   mutable std::vector<Vector> rg_;
+   mutable std::vector<Vector> xg_;
+};
+
+class MaxwellBlochPAOperator;
+
+/** A two-level preconditioner for a high order, kappa shifted curl-curl
+    operator S1 which applies AMS to the same operator discretized on the
+    lowest order Nedelec space of the same mesh.
+
+    The lowest order operator is assembled directly, from the stiffness
+    coefficient and phase shift given by SetCoefficients, so it has the
+    sparsity of a first order discretization and never requires the high
+    order matrix.  The lowest order space is nested in the high order one
+    so the transfer is the identity interpolation.  The high order error
+    is reduced by Jacobi sweeps on S1 before and after the coarse
+    correction, which keeps the preconditioner symmetric.  These are
+    l1-Jacobi when S1 is a HypreParMatrix.  With a MaxwellBlochPAOperator
+    they use its diagonal, weighted by a power iteration estimate of the
+    largest eigenvalue of D^{-1} S1.  Gradient components are left to the
+    subspace projector of the eigensolver. */
+class HCurlLowOrderSolver : public Solver
+{
+public:
+   HCurlLowOrderSolver(ParFiniteElementSpace & HCurlFESpace);
+   ~HCurlLowOrderSolver();
+
+   /// Mirror HypreAMS::SetSingularProblem on the low order operator
+   void SetSingularProblem(bool singular) { singular_ = singular; }
+
+   /// The coefficients of S1 used by the next SetOperator
+   void SetCoefficients(Coefficient & kCoef, double beta,
+                        const Vector & zeta);
+
+   /// S1 as an assembled HypreParMatrix
+   virtual void SetOperator(const Operator &op);
+
+   /// S1 as the diagonal block of a partially assembled A
+   void SetOperator(const MaxwellBlochPAOperator & A);
+
+   virtual void Mult(const Vector &x, Vector &y) const;
+
+private:
+   void clearOperators();
+
+   void assembleLowOrder();
+
+   void applyS(const Vector &x, Vector &y) const;
+
+   void smooth(const Vector &b, Vector &y) const;
+
+   bool singular_;
+
+   Coefficient * kCoef_;
+   double        beta_;
+   Vector        zeta_;
+
+   ParFiniteElementSpace * HCurlFESpace_;
+   ParFiniteElementSpace * HCurlFESpace1_;
+
+   HypreParMatrix * P_;
+
+   // Exactly one of S_ and SPA_ is set
+   HypreParMatrix               * S_;
+   const MaxwellBlochPAOperator * SPA_;
+   HypreParMatrix               * S1_;
+
+   HypreSmoother * smoother_;
+   Vector          diag_;
+   double          omega_;
+
+   HypreAMS      * ams_;
+
+   mutable Vector r_;
+   mutable Vector r1_;
+   mutable Vector x1_;
+};
+
+/** Matrix-free application of the real form of the Bloch operator
+    A = [S1, beta D; -beta D, S1] to a pair of H(Curl) true dof vectors,
+    the real part followed by the imaginary part, for the stiffness
+    coefficient.  zeta x u is evaluated at the quadrature points, as in the
+    ShiftedCurlIntegrator of misc/vector3d-arpack.cpp, rather than
+    interpolated onto H(Div).
+
+    Only the reference shapes and curls of each element geometry are
+    stored along with the Jacobian, the weighted determinant and the
+    coefficient at each quadrature point, so the memory grows with the
+    number of quadrature points rather than with the square of the
+    element dofs.  The kernels apply the dense nd x 3 reference matrices
+    at every point, without sum factorization, so each element costs
+    O(nd nq) flops, which is no cheaper than an assembled product.  With
+    MFEM_USE_OPENMP the elements of each color, which share no vertex,
+    are processed by concurrent threads. */
+class MaxwellBlochPAOperator : public Operator
+{
+public:
+   MaxwellBlochPAOperator(ParFiniteElementSpace & fes, Coefficient & coef);
+
+   void SetBeta(double beta) { beta_ = beta; }
+   void SetZeta(const Vector & zeta) { zeta_ = zeta; }
+
+   virtual void Mult(const Vector &x, Vector &y) const;
+
+   /// Apply the diagonal block S1 to a single H(Curl) true dof vector
+   void MultDiagonalBlock(const Vector &x, Vector &y) const;
+
+   /// The diagonal of S1 on the H(Curl) true dofs
+   void GetDiagonal(Vector & diag) const;
+
+   size_t GetMemoryUsage() const;
+
+private:
+   // Sums the element products of xlr_ and xli_ into ylr_ and yli_
+   void multElements() const;
+
+   void elementMult(int e, Vector & xer, Vector & xei,
+                    Vector & yer, Vector & yei) const;
+
+   ParFiniteElementSpace * fes_;
+
+   double beta_;
+   Vector zeta_;
+
+   // Reference shapes and curls, nd x 3 at each quadrature point, for
+   // each element geometry
+   std::map<int, std::vector<DenseMatrix> > shape_;
+   std::map<int, std::vector<DenseMatrix> > curlShape_;
+
+   // Quadrature data of element e is found in [qOffset_[e],qOffset_[e+1])
+   Array<int> qOffset_;
+   Vector     jac_;
+   Vector     wdet_;
+   Vector     coef_;
+
+   // Signed local dofs of element e are in [dofOffset_[e],dofOffset_[e+1])
+   Array<int> dofOffset_;
+   Array<int> dofs_;
+
+   // Elements of color c are in [colorOffset_[c],colorOffset_[c+1])
+   Array<int> colorOffset_;
+   Array<int> colorElems_;
+
+   mutable Vector xlr_, xli_, ylr_, yli_;
+};
+
+/** Assembles the phase weighted integrals of the H(Curl) and H(Div) basis
+    functions used for the field averages, cos(kappa.x) phi and
+    sin(kappa.x) phi along with their products with the mass coefficient
+    (H(Curl)) or the stiffness coefficient (H(Div)).
+
+    The coefficients, the geometry and the reference shapes are sampled
+    once so that only the phases are evaluated for each kappa.  With
+    MFEM_USE_OPENMP the elements of each color are processed by concurrent
+    threads. */
+class PhaseAverageAssembler
+{
+public:
+   PhaseAverageAssembler(ParFiniteElementSpace & HCurlFESpace,
+                         ParFiniteElementSpace & HDivFESpace,
+                         Coefficient & mCoef, Coefficient & kCoef);
+
+   /// Creates hcurl[j][i] and hdiv[j][i] for the Cartesian components i
+   /// where j selects cos, sin, coef cos, or coef sin
+   void Assemble(const Vector & kappa,
+                 HypreParVector ** hcurl[], HypreParVector ** hdiv[]) const;
+
+private:
+   void elementAssemble(int e, const Vector & kappa,
+                        Vector & ndElem, Vector & rtElem,
+                        Vector & ndLoc, Vector & rtLoc) const;
+
+   ParFiniteElementSpace * HCurlFESpace_;
+   ParFiniteElementSpace * HDivFESpace_;
+
+   // Reference shapes, nd x 3 at each quadrature point, for each element
+   // geometry
+   std::map<int, std::vector<DenseMatrix> > ndShape_;
+   std::map<int, std::vector<DenseMatrix> > rtShape_;
+
+   // Quadrature data of element e is found in [qOffset_[e],qOffset_[e+1]),
+   // the points, the maps J^{-T} and J/det(J) stored by rows, the weighted
+   // determinants and the mass and stiffness coefficients
+   Array<int> qOffset_;
+   Vector     x_;
+   Vector     ndJac_;
+   Vector     rtJac_;
+   Vector     wdet_;
+   Vector     m_;
+   Vector     k_;
+
+   Array<int> ndDofOffset_;
+   Array<int> ndDofs_;
+   Array<int> rtDofOffset_;
+   Array<int> rtDofs_;
+
+   Array<int> colorOffset_;
+   Array<int> colorElems_;
+};
+
 class MaxwellBlochWaveProjector : public Operator
 {
 public:
@@ -65,18 +484,44 @@ public:
    void SetBeta(double beta);
    void SetZeta(const Vector & zeta);
 
+   /// Precondition the MINRES solve with SinglePrecisionChebyshev in place
+   /// of BoomerAMG
+   void SetSinglePrecision(bool sp) { singlePrec_ = sp; }
+
+   /// Relative tolerance of the MINRES solve for the gradient components
+   void SetRelTol(double tol);
+   double GetRelTol() const { return relTol_; }
+
+   /** Setup rebuilds the kappa dependent blocks but keeps the AMG
+       hierarchy of A0 until beta differs from the value it was built for
+       by more than this factor.  Set it to one to rebuild every time. */
+   void SetAMGRefreshFactor(double f) { amgRefresh_ = f; }
+
    void Setup();
 
    void Update();
 
+   /// The discrete gradient from H1 to H(Curl), built by Setup
+   const HypreParMatrix * GetGradient() const { return T01_; }
+
    virtual void Mult(const Vector &x, Vector &y) const;
 
+   /// Add the bytes held by this projector to a memory report
+   void GetMemoryUsage(std::map<std::string,size_t> & bytes) const;
+
 private:
+   void buildPreconditioner();
+
    int myid_;
    int locSize_;
 
    bool newBeta_;
    bool newZeta_;
+   bool singlePrec_;
+
+   double relTol_;
+   double amgRefresh_;
+   double amgBeta_;
 
    // ParFiniteElementSpace * HDivFESpace_;
    ParFiniteElementSpace * HCurlFESpace_;
@@ -92,9 +537,15 @@ private:
    HypreParMatrix * DKZ_;
    HypreParMatrix * DKZT_;
 
+   // The cached hierarchy references the matrix it was built from which
+   // may be an older A0
    HypreBoomerAMG * amg_cos_;
+   HypreParMatrix * amgMat_;
    MINRESSolver   * minres_;
 
+   SinglePrecisionChebyshev    * A0Inv_;
+   BlockDiagonalPreconditioner * S0Inv_;
+
    ParDiscreteGradOperator * Grad_;
    ParDiscreteVectorProductOperator * Zeta_;
 
@@ -140,7 +591,15 @@ private:
 class MaxwellBlochWaveEquation
 {
 public:
-   MaxwellBlochWaveEquation(ParMesh & pmesh, int order);
+   /** The H1 and HDiv spaces are only built when first needed, e.g. HDiv
+       is not built with partial assembly until B or the averages are
+       requested.  When lowMemory is true the block work vectors are also
+       allocated on first use, and Z12, C and the discrete curl and zeta
+       cross product operators are released once S1 and DKZ have been
+       formed.  M2 and T12 do not depend upon kappa so they are kept.  The
+       released operators are rebuilt on demand. */
+   MaxwellBlochWaveEquation(ParMesh & pmesh, int order,
+                            bool lowMemory = false);
 
    ~MaxwellBlochWaveEquation();
 
@@ -164,12 +623,65 @@ public:
    void SetMassCoef(Coefficient & m);
    void SetStiffnessCoef(Coefficient & k);
 
+   /** Replace AMS in the block diagonal preconditioner, and BoomerAMG in
+       the subspace projector, with SinglePrecisionChebyshev smoothers.
+       hypre is only built in double precision so no single precision AMS
+       or AMG hierarchy is available.  The smoothers have no coarse
+       correction and trade more eigensolver iterations for less memory
+       traffic per iteration; iteration counts have not been compared
+       with AMS.  AMS is still used at the Gamma point where the AME
+       solver requires it.  The eigensolver and its convergence checks
+       remain in double precision. */
+   void SetSinglePrecisionPreconditioner(bool sp);
+
+   /** Loosen the gradient projections inside the preconditioner while the
+       eigensolver residuals are large, see MaxwellBlochWavePrecond. */
+   void SetAdaptiveProjector(bool ap) { adaptiveProj_ = ap; }
+
+   /** Apply A to the eigensolver through MaxwellBlochPAOperator instead of
+       assembling D, T12, Z12 and M2.  S1 is still assembled, directly on
+       H(Curl), for the preconditioners and the AME solver, and M1 for the
+       eigensolver, the subspace projector and the AME solver, so this is
+       not guaranteed to save memory: the quadrature data of the operator
+       can outweigh D.  Compare the two with PrintMemoryUsage.  The
+       operator evaluates zeta x u at the quadrature points rather than
+       interpolating it onto H(Div), so for kappa != 0 the eigenvalues
+       agree with the assembled path only up to the discretization error,
+       see test_pa_operator. */
+   void SetPartialAssembly(bool pa);
+
+   /** For order > 1 precondition the curl-curl blocks with
+       HCurlLowOrderSolver so that AMS is only set up on a first order
+       operator.  With partial assembly its smoother applies S1 through
+       the partially assembled A.  AMS is still used at the Gamma point. */
+   void SetLowOrderPreconditioner(bool lo);
+
+   /** Precondition the curl-curl blocks with geometric multigrid on a
+       hierarchy built from coarse_mesh, which, after num_ref uniform
+       refinements, must reproduce the mesh of this equation.  The
+       hierarchy is built by the next Setup and reused for every kappa.
+       AMS is still used at the Gamma point where the AME solver requires
+       it.  Update aborts when multigrid is enabled since the hierarchy can
+       not follow a refinement of the fine mesh. */
+   void SetMultigrid(ParMesh & coarse_mesh, int num_ref);
+
    void Setup();
 
    void SetInitialVectors(int num_vecs, HypreParVector ** vecs);
 
    void SetBravaisLattice(BravaisLattice & bravais) { bravais_ = &bravais; }
 
+   /** Signal that the mesh nodes have moved without any change of topology,
+       e.g. by MorphLatticeMesh.  The spaces, dof numbering and discrete
+       curl are kept while every geometry dependent operator, including
+       any multigrid hierarchy, is rebuilt by the next call to Setup.  The
+       coarse mesh given to SetMultigrid must be moved in the same way. */
+   void MeshMoved();
+
+   /** Follow a refinement of the mesh.  The spaces are updated and every
+       operator and solver is rebuilt by Setup along the same path used for
+       a new kappa, including partial assembly and the low order
+       preconditioner.  Not supported with SetMultigrid. */
    void Update();
 
    /// Solve the eigenproblem
@@ -203,7 +715,12 @@ public:
    Operator * GetSubSpaceProjector() { return SubSpaceProj_; }
 
    ParFiniteElementSpace * GetHCurlFESpace() { return HCurlFESpace_; }
-   ParFiniteElementSpace * GetHDivFESpace()  { return HDivFESpace_; }
+   ParFiniteElementSpace * GetHDivFESpace()
+   { this->buildHDivFESpace(); return HDivFESpace_; }
+
+   ParFESpaceWorkspace * GetHCurlWorkspace() { return hcurlWS_; }
+   ParFESpaceWorkspace * GetHDivWorkspace()
+   { this->buildHDivFESpace(); return hdivWS_; }
 
    // void TestVector(const HypreParVector & v);
 
@@ -226,27 +743,60 @@ public:
 
    void DetermineBasis(const Vector & v1, std::vector<Vector> & e);
 
+   /// Queue the VisIt output with writer rather than writing it directly
+   void SetFieldWriter(AsyncFieldWriter * writer) { writer_ = writer; }
+
    void WriteVisitFields(const std::string & prefix,
                          const std::string & label);
 
+   /// Relative residuals |A x - lambda M x| / |M x| of the computed modes
+   void GetEigenvalueResiduals(std::vector<double> & resid);
+
    void GetSolverStats(double &meanTime, double &stdDevTime,
                        double &meanIter, double &stdDevIter,
                        int &nSolves);
 
+   /** Approximate the bytes held on this processor by each operator,
+       preconditioner and workspace.  The keys are prefixed with
+       "operator:", "preconditioner:" or "workspace:". */
+   void GetMemoryUsage(std::map<std::string,size_t> & bytes) const;
+
+   /// Print the memory report totalled and maximized over all processors
+   void PrintMemoryUsage(std::ostream & os) const;
+
 private:
 
+   void buildH1FESpace();
+   void buildHDivFESpace();
+   void buildCOperator();
+   void buildPAOperators();
+   void assembleAverages();
+   void computeAverages();
+
    MPI_Comm comm_;
    int myid_;
+   int order_;
    int hcurl_loc_size_;
    int hdiv_loc_size_;
    int nev_;
 
+   bool lowMemory_;
+   bool newAvgs_;
+   bool newAvgVals_;
+
    // bool newAlpha_;
    bool newBeta_;
    bool newZeta_;
    bool newOmega_;
    bool newMCoef_;
    bool newKCoef_;
+   bool singlePrec_;
+   bool adaptiveProj_;
+   bool partialAssembly_;
+   bool lowOrderPrec_;
+
+   ParMesh        * mgMesh_;
+   int              mgRef_;
 
    ParMesh        * pmesh_;
    H1_ParFESpace  * H1FESpace_;
@@ -254,6 +804,11 @@ private:
    RT_ParFESpace  * HDivFESpace_;
    L2_ParFESpace  * L2FESpace_;
 
+   ParFESpaceWorkspace * hcurlWS_;
+   ParFESpaceWorkspace * hdivWS_;
+
+   AsyncFieldWriter * writer_;
+
    BravaisLattice     * bravais_;
    HCurlFourierSeries * fourierHCurl_;
 
@@ -300,6 +855,8 @@ private:
    BlockOperator  * M_;
    BlockOperator  * C_;
 
+   MaxwellBlochPAOperator * APA_;
+
    BlockVector    * blkHCurl_;
    BlockVector    * blkHDiv_;
 
@@ -314,6 +871,9 @@ private:
    HypreParMatrix * DKZT_;
 
    HypreAMS       * T1Inv_;
+   SinglePrecisionChebyshev * T1InvSP_;
+   HCurlMultigrid * T1InvMG_;
+   HCurlLowOrderSolver * T1InvLO_;
 
    ParDiscreteCurlOperator * Curl_;
    ParDiscreteVectorCrossProductOperator * Zeta_;
@@ -333,6 +893,8 @@ private:
 
    ParGridFunction ** energy_;
 
+   PhaseAverageAssembler * avgAsm_;
+
    // ParLinearForm * avgHCurl_[3];
    // ParLinearForm * avgHDiv_[3];
 
@@ -352,6 +914,10 @@ private:
    HypreParVector * AvgHDiv_muInv_coskx_[3];
    HypreParVector * AvgHDiv_muInv_sinkx_[3];
 
+   // Projections of every eigenvector onto the vectors above, one column
+   // per eigenvector, reduced across processors in a single call
+   DenseMatrix avgVals_;
+
    std::vector<double> solve_times_;
    std::vector<int>    solve_iters_;
 
@@ -392,29 +958,152 @@ private:
    class MaxwellBlochWavePrecond : public Solver
    {
    public:
-      MaxwellBlochWavePrecond(ParFiniteElementSpace & HCurlFESpace,
+      MaxwellBlochWavePrecond(ParFESpaceWorkspace & ws,
                               BlockDiagonalPreconditioner & BDP,
-                              Operator & subSpaceProj,
+                              MaxwellBlochWaveProjector & subSpaceProj,
                               double w);
 
       ~MaxwellBlochWavePrecond();
 
+      /** Solve the projections to a tolerance proportional to the norm of
+          the incoming residual relative to the largest one seen so far,
+          clamped to [1e-13, 1e-4].  The projector keeps its tight
+          tolerance when used by the eigensolver directly. */
+      void SetAdaptiveProjection(bool ap) { adaptive_ = ap; }
+
       void Mult(const Vector & x, Vector & y) const;
 
       void SetOperator(const Operator & A);
 
+      size_t GetMemoryUsage() const
+      { return 3 * sizeof(double) * u_->Size(); }
+
    private:
       int myid_;
 
       // ParFiniteElementSpace * HCurlFESpace_;
       BlockDiagonalPreconditioner * BDP_;
       const Operator * A_;
-      Operator * subSpaceProj_;
+      MaxwellBlochWaveProjector * subSpaceProj_;
       mutable HypreParVector *r_, *u_, *v_;
+
+      bool adaptive_;
+      mutable double rRef_;
       // double w_;
    };
 };
 
+/** A binary store for the results of a dispersion sweep.
+
+    Each processor writes its own file, "<prefix>/disp.bin.<rank>", which
+    begins with a Header followed by one variable length record per solved
+    k-point:
+
+      Record   : sweep index, number of modes, label and kappa
+      double   : nev eigenvalues
+      double   : nev relative residuals, |A x - lambda M x| / |M x|
+      double   : optionally, the local slices of the nev eigenvectors, each
+                 holding the real part followed by the imaginary part
+
+    Every processor holds the same records apart from the eigenvector
+    slices.  Records are appended and flushed as soon as the k-point has
+    been solved so that a sweep which was interrupted can be resumed from
+    the last record which is complete on every processor.  Existing files
+    are read through a memory map.
+*/
+class DispersionStore
+{
+public:
+   struct Header
+   {
+      char      magic[8];
+      int       version;
+      int       lattice_type;
+      double    lengths[3];
+      double    angles[3];
+      int       serial_ref;
+      int       par_ref;
+      int       order;
+      int       num_procs;
+      int       rank;
+      int       store_vecs;
+      HYPRE_Int glb_size;
+      HYPRE_Int loc_size;
+   };
+
+   struct Record
+   {
+      int    index;
+      int    nev;
+      int    has_vecs;
+      int    pad;
+      char   label[16];
+      double kappa[3];
+   };
+
+   /// Open an existing file read-only, e.g. for post-processing
+   DispersionStore(const std::string & fname);
+
+   /** Collectively open the files of a sweep for writing.  When restart is
+       true and compatible files exist, the records which are complete on
+       every processor are kept and the rest are discarded.  Otherwise new
+       files are started.  Only the header fields describing the sweep need
+       to be set in hdr. */
+   DispersionStore(MPI_Comm comm, const std::string & prefix,
+                   const Header & hdr, bool restart);
+   ~DispersionStore();
+
+   const Header & GetHeader() const { return hdr_; }
+
+   /// Number of records read from an existing file
+   int GetNumRecords() const { return (int)offsets_.size(); }
+
+   const Record & GetRecord(int r) const;
+   const double * GetEigenvalues(int r) const;
+   const double * GetResiduals(int r) const;
+
+   /// Local slice of the i-th eigenvector of record r, or NULL
+   const double * GetEigenvector(int r, int i) const;
+
+   /// The record holding the sweep point index, or -1
+   int FindRecord(int index) const;
+
+   /** Copy the eigenvalues of sweep point index when they have already been
+       stored.  The eigenvectors of the most recent such record are then
+       offered as the initial vectors of the next solve by SetWarmStart. */
+   bool RestoreEigenvalues(int index, std::vector<double> & eigenvalues);
+
+   /// Overwrite init_vecs with the eigenvectors of the last restored record
+   bool SetWarmStart(std::vector<HypreParVector*> & init_vecs);
+
+   /// Append the solution of sweep point index
+   void AddRecord(int index, const std::string & label, const Vector & kappa,
+                  MaxwellBlochWaveEquation & eq);
+
+private:
+   bool mapFile();
+   void unmapFile();
+
+   static size_t RecordSize(const Record & rec, HYPRE_Int loc_size);
+
+   static bool SameSweep(const Header & a, const Header & b);
+
+   int myid_;
+
+   std::string fname_;
+   std::ofstream ofs_;
+
+   Header hdr_;
+
+   char * map_;
+   size_t map_size_;
+
+   std::vector<size_t> offsets_;
+   std::map<int, int>  index_;
+
+   int warm_;
+};
+
 void
 ElementwiseEnergyNorm(BilinearFormIntegrator & bli,
                       ParGridFunction & x,
@@ -2388,6 +2388,7 @@ MaxwellBlochWaveEquationAMR::GetEigenvalues(/*int nev,*/ const Vector & kappa,
    // this->SetInitialVectors(nev, &init_vecs[0]);
    this->Solve();
    this->GetEigenvalues(eigenvalues);
+   this->setWarmStart();
    if ( myid_ == 0 )
    {
       cout << "Entering MaxwellBlochWaveEquationAMR::GetEigenvalues"
@@ -2433,185 +2434,9 @@ MaxwellBlochWaveEquationAMR::GetEigenvalues(/*int nev,*/ const Vector & kappa,
          if ( myid_ == 0 )
          { cout << "Estimating errors" << endl; }
 
-         Vector errors(pmesh_->GetNE());
-         Vector errors_r(pmesh_->GetNE());
-         Vector errors_i(pmesh_->GetNE());
-
-         // Space for the discontinuous (original) flux
-         CurlCurlIntegrator flux_integrator(*aCoef_);
-         RT_FECollection flux_fec(order_-1, pmesh_->SpaceDimension());
-         ParFiniteElementSpace flux_fes(pmesh_, &flux_fec);
-
-         // Space for the smoothed (conforming) flux
-         ND_FECollection smooth_flux_fec(order_, pmesh_->Dimension());
-         ParFiniteElementSpace smooth_flux_fes(pmesh_, &smooth_flux_fec);
-
-         ParGridFunction er(HCurlFESpace_);
-         ParGridFunction ei(HCurlFESpace_);
-
-         HypreParVector Er(HCurlFESpace_->GetComm(),
-                           HCurlFESpace_->GlobalTrueVSize(),
-                           NULL,
-                           HCurlFESpace_->GetTrueDofOffsets());
-         HypreParVector Ei(HCurlFESpace_->GetComm(),
-                           HCurlFESpace_->GlobalTrueVSize(),
-                           NULL,
-                           HCurlFESpace_->GetTrueDofOffsets());
-
-         double norm_p = 1;
-         errors = 0.0;
-
-         set<int>::const_iterator sit;
-         for (sit=modes.begin(); sit!=modes.end(); sit++)
-         {
-            // convert eigenvector from HypreParVector to ParGridFunction
-            this->GetEigenvectorE(*sit, Er, Ei);
-            er = Er;
-            ei = Ei;
-
-            L2ZZErrorEstimator(flux_integrator, er,
-                               smooth_flux_fes, flux_fes, errors_r, norm_p);
-            L2ZZErrorEstimator(flux_integrator, ei,
-                               smooth_flux_fes, flux_fes, errors_i, norm_p);
-
-            for (int j=0; j<errors.Size(); j++)
-            {
-               errors[j] += pow(errors_r[j], norm_p) + pow(errors_i[j], norm_p);
-            }
-         }
-         for (int j=0; j<errors.Size(); j++)
-         {
-            errors[j] = pow(errors[j], 1.0/norm_p);
-         }
-
-         double local_max_err = errors.Max();
-         double global_max_err;
-         MPI_Allreduce(&local_max_err, &global_max_err, 1,
-                       MPI_DOUBLE, MPI_MAX, pmesh_->GetComm());
-
-         if ( myid_ == 0 ) { cout << "Maximum error: " << global_max_err << endl; }
-
-         // Refine the elements whose error is larger than a fraction of the
-         // maximum element error.
-         const double frac = 0.5;
-         double threshold = frac * global_max_err;
-         if ( myid_ == 0 )
-         {
-            cout << "AMR iteration " << it+1 << ", refining from "
-                 << pmesh_->GetNE() << " elements" << flush;
-         }
-         pmesh_->RefineByError(errors, threshold, 0);
-         currSizes_ = false;
-         if ( myid_ == 0 )
-         {
-            cout << " to " << pmesh_->GetNE() << "." << endl;
-         }
-
-         num_init_vecs_ = nev_;
-
-         if ( init_gfr_ == NULL )
-         {
-            init_gfr_ = new ParGridFunction*[num_init_vecs_];
-            for ( int i=0; i<num_init_vecs_; i++)
-            {
-               init_gfr_[i] = new ParGridFunction(HCurlFESpace_);
-            }
-         }
-         if ( init_gfi_ == NULL )
-         {
-            init_gfi_ = new ParGridFunction*[num_init_vecs_];
-            for ( int i=0; i<num_init_vecs_; i++)
-            {
-               init_gfi_[i] = new ParGridFunction(HCurlFESpace_);
-            }
-         }
-         for (int i=0; i<num_init_vecs_; i++)
-         {
-            this->GetEigenvectorE(i, Er, Ei);
-            *init_gfr_[i] = Er;
-            *init_gfi_[i] = Ei;
-         }
-         /*
-              ParGridFunction ** vr = new ParGridFunction*[num_init_vecs_];
-              ParGridFunction ** vi = new ParGridFunction*[num_init_vecs_];
-
-              HypreParVector Vr(this->GetHCurlFESpace()->GetComm(),
-                                this->GetHCurlFESpace()->GlobalTrueVSize(),
-                                NULL,
-                                this->GetHCurlFESpace()->GetTrueDofOffsets());
-              HypreParVector Vi(this->GetHCurlFESpace()->GetComm(),
-                                this->GetHCurlFESpace()->GlobalTrueVSize(),
-                                NULL,
-                                this->GetHCurlFESpace()->GetTrueDofOffsets());
-
-              for (int i=0; i<num_init_vecs_; i++)
-              {
-                 vr[i] = new ParGridFunction(HCurlFESpace_);
-                 vi[i] = new ParGridFunction(HCurlFESpace_);
-
-                 Vr.SetData(&(*init_vecs_[i])(0));
-                 Vi.SetData(&(*init_vecs_[i])(hcurl_loc_size_));
-
-                 *vr[i] = Vr;
-                 *vi[i] = Vi;
-
-                 delete init_vecs_[i];
-              }
-         */
-         this->Update();
-
-         if ( init_vecs_ == NULL )
-         {
-            init_vecs_ = new HypreParVector*[num_init_vecs_];
-            for (int i=0; i<num_init_vecs_; i++)
-            {
-               init_vecs_[i] = new HypreParVector(comm_,
-                                                  2*hcurl_glb_size_, part_);
-            }
-         }
-         for (int i=0; i<num_init_vecs_; i++)
-         {
-            init_gfr_[i]->Update();
-            init_gfi_[i]->Update();
-
-            Er.SetDataAndSize(&(*init_vecs_[i])(0), hcurl_loc_size_);
-            Ei.SetDataAndSize(&(*init_vecs_[i])(hcurl_loc_size_),
-                              hcurl_loc_size_);
-
-            init_gfr_[i]->ParallelAssemble(Er);
-            init_gfi_[i]->ParallelAssemble(Ei);
-         }
-         if ( lobpcg_ )
-         {
-            lobpcg_->SetInitialVectors(num_init_vecs_, init_vecs_);
-         }
-         /*
-              if ( myid_ == 0 )
-              { cout << "Updating initial vectors" << endl; }
-
-              HypreParVector Wr(this->GetHCurlFESpace()->GetComm(),
-                                this->GetHCurlFESpace()->GlobalTrueVSize(),
-                                NULL,
-                                this->GetHCurlFESpace()->GetTrueDofOffsets());
-              HypreParVector Wi(this->GetHCurlFESpace()->GetComm(),
-                                this->GetHCurlFESpace()->GlobalTrueVSize(),
-                                NULL,
-                                this->GetHCurlFESpace()->GetTrueDofOffsets());
-
-              for (int i=0; i<num_init_vecs_; i++)
-              {
-                 vr[i]->Update();
-                 vi[i]->Update();
-
-                 init_vecs_[i] = new HypreParVector(comm_, 2*hcurl_glb_size_, part_);
-
-                 Wr.SetData(&(*init_vecs_[i])(0));
-                 Wi.SetData(&(*init_vecs_[i])(hcurl_loc_size_));
-
-                 vr[i]->ParallelAssemble(Wr);
-                 vi[i]->ParallelAssemble(Wi);
-              }
-         */
+         Vector errors;
+         this->estimateErrors(modes, errors);
+         this->refineMesh(errors);
       }
       /*
       if ( it == 0 )
@@ -2685,6 +2510,237 @@ MaxwellBlochWaveEquationAMR::GetEigenvalues(/*int nev,*/ const Vector & kappa,
    }
 }
 
+void
+MaxwellBlochWaveEquationAMR::AdaptMesh(const vector<Vector> & kappas,
+                                       const set<int> & modes,
+                                       vector<vector<double> > & eigenvalues)
+{
+   if ( myid_ == 0 )
+   {
+      cout << "Entering MaxwellBlochWaveEquationAMR::AdaptMesh" << endl;
+   }
+
+   eigenvalues.resize(kappas.size());
+
+   Vector errors, errors_k;
+
+   for (int it=0; it<=ar_; it++)
+   {
+      if ( myid_ == 0 )
+      { cout << "Shared AMR loop:  iteration " << it << endl; }
+
+      for (unsigned int k=0; k<kappas.size(); k++)
+      {
+         // The number of modes depends on whether kappa vanishes
+         this->SetKappa(kappas[k]);
+
+         int nev = numModes(1);
+         if ( fabs(beta_) == 0.0 ) { nev += 2; }
+         this->SetNumEigs(nev / 2);
+
+         this->Setup();
+         this->Solve();
+         this->GetEigenvalues(eigenvalues[k]);
+         this->setWarmStart();
+
+         if ( it < ar_ )
+         {
+            this->estimateErrors(modes, errors_k);
+            if ( k == 0 )
+            {
+               errors = errors_k;
+            }
+            else
+            {
+               for (int j=0; j<errors.Size(); j++)
+               {
+                  errors[j] = max(errors[j], errors_k[j]);
+               }
+            }
+         }
+      }
+
+      if ( it < ar_ )
+      {
+         this->refineMesh(errors);
+      }
+   }
+
+   if ( myid_ == 0 )
+   {
+      cout << "Leaving MaxwellBlochWaveEquationAMR::AdaptMesh" << endl;
+   }
+}
+
+void
+MaxwellBlochWaveEquationAMR::estimateErrors(const set<int> & modes,
+                                            Vector & errors)
+{
+   errors.SetSize(pmesh_->GetNE());
+   Vector errors_r(pmesh_->GetNE());
+   Vector errors_i(pmesh_->GetNE());
+
+   // Space for the discontinuous (original) flux
+   CurlCurlIntegrator flux_integrator(*aCoef_);
+   RT_FECollection flux_fec(order_-1, pmesh_->SpaceDimension());
+   ParFiniteElementSpace flux_fes(pmesh_, &flux_fec);
+
+   // Space for the smoothed (conforming) flux
+   ND_FECollection smooth_flux_fec(order_, pmesh_->Dimension());
+   ParFiniteElementSpace smooth_flux_fes(pmesh_, &smooth_flux_fec);
+
+   ParGridFunction er(HCurlFESpace_);
+   ParGridFunction ei(HCurlFESpace_);
+
+   HypreParVector Er(HCurlFESpace_->GetComm(),
+                     HCurlFESpace_->GlobalTrueVSize(),
+                     NULL,
+                     HCurlFESpace_->GetTrueDofOffsets());
+   HypreParVector Ei(HCurlFESpace_->GetComm(),
+                     HCurlFESpace_->GlobalTrueVSize(),
+                     NULL,
+                     HCurlFESpace_->GetTrueDofOffsets());
+
+   double norm_p = 1;
+   errors = 0.0;
+
+   set<int>::const_iterator sit;
+   for (sit=modes.begin(); sit!=modes.end(); sit++)
+   {
+      // convert eigenvector from HypreParVector to ParGridFunction
+      this->GetEigenvectorE(*sit, Er, Ei);
+      er = Er;
+      ei = Ei;
+
+      L2ZZErrorEstimator(flux_integrator, er,
+                         smooth_flux_fes, flux_fes, errors_r, norm_p);
+      L2ZZErrorEstimator(flux_integrator, ei,
+                         smooth_flux_fes, flux_fes, errors_i, norm_p);
+
+      for (int j=0; j<errors.Size(); j++)
+      {
+         errors[j] += pow(errors_r[j], norm_p) + pow(errors_i[j], norm_p);
+      }
+   }
+   for (int j=0; j<errors.Size(); j++)
+   {
+      errors[j] = pow(errors[j], 1.0/norm_p);
+   }
+}
+
+void
+MaxwellBlochWaveEquationAMR::refineMesh(const Vector & errors)
+{
+   double local_max_err = errors.Max();
+   double global_max_err;
+   MPI_Allreduce(&local_max_err, &global_max_err, 1,
+                 MPI_DOUBLE, MPI_MAX, pmesh_->GetComm());
+
+   if ( myid_ == 0 ) { cout << "Maximum error: " << global_max_err << endl; }
+
+   // Refine the elements whose error is larger than a fraction of the
+   // maximum element error.
+   const double frac = 0.5;
+   double threshold = frac * global_max_err;
+   if ( myid_ == 0 )
+   {
+      cout << "Refining from " << pmesh_->GetNE() << " elements" << flush;
+   }
+   pmesh_->RefineByError(errors, threshold, 0);
+   currSizes_ = false;
+   if ( myid_ == 0 )
+   {
+      cout << " to " << pmesh_->GetNE() << "." << endl;
+   }
+
+   HypreParVector Er(HCurlFESpace_->GetComm(),
+                     HCurlFESpace_->GlobalTrueVSize(),
+                     NULL,
+                     HCurlFESpace_->GetTrueDofOffsets());
+   HypreParVector Ei(HCurlFESpace_->GetComm(),
+                     HCurlFESpace_->GlobalTrueVSize(),
+                     NULL,
+                     HCurlFESpace_->GetTrueDofOffsets());
+
+   // Hold the current electric fields as grid functions so that they can
+   // follow the refinement and serve as the next initial vectors
+   if ( init_vecs_ != NULL )
+   {
+      for (int i=0; i<num_init_vecs_; i++) { delete init_vecs_[i]; }
+      delete [] init_vecs_;
+      init_vecs_ = NULL;
+   }
+   if ( init_gfr_ != NULL )
+   {
+      for (int i=0; i<num_init_vecs_; i++)
+      {
+         delete init_gfr_[i];
+         delete init_gfi_[i];
+      }
+      delete [] init_gfr_;
+      delete [] init_gfi_;
+   }
+
+   num_init_vecs_ = nev_;
+
+   init_gfr_ = new ParGridFunction*[num_init_vecs_];
+   init_gfi_ = new ParGridFunction*[num_init_vecs_];
+   for (int i=0; i<num_init_vecs_; i++)
+   {
+      init_gfr_[i] = new ParGridFunction(HCurlFESpace_);
+      init_gfi_[i] = new ParGridFunction(HCurlFESpace_);
+
+      this->GetEigenvectorE(i, Er, Ei);
+      *init_gfr_[i] = Er;
+      *init_gfi_[i] = Ei;
+   }
+
+   this->Update();
+   if ( !currSizes_ ) { this->SetupSizes(); }
+
+   // The initial vectors span the full block system, the magnetic flux
+   // blocks are left at zero
+   init_vecs_ = new HypreParVector*[num_init_vecs_];
+   for (int i=0; i<num_init_vecs_; i++)
+   {
+      init_vecs_[i] = new HypreParVector(comm_,
+                                         2 * (hcurl_glb_size_ +
+                                              hdiv_glb_size_),
+                                         part_);
+      *init_vecs_[i] = 0.0;
+
+      init_gfr_[i]->Update();
+      init_gfi_[i]->Update();
+
+      Er.SetDataAndSize(&(*init_vecs_[i])(0), hcurl_loc_size_);
+      Ei.SetDataAndSize(&(*init_vecs_[i])(hcurl_loc_size_),
+                        hcurl_loc_size_);
+
+      init_gfr_[i]->ParallelAssemble(Er);
+      init_gfi_[i]->ParallelAssemble(Ei);
+   }
+   if ( lobpcg_ )
+   {
+      lobpcg_->SetInitialVectors(num_init_vecs_, init_vecs_);
+   }
+}
+
+void
+MaxwellBlochWaveEquationAMR::setWarmStart()
+{
+   if ( vecs_ == NULL || init_vecs_ == NULL ) { return; }
+
+   // SetupBlockSolver hands init_vecs_ to each new eigensolver so copying
+   // the latest eigenvectors there warm starts the next k-point
+   for (int i=0; i<min(nev_, num_init_vecs_); i++)
+   {
+      if ( init_vecs_[i]->Size() == vecs_[i]->Size() )
+      {
+         *init_vecs_[i] = *vecs_[i];
+      }
+   }
+}
+
 void
 MaxwellBlochWaveEquationAMR::GetEigenvector(unsigned int i,
                                             HypreParVector & Er,
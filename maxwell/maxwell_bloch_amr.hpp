@@ -288,6 +288,17 @@ public:
                                     const std::set<int> & modes, double tol,
                                     std::vector<double> & eigenvalues);
 
+   /** Adapt the mesh shared by all k-points.  At each of the ar
+       refinement levels the listed modes are solved at every phase shift
+       in kappas and the elements are refined according to the maximum of
+       their error indicators over those phase shifts.  The eigenvalues
+       returned are those computed on the final mesh.  Later calls to
+       GetEigenvalues(kappa, eigenvalues) reuse the adapted mesh and are
+       warm started from the previous eigenvectors. */
+   void AdaptMesh(const std::vector<Vector> & kappas,
+                  const std::set<int> & modes,
+                  std::vector<std::vector<double> > & eigenvalues);
+
    /// Extract a single eigenvector
    void GetEigenvector(unsigned int i,
                        HypreParVector & Er,
@@ -363,6 +374,15 @@ private:
    void UpdateFES();
    void UpdateTmpVectors();
 
+   // Element error indicators summed over the given modes
+   void estimateErrors(const std::set<int> & modes, Vector & errors);
+
+   // Refine by error and carry the current eigenvectors to the new mesh
+   void refineMesh(const Vector & errors);
+
+   // Copy the latest eigenvectors into the initial vectors
+   void setWarmStart();
+
    MPI_Comm comm_;
    int myid_;
    int num_procs_;
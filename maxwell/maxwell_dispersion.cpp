@@ -1,7 +1,9 @@
 #include "mfem.hpp"
 #include "maxwell_bloch.hpp"
 #include "../common/bravais.hpp"
+#include <climits>
 #include <complex>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -34,43 +36,47 @@ void PrintPhaseShifts(const vector<Vector> & lattice_vecs,
 void CreateInitialVectors(BRAVAIS_LATTICE_TYPE lattice_type,
                           const BravaisLattice & bravais,
                           const Vector & kappa,
-                          ParFiniteElementSpace & fespace,
+                          ParFESpaceWorkspace & ws,
                           int & nev,
                           vector<HypreParVector*> & init_vecs);
 
 void WriteDispersionData(int myid, ostream & os, int c,
                          const string & label, vector<double> & eigenvalues);
 
-class FourierVectorCoefficient
-{
-public:
-   FourierVectorCoefficient();
-
-   void SetN(int n0, int n1, int n2) { n_[0] = n0; n_[1] = n1; n_[2] = n2; }
-   void SetA(const Vector & Ar, const Vector & Ai) { Ar_ = Ar; Ai_ = Ai; }
-
-   const vector<int> & GetN()  const { return n_; }
-   const Vector      & GetAr() const { return Ar_; }
-   const Vector      & GetAi() const { return Ai_; }
-
-   double GetEnergy() const { return Ar_ * Ar_ + Ai_ * Ai_; }
-
-   complex<double> operator*(const FourierVectorCoefficient & v) const;
-
-   void Print(ostream & os);
-
-private:
-   vector<int> n_;
-   Vector Ar_;
-   Vector Ai_;
-};
-
+// Solves the irreducible points of a full zone k-mesh, shared round robin
+// between the nkg processor groups, then writes the band data, density
+// of states, and band gap bounds
+void SweepBrillouinZone(MPI_Comm comm, int kgroup, int nkg,
+                        BRAVAIS_LATTICE_TYPE lattice_type,
+                        const BravaisLattice & bravais,
+                        MaxwellBlochWaveEquation & eq,
+                        int nk, int nbins, const string & prefix,
+                        ostream & ofs);
+
+// Steps the lattice parameters from those of bravais to p1 (a, b, c,
+// alpha, beta, gamma) in nls increments.  The mesh, and the coarse mesh
+// of the multigrid hierarchy, are morphed rather than rebuilt and the
+// modes at the symmetry points of every lattice are written to
+// lattice_sweep.dat.
+void SweepLatticeParameters(BRAVAIS_LATTICE_TYPE lattice_type,
+                            BravaisLattice & bravais, const Vector & p1,
+                            int nls, double lcf,
+                            ParMesh & pmesh, ParMesh * coarse,
+                            ParGridFunction & m, ParGridFunction & k,
+                            MaxwellBlochWaveEquation & eq,
+                            const string & prefix, ostream & ofs,
+                            int logging);
+
+// The coefficients of all modes with |n_i| <= nmax are stored in flat
+// arrays indexed by (n0,n1,n2) along with a flag marking the modes which
+// were actually set.  The tier of a mode is n0^2 + n1^2 + n2^2.
 class FourierVectorCoefficients
 {
 public:
    FourierVectorCoefficients();
-   ~FourierVectorCoefficients();
 
+   void   SetNMax(int nmax);
+   int    GetNMax() const         { return nmax_; }
    void   SetOmega( double omega) { omega_ = omega; }
    double GetOmega() const        { return omega_; }
    double GetEnergy() const;
@@ -84,21 +90,29 @@ public:
                        Vector & Ar,
                        Vector & Ai) const;
 
-   const FourierVectorCoefficient * GetCoefficient(int n0,int n1,int n2) const;
-
+   bool HasCoefficient(int n0, int n1, int n2) const;
 
    complex<double> operator*(const FourierVectorCoefficients & v) const;
 
    void Print(ostream & os);
 
 private:
+   int index(int n0, int n1, int n2) const
+   { return ((n0 + nmax_) * w_ + n1 + nmax_) * w_ + n2 + nmax_; }
+
+   void modeIndices(int m, int & n0, int & n1, int & n2) const;
+
    double omega_;
+   int    nmax_;
+   int    w_;
 
-   map<int,set<FourierVectorCoefficient*> > coefs_;
+   vector<double> ar_;
+   vector<double> ai_;
+   vector<bool>   set_;
 };
 
-void ComputeFourierCoefficients(int myid, ostream & ofs_coef, int nmax,
-                                HCurlFourierSeries & fourier,
+void ComputeFourierCoefficients(int myid, ostream & ofs_coef,
+                                VectorFourierProjector & fourier,
                                 MaxwellBlochWaveEquation & eq,
                                 ParFiniteElementSpace & HCurlFESpace,
                                 const vector<double> & eigenvalues,
@@ -116,7 +130,30 @@ int main(int argc, char *argv[])
    // 1. Initialize MPI.
    int num_procs, myid;
    MPI_Comm comm = MPI_COMM_WORLD;
-   MPI_Init(&argc, &argv);
+   // Full thread support, which allows the output to be written
+   // asynchronously, is only requested when -ao is given
+   bool async_output = false;
+   for (int i=1; i<argc; i++)
+   {
+      if ( !strcmp(argv[i], "-ao") || !strcmp(argv[i], "--async-output") )
+      {
+         async_output = true;
+      }
+      else if ( !strcmp(argv[i], "-no-ao") ||
+                !strcmp(argv[i], "--no-async-output") )
+      {
+         async_output = false;
+      }
+   }
+   if ( async_output )
+   {
+      int provided = MPI_THREAD_SINGLE;
+      MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+   }
+   else
+   {
+      MPI_Init(&argc, &argv);
+   }
    MPI_Comm_size(comm, &num_procs);
    MPI_Comm_rank(comm, &myid);
 
@@ -131,12 +168,28 @@ int main(int argc, char *argv[])
    bool visualization = false;
    bool visit = true;
    bool write_mats = false;
+   bool single_prec = false;
+   bool multigrid = false;
+   bool adaptive_proj = false;
+   bool partial_assembly = false;
+   bool low_order_prec = false;
+   bool low_memory = false;
+   bool restart = false;
+   bool store_vecs = false;
+   const char *mesh_cache = "";
    int nev = 0;
    // int num_beta = 10;
    int np = 0;
+   int nk = 0;
+   int nkg = 1;
+   int nbins = 200;
+   int nls = 0;
+   int fourier_nmax = 0;
    double a = -1.0, b = -1.0, c = -1.0;
    double alpha = -1.0, beta = -1.0, gamma = -1.0;
    double alpha_deg = -1.0, beta_deg = -1.0, gamma_deg = -1.0;
+   double a1 = -1.0, b1 = -1.0, c1 = -1.0;
+   double alpha1_deg = -1.0, beta1_deg = -1.0, gamma1_deg = -1.0;
    double lcf = -1.0;
    // double beta_min = 1.0;
    // double beta_max = 180.0;
@@ -200,6 +253,23 @@ int main(int argc, char *argv[])
                   "Lattice angle beta in degrees");
    args.AddOption(&gamma_deg, "-gamma-deg", "--lattice-gamma-degrees",
                   "Lattice angle gamma in degrees");
+   args.AddOption(&nls, "-nls", "--num-lattice-steps",
+                  "Sweep the lattice parameters towards -a1, -b1, -c1, "
+                  "-alpha1-deg, -beta1-deg and -gamma1-deg in this many "
+                  "steps by morphing the mesh rather than following the "
+                  "band diagram path (0).");
+   args.AddOption(&a1, "-a1", "--lattice-a-final",
+                  "Final lattice spacing a of a lattice sweep");
+   args.AddOption(&b1, "-b1", "--lattice-b-final",
+                  "Final lattice spacing b of a lattice sweep");
+   args.AddOption(&c1, "-c1", "--lattice-c-final",
+                  "Final lattice spacing c of a lattice sweep");
+   args.AddOption(&alpha1_deg, "-alpha1-deg", "--lattice-alpha-final-degrees",
+                  "Final lattice angle alpha of a lattice sweep in degrees");
+   args.AddOption(&beta1_deg, "-beta1-deg", "--lattice-beta-final-degrees",
+                  "Final lattice angle beta of a lattice sweep in degrees");
+   args.AddOption(&gamma1_deg, "-gamma1-deg", "--lattice-gamma-final-degrees",
+                  "Final lattice angle gamma of a lattice sweep in degrees");
    args.AddOption(&lcf, "-lcf", "--lattice-coef-frac",
                   "Fraction of inscribed circle radius for rods");
    //args.AddOption(&alpha_a, "-az", "--azimuth",
@@ -211,6 +281,15 @@ int main(int argc, char *argv[])
                   "Enable or disable mid-point calculations.");
    args.AddOption(&np, "-np", "--num-points",
                   "Number of intermediate points between symmetry points.");
+   args.AddOption(&nk, "-nk", "--num-k-divisions",
+                  "Sample the full Brillouin zone with this many points "
+                  "along each reciprocal vector rather than following the "
+                  "band diagram path (0).");
+   args.AddOption(&nkg, "-nkg", "--num-k-groups",
+                  "Number of processor groups solving k-points "
+                  "concurrently in full zone mode.");
+   args.AddOption(&nbins, "-nbins", "--num-dos-bins",
+                  "Number of frequency bins for the density of states.");
    args.AddOption(&logging, "-l", "--logging",
                   "Output message level.");
    args.AddOption(&visualization, "-vis", "--visualization", "-no-vis",
@@ -221,7 +300,45 @@ int main(int argc, char *argv[])
                   "Enable or disable VisIt visualization.");
    args.AddOption(&write_mats, "-wm", "--write-mats", "-no-wm",
                   "--no-write-mats",
-                  "Enable or disable printing of matrices.");
+                  "Enable or disable writing of binary matrix files.");
+   args.AddOption(&single_prec, "-sp", "--single-precision", "-dp",
+                  "--double-precision",
+                  "Replace AMS and BoomerAMG in the preconditioners with "
+                  "single level, single precision Chebyshev smoothers.");
+   args.AddOption(&multigrid, "-mg", "--multigrid", "-no-mg",
+                  "--no-multigrid",
+                  "Precondition the curl-curl blocks with geometric "
+                  "multigrid over the parallel refinements.");
+   args.AddOption(&adaptive_proj, "-ap", "--adaptive-projector", "-no-ap",
+                  "--no-adaptive-projector",
+                  "Tie the tolerance of the divergence projections in the "
+                  "preconditioner to the eigensolver residual.");
+   args.AddOption(&partial_assembly, "-pa", "--partial-assembly", "-no-pa",
+                  "--no-partial-assembly",
+                  "Apply the stiffness operator A matrix-free instead of "
+                  "assembling D, T12, Z12 and M2.  S1 and M1 are still "
+                  "assembled so memory is not necessarily reduced.");
+   args.AddOption(&low_order_prec, "-lo", "--low-order-prec", "-no-lo",
+                  "--no-low-order-prec",
+                  "Set up AMS on the lowest order projection of the "
+                  "curl-curl blocks.");
+   args.AddOption(&low_memory, "-lm", "--low-memory", "-no-lm",
+                  "--no-low-memory",
+                  "Release the kappa dependent operators once S1 has been "
+                  "formed.");
+   args.AddOption(&async_output, "-ao", "--async-output", "-no-ao",
+                  "--no-async-output",
+                  "Write VisIt fields and matrices from a separate thread.");
+   args.AddOption(&restart, "-rs", "--restart", "-no-rs", "--no-restart",
+                  "Resume an interrupted sweep from its stored results.");
+   args.AddOption(&store_vecs, "-sv", "--store-vectors", "-no-sv",
+                  "--no-store-vectors",
+                  "Store the eigenvectors along with the eigenvalues.");
+   args.AddOption(&mesh_cache, "-mc", "--mesh-cache",
+                  "Directory of cached lattice meshes, empty to disable.");
+   args.AddOption(&fourier_nmax, "-fn", "--fourier-nmax",
+                  "Write the Fourier coefficients of the modes along the "
+                  "path with |n_i| <= nmax to coef.dat, 0 to disable.");
    args.Parse();
    if (!args.Good())
    {
@@ -242,6 +359,25 @@ int main(int argc, char *argv[])
       np++;
    }
 
+   if ( nk > 0 && nls > 0 )
+   {
+      if (myid == 0)
+      {
+         cout << "The lattice sweep is disabled in full zone mode" << endl;
+      }
+      nls = 0;
+   }
+
+   if ( partial_assembly && write_mats )
+   {
+      // The off-diagonal blocks of A are never assembled
+      if (myid == 0)
+      {
+         cout << "Matrix output is disabled with partial assembly" << endl;
+      }
+      write_mats = false;
+   }
+
    if (myid == 0)
    {
       cout << "Creating symmetry points for lattice " << bl_type << endl;
@@ -293,6 +429,9 @@ int main(int argc, char *argv[])
                                                     alpha, beta, gamma,
                                                     logging);
    BravaisLattice3D * bravais3d = dynamic_cast<BravaisLattice3D*>(bravais);
+   MFEM_VERIFY(bravais3d != NULL,
+               "maxwell_dispersion: lattice type " << bl_type
+               << " is not a 3D Bravais lattice");
 
    lattice_label = bravais->GetLatticeTypeLabel();
 
@@ -355,37 +494,46 @@ int main(int argc, char *argv[])
    mesh = new Mesh(imesh, 1, 1);
    imesh.close();
    */
-   Mesh * mesh = bravais->GetCoarseWignerSeitzMesh();
-
-   ofs << "Initial Euler Number:  " << mesh->EulerNumber() << endl;
-   mesh->CheckElementOrientation(false);
-   mesh->CheckBdrElementOrientation(false);
+   LatticeMeshCache cache(comm, mesh_cache, logging);
 
-   // 4. Refine the serial mesh on all processors to increase the resolution. In
-   //    this example we do 'ref_levels' of uniform refinement.
+   // In full zone mode the processors may be split into groups which each
+   // solve a share of the irreducible k-points on their own copy of the mesh
+   MPI_Comm kcomm = comm;
+   int kgroup = 0;
+   if ( nk > 0 && nkg > 1 )
    {
-      int ref_levels = sr;
-      for (int l = 0; l < ref_levels; l++)
-      {
-         mesh->UniformRefinement();
-         ofs << l+1 << ", Refined Euler Number:  " << mesh->EulerNumber() << endl;
-         mesh->CheckElementOrientation(false);
-         mesh->CheckBdrElementOrientation(false);
-      }
+      nkg = min(nkg, num_procs);
+      kgroup = (int)(((long)myid * nkg) / num_procs);
+      MPI_Comm_split(comm, kgroup, myid, &kcomm);
+   }
+   else
+   {
+      nkg = 1;
    }
 
-   // 5. Define a parallel mesh by a partitioning of the serial mesh. Refine
-   //    this mesh further in parallel to increase the resolution. Once the
-   //    parallel mesh is defined, the serial mesh can be deleted.
-   ParMesh *pmesh = new ParMesh(comm, *mesh);
-   delete mesh;
+   // 4. Define a parallel mesh by a partitioning of the coarse mesh and refine
+   //    it 'sr' + 'pr' times. Only the serial refinements needed to populate
+   //    every processor are performed before partitioning and these are
+   //    read from the mesh cache when a previous run has stored them.
+   //    With multigrid the partitioned coarse mesh is kept as the bottom of
+   //    the hierarchy.
+   ParMesh *coarse = NULL;
+   ParMesh *pmesh  = NULL;
+   if ( multigrid )
    {
-      int par_ref_levels = pr;
-      for (int l = 0; l < par_ref_levels; l++)
+      coarse = DistributeMesh(kcomm, cache, *bravais, sr, 0, true,
+                              false, 8, logging);
+      pmesh = new ParMesh(*coarse);
+      for (int l=0; l<pr; l++)
       {
          pmesh->UniformRefinement();
       }
    }
+   else
+   {
+      pmesh = DistributeMesh(kcomm, cache, *bravais, sr, pr, true,
+                             false, 8, logging);
+   }
 
    ND_ParFESpace * HCurlFESpace = new ND_ParFESpace(pmesh, order,
                                                     pmesh->Dimension());
@@ -440,9 +588,15 @@ int main(int argc, char *argv[])
    GridFunctionCoefficient kCoef(k);
 
    MaxwellBlochWaveEquation * eq =
-      new MaxwellBlochWaveEquation(*pmesh, order);
+      new MaxwellBlochWaveEquation(*pmesh, order, low_memory);
 
-   // HCurlFourierSeries fourier_hcurl(*bravais, *HCurlFESpace);
+   VectorFourierProjector * fourier_hcurl = NULL;
+   if ( fourier_nmax > 0 )
+   {
+      fourier_hcurl = new VectorFourierProjector(*bravais,
+                                                 *eq->GetHCurlFESpace(),
+                                                 fourier_nmax);
+   }
 
    HYPRE_Int size = eq->GetHCurlFESpace()->GlobalTrueVSize();
    if (myid == 0)
@@ -454,6 +608,44 @@ int main(int argc, char *argv[])
    // eq->SetNumEigs(nev);
    eq->SetMassCoef(mCoef);
    eq->SetStiffnessCoef(kCoef);
+   eq->SetSinglePrecisionPreconditioner(single_prec);
+   eq->SetAdaptiveProjector(adaptive_proj);
+   eq->SetPartialAssembly(partial_assembly);
+   eq->SetLowOrderPreconditioner(low_order_prec);
+   if ( multigrid )
+   {
+      eq->SetMultigrid(*coarse, pr);
+   }
+
+   AsyncFieldWriter * writer = NULL;
+   if ( visit || write_mats )
+   {
+      writer = new AsyncFieldWriter(*pmesh, async_output);
+      eq->SetFieldWriter(writer);
+   }
+
+   // Results of each k-point are stored as they are computed so that an
+   // interrupted sweep can be resumed
+   DispersionStore::Header store_hdr;
+   store_hdr.lattice_type = bl_type;
+   store_hdr.lengths[0]   = a;
+   store_hdr.lengths[1]   = b;
+   store_hdr.lengths[2]   = c;
+   store_hdr.angles[0]    = alpha;
+   store_hdr.angles[1]    = beta;
+   store_hdr.angles[2]    = gamma;
+   store_hdr.serial_ref   = sr;
+   store_hdr.par_ref      = pr;
+   store_hdr.order        = order;
+   store_hdr.store_vecs   = store_vecs ? 1 : 0;
+   store_hdr.glb_size     = 2 * size;
+   store_hdr.loc_size     = 2 * eq->GetHCurlFESpace()->TrueVSize();
+
+   // The store follows the band diagram path so it is not used in full
+   // zone mode or during a lattice sweep
+   DispersionStore * store = (nk > 0 || nls > 0) ? NULL :
+                             new DispersionStore(comm, oss_prefix.str(),
+                                                 store_hdr, restart);
 
    // DenseMatrix dispersion(num_beta,nev);
 
@@ -470,9 +662,31 @@ int main(int argc, char *argv[])
    map<string,vector<double> > sp_eigs;
    map<string,int> c_by_label;
    map<int, vector<set<int> > > degen;
-   // map<int, map<int, FourierVectorCoefficients> > mfc;
+   map<int, map<int, FourierVectorCoefficients> > mfc;
+
+   if ( nk > 0 )
+   {
+      SweepBrillouinZone(comm, kgroup, nkg, lattice_type, *bravais, *eq,
+                         nk, nbins, oss_prefix.str(), ofs);
+   }
+   else if ( nls > 0 )
+   {
+      // Unset final parameters are left at their initial values
+      Vector p1(6);
+      p1[0] = ( a1 > 0.0 ) ? a1 : a;
+      p1[1] = ( b1 > 0.0 ) ? b1 : b;
+      p1[2] = ( c1 > 0.0 ) ? c1 : c;
+      p1[3] = ( alpha1_deg > 0.0 ) ? alpha1_deg * M_PI / 180.0 : alpha;
+      p1[4] = (  beta1_deg > 0.0 ) ?  beta1_deg * M_PI / 180.0 : beta;
+      p1[5] = ( gamma1_deg > 0.0 ) ? gamma1_deg * M_PI / 180.0 : gamma;
+
+      SweepLatticeParameters(lattice_type, *bravais, p1, nls, lcf,
+                             *pmesh, coarse, *m, *k, *eq,
+                             oss_prefix.str(), ofs, logging);
+   }
 
-   for (unsigned int p=0; p<bravais->GetNumberPaths(); p++)
+   for (unsigned int p=0; nk == 0 && nls == 0 &&
+        p<bravais->GetNumberPaths(); p++)
       // for (unsigned int p=1; p<bravais->GetNumberPaths(); p++)
    {
       int e0 = -1, e1 = -1;
@@ -524,11 +738,17 @@ int main(int argc, char *argv[])
                   }
                }
 
-               CreateInitialVectors(lattice_type, *bravais, kappa,
-                                    *eq->GetHCurlFESpace(),
-                                    nev, init_vecs);
+               bool restored = store->RestoreEigenvalues(count, eigenvalues);
+               if ( !restored )
+               {
+                  CreateInitialVectors(lattice_type, *bravais, kappa,
+                                       *eq->GetHCurlWorkspace(),
+                                       nev, init_vecs);
+                  store->SetWarmStart(init_vecs);
 
-               eq->GetEigenvalues(nev, kappa, init_vecs, eigenvalues);
+                  eq->GetEigenvalues(nev, kappa, init_vecs, eigenvalues);
+                  store->AddRecord(count, label, kappa, *eq);
+               }
                /*
                eq->SetNumEigs(nev);
                eq->SetKappa(kappa);
@@ -543,14 +763,14 @@ int main(int argc, char *argv[])
                   }
                }
 
-               if ( visit )
+               if ( visit && !restored )
                {
                   if ( i == 0 || ( midpoints && i == ( np + 1 ) / 2 ) )
                   {
                      eq->WriteVisitFields(oss_prefix.str(),label);
                   }
                }
-               if ( write_mats )
+               if ( write_mats && !restored )
                {
                   ostringstream ossAr; ossAr << oss_prefix.str() << "/Ar" << label << ".mat";
                   ostringstream ossAi; ossAi << oss_prefix.str() << "/Ai" << label << ".mat";
@@ -584,21 +804,24 @@ int main(int argc, char *argv[])
 
                   cout << "A coefs: " << ar << ", " << ai << endl;
 
-                  if ( Ar ) { Ar->Print(ossAr.str().c_str()); }
-                  if ( Ai ) { Ai->Print(ossAi.str().c_str()); }
-                  if ( Mr ) { Mr->Print(ossM.str().c_str()); }
+                  if ( Ar ) { writer->WriteMatrix(*Ar, ossAr.str()); }
+                  if ( Ai ) { writer->WriteMatrix(*Ai, ossAi.str()); }
+                  if ( Mr ) { writer->WriteMatrix(*Mr, ossM.str()); }
                }
 
                WriteDispersionData(myid,ofs_disp,count,label,eigenvalues);
 
                IdentifyDegeneracies(eigenvalues, 1.0e-4, 1.0e-4, degen[count]);
-               /*
-                    ComputeFourierCoefficients(myid, ofs_coef, 1,
-                                               fourier_hcurl, *eq,
-                                               *HCurlFESpace,
-                                               eigenvalues,
-                                               mfc[count]);
-               */
+
+               // Restored points have no eigenvectors to project
+               if ( fourier_hcurl && !restored )
+               {
+                  ComputeFourierCoefficients(myid, ofs_coef,
+                                             *fourier_hcurl, *eq,
+                                             *eq->GetHCurlFESpace(),
+                                             eigenvalues,
+                                             mfc[count]);
+               }
                count++;
             }
             else
@@ -620,10 +843,17 @@ int main(int argc, char *argv[])
             PrintPhaseShifts(lattice_vecs, kappa1);
          }
 
-         CreateInitialVectors(lattice_type, *bravais, kappa1,
-                              *eq->GetHCurlFESpace(),
-                              nev, init_vecs);
-         eq->GetEigenvalues(nev, kappa1, init_vecs, eigenvalues);
+         bool restored = store->RestoreEigenvalues(count, eigenvalues);
+         if ( !restored )
+         {
+            CreateInitialVectors(lattice_type, *bravais, kappa1,
+                                 *eq->GetHCurlWorkspace(),
+                                 nev, init_vecs);
+            store->SetWarmStart(init_vecs);
+
+            eq->GetEigenvalues(nev, kappa1, init_vecs, eigenvalues);
+            store->AddRecord(count, label, kappa1, *eq);
+         }
          /*
          eq->SetNumEigs(nev);
          eq->SetKappa(kappa1);
@@ -638,7 +868,10 @@ int main(int argc, char *argv[])
          WriteDispersionData(myid,ofs_disp,count,label,eigenvalues);
          count++;
 
-         if ( visit ) { eq->WriteVisitFields(oss_prefix.str(),label); }
+         if ( visit && !restored )
+         {
+            eq->WriteVisitFields(oss_prefix.str(),label);
+         }
       }
       else
       {
@@ -653,40 +886,62 @@ int main(int argc, char *argv[])
    eq->GetSolverStats(meanTime, stdDevTime, meanIts, stdDevIts, nSolves);
    ofs << "Number of eigensolves: " << nSolves << endl;
    ofs << "Timings: " << meanTime << " " << stdDevTime << endl;
-   /*
-   map<int, map<int,FourierVectorCoefficients> >::iterator mmit;
-   map<int,FourierVectorCoefficients>::iterator mit;
-   set<int>::iterator sit;
-   for (mmit=mfc.begin(); mmit!=mfc.end(); mmit++)
-   {
-      ofs_coef << "Kappa index:  " << mmit->first << endl;
-      ofs_coef << "Degeneracies: " << endl;
-      for (unsigned int i=0; i<degen[mmit->first].size(); i++)
+
+   if ( logging > 0 )
+   {
+      eq->PrintMemoryUsage(ofs);
+   }
+
+   // The coefficients are only gathered on the root processor
+   if ( myid == 0 && !mfc.empty() )
+   {
+      map<int, map<int,FourierVectorCoefficients> >::iterator mmit;
+      map<int,FourierVectorCoefficients>::iterator mit;
+      set<int>::iterator sit;
+      for (mmit=mfc.begin(); mmit!=mfc.end(); mmit++)
       {
-         for (sit=degen[mmit->first][i].begin(); sit!=degen[mmit->first][i].end(); sit++)
+         vector<set<int> > & dg = degen[mmit->first];
+
+         ofs_coef << "Kappa index:  " << mmit->first << endl;
+         ofs_coef << "Degeneracies: " << endl;
+         for (unsigned int i=0; i<dg.size(); i++)
+         {
+            for (sit=dg[i].begin(); sit!=dg[i].end(); sit++)
+            {
+               ofs_coef << "\t" << *sit;
+            }
+            ofs_coef << endl;
+         }
+         for (mit=mmit->second.begin(); mit!=mmit->second.end(); mit++)
          {
-            ofs_coef << "\t" << *sit;
+            ofs_coef << "Eigenvalue Index:  " << mit->first << endl;
+            mit->second.Print(ofs_coef);
          }
          ofs_coef << endl;
       }
-      for (mit=mmit->second.begin(); mit!=mmit->second.end(); mit++)
-      {
-         ofs_coef << "Eigenvalue Index:  " << mit->first << endl;
-         mit->second.Print(ofs_coef);
-      }
-      ofs_coef << endl;
+
+      CompareFourierCoefficients(mfc);
    }
    ofs_coef.close();
+   // The initial vectors belong to the HCurl workspace of eq
+   init_vecs.clear();
 
-   CompareFourierCoefficients(mfc);
-   */
-   for (int i=0; i<nev; i++) { delete init_vecs[i]; }
+   // Waits for any output which is still being written
+   delete writer;
+   delete store;
 
+   delete fourier_hcurl;
    delete HCurlFESpace;
    delete L2FESpace;
    delete bravais;
    delete eq;
    delete pmesh;
+   delete coarse;
+
+   if ( kcomm != comm )
+   {
+      MPI_Comm_free(&kcomm);
+   }
 
    MPI_Finalize();
 
@@ -736,13 +991,11 @@ void
 CreateInitialVectors(BRAVAIS_LATTICE_TYPE lattice_type,
                      const BravaisLattice & bravais,
                      const Vector & kappa,
-                     ParFiniteElementSpace & HCurlFESpace,
+                     ParFESpaceWorkspace & ws,
                      int & nev,
                      vector<HypreParVector*> & init_vecs)
 {
-   // Initialize MPI variables
-   MPI_Comm comm = HCurlFESpace.GetComm();
-   int numProcs  = HCurlFESpace.GetNRanks();
+   ParFiniteElementSpace & HCurlFESpace = *ws.GetFESpace();
 
    RealModeCoefficient cosCoef;
    ImagModeCoefficient sinCoef;
@@ -756,8 +1009,8 @@ CreateInitialVectors(BRAVAIS_LATTICE_TYPE lattice_type,
    VectorFunctionCoefficient E0CosCoef(v,cosCoef);
    VectorFunctionCoefficient E0SinCoef(v,sinCoef);
 
-   ParGridFunction Er(&HCurlFESpace);
-   ParGridFunction Ei(&HCurlFESpace);
+   ParGridFunction & Er = ws.GetGridFunction(0);
+   ParGridFunction & Ei = ws.GetGridFunction(1);
 
    Array<int> bOffsets(3);
    bOffsets[0] = 0;
@@ -765,38 +1018,6 @@ CreateInitialVectors(BRAVAIS_LATTICE_TYPE lattice_type,
    bOffsets[2] = HCurlFESpace.TrueVSize();
    bOffsets.PartialSum();
 
-   int locSize = 2*HCurlFESpace.TrueVSize();
-   int glbSize = 0;
-
-   HYPRE_Int * part = NULL;
-
-   if (HYPRE_AssumedPartitionCheck())
-   {
-      part = new HYPRE_Int[2];
-
-      MPI_Scan(&locSize, &part[1], 1, HYPRE_MPI_INT, MPI_SUM, comm);
-
-      part[0] = part[1] - locSize;
-
-      MPI_Allreduce(&locSize, &glbSize, 1, HYPRE_MPI_INT, MPI_SUM, comm);
-   }
-   else
-   {
-      part = new HYPRE_Int[numProcs+1];
-
-      MPI_Allgather(&locSize, 1, MPI_INT,
-                    &part[1], 1, HYPRE_MPI_INT, comm);
-
-      part[0] = 0;
-      for (int i=0; i<numProcs; i++)
-      {
-         part[i+1] += part[i];
-      }
-
-      glbSize = part[numProcs];
-   }
-
-
    BlockVector Ea(NULL,bOffsets);
    BlockVector Eb(NULL,bOffsets);
 
@@ -1006,23 +1227,12 @@ CreateInitialVectors(BRAVAIS_LATTICE_TYPE lattice_type,
    */
    cout << "nev " << nev << ", size of E0 " << E0.size() << endl;
    nev = 2*E0.size();
-   if ( (int)init_vecs.size() > nev )
-   {
-      for (unsigned int i=nev; i<init_vecs.size(); i++)
-      {
-         delete init_vecs[i];
-      }
-      init_vecs.resize(nev);
-   }
-   else
-   {
-      int nev0 = init_vecs.size();
-      init_vecs.resize(nev);
 
-      for (int i=nev0; i<nev; i++)
-      {
-         init_vecs[i] = new HypreParVector(comm,glbSize,part);
-      }
+   // The vectors, and their partitioning, are reused between k-points
+   init_vecs.resize(nev);
+   for (int i=0; i<nev; i++)
+   {
+      init_vecs[i] = &ws.GetTrueVector(i, 2);
    }
 
    for (unsigned int i=0; i<E0.size(); i++)
@@ -1086,69 +1296,259 @@ WriteDispersionData(int myid,ostream & os, int c,
    }
 }
 
-FourierVectorCoefficient::FourierVectorCoefficient()
+void
+SweepBrillouinZone(MPI_Comm comm, int kgroup, int nkg,
+                   BRAVAIS_LATTICE_TYPE lattice_type,
+                   const BravaisLattice & bravais,
+                   MaxwellBlochWaveEquation & eq,
+                   int nk, int nbins, const string & prefix,
+                   ostream & ofs)
 {
-   n_.resize(3); Ar_.SetSize(3); Ai_.SetSize(3);
-}
+   int myid, kid;
+   MPI_Comm_rank(comm, &myid);
+   MPI_Comm_rank(eq.GetHCurlFESpace()->GetComm(), &kid);
 
-complex<double>
-FourierVectorCoefficient::operator*(const FourierVectorCoefficient & v) const
-{
-   complex<double> a = 0.0;
+   BrillouinZoneMesh kmesh(bravais, nk);
+   int nirr = kmesh.GetNumberIrreduciblePoints();
 
-   const vector<int> & n0 = this->GetN();
-   const vector<int> & n1 = v.GetN();
+   if ( myid == 0 )
+   {
+      ofs << "Full zone k-mesh: " << kmesh.GetNumberPoints()
+          << " points, " << nirr << " irreducible" << endl;
+   }
+
+   vector<HypreParVector*> init_vecs;
+   vector<vector<double> > eigs(nirr);
+   Vector kappa;
+   int nev = 0;
+   int nb = INT_MAX;
 
-   if ( n0[0] == n1[0] && n0[1] == n1[1] && n0[2] == n1[2]  )
+   for (int i=kgroup; i<nirr; i+=nkg)
    {
-      const Vector & Ar0 = this->GetAr();
-      const Vector & Ai0 = this->GetAi();
+      kmesh.GetIrreduciblePoint(i, kappa);
 
-      const Vector & Ar1 = v.GetAi();
-      const Vector & Ai1 = v.GetAi();
+      CreateInitialVectors(lattice_type, bravais, kappa,
+                           *eq.GetHCurlWorkspace(), nev, init_vecs);
 
-      // a.real() += Ar0 * Ar1 + Ai0 * Ai1;
-      // a.imag() += Ar0 * Ai1 - Ai0 * Ar1;
-      a += complex<double>(Ar0 * Ar1 + Ai0 * Ai1, Ar0 * Ai1 - Ai0 * Ar1);
+      eq.GetEigenvalues(nev, kappa, init_vecs, eigs[i]);
+      nb = min(nb, (int)eigs[i].size());
    }
+   init_vecs.clear();
 
-   return a;
+   // Only the bands found at every point are kept
+   MPI_Allreduce(MPI_IN_PLACE, &nb, 1, MPI_INT, MPI_MIN, comm);
+
+   // Each group contributes the frequencies of its own points
+   DenseMatrix bands(nirr, nb);
+   bands = 0.0;
+   if ( kid == 0 )
+   {
+      for (int i=kgroup; i<nirr; i+=nkg)
+      {
+         for (int b=0; b<nb; b++)
+         {
+            bands(i, b) = sqrt(max(eigs[i][b], 0.0));
+         }
+      }
+   }
+   MPI_Allreduce(MPI_IN_PLACE, bands.Data(), nirr * nb, MPI_DOUBLE,
+                 MPI_SUM, comm);
+
+   if ( myid != 0 ) { return; }
+
+   ofstream ofs_k((prefix + "/kmesh.dat").c_str());
+   for (int i=0; i<nirr; i++)
+   {
+      kmesh.GetIrreduciblePoint(i, kappa);
+      ofs_k << i << "\t" << kmesh.GetMultiplicity(i);
+      for (int d=0; d<kappa.Size(); d++)
+      {
+         ofs_k << "\t" << kappa[d];
+      }
+      for (int b=0; b<nb; b++)
+      {
+         ofs_k << "\t" << bands(i, b);
+      }
+      ofs_k << endl;
+   }
+   ofs_k.close();
+
+   double wmax = bands.MaxMaxNorm();
+
+   Vector dos(nbins);
+   kmesh.GetDensityOfStates(bands, 0.0, wmax, dos);
+
+   ofstream ofs_dos((prefix + "/dos.dat").c_str());
+   for (int i=0; i<nbins; i++)
+   {
+      ofs_dos << (i + 0.5) * wmax / nbins << "\t" << dos[i] << endl;
+   }
+   ofs_dos.close();
+
+   double lo0, hi0, lo1, hi1;
+   for (int b=0; b<nb-1; b++)
+   {
+      kmesh.GetBandEdges(bands, b, lo0, hi0);
+      kmesh.GetBandEdges(bands, b + 1, lo1, hi1);
+      if ( lo1 > hi0 )
+      {
+         ofs << "Band gap between bands " << b << " and " << b + 1
+             << " lies within [" << hi0 << ", " << lo1 << "]" << endl;
+      }
+   }
 }
 
 void
-FourierVectorCoefficient::Print(ostream & os)
+SweepLatticeParameters(BRAVAIS_LATTICE_TYPE lattice_type,
+                       BravaisLattice & bravais, const Vector & p1,
+                       int nls, double lcf,
+                       ParMesh & pmesh, ParMesh * coarse,
+                       ParGridFunction & m, ParGridFunction & k,
+                       MaxwellBlochWaveEquation & eq,
+                       const string & prefix, ostream & ofs,
+                       int logging)
 {
-   os << "n = (" << n_[0] << "," << n_[1] << "," << n_[2] <<  "), "
-      << "Ar = (" << Ar_[0] << "," << Ar_[1] << "," << Ar_[2] << "), "
-      << "Ai = (" << Ai_[0] << "," << Ai_[1] << "," << Ai_[2] << ")";
+   int myid;
+   MPI_Comm_rank(pmesh.GetComm(), &myid);
+
+   Vector p0(6);
+   // The six sweep parameters are those of a 3D lattice
+   BravaisLattice3D * bravais3d = dynamic_cast<BravaisLattice3D*>(&bravais);
+   MFEM_VERIFY(bravais3d != NULL, "SweepLatticeParameters: lattice "
+               "parameter sweeps require a 3D Bravais lattice");
+   bravais3d->GetAxialLengths(p0[0], p0[1], p0[2]);
+   bravais3d->GetInteraxialAngles(p0[3], p0[4], p0[5]);
+
+   ofstream ofs_ls;
+   if ( myid == 0 )
+   {
+      ofs_ls.open((prefix + "/lattice_sweep.dat").c_str());
+   }
+
+   FunctionCoefficient mFunc(mass_coef);
+   FunctionCoefficient kFunc(stiffness_coef);
+
+   vector<HypreParVector*> init_vecs;
+   vector<double> eigenvalues;
+   Vector p(6), kappa;
+   int nev = 0;
+
+   BravaisLattice * bl = &bravais;
+   for (int s=0; s<=nls; s++)
+   {
+      if ( s > 0 )
+      {
+         add(double(nls - s) / nls, p0, double(s) / nls, p1, p);
+
+         BravaisLattice * next = BravaisLatticeFactory(lattice_type,
+                                                       p[0], p[1], p[2],
+                                                       p[3], p[4], p[5],
+                                                       logging);
+
+         bool moved = MorphLatticeMesh(*bl, *next, pmesh);
+         if ( moved && coarse )
+         {
+            moved = MorphLatticeMesh(*bl, *next, *coarse);
+         }
+         MFEM_VERIFY(moved, "SweepLatticeParameters: lattice " << s
+                     << " can not be reached by morphing the mesh");
+
+         if ( bl != &bravais ) { delete bl; }
+         bl = next;
+
+         // The coefficients are sampled on the moved mesh
+         if ( lcf > 0.0 )
+         {
+            LatticeCoefficient mLatCoef(*bl, lcf, 1.0, 10.0);
+            m.ProjectCoefficient(mLatCoef);
+         }
+         else
+         {
+            m.ProjectCoefficient(mFunc);
+         }
+         k.ProjectCoefficient(kFunc);
+
+         eq.MeshMoved();
+      }
+
+      BravaisLattice3D * bl3d = dynamic_cast<BravaisLattice3D*>(bl);
+      MFEM_VERIFY(bl3d != NULL, "SweepLatticeParameters: lattice " << s
+                  << " of the sweep is not a 3D Bravais lattice");
+      bl3d->GetAxialLengths(p[0], p[1], p[2]);
+      bl3d->GetInteraxialAngles(p[3], p[4], p[5]);
+
+      if ( myid == 0 )
+      {
+         ofs << "Lattice sweep step " << s << ":";
+         for (int i=0; i<6; i++) { ofs << " " << p[i]; }
+         ofs << endl;
+      }
+
+      for (unsigned int i=0; i<bl->GetNumberSymmetryPoints(); i++)
+      {
+         bl->GetSymmetryPoint(i, kappa);
+
+         CreateInitialVectors(lattice_type, *bl, kappa,
+                              *eq.GetHCurlWorkspace(), nev, init_vecs);
+
+         eq.GetEigenvalues(nev, kappa, init_vecs, eigenvalues);
+
+         if ( myid == 0 )
+         {
+            ofs_ls << s;
+            for (int j=0; j<6; j++) { ofs_ls << "\t" << p[j]; }
+            ofs_ls << "\t" << bl->GetSymmetryPointLabel(i);
+            for (unsigned int j=0; j<eigenvalues.size(); j++)
+            {
+               ofs_ls << "\t" << eigenvalues[j];
+            }
+            ofs_ls << endl;
+         }
+      }
+   }
+   init_vecs.clear();
+
+   if ( bl != &bravais ) { delete bl; }
 }
 
 FourierVectorCoefficients::FourierVectorCoefficients()
-   : omega_(NAN)
+   : omega_(NAN),
+     nmax_(-1),
+     w_(0)
 {
+   this->SetNMax(0);
 }
 
-FourierVectorCoefficients::~FourierVectorCoefficients()
+void
+FourierVectorCoefficients::SetNMax(int nmax)
 {
-   map<int,set<FourierVectorCoefficient*> >::iterator mit;
-   set<FourierVectorCoefficient*>::iterator sit;
-   for (mit=coefs_.begin(); mit!=coefs_.end(); mit++)
-   {
-      for (sit=mit->second.begin(); sit!=mit->second.end(); sit++)
-      {
-         delete *sit;
-      }
-   }
+   if ( nmax == nmax_ ) { return; }
+
+   nmax_ = nmax;
+   w_    = 2 * nmax_ + 1;
+
+   int nm = w_ * w_ * w_;
+   ar_.assign(3 * nm, 0.0);
+   ai_.assign(3 * nm, 0.0);
+   set_.assign(nm, false);
+}
+
+void
+FourierVectorCoefficients::modeIndices(int m, int & n0, int & n1,
+                                       int & n2) const
+{
+   n2 = m % w_ - nmax_; m /= w_;
+   n1 = m % w_ - nmax_; m /= w_;
+   n0 = m - nmax_;
 }
 
 double
 FourierVectorCoefficients::GetEnergy() const
 {
    double e = 0.0;
-   map<int,set<FourierVectorCoefficient*> >::const_iterator mit;
-   for (mit=coefs_.begin(); mit!=coefs_.end(); mit++)
+   for (unsigned int i=0; i<ar_.size(); i++)
    {
-      e += this->GetEnergy(mit->first);
+      e += ar_[i] * ar_[i] + ai_[i] * ai_[i];
    }
    return e;
 }
@@ -1157,14 +1557,15 @@ double
 FourierVectorCoefficients::GetEnergy(int tier) const
 {
    double e = 0.0;
-
-   if ( coefs_.find(tier) != coefs_.end() )
+   int n0, n1, n2;
+   for (unsigned int m=0; m<set_.size(); m++)
    {
-      const set<FourierVectorCoefficient*> tierCoefs = coefs_.find(tier)->second;
-      set<FourierVectorCoefficient*>::const_iterator sit;
-      for (sit=tierCoefs.begin(); sit!=tierCoefs.end(); sit++)
+      if ( !set_[m] ) { continue; }
+      this->modeIndices(m, n0, n1, n2);
+      if ( n0 * n0 + n1 * n1 + n2 * n2 != tier ) { continue; }
+      for (int k=0; k<3; k++)
       {
-         e += (*sit)->GetEnergy();
+         e += ar_[3*m+k] * ar_[3*m+k] + ai_[3*m+k] * ai_[3*m+k];
       }
    }
    return e;
@@ -1175,13 +1576,26 @@ FourierVectorCoefficients::AddCoefficient(int n0, int n1, int n2,
                                           const Vector & Ar,
                                           const Vector & Ai)
 {
-   int tier = n0 * n0 + n1 * n1 + n2 * n2;
+   MFEM_ASSERT(abs(n0) <= nmax_ && abs(n1) <= nmax_ && abs(n2) <= nmax_,
+               "FourierVectorCoefficients: mode out of range");
 
-   FourierVectorCoefficient * fc = new FourierVectorCoefficient;
-   fc->SetN(n0,n1,n2);
-   fc->SetA(Ar, Ai);
+   int m = this->index(n0, n1, n2);
+   for (int k=0; k<3; k++)
+   {
+      ar_[3*m+k] = Ar[k];
+      ai_[3*m+k] = Ai[k];
+   }
+   set_[m] = true;
+}
 
-   coefs_[tier].insert(fc);
+bool
+FourierVectorCoefficients::HasCoefficient(int n0, int n1, int n2) const
+{
+   if ( abs(n0) > nmax_ || abs(n1) > nmax_ || abs(n2) > nmax_ )
+   {
+      return false;
+   }
+   return set_[this->index(n0, n1, n2)];
 }
 
 void
@@ -1191,12 +1605,14 @@ FourierVectorCoefficients::GetCoefficient(int n0, int n1, int n2,
 {
    Ar.SetSize(3); Ai.SetSize(3);
 
-   const FourierVectorCoefficient * fvc = this->GetCoefficient(n0, n1, n2);
-
-   if ( fvc != NULL )
+   if ( this->HasCoefficient(n0, n1, n2) )
    {
-      Ar = fvc->GetAr();
-      Ai = fvc->GetAi();
+      int m = this->index(n0, n1, n2);
+      for (int k=0; k<3; k++)
+      {
+         Ar[k] = ar_[3*m+k];
+         Ai[k] = ai_[3*m+k];
+      }
    }
    else
    {
@@ -1204,81 +1620,71 @@ FourierVectorCoefficients::GetCoefficient(int n0, int n1, int n2,
    }
 }
 
-const FourierVectorCoefficient *
-FourierVectorCoefficients::GetCoefficient(int n0, int n1, int n2) const
-{
-   int tier = n0 * n0 + n1 * n1 + n2 * n2;
-
-   map<int,set<FourierVectorCoefficient*> >::const_iterator mit;
-
-   mit = coefs_.find(tier);
-   if ( mit == coefs_.end() )
-   {
-      return NULL;
-   }
-
-   set<FourierVectorCoefficient*>::const_iterator sit;
-
-   for (sit=mit->second.begin(); sit!=mit->second.end(); sit++)
-   {
-      const vector<int> & n = (*sit)->GetN();
-      if ( n[0] == n0 && n[1] == n1 && n2 == n[2] )
-      {
-         return *sit;
-      }
-   }
-
-   return NULL;
-}
-
 complex<double>
 FourierVectorCoefficients::operator*(const FourierVectorCoefficients & v) const
 {
-   complex<double> a = 0.0;
+   double a_r = 0.0, a_i = 0.0;
 
-   map<int,set<FourierVectorCoefficient*> >::const_iterator mit;
-   set<FourierVectorCoefficient*>::const_iterator sit;
-   for (mit=coefs_.begin(); mit!=coefs_.end(); mit++)
+   int n0, n1, n2;
+   for (unsigned int m=0; m<set_.size(); m++)
    {
-      for (sit=mit->second.begin(); sit!=mit->second.end(); sit++)
-      {
-         const vector<int> & n = (*sit)->GetN();
+      if ( !set_[m] ) { continue; }
 
-         const FourierVectorCoefficient * fvc0 = *sit;
-         const FourierVectorCoefficient * fvc1 = v.GetCoefficient(n[0],n[1],n[2]);
+      this->modeIndices(m, n0, n1, n2);
+      if ( !v.HasCoefficient(n0, n1, n2) ) { continue; }
 
-         if ( fvc1 != NULL )
-         {
-            a += (*fvc0) * (*fvc1);
-         }
+      int mv = v.index(n0, n1, n2);
+      for (int k=0; k<3; k++)
+      {
+         double Ar0 = ar_[3*m+k],     Ai0 = ai_[3*m+k];
+         double Ar1 = v.ar_[3*mv+k],  Ai1 = v.ai_[3*mv+k];
+
+         a_r += Ar0 * Ar1 + Ai0 * Ai1;
+         a_i += Ar0 * Ai1 - Ai0 * Ar1;
       }
    }
 
-   return a;
+   return complex<double>(a_r, a_i);
 }
 
 void
 FourierVectorCoefficients::Print(ostream & os)
 {
-   map<int,set<FourierVectorCoefficient*> >::iterator mit;
-   set<FourierVectorCoefficient*>::iterator sit;
    os << "Omega:  " << omega_ << endl;
 
+   // Group the modes by tier
+   map<int,vector<int> > tiers;
+   int n0, n1, n2;
+   for (unsigned int m=0; m<set_.size(); m++)
+   {
+      if ( !set_[m] ) { continue; }
+      this->modeIndices(m, n0, n1, n2);
+      tiers[n0 * n0 + n1 * n1 + n2 * n2].push_back(m);
+   }
+
    double en = this->GetEnergy();
    os << "Total Energy:     " << en << endl;
-   for (mit=coefs_.begin(); mit!=coefs_.end(); mit++)
+
+   map<int,vector<int> >::iterator mit;
+   for (mit=tiers.begin(); mit!=tiers.end(); mit++)
    {
       os << "Energy Fraction:  " << this->GetEnergy(mit->first)/en << endl;
-      for (sit=mit->second.begin(); sit!=mit->second.end(); sit++)
+      for (unsigned int i=0; i<mit->second.size(); i++)
       {
-         (*sit)->Print(os); os << endl;
+         int m = mit->second[i];
+         this->modeIndices(m, n0, n1, n2);
+         os << "n = (" << n0 << "," << n1 << "," << n2 <<  "), "
+            << "Ar = (" << ar_[3*m] << "," << ar_[3*m+1] << ","
+            << ar_[3*m+2] << "), "
+            << "Ai = (" << ai_[3*m] << "," << ai_[3*m+1] << ","
+            << ai_[3*m+2] << ")" << endl;
       }
       os << endl;
    }
 }
 
-void ComputeFourierCoefficients(int myid, ostream & ofs_coef, int nmax,
-                                HCurlFourierSeries & fourier,
+void ComputeFourierCoefficients(int myid, ostream & ofs_coef,
+                                VectorFourierProjector & fourier,
                                 MaxwellBlochWaveEquation & eq,
                                 ParFiniteElementSpace & HCurlFESpace,
                                 const vector<double> & eigenvalues,
@@ -1294,61 +1700,59 @@ void ComputeFourierCoefficients(int myid, ostream & ofs_coef, int nmax,
                       NULL,
                       HCurlFESpace.GetTrueDofOffsets());
 
+   int nev   = eigenvalues.size();
+   int tsize = HCurlFESpace.TrueVSize();
+
+   // Project the real and imaginary parts of every mode at once
+   DenseMatrix X(tsize, 2 * nev);
+   for (int l=0; l<nev; l++)
+   {
+      eq.GetEigenvectorE(l, Er, Ei);
+
+      Vector Xr(X.GetColumn(2 * l), tsize);
+      Vector Xi(X.GetColumn(2 * l + 1), tsize);
+      Xr = Er;
+      Xi = Ei;
+   }
+
+   DenseMatrix a_r, a_i;
+   fourier.Project(X, a_r, a_i);
+
+   if ( myid != 0 ) { return; }
+
    double tol = 1e-6;
-   Vector Err(3), Eri(3), Eir(3), Eii(3), Ar(3), Ai(3);
+   Vector Ar(3), Ai(3);
 
-   for (int i=0; i<=nmax; i++)
+   int n0, n1, n2;
+   for (int m=0; m<fourier.GetNumModes(); m++)
    {
-      for (int j=(i==0)?0:-nmax; j<=nmax; j++)
+      fourier.GetModeIndices(m, n0, n1, n2);
+
+      for (int l=0; l<nev; l++)
       {
-         for (int k=(i==0&&j==0)?0:-nmax; k<=nmax; k++)
+         double nrm = 0.0;
+         for (int k=0; k<3; k++)
          {
-            fourier.SetMode(i, j, k);
-            for (unsigned int l=0; l<eigenvalues.size(); l++)
-            {
-               eq.GetEigenvectorE(l, Er, Ei);
-
-               fourier.GetCoefficient(Er, Err, Eri);
-               fourier.GetCoefficient(Ei, Eir, Eii);
+            nrm = max(nrm, fabs(a_r(3 * m + k, 2 * l)));
+            nrm = max(nrm, fabs(a_i(3 * m + k, 2 * l)));
+            nrm = max(nrm, fabs(a_r(3 * m + k, 2 * l + 1)));
+            nrm = max(nrm, fabs(a_i(3 * m + k, 2 * l + 1)));
+         }
+         if ( nrm <= tol ) { continue; }
 
-               if ( myid == 0 )
-               {
-                  double nrmErr = Err.Normlinf();
-                  double nrmEri = Eri.Normlinf();
-                  double nrmEir = Eir.Normlinf();
-                  double nrmEii = Eii.Normlinf();
+         if ( mfc.find(l) == mfc.end() )
+         {
+            mfc[l].SetNMax(fourier.GetNMax());
+            mfc[l].SetOmega(sqrt(eigenvalues[l]));
+         }
 
-                  if ( nrmErr > tol || nrmEri > tol || nrmEir > tol || nrmEii > tol )
-                  {
-                     /*
-                     ofs_coef << kappa[0] << "\t" << kappa[1] << "\t" << kappa[2]
-                         << "\t" << i << "\t" << j << "\t" << k
-                         << "\t" << l << "\t" << eigenvalues[l];
-                     for (int kk=0; kk<3; kk++)
-                     {
-                       ofs_coef << "\t" << Err[kk] << "\t" << Eri[kk]
-                           << "\t" << Eir[kk] << "\t" << Eii[kk];
-                     }
-                     ofs_coef << endl;
-                     */
-                     if ( mfc.find(l) == mfc.end() )
-                     {
-                        mfc[l].SetOmega(sqrt(eigenvalues[l]));
-                     }
-                     Ar = Err; Ar -= Eii;
-                     Ai = Eir; Ai += Eri;
-                     mfc[l].AddCoefficient(i,j,k,Ar,Ai);
-
-                     if ( i != 0 || j != 0 || k != 0 )
-                     {
-                        Ar = Err; Ar += Eii;
-                        Ai = Eir; Ai -= Eri;
-                        mfc[l].AddCoefficient(-i,-j,-k,Ar,Ai);
-                     }
-                  }
-               }
-            }
+         // The coefficient of exp(i n.x) in Er + i Ei
+         for (int k=0; k<3; k++)
+         {
+            Ar[k] = a_r(3 * m + k, 2 * l) - a_i(3 * m + k, 2 * l + 1);
+            Ai[k] = a_r(3 * m + k, 2 * l + 1) + a_i(3 * m + k, 2 * l);
          }
+         mfc[l].AddCoefficient(n0, n1, n2, Ar, Ai);
       }
    }
 }
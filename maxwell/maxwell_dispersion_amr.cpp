@@ -52,6 +52,12 @@ void RescaleEigMesh(Mesh & emesh,
 void VisualizeMesh(MPI_Comm & comm,  int myid, int num_procs,
                    const string & title, Mesh & emesh, socketstream & sock);
 
+// Adapts the mesh of eq to the symmetry points then follows every path,
+// solving the intermediate points on the same mesh
+void SweepSharedMesh(int myid, BravaisLattice & bravais,
+                     MaxwellBlochWaveEquationAMR & eq,
+                     const set<int> & modes, ostream & ofs_disp);
+
 class FourierVectorCoefficient
 {
 public:
@@ -141,6 +147,7 @@ int main(int argc, char *argv[])
    // bool midpoints = true;
    bool visualization = true;
    bool visit = true;
+   bool k_aware = false;
    // int nev = 0;
    // int np = 1;
    double a = -1.0, b = -1.0, c = -1.0;
@@ -196,6 +203,9 @@ int main(int argc, char *argv[])
    //               "Enable or disable mid-point calculations.");
    // args.AddOption(&np, "-np", "--num-points",
    //               "Number of intermediate points between symmetry points.");
+   args.AddOption(&k_aware, "-ka", "--k-aware", "-no-ka", "--no-k-aware",
+                  "Adapt one shared mesh to all symmetry points and solve "
+                  "the whole path on it.");
    args.AddOption(&logging, "-l", "--logging",
                   "Output message level.");
    args.AddOption(&visualization, "-vis", "--visualization", "-no-vis",
@@ -433,8 +443,27 @@ int main(int argc, char *argv[])
    set<int> modes;
    for (int i=0; i<8; i++) { modes.insert(i); }
 
+   // A single solver whose mesh is adapted once for all k-points
+   MaxwellBlochWaveEquationAMR * shared_eq = NULL;
+   if ( k_aware )
+   {
+      shared_eq =
+         new MaxwellBlochWaveEquationAMR(comm, *mesh, order, ar, logging);
+      if ( lcf > 0.0 )
+      {
+         shared_eq->SetMassCoef(mLatCoef);
+      }
+      else
+      {
+         shared_eq->SetMassCoef(mFunc);
+      }
+      shared_eq->SetStiffnessCoef(aFunc);
+
+      SweepSharedMesh(myid, *bravais, *shared_eq, modes, ofs_disp);
+   }
+
    // for (unsigned int p=0; p<bravais->GetNumberPaths(); p++)
-   for (unsigned int p=0; p<1; p++)
+   for (unsigned int p=0; !k_aware && p<1; p++)
    {
       cout << "Starting path" << endl;
       int e0, e1;
@@ -886,6 +915,7 @@ int main(int argc, char *argv[])
 
    map<string,MaxwellBlochWaveEquationAMR *>::iterator eqit;
    for (eqit=eq.begin(); eqit!=eq.end(); eqit++) { delete eqit->second; }
+   delete shared_eq;
    delete mesh;
 
    MPI_Finalize();
@@ -1325,6 +1355,57 @@ WriteDispersionData(int myid,ostream & os, int c,
    }
 }
 
+void
+SweepSharedMesh(int myid, BravaisLattice & bravais,
+                MaxwellBlochWaveEquationAMR & eq,
+                const set<int> & modes, ostream & ofs_disp)
+{
+   // The symmetry points bound the band structure along the paths so their
+   // combined error indicators drive the refinement
+   vector<Vector> kappas(bravais.GetNumberSymmetryPoints());
+   for (unsigned int i=0; i<kappas.size(); i++)
+   {
+      bravais.GetSymmetryPoint(i, kappas[i]);
+   }
+
+   vector<vector<double> > sp_eigs;
+   eq.AdaptMesh(kappas, modes, sp_eigs);
+
+   Vector kappa;
+   vector<double> eigenvalues;
+   int ci = 0;
+   int e0 = -1, e1 = -1;
+
+   for (unsigned int p=0; p<bravais.GetNumberPaths(); p++)
+   {
+      for (unsigned int s=0; s<bravais.GetNumberPathSegments(p); s++)
+      {
+         bravais.GetPathSegmentEndPointIndices(p, s, e0, e1);
+         if ( s == 0 )
+         {
+            WriteDispersionData(myid, ofs_disp, ci++,
+                                bravais.GetSymmetryPointLabel(e0),
+                                sp_eigs[e0]);
+         }
+
+         bravais.GetIntermediatePoint(p, s, kappa);
+         if ( myid == 0 )
+         {
+            cout << "Intermediate point: "
+                 << bravais.GetIntermediatePointLabel(p, s) << endl;
+         }
+         eq.GetEigenvalues(kappa, eigenvalues);
+         WriteDispersionData(myid, ofs_disp, ci++,
+                             bravais.GetIntermediatePointLabel(p, s),
+                             eigenvalues);
+
+         WriteDispersionData(myid, ofs_disp, ci++,
+                             bravais.GetSymmetryPointLabel(e1),
+                             sp_eigs[e1]);
+      }
+   }
+}
+
 FourierVectorCoefficient::FourierVectorCoefficient()
 {
    n_.resize(3); Ar_.SetSize(3); Ai_.SetSize(3);
@@ -29,45 +29,10 @@ void CreateInitialVectors(int lattice_type,
                           int & nev,
                           vector<HypreParVector*> & init_vecs);
 
-class FourierVectorCoefficient
-{
-public:
-   FourierVectorCoefficient(const string & label = "a")
-      : str_(label)
-   { n_.resize(3); Ar_.SetSize(3); Ai_.SetSize(3); }
-
-   void SetLabel(const string & label) { str_ = label; }
-   void SetN(int n0, int n1, int n2) { n_[0] = n0; n_[1] = n1; n_[2] = n2; }
-   void SetA(const Vector & Ar, const Vector & Ai) { Ar_ = Ar; Ai_ = Ai; }
-
-   const vector<int> & GetN()  const { return n_; }
-   const Vector      & GetAr() const { return Ar_; }
-   const Vector      & GetAi() const { return Ai_; }
-
-   double GetEnergy() const { return Ar_ * Ar_ + Ai_ * Ai_; }
-
-   void Print(ostream & os)
-   {
-      os << "n = (" << n_[0] << "," << n_[1] << "," << n_[2] <<  "), "
-         << str_ << "r = (" << Ar_[0] << "," << Ar_[1] << "," << Ar_[2] << "), "
-         << str_ << "i = (" << Ai_[0] << "," << Ai_[1] << "," << Ai_[2] << ")";
-   }
-
-   void PrintMathematica(ostream & os)
-   {
-      os << "{"
-         << Ar_[0] << "+" << Ai_[0] << "\[ImaginaryI],"
-         << Ar_[1] << "+" << Ai_[1] << "\[ImaginaryI],"
-         << Ar_[2] << "+" << Ai_[2] << "\[ImaginaryI]}, ";
-   }
-
-private:
-   string str_;
-   vector<int> n_;
-   Vector Ar_;
-   Vector Ai_;
-};
-
+// The coefficients of the fields a and b, and of their duals c and d,
+// for all modes with |n_i| <= nmax are stored in flat arrays indexed by
+// (n0,n1,n2).  Flags mark the modes which were actually set.  The tier
+// of a mode is n0^2 + n1^2 + n2^2.
 class FourierVectorCoefficients
 {
 public:
@@ -75,46 +40,43 @@ public:
                              const string & label_b = "b",
                              const string & label_c = "c",
                              const string & label_d = "d")
-      : str0_(label_a), str1_(label_b), str2_(label_c), str3_(label_d),
-        omega_(NAN) {}
-   ~FourierVectorCoefficients()
+      : omega_(NAN), nmax_(-1), w_(0)
    {
-      map<int,set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> > >::iterator mit;
-      set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> >::iterator sit;
-      for (mit=coefs_.begin(); mit!=coefs_.end(); mit++)
-      {
-         for (sit=mit->second.begin(); sit!=mit->second.end(); sit++)
-         {
-            delete sit->first;
-            delete sit->second;
-         }
-      }
-      for (mit=dualCoefs_.begin(); mit!=dualCoefs_.end(); mit++)
+      str_[0] = label_a; str_[1] = label_b;
+      str_[2] = label_c; str_[3] = label_d;
+      this->SetNMax(0);
+   }
+
+   void SetNMax(int nmax)
+   {
+      if ( nmax == nmax_ ) { return; }
+
+      nmax_ = nmax;
+      w_    = 2 * nmax_ + 1;
+
+      int nm = w_ * w_ * w_;
+      for (int f=0; f<4; f++)
       {
-         for (sit=mit->second.begin(); sit!=mit->second.end(); sit++)
-         {
-            delete sit->first;
-            delete sit->second;
-         }
+         re_[f].assign(3 * nm, 0.0);
+         im_[f].assign(3 * nm, 0.0);
       }
+      set_.assign(nm, false);
+      dualSet_.assign(nm, false);
    }
+   int    GetNMax() const { return nmax_; }
 
    void   SetLabels(const string & label_a, const string & label_b)
-   { str0_ = label_a; str1_ = label_b; }
+   { str_[0] = label_a; str_[1] = label_b; }
    void   SetDualLabels(const string & label_a, const string & label_b)
-   { str2_ = label_a; str3_ = label_b; }
+   { str_[2] = label_a; str_[3] = label_b; }
    void   SetOmega( double omega) { omega_ = omega; }
    double GetOmega() const        { return omega_; }
    double GetEnergy() const
    {
       double e = 0.0;
-      map<int,set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> > >::const_iterator mit;
-      for (mit=coefs_.begin(); mit!=coefs_.end(); mit++)
+      for (unsigned int m=0; m<set_.size(); m++)
       {
-         e += this->GetEnergy(mit->first);
+         if ( set_[m] ) { e += this->energy(m); }
       }
       return e;
    }
@@ -122,18 +84,9 @@ public:
    double GetEnergy(int tier) const
    {
       double e = 0.0;
-
-      if ( coefs_.find(tier) != coefs_.end() )
+      for (unsigned int m=0; m<set_.size(); m++)
       {
-         const set<pair<FourierVectorCoefficient*,
-               FourierVectorCoefficient*> > tierCoefs =
-                  coefs_.find(tier)->second;
-         set<pair<FourierVectorCoefficient*,
-             FourierVectorCoefficient*> >::const_iterator sit;
-         for (sit=tierCoefs.begin(); sit!=tierCoefs.end(); sit++)
-         {
-            e += sit->first->GetEnergy() + sit->second->GetEnergy();
-         }
+         if ( set_[m] && this->tier(m) == tier ) { e += this->energy(m); }
       }
       return e;
    }
@@ -142,106 +95,67 @@ public:
                         const Vector & Ar, const Vector & Ai,
                         const Vector & Br, const Vector & Bi)
    {
-      int tier = n0 * n0 + n1 * n1 + n2 * n2;
-
-      FourierVectorCoefficient * fcA = new FourierVectorCoefficient(str0_);
-      fcA->SetN(n0,n1,n2);
-      fcA->SetA(Ar, Ai);
-
-      FourierVectorCoefficient * fcB = new FourierVectorCoefficient(str1_);
-      fcB->SetN(n0,n1,n2);
-      fcB->SetA(Br, Bi);
-
-      coefs_[tier].insert(make_pair<FourierVectorCoefficient*,
-                          FourierVectorCoefficient*>(fcA,fcB));
+      int m = this->index(n0, n1, n2);
+      this->setField(0, m, Ar, Ai);
+      this->setField(1, m, Br, Bi);
+      set_[m] = true;
    }
 
    void AddDualCoefficients(int n0, int n1, int n2,
                             const Vector & Ar, const Vector & Ai,
                             const Vector & Br, const Vector & Bi)
    {
-      int tier = n0 * n0 + n1 * n1 + n2 * n2;
-
-      FourierVectorCoefficient * fcA = new FourierVectorCoefficient(str2_);
-      fcA->SetN(n0,n1,n2);
-      fcA->SetA(Ar, Ai);
-
-      FourierVectorCoefficient * fcB = new FourierVectorCoefficient(str3_);
-      fcB->SetN(n0,n1,n2);
-      fcB->SetA(Br, Bi);
-
-      dualCoefs_[tier].insert(make_pair<FourierVectorCoefficient*,
-                              FourierVectorCoefficient*>(fcA,fcB));
+      int m = this->index(n0, n1, n2);
+      this->setField(2, m, Ar, Ai);
+      this->setField(3, m, Br, Bi);
+      dualSet_[m] = true;
    }
 
    void GetCoefficients(int n0, int n1, int n2,
                         Vector & Ar, Vector & Ai,
                         Vector & Br, Vector & Bi) const
    {
-      int tier = n0 * n0 + n1 * n1 + n2 * n2;
-
-      map<int,set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> > >::const_iterator
-          mit = coefs_.find(tier);
-
-      set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> >::const_iterator
-          sit = mit->second.begin();
-
-      Ar = sit->first->GetAr();
-      Ai = sit->first->GetAi();
-
-      Br = sit->second->GetAr();
-      Bi = sit->second->GetAi();
+      int m = this->index(n0, n1, n2);
+      this->getField(0, m, Ar, Ai);
+      this->getField(1, m, Br, Bi);
    }
 
    void GetDualCoefficients(int n0, int n1, int n2,
                             Vector & Ar, Vector & Ai,
                             Vector & Br, Vector & Bi) const
    {
-      int tier = n0 * n0 + n1 * n1 + n2 * n2;
-
-      map<int,set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> > >::const_iterator
-          mit = dualCoefs_.find(tier);
-
-      set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> >::const_iterator
-          sit = mit->second.begin();
-
-      Ar = sit->first->GetAr();
-      Ai = sit->first->GetAi();
-
-      Br = sit->second->GetAr();
-      Bi = sit->second->GetAi();
+      int m = this->index(n0, n1, n2);
+      this->getField(2, m, Ar, Ai);
+      this->getField(3, m, Br, Bi);
    }
 
    void Print(ostream & os)
    {
-      map<int,set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> > >::iterator mit;
-      set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> >::iterator sit;
-      set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> >::iterator dualSit;
+      map<int,vector<int> > tiers;
+      this->groupTiers(tiers);
+
       os << "Omega:  " << omega_ << endl;
 
       double en = this->GetEnergy();
       os << "Total Energy:     " << en << endl;
-      for (mit=coefs_.begin(); mit!=coefs_.end(); mit++)
+
+      map<int,vector<int> >::iterator mit;
+      for (mit=tiers.begin(); mit!=tiers.end(); mit++)
       {
          os << "Energy Fraction:  " << this->GetEnergy(mit->first)/en << endl;
-         for (sit=mit->second.begin(); sit!=mit->second.end(); sit++)
+         for (unsigned int i=0; i<mit->second.size(); i++)
          {
-            sit->first->Print(os); os << endl;
-            sit->second->Print(os); os << endl;
+            int m = mit->second[i];
+            if ( !set_[m] ) { continue; }
+            this->printField(os, 0, m); os << endl;
+            this->printField(os, 1, m); os << endl;
          }
-         int tier = mit->first;
-         for (dualSit=dualCoefs_[tier].begin();
-              dualSit!=dualCoefs_[tier].end(); dualSit++)
+         for (unsigned int i=0; i<mit->second.size(); i++)
          {
-            dualSit->first->Print(os); os << endl;
-            dualSit->second->Print(os); os << endl;
+            int m = mit->second[i];
+            if ( !dualSet_[m] ) { continue; }
+            this->printField(os, 2, m); os << endl;
+            this->printField(os, 3, m); os << endl;
          }
          os << endl;
       }
@@ -249,47 +163,127 @@ public:
 
    void PrintMathematica(ostream & os)
    {
-      map<int,set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> > >::iterator mit;
-      set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> >::iterator sit;
-      set<pair<FourierVectorCoefficient*,
-          FourierVectorCoefficient*> >::iterator dualSit;
-
-      for (mit=coefs_.begin(); mit!=coefs_.end(); mit++)
+      map<int,vector<int> > tiers;
+      this->groupTiers(tiers);
+
+      map<int,vector<int> >::iterator mit;
+      for (mit=tiers.begin(); mit!=tiers.end(); mit++)
       {
-         for (sit=mit->second.begin(); sit!=mit->second.end(); sit++)
+         for (unsigned int i=0; i<mit->second.size(); i++)
          {
-            sit->first->PrintMathematica(os); os << endl;
-            sit->second->PrintMathematica(os); os << endl;
+            int m = mit->second[i];
+            if ( !set_[m] ) { continue; }
+            this->printMathematica(os, 0, m); os << endl;
+            this->printMathematica(os, 1, m); os << endl;
          }
-         int tier = mit->first;
-         for (dualSit=dualCoefs_[tier].begin();
-              dualSit!=dualCoefs_[tier].end(); dualSit++)
+         for (unsigned int i=0; i<mit->second.size(); i++)
          {
-            dualSit->first->PrintMathematica(os); os << endl;
-            dualSit->second->PrintMathematica(os); os << endl;
+            int m = mit->second[i];
+            if ( !dualSet_[m] ) { continue; }
+            this->printMathematica(os, 2, m); os << endl;
+            this->printMathematica(os, 3, m); os << endl;
          }
          os << endl;
       }
    }
 
 private:
-   string str0_;
-   string str1_;
-   string str2_;
-   string str3_;
+   int index(int n0, int n1, int n2) const
+   {
+      MFEM_ASSERT(abs(n0) <= nmax_ && abs(n1) <= nmax_ && abs(n2) <= nmax_,
+                  "FourierVectorCoefficients: mode out of range");
+      return ((n0 + nmax_) * w_ + n1 + nmax_) * w_ + n2 + nmax_;
+   }
+
+   void modeIndices(int m, int & n0, int & n1, int & n2) const
+   {
+      n2 = m % w_ - nmax_; m /= w_;
+      n1 = m % w_ - nmax_; m /= w_;
+      n0 = m - nmax_;
+   }
+
+   int tier(int m) const
+   {
+      int n0, n1, n2;
+      this->modeIndices(m, n0, n1, n2);
+      return n0 * n0 + n1 * n1 + n2 * n2;
+   }
+
+   double energy(int m) const
+   {
+      double e = 0.0;
+      for (int f=0; f<2; f++)
+      {
+         for (int k=0; k<3; k++)
+         {
+            e += re_[f][3*m+k] * re_[f][3*m+k] + im_[f][3*m+k] * im_[f][3*m+k];
+         }
+      }
+      return e;
+   }
+
+   void groupTiers(map<int,vector<int> > & tiers) const
+   {
+      for (unsigned int m=0; m<set_.size(); m++)
+      {
+         if ( set_[m] || dualSet_[m] ) { tiers[this->tier(m)].push_back(m); }
+      }
+   }
+
+   void setField(int f, int m, const Vector & Ar, const Vector & Ai)
+   {
+      for (int k=0; k<3; k++)
+      {
+         re_[f][3*m+k] = Ar[k];
+         im_[f][3*m+k] = Ai[k];
+      }
+   }
+
+   void getField(int f, int m, Vector & Ar, Vector & Ai) const
+   {
+      Ar.SetSize(3); Ai.SetSize(3);
+      for (int k=0; k<3; k++)
+      {
+         Ar[k] = re_[f][3*m+k];
+         Ai[k] = im_[f][3*m+k];
+      }
+   }
+
+   void printField(ostream & os, int f, int m) const
+   {
+      int n0, n1, n2;
+      this->modeIndices(m, n0, n1, n2);
+      const double * r = &re_[f][3*m];
+      const double * i = &im_[f][3*m];
+      os << "n = (" << n0 << "," << n1 << "," << n2 <<  "), "
+         << str_[f] << "r = (" << r[0] << "," << r[1] << "," << r[2] << "), "
+         << str_[f] << "i = (" << i[0] << "," << i[1] << "," << i[2] << ")";
+   }
+
+   void printMathematica(ostream & os, int f, int m) const
+   {
+      const double * r = &re_[f][3*m];
+      const double * i = &im_[f][3*m];
+      os << "{"
+         << r[0] << "+" << i[0] << "\[ImaginaryI],"
+         << r[1] << "+" << i[1] << "\[ImaginaryI],"
+         << r[2] << "+" << i[2] << "\[ImaginaryI]}, ";
+   }
+
+   string str_[4];
    double omega_;
+   int    nmax_;
+   int    w_;
 
-   map<int,set<pair<FourierVectorCoefficient*,
-       FourierVectorCoefficient*> > > coefs_;
-   map<int,set<pair<FourierVectorCoefficient*,
-       FourierVectorCoefficient*> > > dualCoefs_;
+   vector<double> re_[4];
+   vector<double> im_[4];
+   vector<bool>   set_;
+   vector<bool>   dualSet_;
 };
 
-void ComputeFourierCoefficients(int myid, ostream & ofs_coef, int nmax,
-                                HCurlFourierSeries & fourierHCurl,
-                                HDivFourierSeries & fourierHDiv,
+void ComputeFourierCoefficients(int myid, ostream & ofs_coef,
+                                VectorFourierProjector & fourierHCurl,
+                                VectorFourierProjector & fourierHDiv,
                                 MaxwellBlochWaveEquation & eq,
                                 ParFiniteElementSpace & HCurlFESpace,
                                 ParFiniteElementSpace & HDivFESpace,
@@ -439,31 +433,10 @@ int main(int argc, char *argv[])
    mesh->CheckElementOrientation(false);
    mesh->CheckBdrElementOrientation(false);
 
-   // 4. Refine the serial mesh on all processors to increase the resolution. In
-   //    this example we do 'ref_levels' of uniform refinement.
-   {
-      int ref_levels = sr;
-      for (int l = 0; l < ref_levels; l++)
-      {
-         mesh->UniformRefinement();
-         cout << l+1 << ", Refined Euler Number:  " << mesh->EulerNumber() << endl;
-         mesh->CheckElementOrientation(false);
-         mesh->CheckBdrElementOrientation(false);
-      }
-   }
-
-   // 5. Define a parallel mesh by a partitioning of the serial mesh. Refine
-   //    this mesh further in parallel to increase the resolution. Once the
-   //    parallel mesh is defined, the serial mesh can be deleted.
-   ParMesh *pmesh = new ParMesh(MPI_COMM_WORLD, *mesh);
-   delete mesh;
-   {
-      int par_ref_levels = pr;
-      for (int l = 0; l < par_ref_levels; l++)
-      {
-         pmesh->UniformRefinement();
-      }
-   }
+   // 4. Define a parallel mesh by a partitioning of the coarse mesh and refine
+   //    it 'sr' + 'pr' times. Only the serial refinements needed to populate
+   //    every processor are performed before partitioning.
+   ParMesh *pmesh = DistributeMesh(MPI_COMM_WORLD, mesh, sr, pr);
 
    ND_ParFESpace * HCurlFESpace = new ND_ParFESpace(pmesh, order,
                                                     pmesh->Dimension());
@@ -508,8 +481,8 @@ int main(int argc, char *argv[])
    MaxwellBlochWaveEquation * eq =
       new MaxwellBlochWaveEquation(*pmesh, order);
 
-   HCurlFourierSeries fourier_hcurl(*bravais, *HCurlFESpace);
-   HDivFourierSeries  fourier_hdiv(*bravais, *HDivFESpace);
+   VectorFourierProjector fourier_hcurl(*bravais, *HCurlFESpace, 0);
+   VectorFourierProjector fourier_hdiv(*bravais, *HDivFESpace, 0);
 
    HYPRE_Int size = eq->GetHCurlFESpace()->GlobalTrueVSize();
    if (myid == 0)
@@ -574,7 +547,7 @@ int main(int argc, char *argv[])
       eq->IdentifyDegeneracies(1.0e-4, 1.0e-4, degen[c]);
       // IdentifyDegeneracies(eigenvalues, 1.0e-4, 1.0e-4, degen[c]);
       /*
-      ComputeFourierCoefficients(myid, ofs_coef, 0,
+      ComputeFourierCoefficients(myid, ofs_coef,
                                  fourier_hcurl, fourier_hdiv, *eq,
                                  *HCurlFESpace, *HDivFESpace,
                                  eigenvalues,
@@ -1020,9 +993,9 @@ CreateInitialVectors(int lattice_type,
    */
 }
 
-void ComputeFourierCoefficients(int myid, ostream & ofs_coef, int nmax,
-                                HCurlFourierSeries & fourierHCurl,
-                                HDivFourierSeries  & fourierHDiv,
+void ComputeFourierCoefficients(int myid, ostream & ofs_coef,
+                                VectorFourierProjector & fourierHCurl,
+                                VectorFourierProjector & fourierHDiv,
                                 MaxwellBlochWaveEquation & eq,
                                 ParFiniteElementSpace & HCurlFESpace,
                                 ParFiniteElementSpace & HDivFESpace,
@@ -1049,79 +1022,72 @@ void ComputeFourierCoefficients(int myid, ostream & ofs_coef, int nmax,
                       NULL,
                       HDivFESpace.GetTrueDofOffsets());
 
+   int nev = eigenvalues.size();
+   int ets = HCurlFESpace.TrueVSize();
+   int bts = HDivFESpace.TrueVSize();
+
+   // Project the real and imaginary parts of every mode at once
+   DenseMatrix EX(ets, 2 * nev), BX(bts, 2 * nev);
+   for (int l=0; l<nev; l++)
+   {
+      eq.GetEigenvector(l, Er, Ei, Br, Bi);
+
+      Vector EXr(EX.GetColumn(2 * l), ets);
+      Vector EXi(EX.GetColumn(2 * l + 1), ets);
+      Vector BXr(BX.GetColumn(2 * l), bts);
+      Vector BXi(BX.GetColumn(2 * l + 1), bts);
+      EXr = Er; EXi = Ei;
+      BXr = Br; BXi = Bi;
+   }
+
+   DenseMatrix ea_r, ea_i, ba_r, ba_i;
+   fourierHCurl.Project(EX, ea_r, ea_i);
+   fourierHDiv.Project(BX, ba_r, ba_i);
+
+   if ( myid != 0 ) { return; }
+
    double tol = 1e-6;
-   Vector Err(3), Eri(3), Eir(3), Eii(3), E0r(3), E0i(3);
-   Vector Brr(3), Bri(3), Bir(3), Bii(3), B0r(3), B0i(3);
+   Vector E0r(3), E0i(3), B0r(3), B0i(3);
 
-   for (int i=0; i<=nmax; i++)
+   int n0, n1, n2;
+   for (int m=0; m<fourierHCurl.GetNumModes(); m++)
    {
-      for (int j=(i==0)?0:-nmax; j<=nmax; j++)
+      fourierHCurl.GetModeIndices(m, n0, n1, n2);
+
+      for (int l=0; l<nev; l++)
       {
-         for (int k=(i==0&&j==0)?0:-nmax; k<=nmax; k++)
+         double nrm = 0.0;
+         for (int k=0; k<3; k++)
          {
-            fourierHCurl.SetMode(i, j, k);
-            fourierHDiv.SetMode(i, j, k);
-            for (unsigned int l=0; l<eigenvalues.size(); l++)
-            {
-               eq.GetEigenvector(l, Er, Ei, Br, Bi);
-
-               fourierHCurl.GetCoefficient(Er, Err, Eri);
-               fourierHCurl.GetCoefficient(Ei, Eir, Eii);
+            int r = 3 * m + k;
+            nrm = max(nrm, fabs(ea_r(r, 2 * l)));
+            nrm = max(nrm, fabs(ea_i(r, 2 * l)));
+            nrm = max(nrm, fabs(ea_r(r, 2 * l + 1)));
+            nrm = max(nrm, fabs(ea_i(r, 2 * l + 1)));
+            nrm = max(nrm, fabs(ba_r(r, 2 * l)));
+            nrm = max(nrm, fabs(ba_i(r, 2 * l)));
+            nrm = max(nrm, fabs(ba_r(r, 2 * l + 1)));
+            nrm = max(nrm, fabs(ba_i(r, 2 * l + 1)));
+         }
+         if ( nrm <= tol ) { continue; }
 
-               fourierHDiv.GetCoefficient(Br, Brr, Bri);
-               fourierHDiv.GetCoefficient(Bi, Bir, Bii);
+         if ( mfc.find(l) == mfc.end() )
+         {
+            mfc[l].SetNMax(fourierHCurl.GetNMax());
+            mfc[l].SetOmega(sqrt(fabs(eigenvalues[l])));
+            mfc[l].SetLabels("E", "B");
+         }
 
-               if ( myid == 0 )
-               {
-                  double nrmErr = Err.Normlinf();
-                  double nrmEri = Eri.Normlinf();
-                  double nrmEir = Eir.Normlinf();
-                  double nrmEii = Eii.Normlinf();
-
-                  double nrmBrr = Brr.Normlinf();
-                  double nrmBri = Bri.Normlinf();
-                  double nrmBir = Bir.Normlinf();
-                  double nrmBii = Bii.Normlinf();
-
-                  if ( nrmErr > tol || nrmEri > tol ||
-                       nrmEir > tol || nrmEii > tol ||
-                       nrmBrr > tol || nrmBri > tol ||
-                       nrmBir > tol || nrmBii > tol )
-                  {
-                     /*
-                     ofs_coef << kappa[0] << "\t" << kappa[1] << "\t" << kappa[2]
-                         << "\t" << i << "\t" << j << "\t" << k
-                         << "\t" << l << "\t" << eigenvalues[l];
-                     for (int kk=0; kk<3; kk++)
-                     {
-                       ofs_coef << "\t" << Err[kk] << "\t" << Eri[kk]
-                           << "\t" << Eir[kk] << "\t" << Eii[kk];
-                     }
-                     ofs_coef << endl;
-                     */
-                     if ( mfc.find(l) == mfc.end() )
-                     {
-                        mfc[l].SetOmega(sqrt(fabs(eigenvalues[l])));
-                        mfc[l].SetLabels("E", "B");
-                     }
-                     E0r = Err; E0r -= Eii;
-                     E0i = Eir; E0i += Eri;
-                     B0r = Brr; B0r -= Bii;
-                     B0i = Bir; B0i += Bri;
-                     mfc[l].AddCoefficients(i,j,k,E0r,E0i,B0r,B0i);
-
-                     if ( i != 0 || j != 0 || k != 0 )
-                     {
-                        E0r = Err; E0r += Eii;
-                        E0i = Eir; E0i -= Eri;
-                        B0r = Brr; B0r += Bii;
-                        B0i = Bir; B0i -= Bri;
-                        mfc[l].AddCoefficients(-i,-j,-k,E0r,E0i,B0r,B0i);
-                     }
-                  }
-               }
-            }
+         // The coefficients of exp(i n.x) in Er + i Ei and Br + i Bi
+         for (int k=0; k<3; k++)
+         {
+            int r = 3 * m + k;
+            E0r[k] = ea_r(r, 2 * l) - ea_i(r, 2 * l + 1);
+            E0i[k] = ea_r(r, 2 * l + 1) + ea_i(r, 2 * l);
+            B0r[k] = ba_r(r, 2 * l) - ba_i(r, 2 * l + 1);
+            B0i[k] = ba_r(r, 2 * l + 1) + ba_i(r, 2 * l);
          }
+         mfc[l].AddCoefficients(n0, n1, n2, E0r, E0i, B0r, B0i);
       }
    }
 }
@@ -0,0 +1,225 @@
+#include "mfem.hpp"
+#include "../common/bravais.hpp"
+#include "maxwell_bloch.hpp"
+#include <iostream>
+
+using namespace std;
+using namespace mfem;
+using namespace mfem::miniapps;
+using namespace mfem::bloch;
+using namespace mfem::bravais;
+
+// Fields which are periodic on the unit cube
+static void SmoothRe(const Vector & x, Vector & v)
+{
+   v.SetSize(3);
+   v[0] = sin(2.0 * M_PI * x[1]);
+   v[1] = sin(2.0 * M_PI * x[2]);
+   v[2] = sin(2.0 * M_PI * x[0]);
+}
+
+static void SmoothIm(const Vector & x, Vector & v)
+{
+   v.SetSize(3);
+   v[0] = cos(2.0 * M_PI * x[2]);
+   v[1] = cos(2.0 * M_PI * x[0]);
+   v[2] = cos(2.0 * M_PI * x[1]);
+}
+
+// Relative difference between MaxwellBlochPAOperator and the operator A
+// formed, as in MaxwellBlochWaveEquation::Setup, from products through
+// H(Div).  A is applied to a random vector or to the interpolant of a
+// smooth field.
+static double
+OperatorDifference(ParMesh & pmesh, int order, BravaisLattice & bravais,
+                   double lcf, const Vector & kappa, bool smooth)
+{
+   int dim = pmesh.Dimension();
+
+   ND_ParFESpace HCurlFESpace(&pmesh, order, dim);
+   RT_ParFESpace HDivFESpace(&pmesh, order, dim);
+   L2_ParFESpace L2FESpace(&pmesh, 0, dim);
+
+   // A piecewise constant stiffness is integrated exactly by both operators
+   ParGridFunction kGF(&L2FESpace);
+   {
+      LatticeCoefficient latCoef(bravais, lcf);
+      kGF.ProjectCoefficient(latCoef);
+   }
+   kGF += 1.0;
+   GridFunctionCoefficient kCoef(&kGF);
+
+   double beta = kappa.Norml2();
+   Vector zeta(kappa);
+   if ( beta > 0.0 ) { zeta /= beta; }
+
+   ParBilinearForm m2(&HDivFESpace);
+   m2.AddDomainIntegrator(new VectorFEMassIntegrator(kCoef));
+   m2.Assemble();
+   m2.Finalize();
+   HypreParMatrix * M2 = m2.ParallelAssemble();
+
+   ParDiscreteCurlOperator curl(&HCurlFESpace, &HDivFESpace);
+   curl.Assemble();
+   curl.Finalize();
+   HypreParMatrix * T12 = curl.ParallelAssemble();
+
+   ParDiscreteVectorCrossProductOperator cross(&HCurlFESpace, &HDivFESpace,
+                                               zeta);
+   cross.Assemble();
+   cross.Finalize();
+   HypreParMatrix * Z12 = cross.ParallelAssemble();
+
+   HypreParMatrix * CMC = RAP(M2, T12);
+   HypreParMatrix * ZMZ = RAP(M2, Z12);
+   HypreParMatrix * CMZ = RAP(T12, M2, Z12);
+   HypreParMatrix * ZMC = RAP(Z12, M2, T12);
+
+   *ZMZ *= beta * beta;
+   *ZMC *= -1.0;
+   HypreParMatrix * S1 = ParAdd(CMC, ZMZ);
+   HypreParMatrix * D  = ParAdd(CMZ, ZMC);
+
+   Array<int> offsets(3);
+   offsets[0] = 0;
+   offsets[1] = HCurlFESpace.TrueVSize();
+   offsets[2] = HCurlFESpace.TrueVSize();
+   offsets.PartialSum();
+
+   BlockOperator A(offsets);
+   A.SetDiagonalBlock(0, S1);
+   A.SetDiagonalBlock(1, S1);
+   A.SetBlock(0, 1, D,  beta);
+   A.SetBlock(1, 0, D, -beta);
+
+   MaxwellBlochPAOperator APA(HCurlFESpace, kCoef);
+   APA.SetBeta(beta);
+   APA.SetZeta(zeta);
+
+   BlockVector x(offsets);
+   if ( smooth )
+   {
+      VectorFunctionCoefficient reCoef(3, SmoothRe);
+      VectorFunctionCoefficient imCoef(3, SmoothIm);
+
+      ParGridFunction u(&HCurlFESpace);
+      u.ProjectCoefficient(reCoef);
+      u.ParallelProject(x.GetBlock(0));
+      u.ProjectCoefficient(imCoef);
+      u.ParallelProject(x.GetBlock(1));
+   }
+   else
+   {
+      x.Randomize(123);
+   }
+
+   Vector y(x.Size()), ypa(x.Size());
+   A.Mult(x, y);
+   APA.Mult(x, ypa);
+   ypa -= y;
+
+   double nrm = sqrt(InnerProduct(pmesh.GetComm(), y, y));
+   double dif = sqrt(InnerProduct(pmesh.GetComm(), ypa, ypa));
+
+   delete M2;
+   delete T12;
+   delete Z12;
+   delete CMC;
+   delete ZMZ;
+   delete CMZ;
+   delete ZMC;
+   delete S1;
+   delete D;
+
+   return dif / nrm;
+}
+
+// Checks that MaxwellBlochPAOperator reproduces the assembled operator A of
+// MaxwellBlochWaveEquation.  The curl-curl term is integrated exactly by
+// both so at kappa = 0 they must agree to round-off.  The assembled
+// operator interpolates zeta x u onto H(Div) while the partially assembled
+// one evaluates it at the quadrature points, so for kappa != 0 they only
+// agree up to the discretization error, which must shrink under
+// refinement for a smooth field.
+int main(int argc, char ** argv)
+{
+   // 1. Initialize MPI.
+   int num_procs, myid;
+   MPI_Comm comm = MPI_COMM_WORLD;
+   MPI_Init(&argc, &argv);
+   MPI_Comm_size(comm, &num_procs);
+   MPI_Comm_rank(comm, &myid);
+
+   // 2. Parse command-line options.
+   int order = 2;
+   int sr = 1, pr = 0;
+   double a = 1.0;
+   double lcf = 0.5;
+   double tol = 1e-10;
+
+   OptionsParser args(argc, argv);
+   args.AddOption(&order, "-o", "--order",
+                  "Finite element order (polynomial degree).");
+   args.AddOption(&sr, "-sr", "--serial-refinement",
+                  "Number of serial refinement levels.");
+   args.AddOption(&pr, "-pr", "--parallel-refinement",
+                  "Number of parallel refinement levels.");
+   args.AddOption(&lcf, "-lcf", "--lattice-coef-frac",
+                  "Fraction of inter-lattice distance covered by material.");
+   args.AddOption(&tol, "-tol", "--tolerance",
+                  "Largest acceptable relative difference at kappa = 0.");
+   args.Parse();
+   if (!args.Good())
+   {
+      if (myid == 0)
+      {
+         args.PrintUsage(cout);
+      }
+      MPI_Finalize();
+      return 1;
+   }
+   if (myid == 0)
+   {
+      args.PrintOptions(cout);
+   }
+
+   BravaisLattice * bravais =
+      BravaisLatticeFactory(PRIMITIVE_CUBIC, a, a, a,
+                            0.5 * M_PI, 0.5 * M_PI, 0.5 * M_PI, 0);
+
+   Mesh * mesh = bravais->GetPeriodicWignerSeitzMesh();
+   ParMesh * pmesh = DistributeMesh(comm, mesh, sr, pr, true);
+
+   Vector kappa(3);
+   kappa = 0.0;
+
+   double d0 = OperatorDifference(*pmesh, order, *bravais, lcf, kappa,
+                                  false);
+
+   kappa[0] = 0.25 * M_PI;
+   kappa[1] = 0.15 * M_PI;
+   kappa[2] = 0.05 * M_PI;
+
+   double d1 = OperatorDifference(*pmesh, order, *bravais, lcf, kappa,
+                                  true);
+   pmesh->UniformRefinement();
+   double d2 = OperatorDifference(*pmesh, order, *bravais, lcf, kappa,
+                                  true);
+
+   bool pass = d0 <= tol && d2 < d1;
+
+   if ( myid == 0 )
+   {
+      cout << "Relative difference at kappa = 0:       " << d0 << endl;
+      cout << "Relative difference at kappa, coarse:   " << d1 << endl;
+      cout << "Relative difference at kappa, refined:  " << d2 << endl;
+      cout << ( pass ? "PASSED" : "FAILED" ) << endl;
+   }
+
+   delete pmesh;
+   delete bravais;
+
+   MPI_Finalize();
+
+   return pass ? 0 : 1;
+}
@@ -44,6 +44,8 @@ int main(int argc, char *argv[])
    bool visit = true;
    bool densityCalc = true;
    bool stiffnessCalc = false;
+   bool emCalc = false;
+   bool toptCalc = false;
    bool bandGapCalc = false;
    bool band_gap_mid_pts = false;
 
@@ -53,9 +55,16 @@ int main(int argc, char *argv[])
    double lcf = 0.3;
    double density_tol = 0.05;
    double stiffness_tol = 0.05;
+   double em_tol = 0.05;
+   int    topt_its = 200;
+   int    topt_penalty = 3;
+   double topt_vf = 0.3;
+   double topt_r = 0.05;
+   double topt_tol = 0.01;
    double band_gap_tol = 0.05;
    int    band_gap_max_ref = 2;
    int    band_gap_samp_pow = 2;
+   const char *mesh_cache = "";
    // double lambda = 2.07748e+9;
    // double mu = 0.729927e+9;
    // Gallium Arsenide at T=300K
@@ -115,6 +124,10 @@ int main(int argc, char *argv[])
    args.AddOption(&stiffness_tol, "-ctol", "--stiffness-tolerance",
                   "Stopping tolerance specified as a relative difference "
                   "in the 2-norm of the computed stiffness tensor");
+   args.AddOption(&em_tol, "-emtol", "--em-tolerance",
+                  "Stopping criteria based on the relative change "
+                  "in the 2-norm of the computed permittivity and "
+                  "permeability tensors");
    args.AddOption(&band_gap_tol, "-bgtol", "--band-gap-tolerance",
                   "Stopping tolerance specified as a relative difference "
                   "in the computed band gap");
@@ -151,12 +164,32 @@ int main(int argc, char *argv[])
    args.AddOption(&stiffnessCalc, "-C", "--stiffness",
                   "-no-C", "--no-stiffness",
                   "Enable or disable stiffness tensor calculation.");
+   args.AddOption(&emCalc, "-em", "--em-tensors",
+                  "-no-em", "--no-em-tensors",
+                  "Enable or disable the quasi-static permittivity and "
+                  "permeability tensor calculation.");
+   args.AddOption(&toptCalc, "-topt", "--topology-opt",
+                  "-no-topt", "--no-topology-opt",
+                  "Enable or disable the optimization of the effective "
+                  "bulk modulus starting from the lattice design.");
+   args.AddOption(&topt_its, "-topt-its", "--topology-opt-iterations",
+                  "Maximum number of design iterations.");
+   args.AddOption(&topt_penalty, "-topt-p", "--topology-opt-penalty",
+                  "Penalty exponent for intermediate volume fractions.");
+   args.AddOption(&topt_vf, "-topt-vf", "--topology-opt-volume-fraction",
+                  "Upper bound on the average volume fraction.");
+   args.AddOption(&topt_r, "-topt-r", "--topology-opt-filter-radius",
+                  "Length scale of the design filter.");
+   args.AddOption(&topt_tol, "-topt-tol", "--topology-opt-tolerance",
+                  "Stop once the largest design change falls below this.");
    // args.AddOption(&dispersionPlot, "-disp", "--dispersion",
    //             "-no-disp", "--no-dispersion",
    //             "Enable or disable dispersion plot calculation.");
    args.AddOption(&bandGapCalc, "-bg", "--band-gap",
                   "-no-bg", "--no-band-gap",
                   "Enable or disable band gap calculation.");
+   args.AddOption(&mesh_cache, "-mc", "--mesh-cache",
+                  "Directory of cached lattice meshes, empty to disable.");
    args.Parse();
    if (!args.Good())
    {
@@ -206,6 +239,8 @@ int main(int argc, char *argv[])
 
    CreateDirectory(oss_prefix.str(),comm,myid);
 
+   LatticeMeshCache cache(comm, mesh_cache, logging);
+
    // 3. Read the (serial) mesh from the given mesh file on all processors.  We
    //    can handle triangular, quadrilateral, tetrahedral, hexahedral, surface
    //    and volume meshes with the same code.
@@ -356,7 +391,7 @@ int main(int argc, char *argv[])
 
       elasticity.SetVolumeFraction(*vf0);
       */
-      Mesh * mesh_C = bravais->GetPeriodicWignerSeitzMesh();
+      Mesh * mesh_C = cache.GetWignerSeitzMesh(*bravais, 0);
 
       if ( mesh_C->EulerNumber() != 0 )
       {
@@ -365,12 +400,7 @@ int main(int argc, char *argv[])
                     "should have Euler number 0!");
       }
 
-      // mesh_C->UniformRefinement();
-      mesh_C->UniformRefinement();
-      mesh_C->EnsureNCMesh();
-
-      ParMesh *pmesh_C = new ParMesh(MPI_COMM_WORLD, *mesh_C);
-      delete mesh_C;
+      ParMesh *pmesh_C = DistributeMesh(MPI_COMM_WORLD, mesh_C, 1, 0, true);
 
       meta_material::StiffnessTensor elasticity(*pmesh_C,
                                                 bravais->GetUnitCellVolume(),
@@ -417,12 +447,144 @@ int main(int argc, char *argv[])
       delete pmesh_C;
    }
 
+   if (emCalc)
+   {
+      LatticeCoefficient epsCoef(*bravais, lcf, 1.0, epsRel);
+      LatticeCoefficient  muCoef(*bravais, lcf, 1.0,  muRel);
+
+      Mesh * mesh_em = cache.GetWignerSeitzMesh(*bravais, 0);
+
+      if ( mesh_em->EulerNumber() != 0 )
+      {
+         MFEM_ABORT("Euler number equal to " << mesh_em->EulerNumber()
+                    << ". Periodic Bravais Lattice meshes "
+                    "should have Euler number 0!");
+      }
+
+      ParMesh *pmesh_em = DistributeMesh(MPI_COMM_WORLD, mesh_em, 1, 0, true);
+
+      meta_material::ElectromagneticTensors em(*pmesh_em,
+                                               bravais->GetUnitCellVolume(),
+                                               epsCoef, muCoef, em_tol);
+
+      vector<double> em_p;
+      em.GetHomogenizedProperties(em_p);
+      if ( myid == 0 )
+      {
+         DenseMatrix epsEff, muEff;
+         em.GetPermittivityTensor(epsEff);
+         em.GetPermeabilityTensor(muEff);
+
+         ostringstream oss;
+         oss << oss_prefix.str() << "/em_tensors.dat";
+         ofstream ofs(oss.str().c_str());
+
+         cout << "Effective Permittivity Tensor:  " << endl;
+         epsEff.Print(cout);
+         cout << "Effective Permeability Tensor:  " << endl;
+         muEff.Print(cout);
+         cout << endl;
+
+         for (int i=0; i<3; i++)
+         {
+            for (int j=0; j<3; j++)
+            {
+               ofs << epsEff(i,j); if ( j < 2 ) { ofs << "\t"; }
+            }
+            ofs << endl;
+         }
+         ofs << endl;
+         for (int i=0; i<3; i++)
+         {
+            for (int j=0; j<3; j++)
+            {
+               ofs << muEff(i,j); if ( j < 2 ) { ofs << "\t"; }
+            }
+            ofs << endl;
+         }
+         ofs.close();
+      }
+      if (visualization)
+      {
+         em.InitializeGLVis(vd);
+         em.DisplayToGLVis();
+      }
+      if ( visit )
+      {
+         em.WriteVisItFields(oss_prefix.str(), "ElectromagneticTensors");
+      }
+      delete pmesh_em;
+   }
+
+   if (toptCalc)
+   {
+      double lambda = E * nu / ( (1.0 + nu) * (1.0 - 2.0 * nu) );
+      double mu = 0.5 * E / (1.0 + nu);
+      double mat_scale = 1.0e-6;
+
+      Mesh * mesh_t = cache.GetWignerSeitzMesh(*bravais, 0);
+
+      if ( mesh_t->EulerNumber() != 0 )
+      {
+         MFEM_ABORT("Euler number equal to " << mesh_t->EulerNumber()
+                    << ". Periodic Bravais Lattice meshes "
+                    "should have Euler number 0!");
+      }
+
+      ParMesh *pmesh_t = DistributeMesh(MPI_COMM_WORLD, mesh_t, 1, 0, true);
+
+      // The design is a volume fraction on a fixed mesh which starts
+      // from the lattice geometry
+      L2_ParFESpace L2FESpace_t(pmesh_t, 0, pmesh_t->Dimension());
+      ParGridFunction vf_t(&L2FESpace_t);
+      {
+         LatticeCoefficient latCoef(*bravais, lcf);
+         vf_t.ProjectCoefficient(latCoef);
+      }
+
+      meta_material::PenaltyCoefficient lambdaCoef(&vf_t, topt_penalty,
+                                                   lambda * mat_scale,
+                                                   lambda);
+      meta_material::PenaltyCoefficient muCoef(&vf_t, topt_penalty,
+                                               mu * mat_scale, mu);
+
+      meta_material::StiffnessTensor elasticity(*pmesh_t,
+                                                bravais->GetUnitCellVolume(),
+                                                lambdaCoef, muCoef);
+      elasticity.SetMaxAMRIterations(1);
+
+      // Effective bulk modulus (C11+C22+C33+2(C12+C13+C23))/9 in terms of
+      // the 21 unique entries of the elasticity tensor
+      vector<double> w(21, 0.0);
+      w[0] = w[6] = w[11] = 1.0 / 9.0;
+      w[1] = w[2] = w[7]  = 2.0 / 9.0;
+
+      meta_material::TopologyOptimizer opt(vf_t, elasticity, w,
+                                           topt_vf, topt_r);
+      opt.Optimize(topt_its, topt_tol);
+
+      if (visualization)
+      {
+         socketstream vf_sock;
+         VisualizeField(vf_sock, vf_t, "Optimized Volume Fraction", vd);
+         vd.IncrementWindow();
+      }
+      if ( visit )
+      {
+         VisItDataCollection visit_dc("TopologyOptimization", pmesh_t);
+         visit_dc.SetPrefixPath(oss_prefix.str().c_str());
+         visit_dc.RegisterField("Volume Fraction", &vf_t);
+         visit_dc.Save();
+      }
+      delete pmesh_t;
+   }
+
    if (bandGapCalc)
    {
       LatticeCoefficient epsCoef(*bravais, lcf, 1.0, epsRel);
       LatticeCoefficient  muCoef(*bravais, lcf, 1.0,  muRel);
 
-      Mesh * mesh_bg = bravais->GetPeriodicWignerSeitzMesh();
+      Mesh * mesh_bg = cache.GetWignerSeitzMesh(*bravais, 0);
 
       if ( mesh_bg->EulerNumber() != 0 )
       {
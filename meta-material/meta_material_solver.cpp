@@ -40,32 +40,29 @@ LinearCoefficient::Eval(ElementTransformation &T,
    double vf = this->GridFunctionCoefficient::Eval(T, ip);
    return c0_ + (c1_ - c0_) * vf;
 }
-/*
 PenaltyCoefficient::PenaltyCoefficient(GridFunction * gf, int penalty,
-                                     double c0, double c1)
- : GridFunctionCoefficient(gf),
-   penalty_(penalty),
-   c0_(c0),
-   c1_(c1)
+                                       double c0, double c1)
+   : LinearCoefficient(gf, c0, c1),
+     penalty_(penalty)
 {
 }
 
 double
 PenaltyCoefficient::Eval(ElementTransformation &T,
-                       const IntegrationPoint &ip)
+                         const IntegrationPoint &ip)
 {
- double vf = this->GridFunctionCoefficient::Eval(T, ip);
- return c0_ + (c1_ - c0_) * pow(vf, penalty_);
+   double vf = this->GridFunctionCoefficient::Eval(T, ip);
+   return c0_ + (c1_ - c0_) * pow(vf, penalty_);
 }
 
 double
 PenaltyCoefficient::GetSensitivity(ElementTransformation &T,
-                                 const IntegrationPoint &ip)
+                                   const IntegrationPoint &ip)
 {
- double vf = this->GridFunctionCoefficient::Eval(T, ip);
- return (c1_ - c0_) * penalty_* pow(vf, penalty_ - 1);
+   double vf = this->GridFunctionCoefficient::Eval(T, ip);
+   return (c1_ - c0_) * penalty_* pow(vf, penalty_ - 1);
 }
-*/
+
 Homogenization::Homogenization(MPI_Comm comm)
    : comm_(comm), newVF_(true), vf_(NULL)
 {
@@ -208,28 +205,32 @@ Density::GetHomogenizedProperties(vector<double> & p)
    p[0] = cellVol_->operator()(*rho_);
    p[0] /= vol_;
 }
-/*
+
 void
 Density::GetPropertySensitivities(vector<ParGridFunction> & dp)
 {
- if ( dp.size() < 1 )
- {
-    dp.resize(1);
-    dp[0].SetSpace(L2FESpace_);
- }
-
- Array<int> vdofs;
- ElementTransformation *eltrans;
- IntegrationPoint ip; ip.Init();
- for (int i=0; i<L2FESpace_->GetNE(); i++)
- {
-    L2FESpace_->GetElementVDofs(i, vdofs);
-    eltrans = L2FESpace_->GetElementTransformation(i);
-    double dRho = rhoCoef_.GetSensitivity(*eltrans, ip);
-    dp[0][vdofs[0]] = dRho * (*cellVol_)[vdofs[0]] / vol_;
- }
+   LinearCoefficient * rhoCoef = dynamic_cast<LinearCoefficient*>(rhoCoef_);
+   if ( rhoCoef == NULL )
+   {
+      MFEM_ABORT("Density::GetPropertySensitivities requires a "
+                 "LinearCoefficient for the density");
+   }
+
+   dp.resize(1);
+   dp[0].SetSpace(L2FESpace_);
+
+   Array<int> vdofs;
+   ElementTransformation *eltrans;
+   IntegrationPoint ip; ip.Init();
+   for (int i=0; i<L2FESpace_->GetNE(); i++)
+   {
+      L2FESpace_->GetElementVDofs(i, vdofs);
+      eltrans = L2FESpace_->GetElementTransformation(i);
+      double dRho = rhoCoef->GetSensitivity(*eltrans, ip);
+      dp[0][vdofs[0]] = dRho * (*cellVol_)[vdofs[0]] / vol_;
+   }
 }
-*/
+
 void
 Density::InitializeGLVis(VisData & vd)
 {
@@ -271,6 +272,268 @@ Density::WriteVisItFields(const string & prefix,
    visit_dc.RegisterField("DivGrad Density", divGradRho_);
    visit_dc.Save();
 }
+
+MultiVectorPCG::MultiVectorPCG(MPI_Comm comm)
+   : comm_(comm),
+     A_(NULL),
+     M_(NULL),
+     tol_(1e-12),
+     max_iter_(500),
+     print_level_(0),
+     num_its_(0)
+{
+   MPI_Comm_rank(comm_, &myid_);
+}
+
+// Point v at block j of the multi-vector V whose blocks have size n
+static inline void
+blockView(const Vector & V, int j, int n, Vector & v)
+{
+   v.SetDataAndSize(V.GetData() + j * n, n);
+}
+
+void
+MultiVectorPCG::Mult(const Vector & B, Vector & X, int nvec) const
+{
+   MFEM_ASSERT(A_ != NULL && M_ != NULL,
+               "MultiVectorPCG: operator and preconditioner must be set");
+
+   int n = A_->Height();
+
+   MFEM_ASSERT(B.Size() == n * nvec && X.Size() == n * nvec,
+               "MultiVectorPCG: inconsistent multi-vector sizes");
+
+   Vector R(n * nvec), Z(n * nvec), P(n * nvec), AP(n * nvec);
+   Vector b, x, r, z, p, ap;
+
+   vector<double> loc(2 * nvec), glb(2 * nvec);
+   vector<double> bMb(nvec), rMr(nvec);
+   vector<bool>   active(nvec, true);
+
+   // Initial residuals and the norms used in the stopping criterion
+   for (int j=0; j<nvec; j++)
+   {
+      blockView(B, j, n, b);  blockView(X, j, n, x);
+      blockView(R, j, n, r);  blockView(Z, j, n, z);
+      blockView(AP, j, n, ap);
+
+      A_->Mult(x, r);
+      subtract(b, r, r);
+      M_->Mult(r, z);
+      M_->Mult(b, ap);
+
+      loc[2 * j + 0] = b * ap;
+      loc[2 * j + 1] = r * z;
+   }
+   MPI_Allreduce(&loc[0], &glb[0], 2 * nvec, MPI_DOUBLE, MPI_SUM, comm_);
+
+   int num_active = 0;
+   for (int j=0; j<nvec; j++)
+   {
+      bMb[j] = glb[2 * j + 0];
+      rMr[j] = glb[2 * j + 1];
+
+      if ( bMb[j] == 0.0 )
+      {
+         blockView(X, j, n, x);
+         x = 0.0;
+         active[j] = false;
+      }
+      else if ( rMr[j] <= tol_ * tol_ * bMb[j] )
+      {
+         active[j] = false;
+      }
+      else
+      {
+         blockView(Z, j, n, z); blockView(P, j, n, p);
+         p = z;
+         num_active++;
+      }
+   }
+
+   num_its_ = 0;
+   while ( num_active > 0 && num_its_ < max_iter_ )
+   {
+      num_its_++;
+
+      for (int j=0; j<nvec; j++)
+      {
+         loc[j] = 0.0;
+         if ( !active[j] ) { continue; }
+
+         blockView(P, j, n, p); blockView(AP, j, n, ap);
+         A_->Mult(p, ap);
+         loc[j] = p * ap;
+      }
+      MPI_Allreduce(&loc[0], &glb[0], nvec, MPI_DOUBLE, MPI_SUM, comm_);
+
+      for (int j=0; j<nvec; j++)
+      {
+         loc[j] = 0.0;
+         if ( !active[j] ) { continue; }
+
+         blockView(X, j, n, x);  blockView(R, j, n, r);
+         blockView(Z, j, n, z);  blockView(P, j, n, p);
+         blockView(AP, j, n, ap);
+
+         double alpha = rMr[j] / glb[j];
+         x.Add( alpha, p);
+         r.Add(-alpha, ap);
+         M_->Mult(r, z);
+         loc[j] = r * z;
+      }
+      MPI_Allreduce(&loc[0], &glb[0], nvec, MPI_DOUBLE, MPI_SUM, comm_);
+
+      for (int j=0; j<nvec; j++)
+      {
+         if ( !active[j] ) { continue; }
+
+         double beta = glb[j] / rMr[j];
+         rMr[j] = glb[j];
+
+         if ( rMr[j] <= tol_ * tol_ * bMb[j] )
+         {
+            active[j] = false;
+            num_active--;
+            continue;
+         }
+
+         blockView(Z, j, n, z); blockView(P, j, n, p);
+         p *= beta;
+         p += z;
+      }
+
+      if ( print_level_ > 1 && myid_ == 0 )
+      {
+         cout << "MultiVectorPCG iteration " << num_its_ << ": "
+              << num_active << " of " << nvec << " systems active" << endl;
+      }
+   }
+
+   if ( print_level_ > 0 && myid_ == 0 )
+   {
+      cout << "MultiVectorPCG: " << nvec << " systems in " << num_its_
+           << " iterations";
+      if ( num_active > 0 )
+      {
+         cout << ", " << num_active << " not converged";
+      }
+      cout << endl;
+   }
+}
+
+void
+Block3x3CSRMatrix::Assemble(SparseMatrix * m[6])
+{
+   n_ = m[0]->Height();
+   height = width = 3 * n_;
+
+   const int * mI = m[0]->GetI();
+   const int * mJ = m[0]->GetJ();
+   int nnz = mI[n_];
+
+   I_.SetSize(n_ + 1);
+   J_.SetSize(nnz);
+   A_.SetSize(9 * nnz);
+
+   for (int i=0; i<=n_; i++) { I_[i] = mI[i]; }
+   for (int k=0; k<nnz; k++) { J_[k] = mJ[k]; }
+
+   // Source matrix for each entry of the 3x3 blocks in row major order.
+   // Entries 6, 7, and 8 refer to the transposes of m3, m4, and m5.
+   SparseMatrix * mT[3];
+   for (int i=0; i<3; i++) { mT[i] = Transpose(*m[i+3]); }
+
+   SparseMatrix * src[9] = { m[0],  m[5],  m[4],
+                             mT[2], m[1],  m[3],
+                             mT[1], mT[0], m[2]
+                           };
+
+   // The source matrices may order the columns of a row differently so
+   // each row is scattered through a column marker
+   Array<int> pos(n_);
+   pos = -1;
+
+   for (int i=0; i<n_; i++)
+   {
+      for (int k=I_[i]; k<I_[i+1]; k++) { pos[J_[k]] = k; }
+
+      for (int b=0; b<9; b++)
+      {
+         const int    * sI = src[b]->GetI();
+         const int    * sJ = src[b]->GetJ();
+         const double * sA = src[b]->GetData();
+
+         for (int k=I_[i]; k<I_[i+1]; k++) { A_[9 * k + b] = 0.0; }
+         for (int k=sI[i]; k<sI[i+1]; k++)
+         {
+            MFEM_VERIFY(pos[sJ[k]] >= 0,
+                        "Block3x3CSRMatrix: inconsistent sparsity patterns");
+            A_[9 * pos[sJ[k]] + b] += sA[k];
+         }
+      }
+
+      for (int k=I_[i]; k<I_[i+1]; k++) { pos[J_[k]] = -1; }
+   }
+
+   for (int i=0; i<3; i++) { delete mT[i]; }
+}
+
+void
+Block3x3CSRMatrix::Mult(const Vector & x, Vector & y) const
+{
+   const double * x0 = x.GetData();
+   const double * x1 = x0 + n_;
+   const double * x2 = x1 + n_;
+
+   double * y0 = y.GetData();
+   double * y1 = y0 + n_;
+   double * y2 = y1 + n_;
+
+   const double * a = A_.GetData();
+
+   for (int i=0; i<n_; i++)
+   {
+      double s0 = 0.0, s1 = 0.0, s2 = 0.0;
+      for (int k=I_[i]; k<I_[i+1]; k++)
+      {
+         const int      j = J_[k];
+         const double * b = &a[9 * k];
+
+         s0 += b[0] * x0[j] + b[1] * x1[j] + b[2] * x2[j];
+         s1 += b[3] * x0[j] + b[4] * x1[j] + b[5] * x2[j];
+         s2 += b[6] * x0[j] + b[7] * x1[j] + b[8] * x2[j];
+      }
+      y0[i] = s0; y1[i] = s1; y2[i] = s2;
+   }
+}
+
+void
+Block3x3CSRMatrix::RestrictedMult(int r, const Vector & x, Vector & y) const
+{
+   const double * xr = x.GetData();
+
+   double * y0 = y.GetData();
+   double * y1 = y0 + n_;
+   double * y2 = y1 + n_;
+
+   const double * a = A_.GetData() + r;
+
+   for (int i=0; i<n_; i++)
+   {
+      double s0 = 0.0, s1 = 0.0, s2 = 0.0;
+      for (int k=I_[i]; k<I_[i+1]; k++)
+      {
+         const double * b = &a[9 * k];
+
+         s0 += b[0] * xr[J_[k]];
+         s1 += b[3] * xr[J_[k]];
+         s2 += b[6] * xr[J_[k]];
+      }
+      y0[i] = s0; y1[i] = s1; y2[i] = s2;
+   }
+}
+
 /*
 StiffnessTensor::StiffnessTensor(ParMesh & pmesh, double vol,
                                  double lambda0, double mu0,
@@ -331,6 +594,12 @@ StiffnessTensor::StiffnessTensor(ParMesh & pmesh, double vol,
       errSol_(NULL),
       b_(NULL),
       // tmp1_(NULL),
+      meshSeq_(-1),
+      maxRefIts_(5),
+      amgA_(NULL),
+      amg_(NULL),
+      amgIts_(0),
+      amgSeq_(-1),
       vol_(vol),
       tol_(tol),
       vd_(NULL),
@@ -379,6 +648,7 @@ StiffnessTensor::StiffnessTensor(ParMesh & pmesh, double vol,
       m_[i]   = new ParBilinearForm(HCurlFESpace_);
       Chi_[i] = new ParGridFunction(H1VFESpace_);
       F_[i]   = new ParGridFunction(HCurlVFESpace_);
+      *Chi_[i] = 0.0;
       // MF_[i]  = new ParGridFunction(HCurlVFESpace_);
       MF_[i]  = new ParLinearForm(HCurlVFESpace_);
    }
@@ -440,6 +710,8 @@ StiffnessTensor::StiffnessTensor(ParMesh & pmesh, double vol,
 
 StiffnessTensor::~StiffnessTensor()
 {
+   this->resetAMG();
+
    for (int i=0; i<3; i++)
    {
       delete E_[i];
@@ -551,29 +823,45 @@ StiffnessTensor::GetHomogenizedProperties(vector<double> & p)
    VectorConstantCoefficient zHat(zhat);
 
    bool newProb = true;
-   int max_ref_its = 5;
+   int max_ref_its = maxRefIts_;
    int ref_its = 0;
    while ( newProb )
    {
       ref_its++;
 
-      grad_->Assemble();
-      grad_->Finalize();
+      // The gradient and the unit fields depend only on the mesh
+      if ( meshSeq_ != pmesh_->GetSequence() )
+      {
+         grad_->Assemble();
+         grad_->Finalize();
+
+         E_[0]->ProjectCoefficient(xHat);
+         E_[1]->ProjectCoefficient(yHat);
+         E_[2]->ProjectCoefficient(zHat);
+
+         meshSeq_ = pmesh_->GetSequence();
+      }
 
+      // The forms hold matrices from the previous call, or the eliminated
+      // matrix left by FormLinearSystem, which must not be added to
+      a_->Update();
       a_->Assemble(0);
       a_->Finalize(0);
 
+      SparseMatrix * m[6];
       for (int i=0; i<6; i++)
       {
          m_[i]->Assemble(0);
          m_[i]->Finalize(0);
+         m[i] = &m_[i]->SpMat();
       }
+      tensorMass_.Assemble(m);
 
-      E_[0]->ProjectCoefficient(xHat);
-      E_[1]->ProjectCoefficient(yHat);
-      E_[2]->ProjectCoefficient(zHat);
+      // The block operator holds its own copy of the entries
+      for (int i=0; i<6; i++) { m_[i]->Update(); }
 
       HYPRE_Int h1_tsize = H1FESpace_->GetTrueVSize();
+      HYPRE_Int h1v_tsize = H1VFESpace_->GetTrueVSize();
 
       Array<int> ess_tdof_list(0);
       if ( myid_ == 0 )
@@ -584,18 +872,15 @@ StiffnessTensor::GetHomogenizedProperties(vector<double> & p)
          ess_tdof_list[2] = 2*h1_tsize;
       }
 
-      HypreBoomerAMG * amg = NULL;
-      HyprePCG       * pcg = NULL;
-      HypreParMatrix   A;
-      Vector B, X;
+      // The six right hand sides and solutions are stored as consecutive
+      // blocks of true dofs so that they can be solved together
+      Vector B(6 * h1v_tsize), X(6 * h1v_tsize);
+      Vector Bi, Xi;
+
+      HypreParMatrix * P = H1VFESpace_->Dof_TrueDof_Matrix();
 
       for (int i=0; i<6; i++)
       {
-         if ( myid_ == 0 )
-         {
-            cout << "Solving Problem " << i+1 << " of 6" << endl;
-         }
-
          // The following magic formulae select two x, y, and z indices
          // for our tensor:
          //
@@ -612,61 +897,99 @@ StiffnessTensor::GetHomogenizedProperties(vector<double> & p)
          int ic = i - (i / 3) - (i / 4) - 2 * (i / 5);
 
          //  Compute M * E_ij (using F_[i] as a temporary)
-         // cout << myid_ << ": Calling RestrictedTensorMassMatrix, ib=" << ib
-         //   << ", E_[" << ic << "], F_["<< i << "]" << endl;
          this->RestrictedTensorMassMatrix(ib, *E_[ic], *F_[i]);
          //  Compute b = Div * M * E_ij
-         // cout << myid_ << ": Calling TensorGradietnTranspose" << endl;
          this->TensorGradientTranspose(*F_[i], *b_);
 
          // Compute b = - Div * M * E_ij
-         *b_ *= -1.0; *Chi_[i] = 0.0;
-         // cout << myid_ << ": Calling FormLinearSystem" << endl;
-         a_->FormLinearSystem(ess_tdof_list, *Chi_[i], *b_, A, X, B);
-         // cout << myid_ << ": Back From FormLinearSystem" << endl;
-         /*
-         if ( i == 0 && seqVF_ == 1 )
+         *b_ *= -1.0;
+
+         Bi.SetDataAndSize(B.GetData() + i * h1v_tsize, h1v_tsize);
+         Xi.SetDataAndSize(X.GetData() + i * h1v_tsize, h1v_tsize);
+
+         P->MultTranspose(*b_, Bi);
+
+         // The previous solution (interpolated onto the refined mesh
+         // after an AMR pass) is used as the initial guess
+         Chi_[i]->ParallelProject(Xi);
+
+         for (int j=0; j<ess_tdof_list.Size(); j++)
          {
-            ofstream ofs;
-            ofs.precision(16);
-            ofs.open("ME_XX.vec"); F_[i]->Print(ofs, 1); ofs.close();
-         // b_->Print("b_XX.vec");
+            Bi[ess_tdof_list[j]] = 0.0;
+            Xi[ess_tdof_list[j]] = 0.0;
          }
-         */
-         if ( i == 0 )
-         {
-            /*
-                 if ( false )
-                 {
-                    ostringstream oss;
-                    oss << "A_" << (int)floor(100.0*drand48()) << ".mat";
-                    A.Print(oss.str().c_str());
-                 }
-            */
-            amg = new HypreBoomerAMG(A);
-            if ( amg_elast_ )
-            {
-               amg->SetElasticityOptions(H1VFESpace_);
-            }
-            else
-            {
-               amg->SetSystemsOptions(pmesh_->SpaceDimension());
-            }
-            amg->SetPrintLevel(0);
+      }
+
+      // The essential values are zero so the eliminated system matrix is
+      // the only output of FormLinearSystem which is needed here
+      HypreParMatrix * A = new HypreParMatrix;
+      {
+         Vector B0, X0;
+         a_->FormLinearSystem(ess_tdof_list, *Chi_[0], *b_, *A, X0, B0);
+      }
+
+      // A hierarchy built for an earlier set of coefficients on this mesh
+      // remains a good preconditioner for small design changes
+      if ( amgSeq_ != pmesh_->GetSequence() )
+      {
+         this->resetAMG();
+      }
 
-            pcg = new HyprePCG(A);
-            pcg->SetTol(1e-12);
-            pcg->SetMaxIter(500);
-            pcg->SetPrintLevel(0);
-            pcg->SetPreconditioner(*amg);
+      bool newAMG = false;
+      if ( amg_ == NULL )
+      {
+         amg_ = new HypreBoomerAMG(*A);
+         if ( amg_elast_ )
+         {
+            amg_->SetElasticityOptions(H1VFESpace_);
+         }
+         else
+         {
+            amg_->SetSystemsOptions(pmesh_->SpaceDimension());
          }
+         amg_->SetPrintLevel(0);
+         amgA_ = A;
+         amgSeq_ = pmesh_->GetSequence();
+         newAMG = true;
+      }
+
+      MultiVectorPCG pcg(comm_);
+      pcg.SetOperator(*A);
+      pcg.SetPreconditioner(*amg_);
+      pcg.SetTol(1e-12);
+      pcg.SetMaxIter(500);
+      pcg.SetPrintLevel(0);
+
+      if ( myid_ == 0 )
+      {
+         cout << "Solving 6 Problems" << endl;
+      }
+      pcg.Mult(B, X, 6);
+
+      int its = pcg.GetNumIterations();
+      if ( myid_ == 0 )
+      {
+         cout << "Converged in " << its << " iterations" << endl;
+      }
+
+      if ( newAMG )
+      {
+         amgIts_ = its;
+      }
+      else if ( PreconditionerIsStale(its, amgIts_) )
+      {
+         this->resetAMG();
+      }
+      if ( A != amgA_ ) { delete A; }
 
-         // Solve for Chi_ij
-         // cout << myid_ << ": Solving" << endl;
-         pcg->Mult(B, X);
-         // cout << myid_ << ": Calling RecoverFEMSolution" << endl;
-         a_->RecoverFEMSolution(X, *b_, *Chi_[i]);
-         // cout << myid_ << ": Back From RecoverFEMSolution" << endl;
+      for (int i=0; i<6; i++)
+      {
+         int ib = i - 2 * (i / 3) - 2 * (i / 4) - (i / 5);
+         int ic = i - (i / 3) - (i / 4) - 2 * (i / 5);
+
+         // Recover Chi_ij
+         Xi.SetDataAndSize(X.GetData() + i * h1v_tsize, h1v_tsize);
+         P->Mult(Xi, *Chi_[i]);
 
          // Compute F_ij = E_ij + Grad * Chi_ij
          this->TensorGradient(*Chi_[i], *F_[i]);
@@ -675,8 +998,6 @@ StiffnessTensor::GetHomogenizedProperties(vector<double> & p)
          // Compute M * F_ij
          this->TensorMassMatrix(*F_[i], *MF_[i]);
       }
-      delete pcg;
-      delete amg;
 
       int k=0;
       if ( ref_its > 1 )
@@ -807,10 +1128,18 @@ StiffnessTensor::GetHomogenizedProperties(vector<double> & p)
    */
    //cout << myid_ << ": Leaving GetHomogenizedProperties" << endl;
 }
-/*
 void
 StiffnessTensor::GetPropertySensitivities(vector<ParGridFunction> & dp)
 {
+   LinearCoefficient * lambdaCoef =
+      dynamic_cast<LinearCoefficient*>(lambdaCoef_);
+   LinearCoefficient * muCoef = dynamic_cast<LinearCoefficient*>(muCoef_);
+   if ( lambdaCoef == NULL || muCoef == NULL )
+   {
+      MFEM_ABORT("StiffnessTensor::GetPropertySensitivities requires "
+                 "LinearCoefficients for lambda and mu");
+   }
+
    dp.resize(21);
 
    int l = 0;
@@ -835,14 +1164,17 @@ StiffnessTensor::GetPropertySensitivities(vector<ParGridFunction> & dp)
 
    const IntegrationRule * ir = &IntRules.Get(geom_, irOrder_);
 
+   // The correctors minimize the cell energies so the derivatives of the
+   // effective tensor only involve the derivative of the material tensor,
+   // dC_jk = (F_k, dM F_j) / vol, evaluated element by element
    for (int i=0; i<L2FESpace_->GetNE(); i++)
    {
       L2FESpace_->GetElementVDofs(i, l2_vdofs);
       HCurlFESpace_->GetElementVDofs(i, nd_vdofs);
 
       eltrans = L2FESpace_->GetElementTransformation(i);
-      double dLambda = lambdaCoef_.GetSensitivity(*eltrans, ip);
-      double dMu     = muCoef_.GetSensitivity(*eltrans, ip);
+      double dLambda = lambdaCoef->GetSensitivity(*eltrans, ip);
+      double dMu     = muCoef->GetSensitivity(*eltrans, ip);
 
       DenseTensor mat(3,3,6);
       mat = 0.0;
@@ -868,16 +1200,6 @@ StiffnessTensor::GetPropertySensitivities(vector<ParGridFunction> & dp)
       mat(0,1,5) = dLambda;
       mat(1,0,5) = dMu;
 
-      if ( i == 0 && false )
-      {
-         mat(0).Print(cout); cout << endl;
-         mat(1).Print(cout); cout << endl;
-         mat(2).Print(cout); cout << endl;
-         mat(3).Print(cout); cout << endl;
-         mat(4).Print(cout); cout << endl;
-         mat(5).Print(cout); cout << endl;
-      }
-
       MatrixConstantCoefficient xxCoef(mat(0));
       MatrixConstantCoefficient yyCoef(mat(1));
       MatrixConstantCoefficient zzCoef(mat(2));
@@ -916,34 +1238,18 @@ StiffnessTensor::GetPropertySensitivities(vector<ParGridFunction> & dp)
          mfjy.SetSize(fjx.Size());
          mfjz.SetSize(fjx.Size());
 
-         if ( true )
-         {
-            elmat[0].Mult(fjx, mfjx);
-            elmat[5].AddMult(fjy, mfjx);
-            elmat[4].AddMult(fjz, mfjx);
-
-            elmat[5].MultTranspose(fjx, mfjy);
-            elmat[1].AddMult(fjy, mfjy);
-            elmat[3].AddMult(fjz, mfjy);
-
-            elmat[4].MultTranspose(fjx, mfjz);
-            elmat[3].AddMultTranspose(fjy, mfjz);
-            elmat[2].AddMult(fjz, mfjz);
-         }
-         else
-         {
-            elmat[0].Mult(fjx, mfjx);
-            elmat[5].AddMultTranspose(fjy, mfjx);
-            elmat[4].AddMultTranspose(fjz, mfjx);
+         // Same block structure as TensorMassMatrix
+         elmat[0].Mult(fjx, mfjx);
+         elmat[5].AddMult(fjy, mfjx);
+         elmat[4].AddMult(fjz, mfjx);
 
-            elmat[5].Mult(fjx, mfjy);
-            elmat[1].AddMult(fjy, mfjy);
-            elmat[3].AddMultTranspose(fjz, mfjy);
+         elmat[5].MultTranspose(fjx, mfjy);
+         elmat[1].AddMult(fjy, mfjy);
+         elmat[3].AddMult(fjz, mfjy);
 
-            elmat[4].Mult(fjx, mfjz);
-            elmat[3].AddMult(fjy, mfjz);
-            elmat[2].AddMult(fjz, mfjz);
-         }
+         elmat[4].MultTranspose(fjx, mfjz);
+         elmat[3].AddMultTranspose(fjy, mfjz);
+         elmat[2].AddMult(fjz, mfjz);
 
          for (int k=j; k<6; k++)
          {
@@ -966,7 +1272,16 @@ StiffnessTensor::GetPropertySensitivities(vector<ParGridFunction> & dp)
       }
    }
 }
-*/
+
+void
+StiffnessTensor::resetAMG()
+{
+   delete amg_;  amg_  = NULL;
+   delete amgA_; amgA_ = NULL;
+   amgIts_ = 0;
+   amgSeq_ = -1;
+}
+
 void
 StiffnessTensor::TensorGradient(const Vector & x, Vector & y)
 {
@@ -1012,52 +1327,18 @@ StiffnessTensor::TensorGradientTranspose(const Vector & x, Vector & y)
 void
 StiffnessTensor::TensorMassMatrix(const Vector & x, Vector & y)
 {
-   //cout << myid_ << ": Entering TensorMassMatrix" << endl;
-   HYPRE_Int  nd_size = HCurlFESpace_->GetNDofs();
-
-   Vector xx(&(x.GetData())[0*nd_size], nd_size);
-   Vector xy(&(x.GetData())[1*nd_size], nd_size);
-   Vector xz(&(x.GetData())[2*nd_size], nd_size);
-
-   Vector yx(&(y.GetData())[0*nd_size], nd_size);
-   Vector yy(&(y.GetData())[1*nd_size], nd_size);
-   Vector yz(&(y.GetData())[2*nd_size], nd_size);
-
    // Perform Block Matrix Vector Multiply
    /*
        /yx\   / m0  m5  m4 \ /xx\
        |yy| = | m5T m1  m3 | |xy|
        \yz/   \ m4T m3T m2 / \xz/
    */
-
-   m_[0]->Mult(xx, yx);
-   m_[1]->Mult(xy, yy);
-   m_[2]->Mult(xz, yz);
-   m_[3]->AddMult(xz, yy);
-   m_[4]->AddMult(xz, yx);
-   m_[5]->AddMult(xy, yx);
-   m_[3]->AddMultTranspose(xy, yz);
-   m_[4]->AddMultTranspose(xx, yz);
-   m_[5]->AddMultTranspose(xx, yy);
-   //cout << myid_ << ": Leaving TensorMassMatrix" << endl;
+   tensorMass_.Mult(x, y);
 }
 
 void
 StiffnessTensor::RestrictedTensorMassMatrix(int r, const Vector & x, Vector & y)
 {
-   // cout << myid_ << ": Entering RestrictedTensorMassMatrix" << endl;
-
-   // cout << "x size: " << x.Size() << endl;
-   // cout << "y size: " << y.Size() << endl;
-
-   HYPRE_Int  nd_size = HCurlFESpace_->GetNDofs();
-
-   // cout << "nd_size: " << nd_size << endl;
-
-   Vector yx(&(y.GetData())[0*nd_size], nd_size);
-   Vector yy(&(y.GetData())[1*nd_size], nd_size);
-   Vector yz(&(y.GetData())[2*nd_size], nd_size);
-
    // Perform Block Matrix Vector Multiply
    /*
        /yx\   / m0  m5  m4 \ /xx\
@@ -1068,37 +1349,7 @@ StiffnessTensor::RestrictedTensorMassMatrix(int r, const Vector & x, Vector & y)
        Where |xy| = |0| or |x| or |0| for r = 0, 1, or 2 respectively.
              \xz/   \0/    \0/    \x/
    */
-   for ( int i=0; i<6; i++)
-   {
-      if ( m_[i] == NULL)
-      {
-         cout << "m_[" << i << "] is NULL" << endl;
-      }
-      // else
-      //  {
-      //   cout << "m[" << i << "] is " << m_[i]->Height() << " x " << m_[i]->Width() << endl;
-      //  }
-   }
-
-   switch (r)
-   {
-      case 0:
-         m_[0]->Mult(x, yx);
-         m_[5]->MultTranspose(x, yy);
-         m_[4]->MultTranspose(x, yz);
-         break;
-      case 1:
-         m_[5]->Mult(x, yx);
-         m_[1]->Mult(x, yy);
-         m_[3]->MultTranspose(x, yz);
-         break;
-      case 2:
-         m_[4]->Mult(x, yx);
-         m_[3]->Mult(x, yy);
-         m_[2]->Mult(x, yz);
-         break;
-   }
-   //cout << myid_ << ": Leaving RestrictedTensorMassMatrix" << endl;
+   tensorMass_.RestrictedMult(r, x, y);
 }
 
 void
@@ -1261,27 +1512,618 @@ StiffnessTensor::OffDiagElasticityCoef::Eval(DenseMatrix &K,
    K(axis1_, axis0_) = mu_->Eval(T, ip);
 }
 
-ParDiscreteVectorProductOperator::ParDiscreteVectorProductOperator(
-   ParFiniteElementSpace *dfes,
-   ParFiniteElementSpace *rfes,
-   const Vector & v)
-   : ParDiscreteInterpolationOperator(dfes, rfes),
-     vCoef_(v)
-{
-   this->AddDomainInterpolator(new VectorScalarProductInterpolator(vCoef_));
-}
-
-ParDiscreteVectorCrossProductOperator::ParDiscreteVectorCrossProductOperator(
-   ParFiniteElementSpace *dfes,
-   ParFiniteElementSpace *rfes,
-   const Vector & v)
-   : ParDiscreteInterpolationOperator(dfes, rfes),
-     vCoef_(v)
-{
-   this->AddDomainInterpolator(new VectorCrossProductInterpolator(vCoef_));
-}
-
-MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
+ElectromagneticTensors::ElectromagneticTensors(ParMesh & pmesh, double vol,
+                                               Coefficient & epsCoef,
+                                               Coefficient & muCoef,
+                                               double tol)
+   :  Homogenization(pmesh.GetComm()),
+      pmesh_(&pmesh),
+      L2FESpace_(NULL),
+      L2VFESpace_(NULL),
+      H1FESpace_(NULL),
+      HCurlFESpace_(NULL),
+      HDivFESpace_(NULL),
+      grad_(NULL),
+      errSol_(NULL),
+      errors_(NULL),
+      b_(NULL),
+      eps_(NULL),
+      mu_(NULL),
+      p_(12),
+      vol_(vol),
+      tol_(tol),
+      vd_(NULL)
+{
+   coefs_[0] = &epsCoef;
+   coefs_[1] = &muCoef;
+
+   L2FESpace_  = new L2_ParFESpace(pmesh_, 0, pmesh_->Dimension());
+   L2VFESpace_ = new L2_ParFESpace(pmesh_, 1, pmesh_->Dimension(),
+                                   pmesh_->SpaceDimension());
+   H1FESpace_    = new H1_ParFESpace(pmesh_, 1, pmesh_->Dimension());
+   HCurlFESpace_ = new ND_ParFESpace(pmesh_, 1, pmesh_->Dimension());
+   HDivFESpace_  = new RT_ParFESpace(pmesh_, 1, pmesh_->Dimension());
+
+   // The same rule is used for the H1 and H(Curl) forms so that
+   // Grad^T M Grad reproduces the diffusion operator
+   irOrder_ = H1FESpace_->GetElementTransformation(0)->OrderW() + 2;
+   geom_ = H1FESpace_->GetFE(0)->GetGeomType();
+   const IntegrationRule * ir = &IntRules.Get(geom_, irOrder_);
+
+   grad_ = new ParDiscreteGradOperator(H1FESpace_, HCurlFESpace_);
+
+   eps_ = new ParGridFunction(L2FESpace_);
+   mu_  = new ParGridFunction(L2FESpace_);
+
+   for (int m=0; m<2; m++)
+   {
+      a_[m] = new ParBilinearForm(H1FESpace_);
+      BilinearFormIntegrator * diffInteg = new DiffusionIntegrator(*coefs_[m]);
+      diffInteg->SetIntRule(ir);
+      a_[m]->AddDomainIntegrator(diffInteg);
+
+      m_[m] = new ParBilinearForm(HCurlFESpace_);
+      BilinearFormIntegrator * massInteg =
+         new VectorFEMassIntegrator(*coefs_[m]);
+      massInteg->SetIntRule(ir);
+      m_[m]->AddDomainIntegrator(massInteg);
+   }
+
+   for (int i=0; i<3; i++)
+   {
+      E_[i] = new ParGridFunction(HCurlFESpace_);
+   }
+   for (int i=0; i<6; i++)
+   {
+      Chi_[i] = new ParGridFunction(H1FESpace_);
+      F_[i]   = new ParGridFunction(HCurlFESpace_);
+      MF_[i]  = new ParLinearForm(HCurlFESpace_);
+   }
+
+   // Each cell problem has its own estimator because the estimators cache
+   // their results until the mesh changes
+   errSol_ = new ParGridFunction(H1FESpace_, (double*)NULL);
+   diffInteg_[0] = new DiffusionIntegrator(*coefs_[0]);
+   diffInteg_[1] = new DiffusionIntegrator(*coefs_[1]);
+   for (int i=0; i<6; i++)
+   {
+      errEst_[i] = new L2ZienkiewiczZhuEstimator(*diffInteg_[i/3], *errSol_,
+                                                 *L2VFESpace_, *HDivFESpace_);
+   }
+   errors_ = new ParGridFunction(L2FESpace_);
+
+   b_ = new ParGridFunction(H1FESpace_);
+}
+
+ElectromagneticTensors::~ElectromagneticTensors()
+{
+   for (int i=0; i<6; i++)
+   {
+      delete errEst_[i];
+      delete Chi_[i];
+      delete F_[i];
+      delete MF_[i];
+   }
+   for (int i=0; i<3; i++)
+   {
+      delete E_[i];
+   }
+   for (int m=0; m<2; m++)
+   {
+      delete diffInteg_[m];
+      delete a_[m];
+      delete m_[m];
+   }
+
+   delete grad_;
+
+   delete errSol_;
+   delete errors_;
+   delete b_;
+
+   delete eps_;
+   delete mu_;
+
+   delete L2FESpace_;
+   delete L2VFESpace_;
+   delete H1FESpace_;
+   delete HCurlFESpace_;
+   delete HDivFESpace_;
+}
+
+void
+ElectromagneticTensors::GetHomogenizedProperties(vector<double> & p)
+{
+   vector<double> old_p(12);
+   p.resize(12);
+
+   Vector xhat(3); xhat = 0.0; xhat[0] = 1.0;
+   Vector yhat(3); yhat = 0.0; yhat[1] = 1.0;
+   Vector zhat(3); zhat = 0.0; zhat[2] = 1.0;
+
+   VectorConstantCoefficient xHat(xhat);
+   VectorConstantCoefficient yHat(yhat);
+   VectorConstantCoefficient zHat(zhat);
+
+   bool newProb = true;
+   int max_ref_its = 5;
+   int ref_its = 0;
+   while ( newProb )
+   {
+      ref_its++;
+
+      grad_->Assemble();
+      grad_->Finalize();
+
+      for (int m=0; m<2; m++)
+      {
+         a_[m]->Assemble(0);
+         a_[m]->Finalize(0);
+         m_[m]->Assemble(0);
+         m_[m]->Finalize(0);
+      }
+
+      E_[0]->ProjectCoefficient(xHat);
+      E_[1]->ProjectCoefficient(yHat);
+      E_[2]->ProjectCoefficient(zHat);
+
+      if ( ref_its > 1 )
+      {
+         for (int k=0; k<12; k++)
+         {
+            old_p[k] = p[k];
+         }
+      }
+
+      this->solve(0, p);
+      this->solve(1, p);
+
+      bool bigChange = true;
+      newProb = false;
+      if ( ref_its > 1 )
+      {
+         double norm_p = 0.0;
+         double diff_p = 0.0;
+         for (int k=0; k<12; k++)
+         {
+            norm_p += pow(p[k], 2.0);
+            diff_p += pow(p[k] - old_p[k], 2.0);
+         }
+         double rel_diff = sqrt(diff_p / norm_p);
+         bigChange = rel_diff > tol_;
+         if ( myid_ == 0 )
+         {
+            cout << "diff/norm ratio " << sqrt(diff_p) << "/" << sqrt(norm_p)
+                 << " " << rel_diff << endl;
+         }
+      }
+
+      if ( bigChange && ref_its < max_ref_its )
+      {
+         // Combine the error estimates of all six cell problems
+         *errors_ = 0.0;
+         for (int k=0; k<6; k++)
+         {
+            errSol_->MakeRef(H1FESpace_, Chi_[k]->GetData());
+            const Vector & err = errEst_[k]->GetLocalErrors();
+            for (int i=0; i<errors_->Size(); i++)
+            {
+               (*errors_)[i] += pow(err[i], 2.0);
+            }
+         }
+         for (int i=0; i<errors_->Size(); i++)
+         {
+            (*errors_)[i] = sqrt((*errors_)[i]);
+         }
+
+         double max_err = errors_->Normlinf();
+         double glb_max_err = 0.0;
+         MPI_Allreduce(&max_err, &glb_max_err, 1, MPI_DOUBLE, MPI_MAX, comm_);
+         pmesh_->RefineByError(*errors_, 0.9 * glb_max_err);
+
+         L2FESpace_->Update();
+         L2VFESpace_->Update();
+         H1FESpace_->Update();
+         HCurlFESpace_->Update();
+         HDivFESpace_->Update();
+
+         eps_->Update();
+         mu_->Update();
+
+         for (int m=0; m<2; m++)
+         {
+            a_[m]->Update();
+            m_[m]->Update();
+         }
+         for (int i=0; i<3; i++) { E_[i]->Update(); }
+         for (int i=0; i<6; i++)
+         {
+            Chi_[i]->Update();
+            F_[i]->Update();
+            MF_[i]->Update();
+         }
+         grad_->Update();
+         errSol_->MakeRef(H1FESpace_, Chi_[0]->GetData());
+         errors_->Update();
+         b_->Update();
+
+         newProb = true;
+      }
+   }
+
+   p_ = p;
+}
+
+void
+ElectromagneticTensors::solve(int m, vector<double> & p)
+{
+   HYPRE_Int h1_tsize = H1FESpace_->GetTrueVSize();
+
+   // The correctors are only determined up to a constant
+   Array<int> ess_tdof_list(0);
+   if ( myid_ == 0 && h1_tsize > 0 )
+   {
+      ess_tdof_list.SetSize(1);
+      ess_tdof_list[0] = 0;
+   }
+
+   HypreBoomerAMG * amg = NULL;
+   HyprePCG       * pcg = NULL;
+   HypreParMatrix   A;
+   Vector B, X;
+
+   for (int j=0; j<3; j++)
+   {
+      int k = 3 * m + j;
+
+      if ( myid_ == 0 )
+      {
+         cout << "Solving " << ((m == 0) ? "Electrostatic" : "Magnetostatic")
+              << " Problem " << j+1 << " of 3" << endl;
+      }
+
+      //  Compute b = - Div * M * E_j (using F_[k] as a temporary)
+      m_[m]->Mult(*E_[j], *F_[k]);
+      grad_->MultTranspose(*F_[k], *b_);
+      *b_ *= -1.0; *Chi_[k] = 0.0;
+
+      a_[m]->FormLinearSystem(ess_tdof_list, *Chi_[k], *b_, A, X, B);
+
+      if ( j == 0 )
+      {
+         amg = new HypreBoomerAMG(A);
+         amg->SetPrintLevel(0);
+
+         pcg = new HyprePCG(A);
+         pcg->SetTol(1e-12);
+         pcg->SetMaxIter(500);
+         pcg->SetPrintLevel(0);
+         pcg->SetPreconditioner(*amg);
+      }
+
+      // Solve for Chi_j
+      pcg->Mult(B, X);
+      a_[m]->RecoverFEMSolution(X, *b_, *Chi_[k]);
+
+      // Compute F_j = E_j + Grad * Chi_j
+      grad_->Mult(*Chi_[k], *F_[k]);
+      *F_[k] += *E_[j];
+
+      // Compute M * F_j
+      m_[m]->Mult(*F_[k], *MF_[k]);
+   }
+   delete pcg;
+   delete amg;
+
+   for (int i=0; i<6; i++)
+   {
+      // Same index pairs as in StiffnessTensor:
+      //   i = 0, 1, 2, 3, 4, 5  ->  xx, yy, zz, yz, xz, xy
+      int ib = i - 2 * (i / 3) - 2 * (i / 4) - (i / 5);
+      int ic = i - (i / 3) - (i / 4) - 2 * (i / 5);
+
+      p[6*m+i] = MF_[3*m+ic]->operator()(*F_[3*m+ib]) / vol_;
+   }
+}
+
+void
+ElectromagneticTensors::getTensor(int m, DenseMatrix & T) const
+{
+   T.SetSize(3);
+   T(0,0) = p_[6*m+0];
+   T(1,1) = p_[6*m+1];
+   T(2,2) = p_[6*m+2];
+   T(1,2) = T(2,1) = p_[6*m+3];
+   T(0,2) = T(2,0) = p_[6*m+4];
+   T(0,1) = T(1,0) = p_[6*m+5];
+}
+
+void
+ElectromagneticTensors::InitializeGLVis(VisData & vd)
+{
+   vd_ = &vd;
+
+   for (int i=0; i<9; i++)
+   {
+      socks_[i].precision(8);
+   }
+}
+
+void
+ElectromagneticTensors::DisplayToGLVis()
+{
+   if (vd_ == NULL)
+   {
+      MFEM_WARNING("DisplayToGLVis being called before InitializeGLVis!");
+      return;
+   }
+
+   eps_->ProjectCoefficient(*coefs_[0]);
+   mu_->ProjectCoefficient(*coefs_[1]);
+
+   VisualizeField(socks_[0], *eps_, "Epsilon", *vd_);
+   vd_->IncrementWindow();
+   VisualizeField(socks_[1], *mu_, "Mu", *vd_);
+   vd_->IncrementWindow();
+
+   const char * labels[6] = { "Chi Eps X", "Chi Eps Y", "Chi Eps Z",
+                              "Chi Mu X", "Chi Mu Y", "Chi Mu Z"
+                            };
+   for (int i=0; i<6; i++)
+   {
+      VisualizeField(socks_[i+2], *Chi_[i], labels[i], *vd_);
+      vd_->IncrementWindow();
+   }
+
+   VisualizeField(socks_[8], *errors_, "Combined Error Estimate", *vd_);
+   vd_->IncrementWindow();
+}
+
+void
+ElectromagneticTensors::WriteVisItFields(const string & prefix,
+                                         const string & label)
+{
+   eps_->ProjectCoefficient(*coefs_[0]);
+   mu_->ProjectCoefficient(*coefs_[1]);
+
+   VisItDataCollection visit_dc(label.c_str(), pmesh_);
+   visit_dc.SetPrefixPath(prefix.c_str());
+   visit_dc.RegisterField("Epsilon", eps_);
+   visit_dc.RegisterField("Mu", mu_);
+   visit_dc.RegisterField("Chi Eps X", Chi_[0]);
+   visit_dc.RegisterField("Chi Eps Y", Chi_[1]);
+   visit_dc.RegisterField("Chi Eps Z", Chi_[2]);
+   visit_dc.RegisterField("Chi Mu X", Chi_[3]);
+   visit_dc.RegisterField("Chi Mu Y", Chi_[4]);
+   visit_dc.RegisterField("Chi Mu Z", Chi_[5]);
+   visit_dc.Save();
+}
+
+TopologyOptimizer::TopologyOptimizer(ParGridFunction & vf,
+                                     Homogenization & hom,
+                                     const vector<double> & weights,
+                                     double volFrac, double r)
+   : comm_(vf.ParFESpace()->GetComm()),
+     vf_(&vf),
+     hom_(&hom),
+     w_(weights),
+     volFrac_(volFrac),
+     move_(0.2),
+     vfMin_(1e-3),
+     pmesh_(vf.ParFESpace()->GetParMesh()),
+     H1FESpace_(NULL),
+     Af_(NULL),
+     Bf_(NULL),
+     amg_(NULL),
+     cg_(NULL),
+     totVol_(0.0)
+{
+   MPI_Comm_rank(comm_, &myid_);
+
+   ParFiniteElementSpace * L2FESpace = vf_->ParFESpace();
+
+   MFEM_VERIFY(L2FESpace->GetVSize() == pmesh_->GetNE(),
+               "TopologyOptimizer: the volume fraction must be piecewise "
+               "constant");
+
+   H1FESpace_ = new H1_ParFESpace(pmesh_, 1, pmesh_->Dimension());
+
+   ConstantCoefficient r2Coef(r * r);
+   ConstantCoefficient one(1.0);
+
+   {
+      ParBilinearForm a(H1FESpace_);
+      a.AddDomainIntegrator(new DiffusionIntegrator(r2Coef));
+      a.AddDomainIntegrator(new MassIntegrator(one));
+      a.Assemble();
+      a.Finalize();
+      Af_ = a.ParallelAssemble();
+
+      ParMixedBilinearForm b(L2FESpace, H1FESpace_);
+      b.AddDomainIntegrator(new MassIntegrator(one));
+      b.Assemble();
+      b.Finalize();
+      Bf_ = b.ParallelAssemble();
+
+      ParLinearForm v(L2FESpace);
+      v.AddDomainIntegrator(new DomainLFIntegrator(one));
+      v.Assemble();
+      cellVol_ = v;
+   }
+
+   double locVol = cellVol_.Sum();
+   MPI_Allreduce(&locVol, &totVol_, 1, MPI_DOUBLE, MPI_SUM, comm_);
+
+   amg_ = new HypreBoomerAMG(*Af_);
+   amg_->SetPrintLevel(0);
+
+   cg_ = new CGSolver(comm_);
+   cg_->SetOperator(*Af_);
+   cg_->SetPreconditioner(*amg_);
+   cg_->SetRelTol(1e-10);
+   cg_->SetMaxIter(200);
+   cg_->SetPrintLevel(0);
+
+   // The initial design is the volume fraction provided by the caller
+   x_ = *vf_;
+}
+
+TopologyOptimizer::~TopologyOptimizer()
+{
+   delete cg_;
+   delete amg_;
+   delete Af_;
+   delete Bf_;
+   delete H1FESpace_;
+}
+
+void
+TopologyOptimizer::filter(const Vector & x, Vector & y)
+{
+   // y = D^{-1} B^T A^{-1} B x where D holds the element volumes
+   Vector b(Af_->Height()), z(Af_->Height());
+   Bf_->Mult(x, b);
+   z = 0.0;
+   cg_->Mult(b, z);
+   Bf_->MultTranspose(z, y);
+   for (int i=0; i<y.Size(); i++) { y[i] /= cellVol_[i]; }
+}
+
+void
+TopologyOptimizer::filterTranspose(const Vector & x, Vector & y)
+{
+   // y = B^T A^{-1} B D^{-1} x
+   Vector h(x.Size());
+   for (int i=0; i<x.Size(); i++) { h[i] = x[i] / cellVol_[i]; }
+
+   Vector b(Af_->Height()), z(Af_->Height());
+   Bf_->Mult(h, b);
+   z = 0.0;
+   cg_->Mult(b, z);
+   Bf_->MultTranspose(z, y);
+}
+
+double
+TopologyOptimizer::Step(double & obj)
+{
+   int n = x_.Size();
+
+   this->filter(x_, *vf_);
+
+   vector<double> p;
+   hom_->GetHomogenizedProperties(p);
+   hom_->GetPropertySensitivities(dp_);
+
+   MFEM_VERIFY(p.size() == w_.size() && dp_.size() == w_.size(),
+               "TopologyOptimizer: the number of weights does not match "
+               "the number of homogenized properties");
+
+   obj = 0.0;
+   Vector g(n); g = 0.0;
+   for (unsigned int k=0; k<w_.size(); k++)
+   {
+      if ( w_[k] == 0.0 ) { continue; }
+      MFEM_VERIFY(dp_[k].Size() == n,
+                  "TopologyOptimizer: sensitivities must be defined on "
+                  "the volume fraction space");
+      obj += w_[k] * p[k];
+      g.Add(w_[k], dp_[k]);
+   }
+
+   Vector dx(n);
+   this->filterTranspose(g, dx);
+
+   // Scale the sensitivities so that the bisection bounds below do not
+   // depend on the units of the homogenized properties
+   double loc_max = dx.Normlinf();
+   double glb_max = 0.0;
+   MPI_Allreduce(&loc_max, &glb_max, 1, MPI_DOUBLE, MPI_MAX, comm_);
+   if ( glb_max > 0.0 ) { dx /= glb_max; }
+
+   // Bisection for the Lagrange multiplier of the volume constraint.
+   // Since the filter conserves volume dV/dx_e = |e| / |cell|.
+   Vector xnew(n);
+   double l1 = 0.0, l2 = 1e9;
+   while ( l2 - l1 > 1e-4 * (l1 + l2) )
+   {
+      double lmid = 0.5 * (l1 + l2);
+
+      double loc_vol = 0.0;
+      for (int i=0; i<n; i++)
+      {
+         double dv = cellVol_[i] / totVol_;
+         double xe = x_[i] * sqrt(max(0.0, dx[i]) / (lmid * dv));
+         double lo = max(vfMin_, x_[i] - move_);
+         double hi = min(1.0, x_[i] + move_);
+         xnew[i] = max(lo, min(hi, xe));
+         loc_vol += cellVol_[i] * xnew[i];
+      }
+
+      double glb_vol = 0.0;
+      MPI_Allreduce(&loc_vol, &glb_vol, 1, MPI_DOUBLE, MPI_SUM, comm_);
+
+      if ( glb_vol > volFrac_ * totVol_ ) { l1 = lmid; }
+      else { l2 = lmid; }
+   }
+
+   double loc_change = 0.0;
+   for (int i=0; i<n; i++)
+   {
+      loc_change = max(loc_change, fabs(xnew[i] - x_[i]));
+   }
+   double glb_change = 0.0;
+   MPI_Allreduce(&loc_change, &glb_change, 1, MPI_DOUBLE, MPI_MAX, comm_);
+
+   x_ = xnew;
+
+   return glb_change;
+}
+
+int
+TopologyOptimizer::Optimize(int max_its, double tol)
+{
+   int it = 0;
+   double change = 2.0 * tol;
+   while ( it < max_its && change > tol )
+   {
+      double obj = 0.0;
+      change = this->Step(obj);
+      it++;
+
+      if ( myid_ == 0 )
+      {
+         cout << "Design iteration " << it << ":  objective " << obj
+              << ", change " << change << endl;
+      }
+   }
+
+   // Leave the filtered version of the final design in vf
+   this->filter(x_, *vf_);
+
+   return it;
+}
+
+ParDiscreteVectorProductOperator::ParDiscreteVectorProductOperator(
+   ParFiniteElementSpace *dfes,
+   ParFiniteElementSpace *rfes,
+   const Vector & v)
+   : ParDiscreteInterpolationOperator(dfes, rfes),
+     vCoef_(v)
+{
+   this->AddDomainInterpolator(new VectorScalarProductInterpolator(vCoef_));
+}
+
+ParDiscreteVectorCrossProductOperator::ParDiscreteVectorCrossProductOperator(
+   ParFiniteElementSpace *dfes,
+   ParFiniteElementSpace *rfes,
+   const Vector & v)
+   : ParDiscreteInterpolationOperator(dfes, rfes),
+     vCoef_(v)
+{
+   this->AddDomainInterpolator(new VectorCrossProductInterpolator(vCoef_));
+}
+
+MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
                                                    int order)
    : myid_(0),
      hcurl_loc_size_(-1),
@@ -1293,16 +2135,20 @@ MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
      newOmega_(true),
      newMCoef_(true),
      newKCoef_(true),
+     newT1Inv_(false),
+     newSolver_(false),
      pmesh_(&pmesh),
      H1FESpace_(NULL),
      HCurlFESpace_(NULL),
      HDivFESpace_(NULL),
      // L2FESpace_(NULL),
+     hcurlWS_(NULL),
      // bravais_(NULL),
      // fourierHCurl_(NULL),
      // alpha_a_(0.0),
      // alpha_i_(90.0),
      atol_(1.0e-6),
+     tgTol_(1.0e-3),
      beta_(0.0),
      // omega_(-1.0),
      mCoef_(NULL),
@@ -1323,6 +2169,8 @@ MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
      DKZ_(NULL),
      // DKZT_(NULL),
      T1Inv_(NULL),
+     S1M1_(NULL),
+     S1M1Inv_(NULL),
      Curl_(NULL),
      Zeta_(NULL),
      BDP_(NULL),
@@ -1353,6 +2201,8 @@ MaxwellBlochWaveEquation::MaxwellBlochWaveEquation(ParMesh & pmesh,
    HCurlFESpace_ = new ND_ParFESpace(&pmesh,order,dim);
    HDivFESpace_  = new RT_ParFESpace(&pmesh,order,dim);
    // L2FESpace_    = new L2_ParFESpace(&pmesh,0,dim);
+
+   hcurlWS_ = new ParFESpaceWorkspace(*HCurlFESpace_);
 }
 
 MaxwellBlochWaveEquation::~MaxwellBlochWaveEquation()
@@ -1381,6 +2231,8 @@ MaxwellBlochWaveEquation::~MaxwellBlochWaveEquation()
    delete C_;
    delete BDP_;
    delete T1Inv_;
+   delete S1M1Inv_;
+   delete S1M1_;
 
    delete M1_;
    delete M2_;
@@ -1395,6 +2247,8 @@ MaxwellBlochWaveEquation::~MaxwellBlochWaveEquation()
 
    // delete fourierHCurl_;
 
+   delete hcurlWS_;
+
    delete H1FESpace_;
    delete HCurlFESpace_;
    delete HDivFESpace_;
@@ -1587,6 +2441,13 @@ MaxwellBlochWaveEquation::Setup()
       M1_ = m1.ParallelAssemble();
    }
 
+   if ( newZeta_ || newBeta_ || newKCoef_ || newMCoef_ )
+   {
+      // Formed again from the new S1 and M1 when next needed
+      delete S1M1Inv_; S1M1Inv_ = NULL;
+      delete S1M1_;    S1M1_    = NULL;
+   }
+
    if ( newZeta_ || newBeta_ || newKCoef_ )
    {
       if ( A_ == NULL )
@@ -1642,6 +2503,47 @@ MaxwellBlochWaveEquation::Setup()
    }
 
    if ( newZeta_ || newBeta_ || newKCoef_ )
+   {
+      // The AMS solver for S1 is built with the eigensolver
+      newT1Inv_ = true;
+   }
+
+   if ( ( newZeta_ || newBeta_ || newMCoef_ || newKCoef_ ) && nev_ > 0 )
+   {
+      if ( fabs(beta_) > 0.0 )
+      {
+         delete SubSpaceProj_;
+         if ( myid_ == 0 ) { cout << "Building Subspace Projector" << endl; }
+         MaxwellBlochWaveProjector * mbwProj =
+            new MaxwellBlochWaveProjector(*HCurlFESpace_,
+                                          *H1FESpace_,
+                                          *M_,beta_,zeta_);
+         mbwProj->Setup();
+
+         SubSpaceProj_ = mbwProj;
+      }
+      newSolver_ = true;
+   }
+
+   Vector xHat(3), yHat(3), zHat(3);
+   xHat = yHat = zHat = 0.0;
+   xHat(0) = 1.0; yHat(1) = 1.0; zHat(2) = 1.0;
+
+   newZeta_  = false;
+   newBeta_  = false;
+   newOmega_ = false;
+   newMCoef_ = false;
+   newKCoef_ = false;
+
+   this->TestProjector();
+
+   if ( myid_ == 0 ) { cout << "Leaving Setup" << endl; }
+}
+
+void
+MaxwellBlochWaveEquation::buildEigenSolver()
+{
+   if ( newT1Inv_ )
    {
       if ( myid_ == 0 ) { cout << "Building T1Inv" << endl; }
       delete T1Inv_;
@@ -1666,22 +2568,13 @@ MaxwellBlochWaveEquation::Setup()
          BDP_->SetDiagonalBlock(1,T1Inv_);
          BDP_->owns_blocks = 0;
       }
+      newT1Inv_ = false;
    }
 
-   if ( ( newZeta_ || newBeta_ || newMCoef_ || newKCoef_ ) && nev_ > 0 )
+   if ( newSolver_ )
    {
       if ( fabs(beta_) > 0.0 )
       {
-         delete SubSpaceProj_;
-         if ( myid_ == 0 ) { cout << "Building Subspace Projector" << endl; }
-         MaxwellBlochWaveProjector * mbwProj =
-            new MaxwellBlochWaveProjector(*HCurlFESpace_,
-                                          *H1FESpace_,
-                                          *M_,beta_,zeta_);
-         mbwProj->Setup();
-
-         SubSpaceProj_ = mbwProj;
-
          if ( myid_ == 0 ) { cout << "Building Preconditioner" << endl; }
          delete Precond_;
          Precond_ = new MaxwellBlochWavePrecond(*HCurlFESpace_,*BDP_,
@@ -1732,29 +2625,18 @@ MaxwellBlochWaveEquation::Setup()
          {
             vec0_ = new HypreParVector(*M1_);
          }
-         *vec0_ = 0.0;
-      }
-   }
-
-   Vector xHat(3), yHat(3), zHat(3);
-   xHat = yHat = zHat = 0.0;
-   xHat(0) = 1.0; yHat(1) = 1.0; zHat(2) = 1.0;
-
-   newZeta_  = false;
-   newBeta_  = false;
-   newOmega_ = false;
-   newMCoef_ = false;
-   newKCoef_ = false;
-
-   this->TestProjector();
-
-   if ( myid_ == 0 ) { cout << "Leaving Setup" << endl; }
+         *vec0_ = 0.0;
+      }
+      newSolver_ = false;
+   }
 }
 
 void
 MaxwellBlochWaveEquation::SetInitialVectors(int num_vecs,
                                             HypreParVector ** vecs)
 {
+   this->buildEigenSolver();
+
    if ( lobpcg_ )
    {
       lobpcg_->SetInitialVectors(num_vecs, vecs);
@@ -1764,11 +2646,20 @@ MaxwellBlochWaveEquation::SetInitialVectors(int num_vecs,
 void
 MaxwellBlochWaveEquation::Solve()
 {
+   this->buildEigenSolver();
+
+   eigs_.clear();
+
    if ( nev_ > 0 )
    {
       if ( fabs(beta_) > 0.0 )
       {
          lobpcg_->Solve();
+         if ( vecs_ != NULL )
+         {
+            for (int i=0; i<nev_; i++) { delete vecs_[i]; }
+            delete [] vecs_;
+         }
          vecs_ = lobpcg_->StealEigenvectors();
          cout << "lobpcg done" << endl;
       }
@@ -1785,7 +2676,11 @@ MaxwellBlochWaveEquation::Solve()
 void
 MaxwellBlochWaveEquation::GetEigenvalues(vector<double> & eigenvalues)
 {
-   if ( lobpcg_ )
+   if ( !eigs_.empty() )
+   {
+      eigenvalues = eigs_;
+   }
+   else if ( lobpcg_ )
    {
       Array<double> eigs;
       lobpcg_->GetEigenvalues(eigs);
@@ -1871,7 +2766,8 @@ MaxwellBlochWaveEquation::GetEigenvectorE(unsigned int i,
       }
    }
 
-   if ( lobpcg_ )
+   // Eigenpairs set by TwoGridCorrection have the layout of LOBPCG's
+   if ( !eigs_.empty() || lobpcg_ )
    {
       Er.SetData(&data[0]);
       Ei.SetData(&data[hcurl_loc_size_]);
@@ -1899,7 +2795,7 @@ MaxwellBlochWaveEquation::GetEigenvectorB(unsigned int i,
    vector<double> eigenvalues;
    this->GetEigenvalues(eigenvalues);
 
-   if ( lobpcg_ )
+   if ( !eigs_.empty() || lobpcg_ )
    {
       if ( vecs_ != NULL )
       {
@@ -1977,41 +2873,189 @@ MaxwellBlochWaveEquation::CopyEigenvector(unsigned int i,
    }
 }
 
-HypreParVector *
-MaxwellBlochWaveEquation::ReturnEigenvector(unsigned int i)
+bool
+MaxwellBlochWaveEquation::TwoGridCorrection(vector<double> & eigenvalues,
+                                            vector<HypreParVector*> & vecs)
 {
-   int locSize = 2*HCurlFESpace_->TrueVSize();
-   int glbSize = 0;
+   MFEM_VERIFY(fabs(beta_) > 0.0 && SubSpaceProj_ != NULL,
+               "TwoGridCorrection requires Setup and a nonzero phase shift");
 
-   HYPRE_Int * part = NULL;
+   int n = (int)vecs.size();
+   MFEM_VERIFY(n == nev_ && (int)eigenvalues.size() >= n,
+               "TwoGridCorrection: expected one eigenvalue per vector");
 
-   if (HYPRE_AssumedPartitionCheck())
+   // The shifted operator A + M is positive definite and its diagonal
+   // blocks, curl-curl plus mass, are the problem AMS is designed for.
+   // Both are kept for later calls until Setup rebuilds S1 or M1.
+   if ( S1M1_ == NULL )
    {
-      part = new HYPRE_Int[2];
+      S1M1_    = ParAdd(S1_, M1_);
+      S1M1Inv_ = new HypreAMS(*S1M1_, HCurlFESpace_);
+   }
 
-      MPI_Scan(&locSize, &part[1], 1, HYPRE_MPI_INT, MPI_SUM, comm_);
+   BlockOperator K(block_trueOffsets_);
+   K.SetDiagonalBlock(0, S1M1_);
+   K.SetDiagonalBlock(1, S1M1_);
+   K.SetBlock(0, 1, DKZ_,  beta_);
+   K.SetBlock(1, 0, DKZ_, -beta_);
+
+   BlockDiagonalPreconditioner P(block_trueOffsets_);
+   P.SetDiagonalBlock(0, S1M1Inv_);
+   P.SetDiagonalBlock(1, S1M1Inv_);
+
+   CGSolver pcg(comm_);
+   pcg.SetOperator(K);
+   pcg.SetPreconditioner(P);
+   pcg.SetRelTol(1e-6);
+   pcg.SetMaxIter(200);
+   pcg.SetPrintLevel(0);
+   pcg.iterative_mode = true;
+
+   int size = block_trueOffsets_[2];
+   Vector rhs(size), Ax(size), Mx(size);
+
+   // (A + M) w = (lambda + 1) M u reproduces u when it is an exact
+   // eigenvector so the correction only removes the interpolation error
+   vector<HypreParVector*> w(n);
+   for (int i=0; i<n; i++)
+   {
+      M_->Mult(*vecs[i], rhs);
+      rhs *= eigenvalues[i] + 1.0;
 
-      part[0] = part[1] - locSize;
+      w[i] = new HypreParVector(*vecs[i]);
+      *w[i] = *vecs[i];
+      pcg.Mult(rhs, *w[i]);
 
-      MPI_Allreduce(&locSize, &glbSize, 1, HYPRE_MPI_INT, MPI_SUM, comm_);
+      // Remove any gradient component introduced by the solve
+      SubSpaceProj_->Mult(*w[i], *vecs[i]);
+      *w[i] = *vecs[i];
    }
-   else
+
+   // Rayleigh-Ritz on the span of the corrected vectors
+   vector<double> loc(2*n*n, 0.0), glb(2*n*n);
+   for (int i=0; i<n; i++)
    {
-      int numProcs = HCurlFESpace_->GetNRanks();
-      part = new HYPRE_Int[numProcs+1];
+      A_->Mult(*w[i], Ax);
+      M_->Mult(*w[i], Mx);
+      for (int j=i; j<n; j++)
+      {
+         loc[i*n+j]     = Ax * (*w[j]);
+         loc[n*n+i*n+j] = Mx * (*w[j]);
+      }
+   }
+   MPI_Allreduce(&loc[0], &glb[0], 2*n*n, MPI_DOUBLE, MPI_SUM, comm_);
 
-      MPI_Allgather(&locSize, 1, MPI_INT,
-                    &part[1], 1, HYPRE_MPI_INT, comm_);
+   DenseMatrix Ar(n), Mr(n);
+   for (int i=0; i<n; i++)
+   {
+      for (int j=i; j<n; j++)
+      {
+         Ar(i,j) = Ar(j,i) = glb[i*n+j];
+         Mr(i,j) = Mr(j,i) = glb[n*n+i*n+j];
+      }
+   }
 
-      part[0] = 0;
-      for (int i=0; i<numProcs; i++)
+   vector<double> redEigs(n);
+   int INFO = -1;
+   {
+      int ITYPE = 1;
+      char JOBZ = 'V';
+      char UPLO = 'U';
+      int N = n;
+      int LDA = N;
+      int LDB = N;
+      double SWORK = 0.0;
+      int LWORK = -1;
+
+      dsygv_(&ITYPE, &JOBZ, &UPLO, &N, Ar.Data(), &LDA,
+             Mr.Data(), &LDB, &redEigs[0], &SWORK, &LWORK, &INFO);
+
+      LWORK = (int)SWORK;
+      if ( INFO == 0 && LWORK > 0 )
       {
-         part[i+1] += part[i];
+         double * WORK = new double[LWORK];
+         dsygv_(&ITYPE, &JOBZ, &UPLO, &N, Ar.Data(), &LDA,
+                Mr.Data(), &LDB, &redEigs[0], WORK, &LWORK, &INFO);
+         delete [] WORK;
+      }
+   }
+
+   bool accepted = false;
+   if ( INFO == 0 )
+   {
+      // The Ritz vectors are M-orthonormal combinations of the w's
+      for (int j=0; j<n; j++)
+      {
+         *vecs[j] = 0.0;
+         for (int i=0; i<n; i++)
+         {
+            vecs[j]->Add(Ar(i,j), *w[i]);
+         }
       }
 
-      glbSize = part[numProcs];
+      // Relative residuals of the Ritz pairs, a single linear solve can
+      // not repair a poor interpolant, e.g. near a band crossing
+      vector<double> locRes(2*n), glbRes(2*n);
+      for (int j=0; j<n; j++)
+      {
+         A_->Mult(*vecs[j], Ax);
+         M_->Mult(*vecs[j], Mx);
+         locRes[2*j]   = Mx * Mx;
+         Ax.Add(-redEigs[j], Mx);
+         locRes[2*j+1] = Ax * Ax;
+      }
+      MPI_Allreduce(&locRes[0], &glbRes[0], 2*n, MPI_DOUBLE, MPI_SUM, comm_);
+
+      double maxRes = 0.0;
+      for (int j=0; j<n; j++)
+      {
+         double den = fabs(redEigs[j]) * sqrt(glbRes[2*j]);
+         double res = sqrt(glbRes[2*j+1]);
+         maxRes = max(maxRes, (den > 0.0) ? res / den : res);
+      }
+      accepted = maxRes <= tgTol_;
+
+      if ( !accepted && myid_ == 0 )
+      {
+         cout << "Two-grid correction residual " << maxRes
+              << " exceeds " << tgTol_ << endl;
+      }
+   }
+   else if ( myid_ == 0 )
+   {
+      cout << "Two-grid correction failed, dsygv returns: " << INFO << endl;
+   }
+
+   if ( accepted )
+   {
+      for (int j=0; j<n; j++) { eigenvalues[j] = redEigs[j]; }
+
+      if ( vecs_ != NULL )
+      {
+         for (int i=0; i<nev_; i++) { delete vecs_[i]; }
+         delete [] vecs_;
+      }
+      vecs_ = new HypreParVector*[nev_];
+      for (int i=0; i<nev_; i++)
+      {
+         vecs_[i] = new HypreParVector(*vecs[i]);
+         *vecs_[i] = *vecs[i];
+      }
+      eigs_.assign(eigenvalues.begin(), eigenvalues.begin() + n);
    }
 
+   for (int i=0; i<n; i++) { delete w[i]; }
+
+   return accepted;
+}
+
+HypreParVector *
+MaxwellBlochWaveEquation::ReturnEigenvector(unsigned int i)
+{
+   // The partitioning is owned by the workspace and outlives the vector
+   HYPRE_Int   glbSize = hcurlWS_->GetGlobalSize(2);
+   HYPRE_Int * part    = hcurlWS_->GetPartitioning(2);
+
    HypreParVector * V = new HypreParVector(comm_, glbSize, part);
 
    this->CopyEigenvector(i, *V);
@@ -2595,12 +3639,12 @@ MaxwellBlochWaveSolver::MaxwellBlochWaveSolver(ParMesh & pmesh,
    : max_lvl_(max_ref)
    , nev_(nev)
    , tol_(tol)
+   , twoGrid_(true)
+   , warmStart_(false)
    , pmesh_(0)
    , mbwe_(0)
    , refineOp_(0)
    , initialVecs_(0)
-   , locSize_(0)
-   , part_(0)
    , epsCoef_(&epsCoef)
    , muInvCoef_(&muCoef)
 {
@@ -2611,56 +3655,14 @@ MaxwellBlochWaveSolver::MaxwellBlochWaveSolver(ParMesh & pmesh,
    mbwe_[0]->SetStiffnessCoef(muInvCoef_);
    mbwe_[0]->SetNumEigs(nev_);
 
-   ParFiniteElementSpace *  fespace = mbwe_[0]->GetHCurlFESpace();
-
-   HypreParVector * Er = new HypreParVector(fespace->GetComm(),
-                                            fespace->GlobalTrueVSize(),
-                                            NULL,
-                                            fespace->GetTrueDofOffsets());
-   HypreParVector * Ei = new HypreParVector(fespace->GetComm(),
-                                            fespace->GlobalTrueVSize(),
-                                            NULL,
-                                            fespace->GetTrueDofOffsets());
-
-   EField_.push_back(std::make_pair(Er, Ei));
-   /*
-   EField_.push_back(std::make_pair(HypreParVector(fespace->GetComm(),
-                                                   fespace->GlobalTrueVSize(),
-                                                   NULL,
-                                                   fespace->GetTrueDofOffsets()),
-                                    HypreParVector(fespace->GetComm(),
-                                                   fespace->GlobalTrueVSize(),
-                                                   NULL,
-                                                   fespace->GetTrueDofOffsets())
-                                   )
-                    );
-   */
-   /*
-   efield_.resize(1);
-   efield_[0].resize(nev_);
-   for (int i=0; i<nev_; i++)
-   {
-     efield_[0][i] = make_pair(ParGridFunction(fespace),
-             ParGridFunction(fespace));
-   }
-   */
-   efield_.push_back(make_pair(new ParGridFunction(fespace),
-                               new ParGridFunction(fespace)));
+   ParFESpaceWorkspace * ws = mbwe_[0]->GetHCurlWorkspace();
 
    initialVecs_.resize(1);
    initialVecs_[0].resize(nev_);
 
-   locSize_.push_back(fespace->TrueVSize());
-   int glbSize = 2 * fespace->GlobalTrueVSize();
-
-   part_.push_back(NULL);
-   this->createPartitioning(*fespace, part_[0]);
-
    for (int i=0; i<nev_; i++)
    {
-      initialVecs_[0][i] = new HypreParVector(fespace->GetComm(),
-                                              glbSize,
-                                              part_[0]);
+      initialVecs_[0][i] = &ws->GetTrueVector(i, 2);
    }
 }
 
@@ -2679,16 +3681,7 @@ MaxwellBlochWaveSolver::~MaxwellBlochWaveSolver()
    {
       delete refineOp_[i]; refineOp_[i] = NULL;
    }
-   for (unsigned int i=0; i<EField_.size(); i++)
-   {
-      delete EField_[i].first;  EField_[i].first = NULL;
-      delete EField_[i].second; EField_[i].second = NULL;
-   }
-   for (unsigned int i=0; i<efield_.size(); i++)
-   {
-      delete efield_[i].first;  efield_[i].first = NULL;
-      delete efield_[i].second; efield_[i].second = NULL;
-   }
+   // The initial vectors are owned by the workspaces of each level
 }
 
 void
@@ -2734,9 +3727,21 @@ MaxwellBlochWaveSolver::GetEigenfrequencies(std::vector<double> & omega)
    vector<double> coarse_eigs;
    vector<double> fine_eigs;
 
+   // Only the coarsest level uses an eigensolver.  Its eigenvectors for
+   // the previous kappa are usually good initial vectors for the next.
    mbwe_[0]->Setup();
+   if ( warmStart_ )
+   {
+      mbwe_[0]->SetInitialVectors(nev_, &initialVecs_[0][0]);
+   }
    mbwe_[0]->Solve();
    mbwe_[0]->GetEigenvalues(fine_eigs);
+
+   for (int i=0; i<nev_; i++)
+   {
+      mbwe_[0]->CopyEigenvector(i, *initialVecs_[0][i]);
+   }
+   warmStart_ = true;
    /*
    for (unsigned int i=0; i<fine_eigs.size(); i++)
    {
@@ -2770,53 +3775,16 @@ MaxwellBlochWaveSolver::GetEigenfrequencies(std::vector<double> & omega)
          refineOp_.push_back(fespace->GetUpdateOperator());
          fespace->SetUpdateOperatorOwner(false);
 
-         HypreParVector * Er = new HypreParVector(fespace->GetComm(),
-                                                  fespace->GlobalTrueVSize(),
-                                                  NULL,
-                                                  fespace->GetTrueDofOffsets());
-         HypreParVector * Ei = new HypreParVector(fespace->GetComm(),
-                                                  fespace->GlobalTrueVSize(),
-                                                  NULL,
-                                                  fespace->GetTrueDofOffsets());
-
-         EField_.push_back(std::make_pair(Er, Ei));
-         /*
-              EField_.push_back(
-                 std::make_pair(HypreParVector(fespace->GetComm(),
-                                               fespace->GlobalTrueVSize(),
-                                               NULL,
-                                               fespace->GetTrueDofOffsets()),
-                                HypreParVector(fespace->GetComm(),
-                                               fespace->GlobalTrueVSize(),
-                                               NULL,
-                                               fespace->GetTrueDofOffsets()))
-              );
-         */
-         /*
-         efield_[lvl].resize(nev_);
-         for (int i=0; i<nev_; i++)
-         {
-           efield_[lvl][i] = make_pair(ParGridFunction(fespace),
-                       ParGridFunction(fespace));
-         }
-              */
-         efield_.push_back(make_pair(new ParGridFunction(fespace),
-                                     new ParGridFunction(fespace)));
+         // Drop anything cached before the space was refined
+         ParFESpaceWorkspace * ws = mbwe_[lvl]->GetHCurlWorkspace();
+         ws->Update();
 
          initialVecs_.resize(lvl+1);
          initialVecs_[lvl].resize(nev_);
 
-         locSize_.push_back(fespace->TrueVSize());
-         int glbSize = 2 * fespace->GlobalTrueVSize();
-
-         part_.push_back(NULL);
-         this->createPartitioning(*fespace, part_[lvl]);
-
          for (int i=0; i<nev_; i++)
          {
-            initialVecs_[lvl][i] = new HypreParVector(fespace->GetComm(),
-                                                      glbSize,
-                                                      part_[lvl]);
+            initialVecs_[lvl][i] = &ws->GetTrueVector(i, 2);
          }
 
          mbwe_[lvl]->SetMassCoef(*epsCoef_);
@@ -2826,32 +3794,55 @@ MaxwellBlochWaveSolver::GetEigenfrequencies(std::vector<double> & omega)
       }
 
 
+      ParFESpaceWorkspace * cws = mbwe_[lvl-1]->GetHCurlWorkspace();
+      ParFESpaceWorkspace * fws = mbwe_[lvl]->GetHCurlWorkspace();
+
+      HypreParVector & cEr = cws->GetTrueVectorView(0);
+      HypreParVector & cEi = cws->GetTrueVectorView(1);
+      HypreParVector & fEr = fws->GetTrueVectorView(0);
+      HypreParVector & fEi = fws->GetTrueVectorView(1);
+
+      ParGridFunction & cer = cws->GetGridFunction(0);
+      ParGridFunction & cei = cws->GetGridFunction(1);
+      ParGridFunction & fer = fws->GetGridFunction(0);
+      ParGridFunction & fei = fws->GetGridFunction(1);
+
+      int locSize = fws->GetFESpace()->TrueVSize();
+
       for (int i=0; i<nev_; i++)
       {
-         mbwe_[lvl-1]->GetEigenvectorE(i,
-                                       *EField_[lvl-1].first,
-                                       *EField_[lvl-1].second);
-         *efield_[lvl-1].first  = *EField_[lvl-1].first;
-         *efield_[lvl-1].second = *EField_[lvl-1].second;
+         mbwe_[lvl-1]->GetEigenvectorE(i, cEr, cEi);
+         cer = cEr;
+         cei = cEi;
 
-         refineOp_[lvl-1]->Mult(*efield_[lvl-1].first,
-                                *efield_[lvl].first);
-         refineOp_[lvl-1]->Mult(*efield_[lvl-1].second,
-                                *efield_[lvl].second);
+         refineOp_[lvl-1]->Mult(cer, fer);
+         refineOp_[lvl-1]->Mult(cei, fei);
 
-         EField_[lvl].first->SetData(
-            initialVecs_[lvl][i]->GetData());
-         EField_[lvl].second->SetData(
-            &initialVecs_[lvl][i]->GetData()[locSize_[lvl]]);
+         fEr.SetData(initialVecs_[lvl][i]->GetData());
+         fEi.SetData(&initialVecs_[lvl][i]->GetData()[locSize]);
 
-         efield_[lvl].first->ParallelProject(*EField_[lvl].first);
-         efield_[lvl].second->ParallelProject(*EField_[lvl].second);
+         fer.ParallelProject(fEr);
+         fei.ParallelProject(fEi);
       }
 
       mbwe_[lvl]->Setup();
-      mbwe_[lvl]->SetInitialVectors(nev_, &initialVecs_[lvl][0]);
-      mbwe_[lvl]->Solve();
-      mbwe_[lvl]->GetEigenvalues(fine_eigs);
+
+      // The finer levels correct the interpolated eigenpairs with one
+      // linear solve each rather than iterating to convergence
+      bool corrected = false;
+      if ( twoGrid_ && kappa_.Norml2() > 0.0 &&
+           (int)coarse_eigs.size() >= nev_ )
+      {
+         fine_eigs.assign(coarse_eigs.begin(), coarse_eigs.begin() + nev_);
+         corrected = mbwe_[lvl]->TwoGridCorrection(fine_eigs,
+                                                   initialVecs_[lvl]);
+      }
+      if ( !corrected )
+      {
+         mbwe_[lvl]->SetInitialVectors(nev_, &initialVecs_[lvl][0]);
+         mbwe_[lvl]->Solve();
+         mbwe_[lvl]->GetEigenvalues(fine_eigs);
+      }
       /*
       for (unsigned int i=0; i<fine_eigs.size(); i++)
       {
@@ -2887,38 +3878,27 @@ MaxwellBlochWaveSolver::ReturnFineEigenvector(int i)
 }
 
 void
-MaxwellBlochWaveSolver::createPartitioning(ParFiniteElementSpace & pfes,
-                                           HYPRE_Int *& part)
+MaxwellBlochWaveSolver::GetCoarseElementMap(Array<int> & parent)
 {
-   MPI_Comm comm = pfes.GetComm();
-   int locSize = 2 * pfes.TrueVSize();
-   int glbSize = 0;
+   int nlvl = pmesh_.size();
 
-   if (HYPRE_AssumedPartitionCheck())
+   parent.SetSize(pmesh_[nlvl-1]->GetNE());
+   for (int i=0; i<parent.Size(); i++)
    {
-      part = new HYPRE_Int[2];
-
-      MPI_Scan(&locSize, &part[1], 1, HYPRE_MPI_INT, MPI_SUM, comm);
-
-      part[0] = part[1] - locSize;
-
-      MPI_Allreduce(&locSize, &glbSize, 1, HYPRE_MPI_INT, MPI_SUM, comm);
+      parent[i] = i;
    }
-   else
-   {
-      int numProcs  = pfes.GetNRanks();
-      part = new HYPRE_Int[numProcs+1];
 
-      MPI_Allgather(&locSize, 1, MPI_INT,
-                    &part[1], 1, HYPRE_MPI_INT, comm);
+   // Each level was produced by a single uniform refinement of the
+   // previous one so its embeddings point into the previous level
+   for (int l=nlvl-1; l>0; l--)
+   {
+      const CoarseFineTransformations & cf =
+         pmesh_[l]->GetRefinementTransforms();
 
-      part[0] = 0;
-      for (int i=0; i<numProcs; i++)
+      for (int i=0; i<parent.Size(); i++)
       {
-         part[i+1] += part[i];
+         parent[i] = cf.embeddings[parent[i]].parent;
       }
-
-      glbSize = part[numProcs];
    }
 }
 
@@ -3115,6 +4095,162 @@ MaxwellDispersion::findAndReplace(const string & f,
 }
 
 
+void
+MaxwellDispersion::GetFrequencySensitivity(int p, int s, int ind, int n,
+                                           Vector & dOmega)
+{
+   MaxwellBlochWaveEquation * mbwe = mbws_->GetFineSolver();
+   ParFiniteElementSpace * HCurlFESpace = mbwe->GetHCurlFESpace();
+   ParMesh * pmesh = HCurlFESpace->GetParMesh();
+
+   Array<int> parent;
+   mbws_->GetCoarseElementMap(parent);
+
+   dOmega.SetSize(parent.Max() + 1);
+   dOmega = 0.0;
+
+   const vector<double> & omega = seg_eigs_[p][s][ind];
+   double omega_n = omega[n];
+
+   // The static modes at Gamma do not respond to the permittivity
+   if ( omega_n < 1.0e-6 ) { return; }
+
+   // The frequency is not differentiable within a degenerate subspace so
+   // we use the average of the derivatives of its members
+   vector<int> degen;
+   for (unsigned int i=0; i<omega.size(); i++)
+   {
+      if ( fabs(omega[i] - omega_n) <= 1.0e-4 * omega_n )
+      {
+         degen.push_back(i);
+      }
+   }
+   int nd = degen.size();
+
+   int e0 = -1, e1 = -1;
+   bravais_->GetPathSegmentEndPointIndices(p, s, e0, e1);
+
+   string label = "";
+   if ( ind == 0 )
+   {
+      label = bravais_->GetSymmetryPointLabel(e0);
+   }
+   else if ( ind == n_div_ )
+   {
+      label = bravais_->GetSymmetryPointLabel(e1);
+   }
+   else if ( midPts_ && ind == n_div_ / 2 )
+   {
+      label = bravais_->GetIntermediatePointLabel(p, s);
+   }
+
+   vector<HypreParVector*> vecs(nd);
+   if ( label != "" )
+   {
+      // The exact eigenvectors are already part of the raw basis
+      int off = sp_offset_[label];
+      for (int i=0; i<nd; i++)
+      {
+         vecs[i] = rawBasis_[off + degen[i]];
+      }
+   }
+   else
+   {
+      // Recover the reduced basis eigenvectors at this sample point
+      Vector kappa0(3), kappa1(3), kappa(3);
+      bravais_->GetSymmetryPoint(e0, kappa0);
+      bravais_->GetSymmetryPoint(e1, kappa1);
+      add(double(n_div_ - ind) / n_div_, kappa0,
+          double(ind) / n_div_, kappa1, kappa);
+      mbws_->SetKappa(kappa);
+
+      vector<double> omega_red;
+      this->approxEigenfrequencies(omega_red);
+
+      for (int i=0; i<nd; i++)
+      {
+         vecs[i] = new HypreParVector(*rawBasis_[0]);
+         *vecs[i] = 0.0;
+         for (unsigned int j=0; j<projBasis_.size(); j++)
+         {
+            vecs[i]->Add(A_(j, degen[i]), *projBasis_[j]);
+         }
+      }
+   }
+
+   if ( Mx_ == NULL )
+   {
+      Mx_ = new HypreParVector(*rawBasis_[0]);
+   }
+
+   HypreParVector xr(HCurlFESpace->GetComm(),
+                     HCurlFESpace->GlobalTrueVSize(),
+                     NULL,
+                     HCurlFESpace->GetTrueDofOffsets());
+   HypreParVector xi(HCurlFESpace->GetComm(),
+                     HCurlFESpace->GlobalTrueVSize(),
+                     NULL,
+                     HCurlFESpace->GetTrueDofOffsets());
+
+   // With lambda = omega^2 and M(eps) the only eps dependent operator
+   // d omega / d eps_e = -omega (E, M_e E) / (2 (E, M E))
+   vector<ParGridFunction*> er(nd);
+   vector<ParGridFunction*> ei(nd);
+   vector<double> scale(nd);
+   for (int i=0; i<nd; i++)
+   {
+      mbwe->GetMOperator()->Mult(*vecs[i], *Mx_);
+      double nrm = InnerProduct(*vecs[i], *Mx_);
+
+      scale[i] = -0.5 * omega_n / (nrm * nd);
+
+      er[i] = new ParGridFunction(HCurlFESpace);
+      ei[i] = new ParGridFunction(HCurlFESpace);
+
+      xr.SetData(&vecs[i]->GetData()[0]);
+      xi.SetData(&vecs[i]->GetData()[HCurlFESpace->TrueVSize()]);
+
+      HCurlFESpace->Dof_TrueDof_Matrix()->Mult(xr, *er[i]);
+      HCurlFESpace->Dof_TrueDof_Matrix()->Mult(xi, *ei[i]);
+   }
+
+   // Each element mass matrix is formed once and applied to every
+   // member of the degenerate subspace
+   VectorFEMassIntegrator massInteg;
+   DenseMatrix elmat;
+   Array<int> vdofs;
+   Vector er_loc, ei_loc, tmp;
+
+   for (int e=0; e<pmesh->GetNE(); e++)
+   {
+      HCurlFESpace->GetElementVDofs(e, vdofs);
+      massInteg.AssembleElementMatrix(*HCurlFESpace->GetFE(e),
+                                      *pmesh->GetElementTransformation(e),
+                                      elmat);
+      tmp.SetSize(vdofs.Size());
+
+      for (int i=0; i<nd; i++)
+      {
+         er[i]->GetSubVector(vdofs, er_loc);
+         ei[i]->GetSubVector(vdofs, ei_loc);
+
+         elmat.Mult(er_loc, tmp);
+         double q = er_loc * tmp;
+         elmat.Mult(ei_loc, tmp);
+         q += ei_loc * tmp;
+
+         dOmega[parent[e]] += scale[i] * q;
+      }
+   }
+
+   for (int i=0; i<nd; i++)
+   {
+      delete er[i];
+      delete ei[i];
+      if ( label == "" ) { delete vecs[i]; }
+   }
+}
+
 void
 MaxwellDispersion::InitializeGLVis(VisData & vd)
 {}
@@ -3156,6 +4292,7 @@ MaxwellDispersion::buildRawBasis()
             bravais_->GetSymmetryPoint(e0, kappa);
             mbws_->SetKappa(kappa);
             mbws_->GetEigenfrequencies(sp_eigs_[label0]);
+            sp_offset_[label0] = rawBasis_.size();
             for (unsigned int i=0; i<sp_eigs_[label0].size(); i++)
             {
                rawBasis_.push_back(mbws_->ReturnFineEigenvector(i));
@@ -3166,6 +4303,7 @@ MaxwellDispersion::buildRawBasis()
             bravais_->GetIntermediatePoint(p, s, kappa);
             mbws_->SetKappa(kappa);
             mbws_->GetEigenfrequencies(sp_eigs_[labelI]);
+            sp_offset_[labelI] = rawBasis_.size();
             for (unsigned int i=0; i<sp_eigs_[labelI].size(); i++)
             {
                rawBasis_.push_back(mbws_->ReturnFineEigenvector(i));
@@ -3176,6 +4314,7 @@ MaxwellDispersion::buildRawBasis()
             bravais_->GetSymmetryPoint(e1, kappa);
             mbws_->SetKappa(kappa);
             mbws_->GetEigenfrequencies(sp_eigs_[label1]);
+            sp_offset_[label1] = rawBasis_.size();
             for (unsigned int i=0; i<sp_eigs_[label1].size(); i++)
             {
                rawBasis_.push_back(mbws_->ReturnFineEigenvector(i));
@@ -3328,6 +4467,8 @@ MaxwellDispersion::traverseBrillouinZone()
 
    int ni = (int)pow(2, samp_pow_); // should be a power of 2
 
+   // Discard the frequencies from any previous traversal
+   seg_eigs_.clear();
    seg_eigs_.resize(bravais_->GetNumberPaths());
 
    for (unsigned int p=0; p<bravais_->GetNumberPaths(); p++)
@@ -3418,27 +4559,153 @@ MaxwellBandGap::MaxwellBandGap(ParMesh & pmesh,
                                int max_ref,
                                double tol)
    : Homogenization(pmesh.GetComm())
-     //, pmesh_(&pmesh)
+   , pmesh_(&pmesh)
+   , L2FESpace_(NULL)
+   , band_(-1)
      //, bravais_(&bravais)
      //, epsCoef_(&epsCoef)
      //, muCoef_(&muCoef)
 {
+   L2FESpace_ = new L2_ParFESpace(pmesh_, 0, pmesh_->Dimension());
+
    disp_ = new MaxwellDispersion(pmesh, bravais, samp_pow, epsCoef, muCoef,
                                  midPts, max_ref, 24, tol);
+
+   for (int i=0; i<3; i++)
+   {
+      loLoc_[i] = -1;
+      hiLoc_[i] = -1;
+   }
 }
 
 MaxwellBandGap::~MaxwellBandGap()
 {
    delete disp_;
+   delete L2FESpace_;
 }
 
 void
 MaxwellBandGap::GetHomogenizedProperties(std::vector<double> & p)
 {
-   p.resize(0);
+   p.resize(2);
+   p[0] = 0.0;
+   p[1] = 0.0;
 
-   const vector<vector<map<int,vector<double> > > > seg_eigs =
+   const vector<vector<map<int,vector<double> > > > & seg_eigs =
       disp_->GetDispersionData();
+
+   // Number of bands available at every sample point
+   unsigned int nb = 0;
+   bool first = true;
+   for (unsigned int i=0; i<seg_eigs.size(); i++)
+   {
+      for (unsigned int j=0; j<seg_eigs[i].size(); j++)
+      {
+         map<int,vector<double> >::const_iterator mit;
+         for (mit=seg_eigs[i][j].begin(); mit!=seg_eigs[i][j].end(); mit++)
+         {
+            if ( first || mit->second.size() < nb )
+            {
+               nb = mit->second.size();
+               first = false;
+            }
+         }
+      }
+   }
+
+   // Search for the widest gap relative to its mid-gap frequency
+   band_ = -1;
+   double best = 0.0;
+   for (int n=0; n+1<(int)nb; n++)
+   {
+      double lo = -1.0;
+      double hi = -1.0;
+      int lo_loc[3] = {-1, -1, -1};
+      int hi_loc[3] = {-1, -1, -1};
+
+      for (unsigned int i=0; i<seg_eigs.size(); i++)
+      {
+         for (unsigned int j=0; j<seg_eigs[i].size(); j++)
+         {
+            map<int,vector<double> >::const_iterator mit;
+            for (mit=seg_eigs[i][j].begin(); mit!=seg_eigs[i][j].end(); mit++)
+            {
+               if ( mit->second[n] > lo )
+               {
+                  lo = mit->second[n];
+                  lo_loc[0] = i; lo_loc[1] = j; lo_loc[2] = mit->first;
+               }
+               if ( hi < 0.0 || mit->second[n+1] < hi )
+               {
+                  hi = mit->second[n+1];
+                  hi_loc[0] = i; hi_loc[1] = j; hi_loc[2] = mit->first;
+               }
+            }
+         }
+      }
+
+      if ( hi <= lo ) { continue; }
+
+      double ratio = 2.0 * (hi - lo) / (hi + lo);
+      if ( ratio > best )
+      {
+         best   = ratio;
+         band_  = n;
+         p[0]   = lo;
+         p[1]   = hi;
+         for (int k=0; k<3; k++)
+         {
+            loLoc_[k] = lo_loc[k];
+            hiLoc_[k] = hi_loc[k];
+         }
+      }
+   }
+
+   if ( myid_ == 0 )
+   {
+      if ( band_ >= 0 )
+      {
+         cout << "Band gap between bands " << band_ << " and " << band_ + 1
+              << ": " << p[0] << " to " << p[1]
+              << " (gap/mid-gap " << best << ")" << endl;
+      }
+      else
+      {
+         cout << "No band gap found" << endl;
+      }
+   }
+}
+
+void
+MaxwellBandGap::GetPropertySensitivities(std::vector<ParGridFunction> & dp)
+{
+   dp.resize(2);
+   for (int k=0; k<2; k++)
+   {
+      dp[k].SetSpace(L2FESpace_);
+      dp[k] = 0.0;
+   }
+
+   if ( band_ < 0 ) { return; }
+
+   Vector dOmega;
+   Array<int> vdofs;
+
+   disp_->GetFrequencySensitivity(loLoc_[0], loLoc_[1], loLoc_[2], band_,
+                                  dOmega);
+   for (int i=0; i<L2FESpace_->GetNE(); i++)
+   {
+      L2FESpace_->GetElementVDofs(i, vdofs);
+      dp[0][vdofs[0]] = dOmega[i];
+   }
+
+   disp_->GetFrequencySensitivity(hiLoc_[0], hiLoc_[1], hiLoc_[2], band_ + 1,
+                                  dOmega);
+   for (int i=0; i<L2FESpace_->GetNE(); i++)
+   {
+      L2FESpace_->GetElementVDofs(i, vdofs);
+      dp[1][vdofs[0]] = dOmega[i];
+   }
 }
 
 void
@@ -18,6 +18,9 @@
 
 #include "../common/pfem_extras.hpp"
 #include "../common/bravais.hpp"
+#include "../common/solver_extras.hpp"
+#include <map>
+#include <vector>
 
 extern "C"
 {
@@ -38,6 +41,7 @@ using miniapps::ParDiscreteCurlOperator;
 using miniapps::ParDiscreteInterpolationOperator;
 using miniapps::VisData;
 using  bravais::BravaisLattice;
+using  bravais::ParFESpaceWorkspace;
 
 namespace meta_material
 {
@@ -50,16 +54,18 @@ public:
    virtual double Eval(ElementTransformation &T,
                        const IntegrationPoint &ip);
 
-   double GetSensitivity(ElementTransformation &T,
-                         const IntegrationPoint &ip)
+   // Derivative with respect to the volume fraction
+   virtual double GetSensitivity(ElementTransformation &T,
+                                 const IntegrationPoint &ip)
    { return (c1_ - c0_); }
 
-private:
+protected:
    double c0_;
    double c1_;
 };
-/*
-class PenaltyCoefficient : public GridFunctionCoefficient
+
+// Penalized (SIMP) interpolation c0 + (c1 - c0) * vf^penalty
+class PenaltyCoefficient : public LinearCoefficient
 {
 public:
    PenaltyCoefficient(GridFunction * gf, int penalty, double a0, double a1);
@@ -67,15 +73,13 @@ public:
    virtual double Eval(ElementTransformation &T,
                        const IntegrationPoint &ip);
 
-   double GetSensitivity(ElementTransformation &T,
-                         const IntegrationPoint &ip);
+   virtual double GetSensitivity(ElementTransformation &T,
+                                 const IntegrationPoint &ip);
 
 private:
    int penalty_;
-   double c0_;
-   double c1_;
 };
-*/
+
 class Homogenization
 {
 public:
@@ -116,7 +120,10 @@ public:
    // void SetVolumeFraction(ParGridFunction & vf);
 
    void GetHomogenizedProperties(std::vector<double> & p);
-   void GetPropertySensitivities(std::vector<ParGridFunction> & dp) {}
+
+   // Requires rhoCoef to be a LinearCoefficient of a piecewise constant
+   // volume fraction
+   void GetPropertySensitivities(std::vector<ParGridFunction> & dp);
 
    void InitializeGLVis(VisData & vd);
 
@@ -147,6 +154,79 @@ private:
    socketstream * sock2_;
 };
 
+/** Preconditioned conjugate gradient for several right hand sides which
+    share one operator and one preconditioner.
+
+    The systems are advanced in lockstep so that the inner products needed
+    by all of them are combined into a single MPI_Allreduce per reduction
+    step.  Each system is dropped from the iteration once it has converged.
+    The right hand sides and solutions are stored as nvec consecutive
+    blocks of the local operator size.  As with HyprePCG the stopping
+    criterion is (r, M r) <= tol^2 (b, M b) and X is used as the initial
+    guess.
+*/
+class MultiVectorPCG
+{
+public:
+   MultiVectorPCG(MPI_Comm comm);
+
+   void SetOperator(const Operator & A) { A_ = &A; }
+   void SetPreconditioner(Solver & M) { M_ = &M; }
+
+   void SetTol(double tol) { tol_ = tol; }
+   void SetMaxIter(int max_iter) { max_iter_ = max_iter; }
+   void SetPrintLevel(int print_level) { print_level_ = print_level; }
+
+   void Mult(const Vector & B, Vector & X, int nvec) const;
+
+   int GetNumIterations() const { return num_its_; }
+
+private:
+   MPI_Comm comm_;
+   int myid_;
+
+   const Operator * A_;
+   Solver * M_;
+
+   double tol_;
+   int max_iter_;
+   int print_level_;
+
+   mutable int num_its_;
+};
+
+/** A 3x3 block operator stored as a single CSR matrix whose entries are
+    dense 3x3 blocks.
+
+    The operator is assembled from six sparse matrices with a common
+    sparsity pattern, given in the order xx, yy, zz, yz, xz, xy:
+       / m0  m5  m4 \
+       | m5T m1  m3 |
+       \ m4T m3T m2 /
+    Vectors use the same layout as the sparse blocks, i.e. three
+    consecutive component vectors of the sparse matrix size.  The transposed
+    blocks are gathered once during assembly so that Mult makes a single
+    pass over the matrix, x, and y.
+*/
+class Block3x3CSRMatrix : public Operator
+{
+public:
+   Block3x3CSRMatrix() : Operator(0), n_(0) {}
+
+   void Assemble(SparseMatrix * m[6]);
+
+   virtual void Mult(const Vector & x, Vector & y) const;
+
+   // Multiply by block column r only, x has the size of one component
+   void RestrictedMult(int r, const Vector & x, Vector & y) const;
+
+private:
+   int n_;
+   Array<int> I_;
+   Array<int> J_;
+   Vector     A_;
+};
+
 class StiffnessTensor : public Homogenization
 {
 public:
@@ -162,8 +242,15 @@ public:
 
    // void SetVolumeFraction(ParGridFunction & vf);
 
+   // Limit the number of adaptive refinement passes, 1 keeps the mesh fixed
+   void SetMaxAMRIterations(int max_its) { maxRefIts_ = max_its; }
+
    void GetHomogenizedProperties(std::vector<double> & p);
-   void GetPropertySensitivities(std::vector<ParGridFunction> & dp) {}
+
+   // Derivatives of the 21 tensor entries with respect to a piecewise
+   // constant volume fraction.  Requires the Lame coefficients to be
+   // LinearCoefficients (or PenaltyCoefficients) of that volume fraction.
+   void GetPropertySensitivities(std::vector<ParGridFunction> & dp);
 
    void InitializeGLVis(VisData & vd);
 
@@ -225,6 +312,8 @@ private:
 
    void solve(const Vector & E, Vector & Chi);
 
+   void resetAMG();
+
    int dim_;
    int irOrder_;
    int geom_;
@@ -257,6 +346,7 @@ private:
 
    ParBilinearForm * a_;
    ParBilinearForm * m_[6];
+   Block3x3CSRMatrix tensorMass_;
    ParGridFunction * Chi_[6];
    ParGridFunction * E_[3];
    ParGridFunction * F_[6];
@@ -272,6 +362,17 @@ private:
    ParGridFunction * b_;
    // HypreParVector  * tmp1_;
 
+   // Mesh sequence for which grad_ and E_ are current
+   long meshSeq_;
+   int  maxRefIts_;
+
+   // The AMG hierarchy is kept across calls on the same mesh and is
+   // rebuilt when it becomes stale, see miniapps::PreconditionerIsStale
+   HypreParMatrix * amgA_;
+   HypreBoomerAMG * amg_;
+   int              amgIts_;
+   long             amgSeq_;
+
    double vol_;
    double tol_;
 
@@ -282,6 +383,160 @@ private:
    int seqVF_;
 };
 
+/** Effective permittivity and permeability in the long wavelength limit.
+
+    For each axis j the periodic cell problem
+       Div(eps (Grad chi_j + e_j)) = 0
+    is solved for the corrector chi_j and the effective permittivity is
+    computed as
+       eps_ij = (e_i + Grad chi_i, eps (e_j + Grad chi_j)) / vol
+    The effective permeability follows from the same cell problems with mu
+    in place of eps.  The three solves for each material share a single AMG
+    hierarchy.
+
+    GetHomogenizedProperties returns the 6 unique entries of the effective
+    permittivity followed by the 6 unique entries of the effective
+    permeability, each in the order xx, yy, zz, yz, xz, xy.
+*/
+class ElectromagneticTensors : public Homogenization
+{
+public:
+   ElectromagneticTensors(ParMesh & pmesh, double vol,
+                          Coefficient & epsCoef, Coefficient & muCoef,
+                          double tol = 0.05);
+   ~ElectromagneticTensors();
+
+   void GetHomogenizedProperties(std::vector<double> & p);
+   void GetPropertySensitivities(std::vector<ParGridFunction> & dp) {}
+
+   // The tensors computed by the last call to GetHomogenizedProperties
+   void GetPermittivityTensor(DenseMatrix & eps) const
+   { this->getTensor(0, eps); }
+   void GetPermeabilityTensor(DenseMatrix & mu) const
+   { this->getTensor(1, mu); }
+
+   void InitializeGLVis(VisData & vd);
+
+   void DisplayToGLVis();
+
+   void WriteVisItFields(const std::string & prefix,
+                         const std::string & label);
+
+private:
+
+   // Solve the three cell problems for material m (0 = eps, 1 = mu) and
+   // fill in p[6*m] through p[6*m+5]
+   void solve(int m, std::vector<double> & p);
+
+   void getTensor(int m, DenseMatrix & T) const;
+
+   int irOrder_;
+   int geom_;
+
+   ParMesh * pmesh_;
+
+   L2_ParFESpace * L2FESpace_;
+   L2_ParFESpace * L2VFESpace_;
+   H1_ParFESpace * H1FESpace_;
+   ND_ParFESpace * HCurlFESpace_;
+   RT_ParFESpace * HDivFESpace_;
+
+   Coefficient * coefs_[2];
+
+   ParDiscreteGradOperator * grad_;
+
+   ParBilinearForm * a_[2];
+   ParBilinearForm * m_[2];
+   ParGridFunction * E_[3];
+   ParGridFunction * Chi_[6];
+   ParGridFunction * F_[6];
+   ParLinearForm   * MF_[6];
+
+   BilinearFormIntegrator * diffInteg_[2];
+   ParGridFunction * errSol_;
+   ErrorEstimator  * errEst_[6];
+   ParGridFunction * errors_;
+
+   ParGridFunction * b_;
+
+   ParGridFunction * eps_;
+   ParGridFunction * mu_;
+
+   std::vector<double> p_;
+
+   double vol_;
+   double tol_;
+
+   VisData      * vd_;
+   socketstream   socks_[9];
+};
+
+/** Optimality criteria (OC) design of a piecewise constant volume fraction.
+
+    The objective w^T p, where p are the properties computed by a
+    Homogenization object, is maximized subject to a bound on the average
+    volume fraction.  The Homogenization must evaluate its material
+    coefficients from the volume fraction grid function passed to the
+    constructor and must provide sensitivities with respect to it.
+
+    The design variables are smoothed by the Helmholtz filter
+       -r^2 Div Grad vf + vf = x
+    to suppress checkerboard patterns.  On a periodic cell this filter
+    conserves the total volume so the volume constraint is applied to the
+    unfiltered design.  The mesh, the FE spaces, the filter solver, and the
+    Homogenization object with its solvers and previous solutions are all
+    reused from one design iteration to the next.
+*/
+class TopologyOptimizer
+{
+public:
+   TopologyOptimizer(ParGridFunction & vf, Homogenization & hom,
+                     const std::vector<double> & weights,
+                     double volFrac, double r);
+   ~TopologyOptimizer();
+
+   void SetMoveLimit(double move) { move_ = move; }
+   void SetMinVolumeFraction(double vf_min) { vfMin_ = vf_min; }
+
+   // Evaluate the current design, perform one OC update, and return the
+   // largest change in the design variables
+   double Step(double & obj);
+
+   // Iterate until the design change falls below tol, returns the number
+   // of iterations performed
+   int Optimize(int max_its, double tol);
+
+private:
+   void filter(const Vector & x, Vector & y);
+   void filterTranspose(const Vector & x, Vector & y);
+
+   MPI_Comm comm_;
+   int      myid_;
+
+   ParGridFunction * vf_;
+   Homogenization  * hom_;
+
+   std::vector<double> w_;
+
+   double volFrac_;
+   double move_;
+   double vfMin_;
+
+   ParMesh       * pmesh_;
+   H1_ParFESpace * H1FESpace_;
+
+   HypreParMatrix * Af_;
+   HypreParMatrix * Bf_;
+   HypreBoomerAMG * amg_;
+   CGSolver       * cg_;
+
+   Vector x_;
+   Vector cellVol_;
+   double totVol_;
+
+   std::vector<ParGridFunction> dp_;
+};
+
 class ParDiscreteVectorProductOperator
    : public ParDiscreteInterpolationOperator
 {
@@ -327,6 +582,7 @@ public:
 
    // void SetOmega(double omega);
    void SetAbsoluteTolerance(double atol);
+   void SetTwoGridTolerance(double tol) { tgTol_ = tol; }
    void SetNumEigs(int nev);
    void SetMassCoef(Coefficient & m);
    void SetStiffnessCoef(Coefficient & k);
@@ -350,6 +606,18 @@ public:
                        std::vector<HypreParVector*> & init_vecs,
                        std::vector<double> & eigenvalues);
 
+   /** Improve approximate eigenpairs, e.g. interpolated from a coarser
+       mesh, with one shifted linear solve per vector followed by a
+       Rayleigh-Ritz projection onto the corrected vectors.  The eigenpairs
+       are updated in place and are also returned by subsequent calls to
+       GetEigenvalues and GetEigenvector.  Requires Setup and a nonzero
+       phase shift.  Returns false if the corrected vectors are numerically
+       dependent or if a relative residual ||A u - lambda M u|| /
+       (lambda ||M u||) exceeds the two-grid tolerance.  vecs then hold the
+       corrected vectors which may still seed a full eigensolve. */
+   bool TwoGridCorrection(std::vector<double> & eigenvalues,
+                          std::vector<HypreParVector*> & vecs);
+
    /// Extract a single eigenvector
    HypreParVector * ReturnEigenvector(unsigned int i);
 
@@ -378,6 +646,8 @@ public:
    ParFiniteElementSpace * GetHCurlFESpace() { return HCurlFESpace_; }
    ParFiniteElementSpace * GetHDivFESpace()  { return HDivFESpace_; }
 
+   ParFESpaceWorkspace * GetHCurlWorkspace() { return hcurlWS_; }
+
    // void TestVector(const HypreParVector & v);
 
    ParGridFunction * GetEigenvectorEnergy(unsigned int i) { return energy_[i]; }
@@ -410,6 +680,11 @@ public:
 
 private:
 
+   // Builds the AMS, preconditioner and eigensolver flagged by Setup.
+   // Called by SetInitialVectors and Solve so that levels which are
+   // corrected by TwoGridCorrection never build them.
+   void buildEigenSolver();
+
    MPI_Comm comm_;
    int myid_;
    int hcurl_loc_size_;
@@ -421,6 +696,8 @@ private:
    bool newOmega_;
    bool newMCoef_;
    bool newKCoef_;
+   bool newT1Inv_;
+   bool newSolver_;
 
    ParMesh        * pmesh_;
    H1_ParFESpace  * H1FESpace_;
@@ -428,10 +705,13 @@ private:
    RT_ParFESpace  * HDivFESpace_;
    // L2_ParFESpace  * L2FESpace_;
 
+   ParFESpaceWorkspace * hcurlWS_;
+
    // BravaisLattice     * bravais_;
    // HCurlFourierSeries * fourierHCurl_;
 
    double           atol_;
+   double           tgTol_;
    double           beta_;
 
    Vector           zeta_;
@@ -464,6 +744,11 @@ private:
 
    HypreAMS       * T1Inv_;
 
+   // S1 + M1 and its AMS solver, formed by TwoGridCorrection and kept
+   // until Setup rebuilds S1 or M1
+   HypreParMatrix * S1M1_;
+   HypreAMS       * S1M1Inv_;
+
    ParDiscreteCurlOperator * Curl_;
    ParDiscreteVectorCrossProductOperator * Zeta_;
 
@@ -476,6 +761,9 @@ private:
    HypreParVector ** vecs_;
    HypreParVector * vec0_;
 
+   // Eigenvalues set by TwoGridCorrection rather than an eigensolver
+   std::vector<double> eigs_;
+
    HypreLOBPCG * lobpcg_;
    HypreAME    * ame_;
 
@@ -599,13 +887,26 @@ public:
    void SetBeta(double beta);
    void SetZeta(const Vector & zeta);
 
+   /** Solve the eigenproblem on the original mesh and, while the
+       eigenvalues have not settled, on successively refined meshes.  By
+       default only the original mesh uses an eigensolver, warm started
+       from the previous kappa, and each refinement applies a two-grid
+       correction to the interpolated eigenpairs.  The refined meshes and
+       their operators persist across calls. */
    void GetEigenfrequencies(std::vector<double> & omega);
 
+   /// When disabled each refined mesh uses a full eigensolve
+   void SetTwoGridCorrection(bool tg) { twoGrid_ = tg; }
+
    MaxwellBlochWaveEquation * GetFineSolver()
    { return mbwe_[mbwe_.size()-1]; }
 
    HypreParVector * ReturnFineEigenvector(int i);
 
+   // Index of the element of the original mesh containing each element
+   // of the finest mesh
+   void GetCoarseElementMap(Array<int> & parent);
+
    void InitializeGLVis(VisData & vd);
 
    void DisplayToGLVis();
@@ -615,22 +916,17 @@ public:
 
 private:
 
-   void createPartitioning(ParFiniteElementSpace & pfes, HYPRE_Int *& part);
-
    int max_lvl_;
    int nev_;
    double tol_;
 
+   bool twoGrid_;
+   bool warmStart_;
+
    std::vector<ParMesh*> pmesh_;
    std::vector<MaxwellBlochWaveEquation*> mbwe_;
    std::vector<const Operator*> refineOp_;
-   std::vector<std::pair<HypreParVector*, HypreParVector*> > EField_;
-   //std::vector<std::vector<std::pair<ParGridFunction,
-   //                ParGridFunction> > > efield_;
-   std::vector<std::pair<ParGridFunction*, ParGridFunction*> > efield_;
    std::vector<std::vector<HypreParVector*> > initialVecs_;
-   std::vector<int> locSize_;
-   std::vector<HYPRE_Int*> part_;
 
    Vector kappa_;
    Coefficient * epsCoef_;
@@ -655,6 +951,12 @@ public:
 
    void PrintDispersionPlot(std::ostream & os);
 
+   // Derivative of the frequency of band n at the sample point ind of
+   // path segment (p,s) with respect to the permittivity of each element
+   // of the original mesh.  Degenerate bands share the averaged result.
+   void GetFrequencySensitivity(int p, int s, int ind, int n,
+                                Vector & dOmega);
+
    void InitializeGLVis(VisData & vd);
 
    void DisplayToGLVis();
@@ -688,6 +990,7 @@ private:
    std::vector<HypreParVector*> projBasis_;
 
    std::map<std::string,std::vector<double> > sp_eigs_;
+   std::map<std::string,int> sp_offset_;
    std::vector<std::vector<std::map<int,std::vector<double> > > > seg_eigs_;
 
    int n_pow_;
@@ -707,8 +1010,11 @@ public:
                   bool midPts = false, int max_ref = 2, double tol = 0.05);
    ~MaxwellBandGap();
 
+   // Returns the lower and upper edges of the widest relative band gap
    void GetHomogenizedProperties(std::vector<double> & p);
-   void GetPropertySensitivities(std::vector<ParGridFunction> & dp) {}
+
+   // Derivatives of the gap edges with respect to the element permittivity
+   void GetPropertySensitivities(std::vector<ParGridFunction> & dp);
 
    void PrintDispersionPlot(std::ostream & os);
 
@@ -720,7 +1026,15 @@ public:
                          const std::string & label);
 private:
 
-   MaxwellDispersion * disp_;
+   ParMesh             * pmesh_;
+   L2_ParFESpace       * L2FESpace_;
+   MaxwellDispersion   * disp_;
+
+   // Band below the gap and the sample points (path, segment, index)
+   // where the gap edges are attained
+   int band_;
+   int loLoc_[3];
+   int hiLoc_[3];
 };
 
 } // namespace meta_material
@@ -0,0 +1,105 @@
+#include "mfem.hpp"
+#include "../common/bravais.hpp"
+#include "meta_material_solver.hpp"
+#include <iostream>
+
+using namespace std;
+using namespace mfem;
+using namespace mfem::miniapps;
+using namespace mfem::bravais;
+
+// Checks that repeated calls to StiffnessTensor::GetHomogenizedProperties
+// on an unchanged design and mesh, as made by TopologyOptimizer::Step,
+// return the same effective elasticity tensor.
+int main(int argc, char ** argv)
+{
+   // 1. Initialize MPI.
+   int num_procs, myid;
+   MPI_Comm comm = MPI_COMM_WORLD;
+   MPI_Init(&argc, &argv);
+   MPI_Comm_size(comm, &num_procs);
+   MPI_Comm_rank(comm, &myid);
+
+   // 2. Parse command-line options.
+   int sr = 1, pr = 0;
+   double a = 1.0;
+   double lcf = 0.5;
+   double tol = 1e-8;
+
+   OptionsParser args(argc, argv);
+   args.AddOption(&sr, "-sr", "--serial-refinement",
+                  "Number of serial refinement levels.");
+   args.AddOption(&pr, "-pr", "--parallel-refinement",
+                  "Number of parallel refinement levels.");
+   args.AddOption(&lcf, "-lcf", "--lattice-coef-frac",
+                  "Fraction of inter-lattice distance covered by material.");
+   args.AddOption(&tol, "-tol", "--tolerance",
+                  "Largest acceptable relative difference between calls.");
+   args.Parse();
+   if (!args.Good())
+   {
+      if (myid == 0)
+      {
+         args.PrintUsage(cout);
+      }
+      MPI_Finalize();
+      return 1;
+   }
+   if (myid == 0)
+   {
+      args.PrintOptions(cout);
+   }
+
+   BravaisLattice * bravais =
+      BravaisLatticeFactory(PRIMITIVE_CUBIC, a, a, a,
+                            0.5 * M_PI, 0.5 * M_PI, 0.5 * M_PI, 0);
+
+   Mesh * mesh = bravais->GetPeriodicWignerSeitzMesh();
+   ParMesh * pmesh = DistributeMesh(comm, mesh, sr, pr, true);
+
+   L2_ParFESpace L2FESpace(pmesh, 0, pmesh->Dimension());
+   ParGridFunction vf(&L2FESpace);
+   {
+      LatticeCoefficient latCoef(*bravais, lcf);
+      vf.ProjectCoefficient(latCoef);
+   }
+
+   meta_material::LinearCoefficient lambdaCoef(&vf, 1.0e-6, 1.0);
+   meta_material::LinearCoefficient muCoef(&vf, 1.0e-6, 1.0);
+
+   meta_material::StiffnessTensor elasticity(*pmesh,
+                                             bravais->GetUnitCellVolume(),
+                                             lambdaCoef, muCoef);
+   elasticity.SetMaxAMRIterations(1);
+
+   vector<double> p0, p1;
+   vector<ParGridFunction> dp;
+
+   elasticity.GetHomogenizedProperties(p0);
+   elasticity.GetPropertySensitivities(dp);
+   elasticity.GetHomogenizedProperties(p1);
+
+   double nrm = 0.0, diff = 0.0;
+   for (unsigned int i=0; i<p0.size(); i++)
+   {
+      nrm  += p0[i] * p0[i];
+      diff += (p1[i] - p0[i]) * (p1[i] - p0[i]);
+   }
+   double rel = (nrm > 0.0) ? sqrt(diff / nrm) : sqrt(diff);
+
+   bool pass = p0.size() == 21 && p1.size() == 21 && rel <= tol;
+
+   if ( myid == 0 )
+   {
+      cout << "Relative difference between repeated calls:  " << rel
+           << endl;
+      cout << (pass ? "PASSED" : "FAILED") << endl;
+   }
+
+   delete pmesh;
+   delete bravais;
+
+   MPI_Finalize();
+
+   return pass ? 0 : 1;
+}
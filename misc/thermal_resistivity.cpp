@@ -88,6 +88,7 @@ int main(int argc, char *argv[])
    double a = 1.0;
    int    xi = 0;
    double dx = 0.01;
+   bool incremental = true;
    bool visualization = true;
 
    OptionsParser args(argc, argv);
@@ -106,6 +107,10 @@ int main(int argc, char *argv[])
                   "");
    args.AddOption(&xi, "-xi", "--delta-x-index",
                   "");
+   args.AddOption(&incremental, "-inc", "--incremental", "-no-inc",
+                  "--no-incremental",
+                  "Update only the changed element or reassemble everything "
+                  "after the volume fraction change.");
    args.AddOption(&visualization, "-vis", "--visualization", "-no-vis",
                   "--no-visualization",
                   "Enable or disable GLVis visualization.");
@@ -155,11 +160,20 @@ int main(int argc, char *argv[])
    }
 
    // 6. Adjust the volume fraction and recompute the resisitivity
+   Array<int> changed(0);
    if ( myid == 0 )
    {
       vf[xi] += dx;
+      changed.Append(xi);
+   }
+   if ( incremental )
+   {
+      tr.ConductivityChanged(changed);
+   }
+   else
+   {
+      tr.ConductivityChanged();
    }
-   tr.ConductivityChanged();
 
    double R_lambda_1 = tr.GetResistivity();
 
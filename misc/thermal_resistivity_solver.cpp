@@ -14,6 +14,8 @@
 #ifdef MFEM_USE_MPI
 
 #include "thermal_resistivity_solver.hpp"
+#include "../common/solver_extras.hpp"
+#include <vector>
 
 using namespace std;
 using namespace mfem::miniapps;
@@ -103,6 +105,37 @@ private:
    DenseMatrix invdfdx;
 };
 
+/// Diffusion integrator which keeps a copy of every element matrix it
+/// computes so that individual elements can be updated later.  Each matrix
+/// has the size of its own element so meshes may mix element types.
+class CachedDiffusionIntegrator : public DiffusionIntegrator
+{
+public:
+   CachedDiffusionIntegrator(Coefficient & q)
+      : DiffusionIntegrator(q) {}
+
+   /// Must be called before assembling on a new mesh
+   void Reset(int ne) { elmats_.clear(); elmats_.resize(ne); }
+
+   virtual void AssembleElementMatrix(const FiniteElement &el,
+                                      ElementTransformation &Trans,
+                                      DenseMatrix &elmat)
+   {
+      DiffusionIntegrator::AssembleElementMatrix(el, Trans, elmat);
+
+      MFEM_ASSERT(Trans.ElementNo < (int)elmats_.size(),
+                  "CachedDiffusionIntegrator: cache has not been sized "
+                  "for this mesh");
+
+      elmats_[Trans.ElementNo] = elmat;
+   }
+
+   const DenseMatrix & GetElementMatrix(int e) { return elmats_[e]; }
+
+private:
+   vector<DenseMatrix> elmats_;
+};
+
 /// Coefficient defined on a subset of domain or boundary attributes
 class BdrRestrictedCoefficient : public Coefficient
 {
@@ -162,12 +195,19 @@ ThermalResistivity::ThermalResistivity(MPI_Comm & comm, ParMesh & pmesh,
      rkCoef_(NULL),
      rCoef_(NULL),
      ak_(NULL),
+     kInteg_(NULL),
      gk_(NULL),
      t_(NULL),
      rhs_(NULL),
      k_(NULL),
      w_(NULL),
-     A_(NULL)
+     A_(NULL),
+     amgA_(NULL),
+     amg_(NULL),
+     amgIts_(0),
+     warm_(false),
+     bMbT_(0.0),
+     bMbW_(0.0)
 {
    MPI_Comm_rank(*commPtr_, &myid_);
    MPI_Comm_size(*commPtr_, &numProcs_);
@@ -197,7 +237,8 @@ ThermalResistivity::ThermalResistivity(MPI_Comm & comm, ParMesh & pmesh,
    H1FESpace_    = new H1_ParFESpace(pmesh_,order_,dim_);
 
    ak_ = new ParBilinearForm(H1FESpace_);
-   ak_->AddDomainIntegrator(new DiffusionIntegrator(*kCoef_));
+   kInteg_ = new CachedDiffusionIntegrator(*kCoef_);
+   ak_->AddDomainIntegrator(kInteg_);
 
    rkCoef_ = new BdrRestrictedCoefficient(*pmesh_, *kCoef_, ess_bdr2_);
    rCoef_ = new BdrRestrictedCoefficient(ess_bdr2_);
@@ -214,6 +255,7 @@ ThermalResistivity::ThermalResistivity(MPI_Comm & comm, ParMesh & pmesh,
 
 ThermalResistivity::~ThermalResistivity()
 {
+   this->ResetPreconditioner();
    delete A_;
 
    delete t_;
@@ -239,11 +281,15 @@ ThermalResistivity::SetConductivityCoef(Coefficient & kCoef)
 
    delete ak_;
    ak_ = new ParBilinearForm(H1FESpace_);
-   ak_->AddDomainIntegrator(new DiffusionIntegrator(*kCoef_));
-   ak_->Assemble();
-   ak_->Finalize();
+   kInteg_ = new CachedDiffusionIntegrator(*kCoef_);
+   kInteg_->Reset(pmesh_->GetNE());
+   ak_->AddDomainIntegrator(kInteg_);
+   ak_->Assemble(0);
+   ak_->Finalize(0);
 
+   this->ResetPreconditioner();
    delete A_; A_ = new HypreParMatrix;
+   warm_ = false;
 
    delete rkCoef_;
    rkCoef_ = new BdrRestrictedCoefficient(*pmesh_, *kCoef_, ess_bdr2_);
@@ -257,22 +303,72 @@ ThermalResistivity::SetConductivityCoef(Coefficient & kCoef)
 void
 ThermalResistivity::ConductivityChanged()
 {
+   this->ResetPreconditioner();
    delete A_; A_ = new HypreParMatrix;
+   warm_ = false;
 
    ak_->Update();
-   ak_->Assemble();
-   ak_->Finalize();
+   ak_->Assemble(0);
+   ak_->Finalize(0);
 
    gk_->Assemble();
 }
 
+void
+ThermalResistivity::ConductivityChanged(const Array<int> & elems)
+{
+   SparseMatrix & K = ak_->SpMat();
+
+   Array<int> vdofs;
+   DenseMatrix dK;
+
+   for (int i=0; i<elems.Size(); i++)
+   {
+      int e = elems[i];
+
+      // Replace the old element matrix by the new one.  The matrix was
+      // assembled without skipping zeros so the sparsity pattern already
+      // contains every entry touched here.
+      dK = kInteg_->GetElementMatrix(e);
+      dK.Neg();
+
+      DenseMatrix elmat;
+      kInteg_->AssembleElementMatrix(*H1FESpace_->GetFE(e),
+                                     *H1FESpace_->GetElementTransformation(e),
+                                     elmat);
+      dK += elmat;
+
+      H1FESpace_->GetElementVDofs(e, vdofs);
+      K.AddSubMatrix(vdofs, vdofs, dK, 0);
+   }
+
+   // Keep the current AMG hierarchy, it is built from amgA_
+   if ( A_ != amgA_ ) { delete A_; }
+   A_ = new HypreParMatrix;
+   warm_ = true;
+
+   gk_->Assemble();
+}
+
+void
+ThermalResistivity::ResetPreconditioner()
+{
+   delete amg_; amg_ = NULL;
+   if ( amgA_ != A_ ) { delete amgA_; }
+   amgA_ = NULL;
+   amgIts_ = 0;
+}
+
 void
 ThermalResistivity::InitSecondaryObjects()
 {
    H1FESpace_->GetEssentialTrueDofs(ess_bdr_, ess_tdof_list_);
 
-   ak_->Assemble();
-   ak_->Finalize();
+   // Zeros are kept so that ConductivityChanged(elems) can update the
+   // matrix in place
+   kInteg_->Reset(pmesh_->GetNE());
+   ak_->Assemble(0);
+   ak_->Finalize(0);
 
    A_ = new HypreParMatrix;
 
@@ -284,36 +380,96 @@ ThermalResistivity::Solve(ParGridFunction * w)
 {
    /// Set the Temperature to 0.0 on surface 1 and 1.0 pn surface 2
    ConstantCoefficient one(1.0);
-   *t_ = 0.0;
+   if ( !warm_ ) { *t_ = 0.0; }
    t_->ProjectBdrCoefficient(one, ess_bdr2_);
 
    *rhs_ = 0.0;
 
    ak_->FormLinearSystem(ess_tdof_list_, *t_, *rhs_, *A_, T_, RHS_);
 
-   HypreBoomerAMG amg(*A_);
-   amg.SetPrintLevel(0);
-   HyprePCG pcg(*A_);
-   pcg.SetTol(1e-12);
-   pcg.SetMaxIter(200);
-   pcg.SetPrintLevel(0);
-   pcg.SetPreconditioner(amg);
-   pcg.Mult(RHS_, T_);
+   bool newAMG = false;
+   if ( amg_ == NULL )
+   {
+      amg_ = new HypreBoomerAMG(*A_);
+      amg_->SetPrintLevel(0);
+      amgA_ = A_;
+      newAMG = true;
+   }
+
+   int its = this->SolveSystem(RHS_, T_, warm_, bMbT_);
+
+   // A stale hierarchy is rebuilt at the next solve
+   if ( newAMG )
+   {
+      amgIts_ = its;
+   }
+   else if ( PreconditionerIsStale(its, amgIts_) )
+   {
+      if ( myid_ == 0 )
+      {
+         cout << "Rebuilding AMG after " << its << " iterations" << endl;
+      }
+      this->ResetPreconditioner();
+   }
 
    ak_->RecoverFEMSolution(T_, *rhs_, *t_);
 
    if ( w != NULL )
    {
       H1FESpace_->Dof_TrueDof_Matrix()->MultTranspose(*gk_, RHS_);
-      pcg.Mult(RHS_, T_);
+      if ( warm_ )
+      {
+         w->ParallelProject(T_);
+      }
       for (int i=0; i<ess_tdof_list_.Size(); i++)
       {
+         RHS_[ess_tdof_list_[i]] = 0.0;
          T_[ess_tdof_list_[i]] = 0.0;
       }
+      this->SolveSystem(RHS_, T_, warm_, bMbW_);
       H1FESpace_->Dof_TrueDof_Matrix()->Mult(T_, *w);
    }
 }
 
+int
+ThermalResistivity::SolveSystem(const Vector & B, Vector & X, bool warm,
+                                double & bMb)
+{
+   // The preconditioner may have been built from an older matrix so the
+   // solve is driven by an MFEM CG which applies it without a new setup
+   int its = 0;
+   if ( !warm || bMb <= 0.0 )
+   {
+      // A cold start takes the first CG step, along Z = M B, here so that
+      // the V-cycle which measures (B, M B) is not repeated by the solver
+      Vector Z(B.Size()), AZ(B.Size());
+      amg_->Mult(B, Z);
+      A_->Mult(Z, AZ);
+
+      double loc[2] = { B * Z, Z * AZ };
+      double glb[2];
+      MPI_Allreduce(loc, glb, 2, MPI_DOUBLE, MPI_SUM, *commPtr_);
+
+      bMb = glb[0];
+      X = Z;
+      X *= ( glb[1] > 0.0 ) ? glb[0] / glb[1] : 0.0;
+      its = 1;
+   }
+
+   // Warm starts keep the tolerance of the last cold start
+   CGSolver pcg(*commPtr_);
+   pcg.SetOperator(*A_);
+   pcg.SetPreconditioner(*amg_);
+   pcg.SetRelTol(0.0);
+   pcg.SetAbsTol(1e-12 * sqrt(bMb));
+   pcg.SetMaxIter(200);
+   pcg.SetPrintLevel(0);
+   pcg.iterative_mode = true;
+   pcg.Mult(B, X);
+
+   return its + pcg.GetNumIterations();
+}
+
 double
 ThermalResistivity::GetResistivity(Vector * dR)
 {
@@ -328,49 +484,113 @@ ThermalResistivity::GetResistivity(Vector * dR)
 }
 
 void
-ThermalResistivity::CalcSensitivity(Vector & dF)
+ThermalResistivity::InitSensitivityCache()
 {
-   dF.SetSize(pmesh_->GetNE());
-   dF = 0.0;
+   int ne = pmesh_->GetNE();
+   int nd = H1FESpace_->GetFE(0)->GetDof();
+
+   sMats_.SetSize(nd, nd, ne);
+   elDofs_.SetSize(ne * nd);
+   elL2Dof_.SetSize(ne);
+   bdrIdx_.SetSize(ne);
+   bdrIdx_ = -1;
 
    Array<int> h1Vdofs, l2Vdofs;
    DenseMatrix sMat;
-   Vector tVec, wVec, gVec, stVec;
+   Vector gVec;
 
-   BdrGradIntegrator gInt(*rCoef_);
    DiffusionIntegrator sInt;
 
+   for (int i=0; i<ne; i++)
+   {
+      H1FESpace_->GetElementVDofs(i,h1Vdofs);
+      L2FESpace_->GetElementVDofs(i,l2Vdofs);
+
+      MFEM_VERIFY(h1Vdofs.Size() == nd,
+                  "ThermalResistivity: meshes with mixed element types "
+                  "are not supported");
+
+      for (int j=0; j<nd; j++) { elDofs_[i * nd + j] = h1Vdofs[j]; }
+      elL2Dof_[i] = l2Vdofs[0];
+
+      sInt.AssembleElementMatrix(*H1FESpace_->GetFE(i),
+                                 *H1FESpace_->GetElementTransformation(i),
+                                 sMat);
+      sMats_(i) = sMat;
+   }
+
+   // Sum the boundary flux vectors of each element so that an element
+   // with several faces on the boundary contributes only once
+   int nb = 0;
    for (int i=0; i<pmesh_->GetNBE(); i++)
    {
+      if ( !ess_bdr2_[pmesh_->GetBdrAttribute(i)-1] ) { continue; }
+
+      int el1 = pmesh_->GetBdrFaceTransformations(i)->Elem1No;
+      if ( bdrIdx_[el1] < 0 ) { bdrIdx_[el1] = nb++; }
+   }
+
+   bdrVecs_.SetSize(nd, nb);
+   bdrVecs_ = 0.0;
+
+   BdrGradIntegrator gInt(*rCoef_);
+
+   for (int i=0; i<pmesh_->GetNBE(); i++)
+   {
+      if ( !ess_bdr2_[pmesh_->GetBdrAttribute(i)-1] ) { continue; }
+
       FaceElementTransformations * tr = pmesh_->GetBdrFaceTransformations(i);
 
       int el1 = tr -> Elem1No;
-      H1FESpace_->GetElementVDofs(el1,h1Vdofs);;
-      L2FESpace_->GetElementVDofs(el1,l2Vdofs);;
-
-      t_->GetSubVector(h1Vdofs, tVec);
+      gInt.AssembleRHSElementVect(*H1FESpace_->GetFE(el1), *tr, gVec);
 
-      gInt.AssembleRHSElementVect(*H1FESpace_->GetFE(el1),
-                                  *tr, gVec);
-      dF[l2Vdofs[0]] += gVec * tVec;
+      double * b = bdrVecs_.GetColumn(bdrIdx_[el1]);
+      for (int j=0; j<nd; j++) { b[j] += gVec[j]; }
    }
-   for (int i=0; i<pmesh_->GetNE(); i++)
+}
+
+void
+ThermalResistivity::CalcSensitivity(Vector & dF)
+{
+   if ( sMats_.SizeK() != pmesh_->GetNE() )
    {
-      H1FESpace_->GetElementVDofs(i,h1Vdofs);;
-      L2FESpace_->GetElementVDofs(i,l2Vdofs);;
+      this->InitSensitivityCache();
+   }
 
-      t_->GetSubVector(h1Vdofs, tVec);
-      w_->GetSubVector(h1Vdofs, wVec);
+   int ne = pmesh_->GetNE();
+   int nd = sMats_.SizeI();
 
-      sInt.AssembleElementMatrix(*H1FESpace_->GetFE(i),
-                                 *H1FESpace_->GetElementTransformation(i),
-                                 sMat);
+   dF.SetSize(ne);
 
-      stVec.SetSize(h1Vdofs.Size());
-      sMat.Mult(tVec, stVec);
-      dF[l2Vdofs[0]] -= wVec * stVec;
-   }
+   const double * t = t_->GetData();
+   const double * w = w_->GetData();
 
+   // Each element writes only its own entry of dF
+#ifdef MFEM_USE_OPENMP
+   #pragma omp parallel for
+#endif
+   for (int i=0; i<ne; i++)
+   {
+      const int    * dofs = &elDofs_[i * nd];
+      const double * S    = sMats_.GetData(i);
+      const double * b    = ( bdrIdx_[i] >= 0 ) ?
+                            bdrVecs_.GetColumn(bdrIdx_[i]) : NULL;
+
+      // dF = b^T t - w^T S t
+      double val = 0.0;
+      for (int k=0; k<nd; k++)
+      {
+         double tk = t[dofs[k]];
+         double wSk = 0.0;
+         for (int j=0; j<nd; j++)
+         {
+            wSk += w[dofs[j]] * S[k * nd + j];
+         }
+         val -= wSk * tk;
+         if ( b ) { val += b[k] * tk; }
+      }
+      dF[elL2Dof_[i]] = val;
+   }
 }
 
 double
@@ -19,6 +19,8 @@
 namespace mfem
 {
 
+class CachedDiffusionIntegrator;
+
 class ThermalResistivity
 {
 public:
@@ -31,6 +33,17 @@ public:
 
    void ConductivityChanged();
 
+   /** Update the conductivity on a few local elements only.
+
+       The element matrices of the listed elements are recomputed and the
+       difference is added to the assembled matrix in place.  The AMG
+       hierarchy of the previous solve is kept as the preconditioner and
+       the previous temperature and adjoint fields are used as initial
+       guesses.  Each rank passes the local indices of its own changed
+       elements, possibly none.
+   */
+   void ConductivityChanged(const Array<int> & elems);
+
    void SetConductivityCoef(Coefficient & kCoef);
 
    double GetResistivity(Vector * dR = NULL);
@@ -46,8 +59,18 @@ private:
 
    void Solve(ParGridFunction * w = NULL);
 
+   // Solve A X = B with the shared preconditioner and the same stopping
+   // criterion as HyprePCG, i.e. (r, M r) <= tol^2 (b, M b).  A cold solve
+   // stores (b, M b) in bMb, a warm solve reuses it.
+   int SolveSystem(const Vector & B, Vector & X, bool warm, double & bMb);
+
+   void ResetPreconditioner();
+
    void CalcSensitivity(Vector & dF);
 
+   // Precompute the geometric data used by CalcSensitivity
+   void InitSensitivityCache();
+
    double CalcResistivity(Vector * dR = NULL);
 
    // double EstimateErrors();
@@ -70,6 +93,7 @@ private:
    Coefficient           * rCoef_;
    // Coefficient           * rkCoef1_;
    ParBilinearForm       * ak_;
+   CachedDiffusionIntegrator * kInteg_;
    ParLinearForm         * gk_;
    // ParLinearForm         * gk1_;
 
@@ -80,11 +104,31 @@ private:
 
    HypreParMatrix * A_;
 
+   // The matrix the AMG hierarchy was built from which may be older
+   // than A_ after incremental updates
+   HypreParMatrix * amgA_;
+   HypreBoomerAMG * amg_;
+   int              amgIts_;
+   bool             warm_;
+
+   // (b, M b) of the temperature and adjoint systems at their last cold
+   // solves
+   double           bMbT_;
+   double           bMbW_;
+
    mutable Vector T_;
    mutable Vector RHS_;
 
    Vector errors_;
 
+   // Unit coefficient element stiffness matrices, element dofs, and the
+   // summed boundary flux vectors of elements touching ess_bdr2_
+   DenseTensor sMats_;
+   Array<int>  elDofs_;
+   Array<int>  elL2Dof_;
+   Array<int>  bdrIdx_;
+   DenseMatrix bdrVecs_;
+
    Array<int> ess_bdr_;
    Array<int> ess_bdr2_;
    Array<int> ess_tdof_list_;